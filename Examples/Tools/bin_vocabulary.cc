@@ -0,0 +1,116 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<chrono>
+#include<vector>
+#include<random>
+
+#include<opencv2/core/core.hpp>
+
+#include"ORBVocabulary.h"
+
+using namespace std;
+
+// 把文本格式的ORB字典转换成可以内存映射的二进制格式,然后检验两者得到的词袋向量完全相同
+
+int main(int argc, char **argv)
+{
+    if(argc != 3)
+    {
+        cerr << endl << "Usage: ./bin_vocabulary path_to_text_vocabulary path_to_binary_vocabulary" << endl;
+        return 1;
+    }
+
+    ORB_SLAM2::ORBVocabulary voc;
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    if(!voc.loadFromTextFile(argv[1]))
+    {
+        cerr << "Failed to open the text vocabulary at: " << argv[1] << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    cout << "Text vocabulary loaded in "
+         << chrono::duration_cast<chrono::duration<double,milli> >(t1-t0).count() << " ms: "
+         << voc.size() << " words" << endl;
+
+    if(!voc.saveToBinaryFile(argv[2]))
+    {
+        cerr << "Failed to write the binary vocabulary at: " << argv[2] << endl;
+        return 1;
+    }
+
+    ORB_SLAM2::ORBVocabulary binVoc;
+
+    t0 = chrono::steady_clock::now();
+    if(!binVoc.loadFromBinaryFile(argv[2]))
+    {
+        cerr << "Failed to map the binary vocabulary at: " << argv[2] << endl;
+        return 1;
+    }
+    t1 = chrono::steady_clock::now();
+    cout << "Binary vocabulary mapped in "
+         << chrono::duration_cast<chrono::duration<double,milli> >(t1-t0).count() << " ms" << endl;
+
+    // 检验: 随机描述子和字典中的单词本身在两个字典中得到相同的词袋向量和特征向量
+    if(voc.size() != binVoc.size())
+    {
+        cerr << "Verification failed: " << binVoc.size() << " words in the binary vocabulary" << endl;
+        return 1;
+    }
+
+    const int nRandom = 10000;
+    vector<cv::Mat> vDesc;
+    vDesc.reserve(nRandom + voc.size());
+    std::mt19937 rng(0);
+    for(int i=0; i<nRandom; i++)
+    {
+        cv::Mat d(1,32,CV_8U);
+        unsigned char *p = d.ptr<unsigned char>();
+        for(int j=0; j<32; j++)
+            p[j] = rng() & 0xFF;
+        vDesc.push_back(d);
+    }
+    for(unsigned int i=0; i<voc.size(); i++)
+        vDesc.push_back(voc.getWord(i));
+
+    DBoW2::BowVector vBow, vBinBow;
+    DBoW2::FeatureVector vFeat, vBinFeat;
+
+    t0 = chrono::steady_clock::now();
+    voc.transform(vDesc,vBow,vFeat,4);
+    t1 = chrono::steady_clock::now();
+    binVoc.transform(vDesc,vBinBow,vBinFeat,4);
+    chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+    if(vBow != vBinBow || vFeat != vBinFeat)
+    {
+        cerr << "Verification failed: the binary vocabulary gives different bag of words vectors" << endl;
+        return 1;
+    }
+
+    cout << "Verified " << vDesc.size() << " descriptors. Transform time: text "
+         << chrono::duration_cast<chrono::duration<double,milli> >(t1-t0).count() << " ms, binary "
+         << chrono::duration_cast<chrono::duration<double,milli> >(t2-t1).count() << " ms" << endl;
+
+    return 0;
+}
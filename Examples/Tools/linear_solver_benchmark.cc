@@ -0,0 +1,318 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include<iostream>
+#include<iomanip>
+#include<chrono>
+#include<vector>
+#include<random>
+#include<cstdlib>
+
+#include"Thirdparty/g2o/g2o/core/block_solver.h"
+#include"Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
+#include"Thirdparty/g2o/g2o/core/batch_stats.h"
+#include"Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
+#include"Thirdparty/g2o/g2o/solvers/linear_solver_pcg.h"
+#include"Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+#include"Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
+
+using namespace std;
+
+// 在合成的全局BA和本质图问题上比较稀疏Cholesky分解和PCG两种线性求解器的精度和速度.
+// 两个问题的结构和 Optimizer::BundleAdjustment / Optimizer::OptimizeEssentialGraph 相同:
+// 全局BA中地图点被边缘化,PCG求解的是Schur补之后的相机系统;本质图中只有Sim3位姿顶点
+
+struct Result
+{
+    double chi2;
+    double time;            // ms
+    int nIterations;        // LM迭代次数
+    double linearIterations;// PCG平均每次求解的迭代次数
+    long choleskyNNZ;       // Cholesky因子的非零元素个数
+    double rmse;            // 相机光心相对于真值的均方根误差
+};
+
+static void PrintResult(const string &name, const Result &r)
+{
+    cout << "  " << setw(9) << left << name << right
+         << " chi2: " << setw(14) << fixed << setprecision(4) << r.chi2
+         << "  time: " << setw(9) << setprecision(1) << r.time << " ms"
+         << "  LM iterations: " << r.nIterations
+         << "  RMSE: " << scientific << setprecision(3) << r.rmse;
+    if(r.choleskyNNZ>0)
+        cout << "  factor: " << fixed << setprecision(1) << r.choleskyNNZ*sizeof(double)/1048576.0 << " MB";
+    if(r.linearIterations>0)
+        cout << "  CG iterations/solve: " << fixed << setprecision(1) << r.linearIterations;
+    cout << endl;
+}
+
+// PCG的停止条件和Optimizer中相同:全局BA的相对残差1e-3,本质图1e-6
+template<typename MatrixType>
+static void SetTolerance(g2o::LinearSolverPCG<MatrixType>* pLinearSolver, const double dTolerance)
+{
+    pLinearSolver->setTolerance(dTolerance);
+}
+
+template<typename MatrixType>
+static void SetTolerance(g2o::LinearSolverEigen<MatrixType>*, const double)
+{
+}
+
+// 从优化器的逐次迭代统计中取出Cholesky因子大小和PCG迭代次数
+static void CollectStatistics(const g2o::SparseOptimizer &optimizer, Result &r)
+{
+    r.choleskyNNZ = 0;
+    r.linearIterations = 0;
+    int nSolves = 0;
+    for(size_t i=0; i<optimizer.batchStatistics().size(); i++)
+    {
+        const g2o::G2OBatchStatistics &stats = optimizer.batchStatistics()[i];
+        r.choleskyNNZ = max<long>(r.choleskyNNZ, stats.choleskyNNZ);
+        if(stats.iterationsLinearSolver>0)
+        {
+            r.linearIterations += stats.iterationsLinearSolver;
+            nSolves++;
+        }
+    }
+    if(nSolves>0)
+        r.linearIterations /= nSolves;
+}
+
+/**
+ * @brief 合成一条前进的相机轨迹,每个地图点被连续的若干关键帧观测到,与真实的地图结构类似
+ */
+template<typename LinearSolver>
+static Result RunBundleAdjustment(const int nKFs, const int nPointsPerKF)
+{
+    mt19937 rng(0);
+    normal_distribution<double> noise(0,1);
+    uniform_real_distribution<double> uniform(0,1);
+
+    g2o::SparseOptimizer optimizer;
+    LinearSolver* pLinearSolver = new LinearSolver();
+    SetTolerance(pLinearSolver, 1e-3);
+    optimizer.setAlgorithm(new g2o::OptimizationAlgorithmLevenberg(new g2o::BlockSolver_6_3(pLinearSolver)));
+    optimizer.setComputeBatchStatistics(true);
+
+    const double fx = 500, fy = 500, cx = 320, cy = 240;
+
+    vector<g2o::SE3Quat> vTrue;
+    for(int i=0; i<nKFs; i++)
+    {
+        // 沿着一条缓慢转弯的路径前进
+        const double yaw = 0.002*i;
+        Eigen::Quaterniond q(Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitY()));
+        Eigen::Vector3d twc(0.3*i*sin(yaw), 0.05*sin(0.1*i), 0.3*i*cos(yaw));
+        g2o::SE3Quat Twc(q, twc);
+        vTrue.push_back(Twc.inverse());
+
+        g2o::VertexSE3Expmap* v = new g2o::VertexSE3Expmap();
+        Eigen::Matrix<double,6,1> d;
+        for(int k=0; k<6; k++)
+            d[k] = 0.01*noise(rng);
+        v->setEstimate(i<2 ? vTrue.back() : g2o::SE3Quat::exp(d)*vTrue.back());
+        v->setId(i);
+        // 固定前两个关键帧,去掉单目BA的尺度自由度,这样才能和真值比较
+        v->setFixed(i<2);
+        optimizer.addVertex(v);
+    }
+
+    int id = nKFs;
+    for(int i=0; i<nKFs; i++)
+    {
+        const g2o::SE3Quat Twc = vTrue[i].inverse();
+        for(int j=0; j<nPointsPerKF; j++)
+        {
+            Eigen::Vector3d Xc(8*(uniform(rng)-0.5), 6*(uniform(rng)-0.5), 4+10*uniform(rng));
+            Eigen::Vector3d Xw = Twc.map(Xc);
+
+            g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
+            vPoint->setEstimate(Xw + 0.05*Eigen::Vector3d(noise(rng),noise(rng),noise(rng)));
+            vPoint->setId(id);
+            vPoint->setMarginalized(true);
+            optimizer.addVertex(vPoint);
+
+            const int nObs = 2 + rng()%8;
+            for(int k=i; k<min(nKFs,i+nObs); k++)
+            {
+                Eigen::Vector3d Xk = vTrue[k].map(Xw);
+                if(Xk[2]<0.5)
+                    continue;
+                Eigen::Vector2d obs(fx*Xk[0]/Xk[2]+cx+noise(rng), fy*Xk[1]/Xk[2]+cy+noise(rng));
+                g2o::EdgeSE3ProjectXYZ* e = new g2o::EdgeSE3ProjectXYZ();
+                e->setVertex(0, vPoint);
+                e->setVertex(1, optimizer.vertex(k));
+                e->setMeasurement(obs);
+                e->setInformation(Eigen::Matrix2d::Identity());
+                e->fx = fx; e->fy = fy; e->cx = cx; e->cy = cy;
+                optimizer.addEdge(e);
+            }
+            id++;
+        }
+    }
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    optimizer.initializeOptimization();
+    Result r;
+    r.nIterations = optimizer.optimize(10);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    r.time = chrono::duration_cast<chrono::duration<double,milli> >(t1-t0).count();
+    optimizer.computeActiveErrors();
+    r.chi2 = optimizer.activeChi2();
+    CollectStatistics(optimizer, r);
+
+    double sum = 0;
+    for(int i=0; i<nKFs; i++)
+    {
+        const g2o::SE3Quat Tcw = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(i))->estimate();
+        sum += (Tcw.inverse().translation()-vTrue[i].inverse().translation()).squaredNorm();
+    }
+    r.rmse = sqrt(sum/nKFs);
+    return r;
+}
+
+/**
+ * @brief 合成一个有累积漂移的闭环:生成树边,相邻若干关键帧间的共视边,以及首尾之间的闭环边
+ */
+template<typename LinearSolver>
+static Result RunEssentialGraph(const int nKFs)
+{
+    mt19937 rng(1);
+    normal_distribution<double> noise(0,1);
+
+    g2o::SparseOptimizer optimizer;
+    LinearSolver* pLinearSolver = new LinearSolver();
+    SetTolerance(pLinearSolver, 1e-6);
+    g2o::OptimizationAlgorithmLevenberg* solver =
+            new g2o::OptimizationAlgorithmLevenberg(new g2o::BlockSolver_7_3(pLinearSolver));
+    solver->setUserLambdaInit(1e-16);
+    optimizer.setAlgorithm(solver);
+    optimizer.setComputeBatchStatistics(true);
+
+    // 真实位姿在一个圆上,最后一个关键帧回到起点附近
+    vector<g2o::Sim3> vTrue;
+    const double radius = 0.05*nKFs;
+    for(int i=0; i<nKFs; i++)
+    {
+        const double a = 2*M_PI*i/nKFs;
+        Eigen::Matrix3d Rwc = Eigen::AngleAxisd(a, Eigen::Vector3d::UnitY()).toRotationMatrix();
+        Eigen::Vector3d twc(radius*sin(a), 0, radius*(1-cos(a)));
+        vTrue.push_back(g2o::Sim3(Rwc.transpose(), -Rwc.transpose()*twc, 1.0));
+    }
+
+    // 由带噪声的相对位姿串联得到有漂移的初值,这就是闭环纠正之前的状态
+    vector<g2o::Sim3> vInit(nKFs);
+    vInit[0] = vTrue[0];
+    for(int i=1; i<nKFs; i++)
+    {
+        Eigen::Matrix<double,7,1> d;
+        for(int k=0; k<7; k++)
+            d[k] = 0.002*noise(rng);
+        d[6] = 0;
+        g2o::Sim3 Sji = g2o::Sim3(d)*vTrue[i]*vTrue[i-1].inverse();
+        vInit[i] = Sji*vInit[i-1];
+    }
+
+    for(int i=0; i<nKFs; i++)
+    {
+        g2o::VertexSim3Expmap* v = new g2o::VertexSim3Expmap();
+        v->setEstimate(vInit[i]);
+        v->setId(i);
+        v->setFixed(i==0);
+        v->setMarginalized(false);
+        v->_fix_scale = true;
+        optimizer.addVertex(v);
+    }
+
+    // 与 OptimizeEssentialGraph 相同,边的测量值是纠正之前的相对位姿,闭环边是真实的相对位姿
+    const Eigen::Matrix<double,7,7> matLambda = Eigen::Matrix<double,7,7>::Identity();
+    for(int i=1; i<nKFs; i++)
+    {
+        for(int j=max(0,i-5); j<i; j++)
+        {
+            g2o::EdgeSim3* e = new g2o::EdgeSim3();
+            e->setVertex(1, optimizer.vertex(j));
+            e->setVertex(0, optimizer.vertex(i));
+            e->setMeasurement(vInit[j]*vInit[i].inverse());
+            e->information() = matLambda;
+            optimizer.addEdge(e);
+        }
+    }
+    for(int i=nKFs-5; i<nKFs; i++)
+    {
+        for(int j=0; j<5; j++)
+        {
+            g2o::EdgeSim3* e = new g2o::EdgeSim3();
+            e->setVertex(1, optimizer.vertex(j));
+            e->setVertex(0, optimizer.vertex(i));
+            e->setMeasurement(vTrue[j]*vTrue[i].inverse());
+            e->information() = matLambda;
+            optimizer.addEdge(e);
+        }
+    }
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    optimizer.initializeOptimization();
+    Result r;
+    r.nIterations = optimizer.optimize(20);
+    chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+    r.time = chrono::duration_cast<chrono::duration<double,milli> >(t1-t0).count();
+    optimizer.computeActiveErrors();
+    r.chi2 = optimizer.activeChi2();
+    CollectStatistics(optimizer, r);
+
+    double sum = 0;
+    for(int i=0; i<nKFs; i++)
+    {
+        const g2o::Sim3 Scw = static_cast<g2o::VertexSim3Expmap*>(optimizer.vertex(i))->estimate();
+        sum += (Scw.inverse().translation()-vTrue[i].inverse().translation()).squaredNorm();
+    }
+    r.rmse = sqrt(sum/nKFs);
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 4)
+    {
+        cerr << endl << "Usage: ./linear_solver_benchmark [number_of_keyframes] [points_per_keyframe] [essential_graph_keyframes]" << endl;
+        return 1;
+    }
+
+    const int nKFs = argc>1 ? atoi(argv[1]) : 300;
+    const int nPointsPerKF = argc>2 ? atoi(argv[2]) : 100;
+    const int nEssentialKFs = argc>3 ? atoi(argv[3]) : 3000;
+
+    typedef g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType> CholeskyBA;
+    typedef g2o::LinearSolverPCG<g2o::BlockSolver_6_3::PoseMatrixType> PCGBA;
+    typedef g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType> CholeskyEG;
+    typedef g2o::LinearSolverPCG<g2o::BlockSolver_7_3::PoseMatrixType> PCGEG;
+
+    cout << "Global BA: " << nKFs << " keyframes, " << nKFs*nPointsPerKF << " points" << endl;
+    PrintResult("Cholesky", RunBundleAdjustment<CholeskyBA>(nKFs, nPointsPerKF));
+    PrintResult("PCG", RunBundleAdjustment<PCGBA>(nKFs, nPointsPerKF));
+
+    cout << "Essential graph: " << nEssentialKFs << " keyframes" << endl;
+    PrintResult("Cholesky", RunEssentialGraph<CholeskyEG>(nEssentialKFs));
+    PrintResult("PCG", RunEssentialGraph<PCGEG>(nEssentialKFs));
+
+    return 0;
+}
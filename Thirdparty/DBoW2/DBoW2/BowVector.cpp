@@ -31,11 +31,53 @@ BowVector::~BowVector(void)
 
 // --------------------------------------------------------------------------
 
+/// Orders words by id
+struct WordIdLess
+{
+  inline bool operator()(const BowVector::value_type &a, WordId id) const
+  { return a.first < id; }
+  inline bool operator()(const BowVector::value_type &a, 
+    const BowVector::value_type &b) const
+  { return a.first < b.first; }
+};
+
+// --------------------------------------------------------------------------
+
+BowVector::iterator BowVector::lower_bound(WordId id)
+{
+  return std::lower_bound(begin(), end(), id, WordIdLess());
+}
+
+// --------------------------------------------------------------------------
+
+BowVector::const_iterator BowVector::lower_bound(WordId id) const
+{
+  return std::lower_bound(begin(), end(), id, WordIdLess());
+}
+
+// --------------------------------------------------------------------------
+
+BowVector::iterator BowVector::find(WordId id)
+{
+  BowVector::iterator vit = this->lower_bound(id);
+  return (vit != end() && vit->first == id) ? vit : end();
+}
+
+// --------------------------------------------------------------------------
+
+BowVector::const_iterator BowVector::find(WordId id) const
+{
+  BowVector::const_iterator vit = this->lower_bound(id);
+  return (vit != end() && vit->first == id) ? vit : end();
+}
+
+// --------------------------------------------------------------------------
+
 void BowVector::addWeight(WordId id, WordValue v)
 {
   BowVector::iterator vit = this->lower_bound(id);
   
-  if(vit != this->end() && !(this->key_comp()(id, vit->first)))
+  if(vit != this->end() && vit->first == id)
   {
     vit->second += v;
   }
@@ -51,7 +93,7 @@ void BowVector::addIfNotExist(WordId id, WordValue v)
 {
   BowVector::iterator vit = this->lower_bound(id);
   
-  if(vit == this->end() || (this->key_comp()(id, vit->first)))
+  if(vit == this->end() || vit->first != id)
   {
     this->insert(vit, BowVector::value_type(id, v));
   }
@@ -59,6 +101,30 @@ void BowVector::addIfNotExist(WordId id, WordValue v)
 
 // --------------------------------------------------------------------------
 
+void BowVector::sortWords(bool add_weights)
+{
+  if(empty()) return;
+
+  // stable, so that repeated words are merged in the order they were added
+  std::stable_sort(begin(), end(), WordIdLess());
+
+  BowVector::iterator last = begin();
+  for(BowVector::iterator vit = begin() + 1; vit != end(); ++vit)
+  {
+    if(vit->first == last->first)
+    {
+      if(add_weights) last->second += vit->second;
+    }
+    else
+    {
+      *(++last) = *vit;
+    }
+  }
+  erase(last + 1, end());
+}
+
+// --------------------------------------------------------------------------
+
 void BowVector::normalize(LNorm norm_type)
 {
   double norm = 0.0; 
@@ -11,8 +11,8 @@
 #define __D_T_BOW_VECTOR__
 
 #include <iostream>
-#include <map>
 #include <vector>
+#include <utility>
 
 namespace DBoW2 {
 
@@ -52,9 +52,11 @@ enum ScoringType
   DOT_PRODUCT,
 };
 
-/// Vector of words to represent images
+/// Vector of words to represent images. 
+/// The words are stored contiguously, sorted by id, with the iterator and
+/// lookup interface of the std::map it replaces
 class BowVector: 
-	public std::map<WordId, WordValue>
+	public std::vector<std::pair<WordId, WordValue> >
 {
 public:
 
@@ -67,6 +69,20 @@ public:
 	 * Destructor
 	 */
 	~BowVector(void);
+
+	/**
+	 * Returns the first word whose id is not less than the given one
+	 * @param id word id
+	 */
+	iterator lower_bound(WordId id);
+	const_iterator lower_bound(WordId id) const;
+
+	/**
+	 * Returns the word with the given id, or end() if it is not present
+	 * @param id word id
+	 */
+	iterator find(WordId id);
+	const_iterator find(WordId id) const;
 	
 	/**
 	 * Adds a value to a word value existing in the vector, or creates a new
@@ -83,6 +99,16 @@ public:
 	 */
 	void addIfNotExist(WordId id, WordValue v);
 
+	/**
+	 * Sorts the words appended with push_back and merges the repeated ones.
+	 * Building a vector this way takes a single sort instead of one 
+	 * insertion per word
+	 * @param add_weights if true, the values of a repeated word are added 
+	 *   (as with addWeight); otherwise the first value is kept (as with 
+	 *   addIfNotExist)
+	 */
+	void sortWords(bool add_weights);
+
 	/**
 	 * L1-Normalizes the values in the vector 
 	 * @param norm_type norm used
@@ -13,8 +13,14 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
 #include <stdint-gcc.h>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 #include "FORB.h"
 
 using namespace std;
@@ -100,6 +106,102 @@ int FORB::distance(const FORB::TDescriptor &a,
   return dist;
 }
 
+// --------------------------------------------------------------------------
+
+int FORB::distance(const FORB::TDescriptor &a, const unsigned char *b)
+{
+  const int *pa = a.ptr<int32_t>();
+  const int *pb = reinterpret_cast<const int*>(b);
+
+  int dist=0;
+
+  for(int i=0; i<8; i++, pa++, pb++)
+  {
+      unsigned  int v = *pa ^ *pb;
+      v = v - ((v >> 1) & 0x55555555);
+      v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+      dist += (((v + (v >> 4)) & 0xF0F0F0F) * 0x1010101) >> 24;
+  }
+
+  return dist;
+}
+
+// --------------------------------------------------------------------------
+
+#ifdef __AVX2__
+
+/// Number of bits set in each 64-bit lane of x
+static inline __m256i popcount64(__m256i x)
+{
+  // popcount of each nibble by table lookup, then sum of the bytes of
+  // each 64-bit lane
+  const __m256i lut = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+    0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  const __m256i lo = _mm256_and_si256(x, low);
+  const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low);
+  const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), 
+    _mm256_shuffle_epi8(lut, hi));
+  return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+#endif
+
+void FORB::distances(const FORB::TDescriptor &a, const unsigned char *b, 
+  unsigned int n, int *distances)
+{
+  unsigned int i = 0;
+
+#ifdef __AVX2__
+  // one descriptor per register, two descriptors per iteration
+  const __m256i va = _mm256_loadu_si256((const __m256i*)a.ptr<unsigned char>());
+  for(; i + 1 < n; i += 2, b += 2 * FORB::L)
+  {
+    const __m256i c0 = popcount64(_mm256_xor_si256(va, 
+      _mm256_loadu_si256((const __m256i*)b)));
+    const __m256i c1 = popcount64(_mm256_xor_si256(va, 
+      _mm256_loadu_si256((const __m256i*)(b + FORB::L))));
+    // [c0.0+c0.1, c1.0+c1.1, c0.2+c0.3, c1.2+c1.3]
+    const __m256i s = _mm256_add_epi64(_mm256_unpacklo_epi64(c0, c1),
+      _mm256_unpackhi_epi64(c0, c1));
+    const __m128i d = _mm_add_epi64(_mm256_castsi256_si128(s), 
+      _mm256_extracti128_si256(s, 1));
+    distances[i] = _mm_cvtsi128_si32(d);
+    distances[i+1] = _mm_cvtsi128_si32(_mm_unpackhi_epi64(d, d));
+  }
+#endif
+
+  const unsigned char *pa = a.ptr<unsigned char>();
+  for(; i < n; ++i, b += FORB::L)
+  {
+    int dist = 0;
+    for(int j = 0; j < FORB::L; j += 8)
+    {
+      uint64_t va, vb;
+      memcpy(&va, pa + j, 8);
+      memcpy(&vb, b + j, 8);
+      dist += __builtin_popcountll(va ^ vb);
+    }
+    distances[i] = dist;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+void FORB::toBytes(const FORB::TDescriptor &a, unsigned char *bytes)
+{
+  const unsigned char *p = a.ptr<unsigned char>();
+  std::copy(p, p + FORB::L, bytes);
+}
+
+// --------------------------------------------------------------------------
+
+void FORB::fromBytes(FORB::TDescriptor &a, const unsigned char *bytes)
+{
+  a.create(1, FORB::L, CV_8U);
+  std::copy(bytes, bytes + FORB::L, a.ptr<unsigned char>());
+}
+
 // --------------------------------------------------------------------------
   
 std::string FORB::toString(const FORB::TDescriptor &a)
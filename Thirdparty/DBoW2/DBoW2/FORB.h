@@ -46,6 +46,41 @@ public:
    */
   static int distance(const TDescriptor &a, const TDescriptor &b);
 
+  /**
+   * Calculates the distance between a descriptor and a descriptor stored
+   * as L raw bytes (e.g. in a memory-mapped vocabulary)
+   * @param a
+   * @param b L bytes
+   * @return distance
+   */
+  static int distance(const TDescriptor &a, const unsigned char *b);
+
+  /**
+   * Calculates the distances between a descriptor and n descriptors stored
+   * contiguously as L raw bytes each, e.g. the children of a node of the
+   * vocabulary tree. Uses AVX2 when the library is compiled with it
+   * @param a
+   * @param b n * L bytes
+   * @param n number of descriptors in b
+   * @param distances (out) n distances
+   */
+  static void distances(const TDescriptor &a, const unsigned char *b, 
+    unsigned int n, int *distances);
+
+  /**
+   * Copies the L bytes of a descriptor
+   * @param a descriptor
+   * @param bytes (out) L bytes
+   */
+  static void toBytes(const TDescriptor &a, unsigned char *bytes);
+
+  /**
+   * Returns a descriptor from its L raw bytes
+   * @param a descriptor
+   * @param bytes L bytes
+   */
+  static void fromBytes(TDescriptor &a, const unsigned char *bytes);
+
   /**
    * Returns a string version of the descriptor
    * @param a descriptor
@@ -8,8 +8,8 @@
  */
 
 #include "FeatureVector.h"
-#include <map>
 #include <vector>
+#include <algorithm>
 #include <iostream>
 
 namespace DBoW2 {
@@ -28,6 +28,79 @@ FeatureVector::~FeatureVector(void)
 
 // ---------------------------------------------------------------------------
 
+/// Orders nodes by id
+struct NodeIdLess
+{
+  inline bool operator()(const FeatureVector::value_type &a, NodeId id) const
+  { return a.first < id; }
+};
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::iterator FeatureVector::lower_bound(NodeId id)
+{
+  return std::lower_bound(begin(), end(), id, NodeIdLess());
+}
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::const_iterator FeatureVector::lower_bound(NodeId id) const
+{
+  return std::lower_bound(begin(), end(), id, NodeIdLess());
+}
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::iterator FeatureVector::find(NodeId id)
+{
+  FeatureVector::iterator vit = this->lower_bound(id);
+  return (vit != end() && vit->first == id) ? vit : end();
+}
+
+// ---------------------------------------------------------------------------
+
+FeatureVector::const_iterator FeatureVector::find(NodeId id) const
+{
+  FeatureVector::const_iterator vit = this->lower_bound(id);
+  return (vit != end() && vit->first == id) ? vit : end();
+}
+
+// ---------------------------------------------------------------------------
+
+void FeatureVector::setFeatures(
+  std::vector<std::pair<NodeId, unsigned int> > &features)
+{
+  clear();
+  if(features.empty()) return;
+
+  std::sort(features.begin(), features.end());
+
+  // number of nodes, to allocate each vector once
+  size_t n_nodes = 1;
+  for(size_t i = 1; i < features.size(); ++i)
+    if(features[i].first != features[i-1].first) ++n_nodes;
+  reserve(n_nodes);
+
+  size_t begin = 0;
+  while(begin < features.size())
+  {
+    size_t end = begin + 1;
+    while(end < features.size() && features[end].first == features[begin].first)
+      ++end;
+
+    push_back(FeatureVector::value_type(features[begin].first, 
+      std::vector<unsigned int>()));
+    std::vector<unsigned int> &indexes = back().second;
+    indexes.reserve(end - begin);
+    for(size_t i = begin; i < end; ++i)
+      indexes.push_back(features[i].second);
+
+    begin = end;
+  }
+}
+
+// ---------------------------------------------------------------------------
+
 void FeatureVector::addFeature(NodeId id, unsigned int i_feature)
 {
   FeatureVector::iterator vit = this->lower_bound(id);
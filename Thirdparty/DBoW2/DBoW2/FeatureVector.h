@@ -11,15 +11,17 @@
 #define __D_T_FEATURE_VECTOR__
 
 #include "BowVector.h"
-#include <map>
 #include <vector>
+#include <utility>
 #include <iostream>
 
 namespace DBoW2 {
 
-/// Vector of nodes with indexes of local features
+/// Vector of nodes with indexes of local features.
+/// The nodes are stored contiguously, sorted by id, with the iterator and
+/// lookup interface of the std::map it replaces
 class FeatureVector: 
-  public std::map<NodeId, std::vector<unsigned int> >
+  public std::vector<std::pair<NodeId, std::vector<unsigned int> > >
 {
 public:
 
@@ -32,6 +34,20 @@ public:
    * Destructor
    */
   ~FeatureVector(void);
+
+  /**
+   * Returns the first node whose id is not less than the given one
+   * @param id node id
+   */
+  iterator lower_bound(NodeId id);
+  const_iterator lower_bound(NodeId id) const;
+
+  /**
+   * Returns the node with the given id, or end() if it is not present
+   * @param id node id
+   */
+  iterator find(NodeId id);
+  const_iterator find(NodeId id) const;
   
   /**
    * Adds a feature to an existing node, or adds a new node with an initial
@@ -41,6 +57,13 @@ public:
    */
   void addFeature(NodeId id, unsigned int i_feature);
 
+  /**
+   * Replaces the content with the given features, grouped by node with a
+   * single sort. The indexes of each node are sorted
+   * @param features (node id, feature index) pairs; they are sorted in place
+   */
+  void setFeatures(std::vector<std::pair<NodeId, unsigned int> > &features);
+
   /**
    * Sends a string versions of the feature vector through the stream
    * @param out stream
@@ -0,0 +1,74 @@
+/**
+ * File: MappedFile.cpp
+ * Description: read-only memory mapping of a whole file
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "MappedFile.h"
+
+namespace DBoW2 {
+
+// --------------------------------------------------------------------------
+
+MappedFile::MappedFile(): m_data(NULL), m_size(0)
+{
+}
+
+// --------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+// --------------------------------------------------------------------------
+
+bool MappedFile::open(const std::string &filename)
+{
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size <= 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping stays valid after closing the descriptor
+  ::close(fd);
+
+  if(p == MAP_FAILED) return false;
+
+  // start reading ahead in the background; pages are faulted in on demand
+  madvise(p, st.st_size, MADV_WILLNEED);
+
+  m_data = static_cast<const unsigned char*>(p);
+  m_size = st.st_size;
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+void MappedFile::close()
+{
+  if(m_data)
+  {
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+    m_data = NULL;
+    m_size = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DBoW2
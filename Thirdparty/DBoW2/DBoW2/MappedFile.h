@@ -0,0 +1,62 @@
+/**
+ * File: MappedFile.h
+ * Description: read-only memory mapping of a whole file
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_MAPPED_FILE__
+#define __D_T_MAPPED_FILE__
+
+#include <string>
+#include <cstddef>
+
+namespace DBoW2 {
+
+/// Maps a whole file read-only into memory. The pages come from the page
+/// cache, so several processes mapping the same file share them.
+class MappedFile
+{
+public:
+
+  MappedFile();
+  ~MappedFile();
+
+  /**
+   * Maps the given file, unmapping any previous one
+   * @param filename
+   * @return true iff the file could be opened and mapped
+   */
+  bool open(const std::string &filename);
+
+  /**
+   * Unmaps the file
+   */
+  void close();
+
+  /**
+   * Returns the first byte of the mapping, or NULL if nothing is mapped
+   */
+  inline const unsigned char* data() const { return m_data; }
+
+  /**
+   * Returns the size of the mapped file in bytes
+   */
+  inline size_t size() const { return m_size; }
+
+private:
+
+  // non copyable
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  /// First byte of the mapping
+  const unsigned char *m_data;
+
+  /// Size of the mapping
+  size_t m_size;
+};
+
+} // namespace DBoW2
+
+#endif
@@ -26,10 +26,15 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <memory>
+#include <cstring>
+#include <functional>
+#include <stdint.h>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
 #include "ScoringObject.h"
+#include "MappedFile.h"
 
 #include "../DUtils/Random.h"
 
@@ -151,6 +156,28 @@ public:
    * @return word id
    */
   virtual WordId transform(const TDescriptor& feature) const;
+
+  /**
+   * Function that processes the index range [0, n) in parallel, in chunks of
+   * at least min_grain elements, and returns when all the chunks are done.
+   * Arguments: n, min_grain, function processing the range [begin, end)
+   */
+  typedef std::function<void(size_t, size_t, 
+    const std::function<void(size_t, size_t)>&)> ParallelForFunction;
+
+  /**
+   * Sets the function used to transform sets of features into bow and
+   * feature vectors in parallel, so that the vocabulary can share the
+   * thread pool of the application. The result does not depend on it
+   * @param f parallel for, empty (default) runs in the calling thread
+   */
+  void setParallelFor(const ParallelForFunction &f);
+
+  /**
+   * Returns the function used to transform sets of features in parallel
+   */
+  inline const ParallelForFunction& getParallelFor() const 
+    { return m_parallel_for; }
   
   /**
    * Returns the score of two vectors
@@ -246,6 +273,31 @@ public:
    */
   void saveToTextFile(const std::string &filename) const;  
 
+  /**
+   * Loads the vocabulary from a binary file written by saveToBinaryFile.
+   * The file is memory-mapped and the descriptors and weights are read in
+   * place, so loading does not parse or allocate anything per node, and
+   * processes that map the same file share its pages.
+   * Only transform, score, size, empty, getWord and getWordWeight are
+   * available on a mapped vocabulary; the functions that walk or modify the
+   * tree (getParentNode, getWordsFromNode, getEffectiveLevels, stopWords,
+   * save*) need a vocabulary loaded with loadFromTextFile or load.
+   * @param filename
+   * @return true iff the file could be mapped and has a valid header
+   */
+  bool loadFromBinaryFile(const std::string &filename);
+
+  /**
+   * Saves the vocabulary into a binary file that can be memory-mapped by
+   * loadFromBinaryFile. The nodes are stored in level order, so that the
+   * children of a node and their descriptors are contiguous. Node and word
+   * ids are kept, so both formats produce the same bow and feature vectors.
+   * The file uses the byte order of the host.
+   * @param filename
+   * @return true iff the file could be written
+   */
+  bool saveToBinaryFile(const std::string &filename) const;
+
   /**
    * Saves the vocabulary into a file
    * @param filename
@@ -328,6 +380,40 @@ protected:
     inline bool isLeaf() const { return children.empty(); }
   };
 
+  /// Header of the binary vocabulary file
+  struct BinaryHeader
+  {
+    /// "DBOW2BIN"
+    char magic[8];
+    /// Format version
+    uint32_t version;
+    /// Branching factor, depth levels, scoring and weighting types
+    int32_t k, L, scoring, weighting;
+    /// Length in bytes of the descriptors (F::L)
+    uint32_t descriptorBytes;
+    /// Number of nodes, root included, and of words
+    uint32_t nNodes, nWords;
+    /// Offsets in bytes of the node, descriptor and word sections
+    uint64_t nodesOffset, descriptorsOffset, wordsOffset;
+    /// Total size of the file in bytes
+    uint64_t fileSize;
+  };
+
+  /// Node of the level-ordered tree
+  struct FlatNode
+  {
+    /// Position of the first child; the children are contiguous
+    uint32_t firstChild;
+    /// Number of children, 0 for words
+    uint32_t nChildren;
+    /// Node id, as in the tree
+    uint32_t nodeId;
+    /// Word id if the node is a word
+    uint32_t wordId;
+    /// Weight if the node is a word
+    double weight;
+  };
+
 protected:
 
   /**
@@ -335,6 +421,47 @@ protected:
    */
   void createScoringObject();
 
+  /**
+   * Unmaps the binary file, if any, and forgets the level-ordered tree
+   */
+  void clearFlatTree();
+
+  /**
+   * Builds the level-ordered tree from m_nodes into the own buffers.
+   * Called whenever the tree is created or loaded
+   */
+  void createFlatTree();
+
+  /**
+   * Lays out m_nodes in level order, so that the children of a node and
+   * their descriptors are contiguous
+   * @param nodes (out) nodes, the root first
+   * @param descriptors (out) F::L bytes per node, zeros for the root
+   * @param words (out) position in nodes of each word
+   */
+  void buildFlatTree(std::vector<FlatNode> &nodes, 
+    std::vector<unsigned char> &descriptors, 
+    std::vector<uint32_t> &words) const;
+
+  /**
+   * Transforms each feature into a word, using m_parallel_for if set
+   * @param features
+   * @param ids (out) word id of each feature
+   * @param weights (out) word weight of each feature
+   * @param nids (out) if given, node id of each feature at levelsup
+   * @param levelsup
+   */
+  void transformFeatures(const std::vector<TDescriptor>& features,
+    std::vector<WordId> &ids, std::vector<WordValue> &weights,
+    std::vector<NodeId> *nids, int levelsup) const;
+
+  /**
+   * Returns the word id associated to a feature by descending the
+   * level-ordered tree. Same arguments as transform
+   */
+  void transformFlat(const TDescriptor &feature, 
+    WordId &id, WordValue &weight, NodeId* nid, int levelsup) const;
+
   /** 
    * Returns a set of pointers to descriptores
    * @param training_features all the features
@@ -425,6 +552,32 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Mapped binary file holding the level-ordered tree (see 
+  /// loadFromBinaryFile). Copies of the vocabulary share the mapping
+  std::shared_ptr<MappedFile> m_mapped;
+
+  /// Level-ordered tree used by transform. It points into the mapped file or
+  /// into the own buffers below, NULL if the vocabulary is empty
+  const FlatNode *m_flat_nodes;
+
+  /// Descriptors of the level-ordered tree, F::L bytes each
+  const unsigned char *m_flat_descriptors;
+
+  /// Position in m_flat_nodes of each word
+  const uint32_t *m_flat_words;
+
+  /// Number of nodes and words of the level-ordered tree
+  unsigned int m_flat_nnodes, m_flat_nwords;
+
+  /// Level-ordered tree of a vocabulary loaded from text or created, 
+  /// pointed by m_flat_* (empty if the vocabulary is mapped)
+  std::vector<FlatNode> m_flat_node_buffer;
+  std::vector<unsigned char> m_flat_descriptor_buffer;
+  std::vector<uint32_t> m_flat_word_buffer;
+
+  /// Parallel for used to transform sets of features (may be empty)
+  ParallelForFunction m_parallel_for;
   
 };
 
@@ -434,7 +587,9 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_flat_nodes(NULL), m_flat_descriptors(NULL),
+  m_flat_words(NULL), m_flat_nnodes(0), m_flat_nwords(0), 
+  m_parallel_for()
 {
   createScoringObject();
 }
@@ -443,7 +598,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL), m_flat_nodes(NULL),
+  m_flat_descriptors(NULL), m_flat_words(NULL), m_flat_nnodes(0), m_flat_nwords(0),
+  m_parallel_for()
 {
   load(filename);
 }
@@ -452,7 +609,9 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL), m_flat_nodes(NULL),
+  m_flat_descriptors(NULL), m_flat_words(NULL), m_flat_nnodes(0), m_flat_nwords(0),
+  m_parallel_for()
 {
   load(filename);
 }
@@ -496,6 +655,93 @@ void TemplatedVocabulary<TDescriptor,F>::createScoringObject()
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::clearFlatTree()
+{
+  m_mapped.reset();
+  m_flat_nodes = NULL;
+  m_flat_descriptors = NULL;
+  m_flat_words = NULL;
+  m_flat_nnodes = 0;
+  m_flat_nwords = 0;
+  m_flat_node_buffer.clear();
+  m_flat_descriptor_buffer.clear();
+  m_flat_word_buffer.clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createFlatTree()
+{
+  clearFlatTree();
+  if(m_nodes.empty()) return;
+
+  buildFlatTree(m_flat_node_buffer, m_flat_descriptor_buffer, 
+    m_flat_word_buffer);
+
+  m_flat_nodes = &m_flat_node_buffer[0];
+  m_flat_descriptors = &m_flat_descriptor_buffer[0];
+  m_flat_words = m_flat_word_buffer.empty() ? NULL : &m_flat_word_buffer[0];
+  m_flat_nnodes = m_flat_node_buffer.size();
+  m_flat_nwords = m_flat_word_buffer.size();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::buildFlatTree(
+  std::vector<FlatNode> &nodes, std::vector<unsigned char> &descriptors, 
+  std::vector<uint32_t> &words) const
+{
+  // level order: the children of a node get consecutive positions
+  vector<NodeId> order;
+  vector<uint32_t> position(m_nodes.size());
+  order.reserve(m_nodes.size());
+  order.push_back(0);
+  position[0] = 0;
+  for(size_t i = 0; i < order.size(); ++i)
+  {
+    const vector<NodeId> &children = m_nodes[order[i]].children;
+    for(size_t j = 0; j < children.size(); ++j)
+    {
+      position[children[j]] = order.size();
+      order.push_back(children[j]);
+    }
+  }
+
+  nodes.resize(order.size());
+  descriptors.assign((size_t)order.size() * F::L, 0);
+  words.resize(m_words.size());
+
+  for(size_t i = 0; i < order.size(); ++i)
+  {
+    const Node &node = m_nodes[order[i]];
+    FlatNode &flat = nodes[i];
+    flat.nodeId = node.id;
+    flat.nChildren = node.children.size();
+    flat.firstChild = node.children.empty() ? 0 : position[node.children[0]];
+    flat.wordId = node.isLeaf() ? node.word_id : 0xFFFFFFFF;
+    flat.weight = node.weight;
+
+    // the root has no descriptor
+    if(i > 0) F::toBytes(node.descriptor, &descriptors[i * F::L]);
+
+    if(node.isLeaf() && i > 0) words[node.word_id] = i;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::setParallelFor(
+  const ParallelForFunction &f)
+{
+  m_parallel_for = f;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::setScoringType(ScoringType type)
 {
@@ -516,7 +762,9 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_flat_nodes(NULL), m_flat_descriptors(NULL),
+  m_flat_words(NULL), m_flat_nnodes(0), m_flat_nwords(0), 
+  m_parallel_for()
 {
   *this = voc;
 }
@@ -548,6 +796,22 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   
   this->m_nodes = voc.m_nodes;
   this->createWords();
+
+  if(voc.m_mapped)
+  {
+    // share the mapping
+    this->clearFlatTree();
+    this->m_mapped = voc.m_mapped;
+    this->m_flat_nodes = voc.m_flat_nodes;
+    this->m_flat_descriptors = voc.m_flat_descriptors;
+    this->m_flat_words = voc.m_flat_words;
+    this->m_flat_nnodes = voc.m_flat_nnodes;
+    this->m_flat_nwords = voc.m_flat_nwords;
+  }
+  else
+    this->createFlatTree();
+
+  this->m_parallel_for = voc.m_parallel_for;
   
   return *this;
 }
@@ -560,6 +824,7 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 {
   m_nodes.clear();
   m_words.clear();
+  clearFlatTree();
   
   // expected_nodes = Sum_{i=0..L} ( k^i )
 	int expected_nodes = 
@@ -583,7 +848,8 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
-  
+
+  createFlatTree();
 }
 
 // --------------------------------------------------------------------------
@@ -1000,6 +1266,7 @@ void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
 template<class TDescriptor, class F>
 inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 {
+  if(m_flat_nodes) return m_flat_nwords;
   return m_words.size();
 }
 
@@ -1008,6 +1275,7 @@ inline unsigned int TemplatedVocabulary<TDescriptor,F>::size() const
 template<class TDescriptor, class F>
 inline bool TemplatedVocabulary<TDescriptor,F>::empty() const
 {
+  if(m_flat_nodes) return m_flat_nwords == 0;
   return m_words.empty();
 }
 
@@ -1033,6 +1301,12 @@ float TemplatedVocabulary<TDescriptor,F>::getEffectiveLevels() const
 template<class TDescriptor, class F>
 TDescriptor TemplatedVocabulary<TDescriptor,F>::getWord(WordId wid) const
 {
+  if(m_mapped)
+  {
+    TDescriptor d;
+    F::fromBytes(d, m_flat_descriptors + (size_t)m_flat_words[wid] * F::L);
+    return d;
+  }
   return m_words[wid]->descriptor;
 }
 
@@ -1041,6 +1315,7 @@ TDescriptor TemplatedVocabulary<TDescriptor,F>::getWord(WordId wid) const
 template<class TDescriptor, class F>
 WordValue TemplatedVocabulary<TDescriptor, F>::getWordWeight(WordId wid) const
 {
+  if(m_flat_nodes) return m_flat_nodes[m_flat_words[wid]].weight;
   return m_words[wid]->weight;
 }
 
@@ -1077,21 +1352,22 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
 
-	typename vector<TDescriptor>::const_iterator fit;
+  // words of all the features, then accumulated in order
+  vector<WordId> ids;
+  vector<WordValue> weights;
+  transformFeatures(features, ids, weights, NULL, 0);
+
+  // append the words not stopped, then sort and merge them once
+  v.reserve(features.size());
+  for(size_t i = 0; i < features.size(); ++i)
+  {
+    // w is the idf value if TF_IDF, 1 if TF, idf if IDF, or 1 if BINARY
+    if(weights[i] > 0) v.push_back(BowVector::value_type(ids[i], weights[i]));
+  }
 
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w; 
-      // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w);
-      
-      // not stopped
-      if(w > 0) v.addWeight(id, w);
-    }
+    v.sortWords(true);
     
     if(!v.empty() && !must)
     {
@@ -1104,18 +1380,7 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
-    {
-      WordId id;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w);
-      
-      // not stopped
-      if(w > 0) v.addIfNotExist(id, w);
-      
-    } // if add_features
+    v.sortWords(false);
   } // if m_weighting == ...
   
   if(must) v.normalize(norm);
@@ -1140,26 +1405,33 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
   
-  typename vector<TDescriptor>::const_iterator fit;
-  
-  if(m_weighting == TF || m_weighting == TF_IDF)
+  // words of all the features, then accumulated in order
+  vector<WordId> ids;
+  vector<WordValue> weights;
+  vector<NodeId> nids;
+  transformFeatures(features, ids, weights, &nids, levelsup);
+  
+  // append the words and nodes of the features not stopped, then sort and
+  // merge them once
+  vector<pair<NodeId, unsigned int> > nodes;
+  nodes.reserve(features.size());
+  v.reserve(features.size());
+  for(unsigned int i_feature = 0; i_feature < features.size(); ++i_feature)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    // w is the idf value if TF_IDF, 1 if TF, idf if IDF, or 1 if BINARY
+    const WordValue w = weights[i_feature];
+    
+    if(w > 0) // not stopped
     {
-      WordId id;
-      NodeId nid;
-      WordValue w; 
-      // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      { 
-        v.addWeight(id, w);
-        fv.addFeature(nid, i_feature);
-      }
+      v.push_back(BowVector::value_type(ids[i_feature], w));
+      nodes.push_back(make_pair(nids[i_feature], i_feature));
     }
+  }
+  fv.setFeatures(nodes);
+  
+  if(m_weighting == TF || m_weighting == TF_IDF)
+  {
+    v.sortWords(true);
     
     if(!v.empty() && !must)
     {
@@ -1172,22 +1444,7 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
-    {
-      WordId id;
-      NodeId nid;
-      WordValue w;
-      // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w, &nid, levelsup);
-      
-      if(w > 0) // not stopped
-      {
-        v.addIfNotExist(id, w);
-        fv.addFeature(nid, i_feature);
-      }
-    }
+    v.sortWords(false);
   } // if m_weighting == ...
   
   if(must) v.normalize(norm);
@@ -1195,6 +1452,42 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F> 
+void TemplatedVocabulary<TDescriptor,F>::transformFeatures(
+  const std::vector<TDescriptor>& features,
+  std::vector<WordId> &ids, std::vector<WordValue> &weights,
+  std::vector<NodeId> *nids, int levelsup) const
+{
+  const size_t n = features.size();
+  ids.resize(n);
+  weights.resize(n);
+  if(nids) nids->resize(n);
+
+  // each feature descends the tree independently
+  // (the results are written in place, so no locking is needed)
+  const size_t min_per_thread = 128;
+
+  NodeId *pnids = (nids && n > 0) ? &(*nids)[0] : NULL;
+  WordId *pids = n > 0 ? &ids[0] : NULL;
+  WordValue *pweights = n > 0 ? &weights[0] : NULL;
+
+  const std::function<void(size_t, size_t)> run = 
+    [this, &features, pids, pweights, pnids, levelsup]
+    (size_t begin, size_t end)
+  {
+    for(size_t i = begin; i < end; ++i)
+      transform(features[i], pids[i], pweights[i], 
+        pnids ? &pnids[i] : NULL, levelsup);
+  };
+
+  if(m_parallel_for)
+    m_parallel_for(n, min_per_thread, run);
+  else
+    run(0, n);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F> 
 inline double TemplatedVocabulary<TDescriptor,F>::score
   (const BowVector &v1, const BowVector &v2) const
@@ -1218,6 +1511,12 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
+  if(m_flat_nodes)
+  {
+    transformFlat(feature, word_id, weight, nid, levelsup);
+    return;
+  }
+
   // propagate the feature down the tree
   vector<NodeId> nodes;
   typename vector<NodeId>::const_iterator nit;
@@ -1260,6 +1559,58 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transformFlat(const TDescriptor &feature, 
+  WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
+{
+  // level at which the node must be stored in nid, if given
+  const int nid_level = m_L - levelsup;
+  if(nid_level <= 0 && nid != NULL) *nid = 0; // root
+
+  unsigned int final_pos = 0; // root
+  int current_level = 0;
+
+  do
+  {
+    ++current_level;
+    const FlatNode &node = m_flat_nodes[final_pos];
+
+    // the descriptors of the children are contiguous, so the distances
+    // to all of them are computed at once
+    const unsigned char *d = m_flat_descriptors + (size_t)node.firstChild * F::L;
+    final_pos = node.firstChild;
+    int best_d = std::numeric_limits<int>::max();
+
+    const unsigned int max_batch = 32;
+    int dist[max_batch];
+    for(unsigned int i = 0; i < node.nChildren; i += max_batch)
+    {
+      const unsigned int batch = std::min(max_batch, node.nChildren - i);
+      F::distances(feature, d + (size_t)i * F::L, batch, dist);
+
+      // the first child wins ties, as in the tree traversal
+      for(unsigned int j = 0; j < batch; ++j)
+      {
+        if(dist[j] < best_d)
+        {
+          best_d = dist[j];
+          final_pos = node.firstChild + i + j;
+        }
+      }
+    }
+
+    if(nid != NULL && current_level == nid_level)
+      *nid = m_flat_nodes[final_pos].nodeId;
+
+  } while(m_flat_nodes[final_pos].nChildren > 0);
+
+  // turn node id into word id
+  word_id = m_flat_nodes[final_pos].wordId;
+  weight = m_flat_nodes[final_pos].weight;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 NodeId TemplatedVocabulary<TDescriptor,F>::getParentNode
   (WordId wid, int levelsup) const
@@ -1319,6 +1670,9 @@ void TemplatedVocabulary<TDescriptor,F>::getWordsFromNode
 template<class TDescriptor, class F>
 int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
 {
+  // the weights of a mapped vocabulary are read-only
+  if(m_mapped) return 0;
+
   int c = 0;
   typename vector<Node*>::iterator wit;
   for(wit = m_words.begin(); wit != m_words.end(); ++wit)
@@ -1327,6 +1681,8 @@ int TemplatedVocabulary<TDescriptor,F>::stopWords(double minWeight)
     {
       ++c;
       (*wit)->weight = 0;
+      if(!m_flat_node_buffer.empty())
+        m_flat_node_buffer[m_flat_words[wit - m_words.begin()]].weight = 0;
     }
   }
   return c;
@@ -1345,6 +1701,7 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
 
     m_words.clear();
     m_nodes.clear();
+    clearFlatTree();
 
     string s;
     getline(f,s);
@@ -1419,6 +1776,8 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
         }
     }
 
+    createFlatTree();
+
     return true;
 
 }
@@ -1450,6 +1809,150 @@ void TemplatedVocabulary<TDescriptor,F>::saveToTextFile(const std::string &filen
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::loadFromBinaryFile(const std::string &filename)
+{
+  std::shared_ptr<MappedFile> mapped(new MappedFile);
+  if(!mapped->open(filename))
+  {
+    std::cerr << "Vocabulary loading failure: cannot map " << filename << endl;
+    return false;
+  }
+
+  const unsigned char *data = mapped->data();
+  const size_t size = mapped->size();
+
+  BinaryHeader h;
+  if(size < sizeof(h))
+  {
+    std::cerr << "Vocabulary loading failure: This is not a correct binary file!" << endl;
+    return false;
+  }
+  memcpy(&h, data, sizeof(h));
+
+  const uint64_t nodesBytes = (uint64_t)h.nNodes * sizeof(FlatNode);
+  const uint64_t descriptorsBytes = (uint64_t)h.nNodes * F::L;
+  const uint64_t wordsBytes = (uint64_t)h.nWords * sizeof(uint32_t);
+
+  if(memcmp(h.magic, "DBOW2BIN", 8) != 0 || h.version != 1 ||
+    h.descriptorBytes != (uint32_t)F::L || h.fileSize != size ||
+    h.k < 0 || h.k > 20 || h.L < 1 || h.L > 10 || 
+    h.scoring < 0 || h.scoring > 5 || h.weighting < 0 || h.weighting > 3 ||
+    h.nNodes < 1 || h.nWords > h.nNodes ||
+    h.nodesOffset % 8 != 0 || h.wordsOffset % 4 != 0 ||
+    h.nodesOffset + nodesBytes > size ||
+    h.descriptorsOffset + descriptorsBytes > size ||
+    h.wordsOffset + wordsBytes > size)
+  {
+    std::cerr << "Vocabulary loading failure: This is not a correct binary file!" << endl;
+    return false;
+  }
+
+  // the lookups index the mapped arrays directly, so every link must be
+  // inside them. Children come after their parent (level order), which
+  // also guarantees that the descent terminates
+  const FlatNode *nodes = reinterpret_cast<const FlatNode*>(data + h.nodesOffset);
+  const uint32_t *words = reinterpret_cast<const uint32_t*>(data + h.wordsOffset);
+  bool valid = nodes[0].nChildren > 0;
+  for(uint32_t i = 0; i < h.nNodes && valid; ++i)
+  {
+    const FlatNode &node = nodes[i];
+    if(node.nChildren > 0)
+      valid = node.firstChild > i && 
+        (uint64_t)node.firstChild + node.nChildren <= h.nNodes;
+    else
+      valid = node.wordId < h.nWords;
+  }
+  for(uint32_t w = 0; w < h.nWords && valid; ++w)
+  {
+    valid = words[w] < h.nNodes && nodes[words[w]].nChildren == 0 &&
+      nodes[words[w]].wordId == w;
+  }
+
+  if(!valid)
+  {
+    std::cerr << "Vocabulary loading failure: the tree in " << filename
+      << " is corrupt" << endl;
+    return false;
+  }
+
+  m_words.clear();
+  m_nodes.clear();
+
+  m_k = h.k;
+  m_L = h.L;
+  m_scoring = (ScoringType)h.scoring;
+  m_weighting = (WeightingType)h.weighting;
+  createScoringObject();
+
+  m_mapped = mapped;
+  m_flat_nodes = reinterpret_cast<const FlatNode*>(data + h.nodesOffset);
+  m_flat_descriptors = data + h.descriptorsOffset;
+  m_flat_words = reinterpret_cast<const uint32_t*>(data + h.wordsOffset);
+  m_flat_nnodes = h.nNodes;
+  m_flat_nwords = h.nWords;
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+bool TemplatedVocabulary<TDescriptor,F>::saveToBinaryFile(const std::string &filename) const
+{
+  if(m_nodes.empty())
+  {
+    std::cerr << "Vocabulary saving failure: the tree is not loaded" << endl;
+    return false;
+  }
+
+  vector<FlatNode> nodes;
+  vector<unsigned char> descriptors;
+  vector<uint32_t> words;
+  buildFlatTree(nodes, descriptors, words);
+
+  // sections aligned to 64 bytes
+  BinaryHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "DBOW2BIN", 8);
+  h.version = 1;
+  h.k = m_k;
+  h.L = m_L;
+  h.scoring = m_scoring;
+  h.weighting = m_weighting;
+  h.descriptorBytes = F::L;
+  h.nNodes = nodes.size();
+  h.nWords = words.size();
+  h.nodesOffset = (sizeof(h) + 63) & ~(uint64_t)63;
+  h.descriptorsOffset = 
+    (h.nodesOffset + (uint64_t)h.nNodes * sizeof(FlatNode) + 63) & ~(uint64_t)63;
+  h.wordsOffset = 
+    (h.descriptorsOffset + (uint64_t)h.nNodes * F::L + 63) & ~(uint64_t)63;
+  h.fileSize = h.wordsOffset + (uint64_t)h.nWords * sizeof(uint32_t);
+
+  ofstream f(filename.c_str(), ios_base::out | ios_base::binary);
+  if(!f.is_open())
+  {
+    std::cerr << "Vocabulary saving failure: cannot open " << filename << endl;
+    return false;
+  }
+
+  const vector<char> padding(64, 0);
+  f.write((const char*)&h, sizeof(h));
+  f.write(&padding[0], h.nodesOffset - sizeof(h));
+  f.write((const char*)&nodes[0], nodes.size() * sizeof(FlatNode));
+  f.write(&padding[0], h.descriptorsOffset - h.nodesOffset - 
+    nodes.size() * sizeof(FlatNode));
+  f.write((const char*)&descriptors[0], descriptors.size());
+  f.write(&padding[0], h.wordsOffset - h.descriptorsOffset - descriptors.size());
+  if(!words.empty())
+    f.write((const char*)&words[0], words.size() * sizeof(uint32_t));
+
+  return f.good();
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::save(const std::string &filename) const
 {
@@ -1575,6 +2078,7 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
 {
   m_words.clear();
   m_nodes.clear();
+  clearFlatTree();
   
   cv::FileNode fvoc = fs[name];
   
@@ -1619,6 +2123,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
 }
 
 // --------------------------------------------------------------------------
@@ -31,6 +31,7 @@
 #include "linear_solver.h"
 #include "sparse_block_matrix.h"
 #include "sparse_block_matrix_diagonal.h"
+#include "optimizable_graph.h"
 #include "openmp_mutex.h"
 #include "../../config.h"
 
@@ -147,6 +148,26 @@ namespace g2o {
 
       void deallocate();
 
+      /**
+       * eliminate one landmark block from the system: add its contribution to the coefficients and to
+       * the blocks of the Schur complement. If hschur is 0, the blocks of _Hschur are updated in place,
+       * otherwise the contributions are accumulated into the flat buffer laid out by _schurBlockOffsets.
+       */
+      void schurComplementLandmark(int landmarkIndex, double* coefficients, double* hschur);
+
+#    ifdef G2O_OPENMP
+      /**
+       * group the active edges by the pose vertex they write to, such that each pose block is
+       * accumulated by a single thread in buildSystem()
+       */
+      void buildEdgeBuckets();
+
+      /**
+       * compute the layout of the per-thread buffers used to accumulate the Schur complement
+       */
+      void buildSchurLayout();
+#    endif
+
       SparseBlockMatrix<PoseMatrixType>* _Hpp;
       SparseBlockMatrix<LandmarkMatrixType>* _Hll;
       SparseBlockMatrix<PoseLandmarkMatrixType>* _Hpl;
@@ -163,7 +184,11 @@ namespace g2o {
       std::vector<LandmarkVectorType, Eigen::aligned_allocator<LandmarkVectorType> > _diagonalBackupLandmark;
 
 #    ifdef G2O_OPENMP
-      std::vector<OpenMPMutex> _coefficientsMutex;
+      std::vector<OptimizableGraph::Edge*> _bucketEdges;  ///< active edges sorted by their owning vertex
+      std::vector<int> _bucketBegin;                      ///< start of the edges owned by each vertex in _bucketEdges
+      std::vector<int> _schurColumnBegin;                 ///< index of the first block of each column of _HschurTransposedCCS
+      std::vector<int> _schurBlockOffsets;                ///< offset of each block of _HschurTransposedCCS in a thread buffer
+      std::vector<double> _schurThreadBuffers;            ///< per-thread accumulators of the Schur complement and the coefficients
 #    endif
 
       bool _doSchur;
@@ -85,9 +85,6 @@ void BlockSolver<Traits>::resize(int* blockPoseIndices, int numPoseBlocks,
     _Hpl=new PoseLandmarkHessianType(blockPoseIndices, blockLandmarkIndices, numPoseBlocks, numLandmarkBlocks);
     _HplCCS = new SparseBlockMatrixCCS<PoseLandmarkMatrixType>(_Hpl->rowBlockIndices(), _Hpl->colBlockIndices());
     _HschurTransposedCCS = new SparseBlockMatrixCCS<PoseMatrixType>(_Hschur->colBlockIndices(), _Hschur->rowBlockIndices());
-#ifdef G2O_OPENMP
-    _coefficientsMutex.resize(numPoseBlocks);
-#endif
   }
 }
 
@@ -253,6 +250,10 @@ bool BlockSolver<Traits>::buildStructure(bool zeroBlocks)
     }
   }
 
+# ifdef G2O_OPENMP
+  buildEdgeBuckets();
+# endif
+
   if (! _doSchur)
     return true;
 
@@ -290,10 +291,88 @@ bool BlockSolver<Traits>::buildStructure(bool zeroBlocks)
   _Hschur->takePatternFromHash(*schurMatrixLookup);
   delete schurMatrixLookup;
   _Hschur->fillSparseBlockMatrixCCSTransposed(*_HschurTransposedCCS);
+# ifdef G2O_OPENMP
+  buildSchurLayout();
+# endif
 
   return true;
 }
 
+#ifdef G2O_OPENMP
+template <typename Traits>
+void BlockSolver<Traits>::buildEdgeBuckets()
+{
+  // an edge is owned by its first free pose vertex, or by its first free landmark if it does not
+  // touch a free pose. Edges are sorted into the buckets of their owners by counting sort.
+  const SparseOptimizer::EdgeContainer& activeEdges = _optimizer->activeEdges();
+  int numBuckets = std::max(1, static_cast<int>(_optimizer->indexMapping().size()));
+  std::vector<int> owners(activeEdges.size());
+  _bucketBegin.assign(numBuckets + 2, 0);
+  for (size_t k = 0; k < activeEdges.size(); ++k) {
+    OptimizableGraph::Edge* e = activeEdges[k];
+    int owner = -1;
+    for (size_t i = 0; i < e->vertices().size(); ++i) {
+      const OptimizableGraph::Vertex* v = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i));
+      if (v->hessianIndex() == -1)
+        continue;
+      if (! v->marginalized()) {
+        owner = v->hessianIndex();
+        break;
+      }
+      if (owner == -1)
+        owner = v->hessianIndex();
+    }
+    // edges without any free vertex go to the first bucket, they do not write to the system
+    owners[k] = owner == -1 ? 0 : owner;
+    ++_bucketBegin[owners[k] + 2];
+  }
+  for (int b = 2; b < numBuckets + 2; ++b)
+    _bucketBegin[b] += _bucketBegin[b-1];
+  _bucketEdges.resize(activeEdges.size());
+  for (size_t k = 0; k < activeEdges.size(); ++k)
+    _bucketEdges[_bucketBegin[owners[k] + 1]++] = activeEdges[k];
+  _bucketBegin.pop_back();
+
+  // a free vertex which is only written by the edges of its own bucket is accumulated by a single
+  // thread and needs no lock; fixed vertices are never written. If two edges of different buckets
+  // write the same off-diagonal block, both of its vertices are shared and the edges still lock them.
+  std::vector<char> shared(numBuckets, 0);
+  for (size_t k = 0; k < activeEdges.size(); ++k) {
+    OptimizableGraph::Edge* e = activeEdges[k];
+    for (size_t i = 0; i < e->vertices().size(); ++i) {
+      const OptimizableGraph::Vertex* v = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i));
+      if (v->hessianIndex() != -1 && v->hessianIndex() != owners[k])
+        shared[v->hessianIndex()] = 1;
+    }
+  }
+  for (size_t k = 0; k < activeEdges.size(); ++k) {
+    OptimizableGraph::Edge* e = activeEdges[k];
+    for (size_t i = 0; i < e->vertices().size(); ++i) {
+      OptimizableGraph::Vertex* v = static_cast<OptimizableGraph::Vertex*>(e->vertex(i));
+      v->setExclusiveQuadraticForm(v->hessianIndex() == -1 || ! shared[v->hessianIndex()]);
+    }
+  }
+}
+
+template <typename Traits>
+void BlockSolver<Traits>::buildSchurLayout()
+{
+  const std::vector<typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn>& columns = _HschurTransposedCCS->blockCols();
+  _schurColumnBegin.resize(columns.size() + 1);
+  _schurBlockOffsets.clear();
+  int offset = 0;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    _schurColumnBegin[i] = static_cast<int>(_schurBlockOffsets.size());
+    for (typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::const_iterator it = columns[i].begin(); it != columns[i].end(); ++it) {
+      _schurBlockOffsets.push_back(offset);
+      offset += static_cast<int>(it->block->rows() * it->block->cols());
+    }
+  }
+  _schurColumnBegin[columns.size()] = static_cast<int>(_schurBlockOffsets.size());
+  _schurBlockOffsets.push_back(offset);
+}
+#endif
+
 template <typename Traits>
 bool BlockSolver<Traits>::updateStructure(const std::vector<HyperGraph::Vertex*>& vset, const HyperGraph::EdgeSet& edges)
 {
@@ -350,6 +429,67 @@ bool BlockSolver<Traits>::updateStructure(const std::vector<HyperGraph::Vertex*>
   return true;
 }
 
+template <typename Traits>
+void BlockSolver<Traits>::schurComplementLandmark(int landmarkIndex, double* coefficients, double* hschur)
+{
+  const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
+  assert(marginalizeColumn.size() == 1 && "more than one block in _Hll column");
+
+  // calculate inverse block for the landmark
+  const LandmarkMatrixType * D = marginalizeColumn.begin()->second;
+  assert (D && D->rows()==D->cols() && "Error in landmark matrix");
+  LandmarkMatrixType& Dinv = _DInvSchur->diagonal()[landmarkIndex];
+  Dinv = D->inverse();
+
+  LandmarkVectorType  db(D->rows());
+  for (int j=0; j<D->rows(); ++j) {
+    db[j]=_b[_Hll->rowBaseOfBlock(landmarkIndex) + _sizePoses + j];
+  }
+  db=Dinv*db;
+
+  assert((size_t)landmarkIndex < _HplCCS->blockCols().size() && "Index out of bounds");
+  const typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn& landmarkColumn = _HplCCS->blockCols()[landmarkIndex];
+
+  for (typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_outer = landmarkColumn.begin();
+      it_outer != landmarkColumn.end(); ++it_outer) {
+    int i1 = it_outer->row;
+
+    const PoseLandmarkMatrixType* Bi = it_outer->block;
+    assert(Bi);
+
+    PoseLandmarkMatrixType BDinv = (*Bi)*(Dinv);
+    assert(_HplCCS->rowBaseOfBlock(i1) < _sizePoses && "Index out of bounds");
+    typename PoseVectorType::MapType Bb(&coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
+    Bb.noalias() += (*Bi)*db;
+
+    assert(i1 >= 0 && i1 < static_cast<int>(_HschurTransposedCCS->blockCols().size()) && "Index out of bounds");
+    typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn& targetColumn = _HschurTransposedCCS->blockCols()[i1];
+    typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::iterator targetColumnIt = targetColumn.begin();
+
+    typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::RowBlock aux(i1, 0);
+    typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_inner = lower_bound(landmarkColumn.begin(), landmarkColumn.end(), aux);
+    for (; it_inner != landmarkColumn.end(); ++it_inner) {
+      int i2 = it_inner->row;
+      const PoseLandmarkMatrixType* Bj = it_inner->block;
+      assert(Bj); 
+      while (targetColumnIt->row < i2 /*&& targetColumnIt != targetColumn.end()*/)
+        ++targetColumnIt;
+      assert(targetColumnIt != targetColumn.end() && targetColumnIt->row == i2 && "invalid iterator, something wrong with the matrix structure");
+      PoseMatrixType* Hi1i2 = targetColumnIt->block;//_Hschur->block(i1,i2);
+      assert(Hi1i2);
+      if (! hschur) {
+        (*Hi1i2).noalias() -= BDinv*Bj->transpose();
+        continue;
+      }
+#   ifdef G2O_OPENMP
+      int offset = _schurBlockOffsets[_schurColumnBegin[i1] + (targetColumnIt - targetColumn.begin())];
+      Eigen::Map<PoseMatrixType> threadHi1i2(hschur + offset, Hi1i2->rows(), Hi1i2->cols());
+      threadHi1i2.noalias() -= BDinv*Bj->transpose();
+#   endif
+    }
+  }
+}
+
 template <typename Traits>
 bool BlockSolver<Traits>::solve(){
   //cerr << __PRETTY_FUNCTION__ << endl;
@@ -375,60 +515,48 @@ bool BlockSolver<Traits>::solve(){
 
   //_DInvSchur->clear();
   memset (_coefficients, 0, _sizePoses*sizeof(double));
+  int numLandmarkBlocks = static_cast<int>(_Hll->blockCols().size());
 # ifdef G2O_OPENMP
-# pragma omp parallel for default (shared) schedule(dynamic, 10)
-# endif
-  for (int landmarkIndex = 0; landmarkIndex < static_cast<int>(_Hll->blockCols().size()); ++landmarkIndex) {
-    const typename SparseBlockMatrix<LandmarkMatrixType>::IntBlockMap& marginalizeColumn = _Hll->blockCols()[landmarkIndex];
-    assert(marginalizeColumn.size() == 1 && "more than one block in _Hll column");
-
-    // calculate inverse block for the landmark
-    const LandmarkMatrixType * D = marginalizeColumn.begin()->second;
-    assert (D && D->rows()==D->cols() && "Error in landmark matrix");
-    LandmarkMatrixType& Dinv = _DInvSchur->diagonal()[landmarkIndex];
-    Dinv = D->inverse();
-
-    LandmarkVectorType  db(D->rows());
-    for (int j=0; j<D->rows(); ++j) {
-      db[j]=_b[_Hll->rowBaseOfBlock(landmarkIndex) + _sizePoses + j];
-    }
-    db=Dinv*db;
-
-    assert((size_t)landmarkIndex < _HplCCS->blockCols().size() && "Index out of bounds");
-    const typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn& landmarkColumn = _HplCCS->blockCols()[landmarkIndex];
-
-    for (typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_outer = landmarkColumn.begin();
-        it_outer != landmarkColumn.end(); ++it_outer) {
-      int i1 = it_outer->row;
-
-      const PoseLandmarkMatrixType* Bi = it_outer->block;
-      assert(Bi);
-
-      PoseLandmarkMatrixType BDinv = (*Bi)*(Dinv);
-      assert(_HplCCS->rowBaseOfBlock(i1) < _sizePoses && "Index out of bounds");
-      typename PoseVectorType::MapType Bb(&_coefficients[_HplCCS->rowBaseOfBlock(i1)], Bi->rows());
-#    ifdef G2O_OPENMP
-      ScopedOpenMPMutex mutexLock(&_coefficientsMutex[i1]);
-#    endif
-      Bb.noalias() += (*Bi)*db;
-
-      assert(i1 >= 0 && i1 < static_cast<int>(_HschurTransposedCCS->blockCols().size()) && "Index out of bounds");
-      typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn::iterator targetColumnIt = _HschurTransposedCCS->blockCols()[i1].begin();
-
-      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::RowBlock aux(i1, 0);
-      typename SparseBlockMatrixCCS<PoseLandmarkMatrixType>::SparseColumn::const_iterator it_inner = lower_bound(landmarkColumn.begin(), landmarkColumn.end(), aux);
-      for (; it_inner != landmarkColumn.end(); ++it_inner) {
-        int i2 = it_inner->row;
-        const PoseLandmarkMatrixType* Bj = it_inner->block;
-        assert(Bj); 
-        while (targetColumnIt->row < i2 /*&& targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end()*/)
-          ++targetColumnIt;
-        assert(targetColumnIt != _HschurTransposedCCS->blockCols()[i1].end() && targetColumnIt->row == i2 && "invalid iterator, something wrong with the matrix structure");
-        PoseMatrixType* Hi1i2 = targetColumnIt->block;//_Hschur->block(i1,i2);
-        assert(Hi1i2);
-        (*Hi1i2).noalias() -= BDinv*Bj->transpose();
+  int numThreads = omp_get_max_threads();
+  if (numThreads > 1 && numLandmarkBlocks > 100) {
+    // every thread accumulates the contributions of its landmarks into a private copy of the
+    // Schur complement blocks and of the coefficients, the copies are summed up afterwards
+    int hschurSize = _schurBlockOffsets.back();
+    int threadStride = hschurSize + _sizePoses;
+    _schurThreadBuffers.resize(static_cast<size_t>(threadStride) * numThreads);
+#   pragma omp parallel default (shared) num_threads(numThreads)
+    {
+      double* hschur = &_schurThreadBuffers[static_cast<size_t>(threadStride) * omp_get_thread_num()];
+      double* coefficients = hschur + hschurSize;
+      memset(hschur, 0, threadStride * sizeof(double));
+#     pragma omp for schedule(dynamic, 10)
+      for (int landmarkIndex = 0; landmarkIndex < numLandmarkBlocks; ++landmarkIndex)
+        schurComplementLandmark(landmarkIndex, coefficients, hschur);
+
+      // reduction over the threads, each pose column of the Schur complement is summed up by one thread
+#     pragma omp for schedule(dynamic, 10)
+      for (int i1 = 0; i1 < static_cast<int>(_HschurTransposedCCS->blockCols().size()); ++i1) {
+        typename SparseBlockMatrixCCS<PoseMatrixType>::SparseColumn& column = _HschurTransposedCCS->blockCols()[i1];
+        for (size_t k = 0; k < column.size(); ++k) {
+          PoseMatrixType* block = column[k].block;
+          int offset = _schurBlockOffsets[_schurColumnBegin[i1] + k];
+          for (int thread = 0; thread < numThreads; ++thread)
+            *block += Eigen::Map<PoseMatrixType>(&_schurThreadBuffers[static_cast<size_t>(threadStride) * thread + offset], block->rows(), block->cols());
+        }
+        int rowBase = _HschurTransposedCCS->rowBaseOfBlock(i1);
+        int rowEnd = rowBase + _HschurTransposedCCS->rowsOfBlock(i1);
+        for (int thread = 0; thread < numThreads; ++thread) {
+          const double* threadCoefficients = &_schurThreadBuffers[static_cast<size_t>(threadStride) * thread + hschurSize];
+          for (int i = rowBase; i < rowEnd; ++i)
+            _coefficients[i] += threadCoefficients[i];
+        }
       }
     }
+  } else
+# endif
+  {
+    for (int landmarkIndex = 0; landmarkIndex < numLandmarkBlocks; ++landmarkIndex)
+      schurComplementLandmark(landmarkIndex, _coefficients, 0);
   }
   //cerr << "Solve [marginalize] = " <<  get_monotonic_time()-t << endl;
 
@@ -521,11 +649,6 @@ bool BlockSolver<Traits>::buildSystem()
 # ifndef G2O_OPENMP
   // no threading, we do not need to copy the workspace
   JacobianWorkspace& jacobianWorkspace = _optimizer->jacobianWorkspace();
-# else
-  // if running with threads need to produce copies of the workspace for each thread
-  JacobianWorkspace jacobianWorkspace = _optimizer->jacobianWorkspace();
-# pragma omp parallel for default (shared) firstprivate(jacobianWorkspace) if (_optimizer->activeEdges().size() > 100)
-# endif
   for (int k = 0; k < static_cast<int>(_optimizer->activeEdges().size()); ++k) {
     OptimizableGraph::Edge* e = _optimizer->activeEdges()[k];
     e->linearizeOplus(jacobianWorkspace); // jacobian of the nodes' oplus (manifold)
@@ -543,6 +666,37 @@ bool BlockSolver<Traits>::buildSystem()
     }
 #  endif
   }
+# else
+  // the edges added by updateStructure() are not yet assigned to a bucket
+  if (_bucketEdges.size() != _optimizer->activeEdges().size())
+    buildEdgeBuckets();
+
+  // if running with threads need to produce copies of the workspace for each thread.
+  // The threads process whole buckets, hence the Hessian block of a pose is accumulated by a single
+  // thread without locking it, and only the landmark blocks shared between buckets take their locks
+  JacobianWorkspace jacobianWorkspace = _optimizer->jacobianWorkspace();
+  int numBuckets = static_cast<int>(_bucketBegin.size()) - 1;
+# pragma omp parallel for default (shared) firstprivate(jacobianWorkspace) schedule(dynamic, 4) if (_optimizer->activeEdges().size() > 100)
+  for (int b = 0; b < numBuckets; ++b) {
+    for (int k = _bucketBegin[b]; k < _bucketBegin[b+1]; ++k) {
+      OptimizableGraph::Edge* e = _bucketEdges[k];
+      e->linearizeOplus(jacobianWorkspace); // jacobian of the nodes' oplus (manifold)
+      e->constructQuadraticForm();
+#    ifndef NDEBUG
+      for (size_t i = 0; i < e->vertices().size(); ++i) {
+        const OptimizableGraph::Vertex* v = static_cast<const OptimizableGraph::Vertex*>(e->vertex(i));
+        if (! v->fixed()) {
+          bool hasANan = arrayHasNaN(jacobianWorkspace.workspaceForVertex(i), e->dimension() * v->dimension());
+          if (hasANan) {
+            cerr << "buildSystem(): NaN within Jacobian for edge " << e << " for vertex " << i << endl;
+            break;
+          }
+        }
+      }
+#    endif
+    }
+  }
+# endif
 
   // flush the current system in a sparse block matrix
 # ifdef G2O_OPENMP
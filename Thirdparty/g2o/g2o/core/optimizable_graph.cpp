@@ -63,7 +63,7 @@ namespace g2o {
   OptimizableGraph::Vertex::Vertex() :
     HyperGraph::Vertex(),
     _graph(0), _userData(0), _hessianIndex(-1), _fixed(false), _marginalized(false),
-    _colInHessian(-1), _cacheContainer(0)
+    _colInHessian(-1), _exclusiveQuadraticForm(false), _cacheContainer(0)
   {
   }
 
@@ -328,13 +328,20 @@ namespace g2o {
 
         /**
          * lock for the block of the hessian and the b vector associated with this vertex, to avoid
-         * race-conditions if multi-threaded.
+         * race-conditions if multi-threaded. Does nothing if the block is written by a single thread.
          */
-        void lockQuadraticForm() { _quadraticFormMutex.lock();}
+        void lockQuadraticForm() { if (! _exclusiveQuadraticForm) _quadraticFormMutex.lock();}
         /**
          * unlock the block of the hessian and the b vector associated with this vertex
          */
-        void unlockQuadraticForm() { _quadraticFormMutex.unlock();}
+        void unlockQuadraticForm() { if (! _exclusiveQuadraticForm) _quadraticFormMutex.unlock();}
+        /**
+         * true if all the edges writing to the quadratic form of this vertex are processed
+         * by the same thread, which then does not need to lock it. Set by the block solver
+         * while building the system, must not change during constructQuadraticForm().
+         */
+        bool exclusiveQuadraticForm() const { return _exclusiveQuadraticForm;}
+        void setExclusiveQuadraticForm(bool exclusive) { _exclusiveQuadraticForm = exclusive;}
 
         //! read the vertex from a stream, i.e., the internal state of the vertex
         virtual bool read(std::istream& is) = 0;
@@ -353,6 +360,7 @@ namespace g2o {
         int _dimension;
         int _colInHessian;
         OpenMPMutex _quadraticFormMutex;
+        bool _exclusiveQuadraticForm;
 
         CacheContainer* _cacheContainer;
 
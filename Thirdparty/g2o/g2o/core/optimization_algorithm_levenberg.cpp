@@ -52,6 +52,7 @@ namespace g2o {
     _ni=2.;
     _levenbergIterations = 0;
     _nBad = 0;
+    _currentChi = 0.;
   }
 
   OptimizationAlgorithmLevenberg::~OptimizationAlgorithmLevenberg()
@@ -83,12 +84,17 @@ namespace g2o {
     double tempChi=currentChi;
 
     double iniChi = currentChi;
+    _currentChi = currentChi;
 
     _solver->buildSystem();
     if (globalStats) {
       globalStats->timeQuadraticForm = get_monotonic_time()-t;
     }
 
+    // building the system of a large problem takes long, do not start a trial if a stop was requested meanwhile
+    if (_optimizer->terminate())
+      return Terminate;
+
     // core part of the Levenbarg algorithm
     if (iteration == 0) {       
       _currentLambda = computeLambdaInit();
@@ -139,6 +145,7 @@ namespace g2o {
         _currentLambda *= scaleFactor;
         _ni = 2;
         currentChi=tempChi;
+        _currentChi=currentChi;
         _optimizer->discardTop();
       } else {
         _currentLambda*=_ni;
@@ -65,6 +65,9 @@ namespace g2o {
       //! return the number of levenberg iterations performed in the last round
       int levenbergIteration() { return _levenbergIterations;}
 
+      //! return the robust chi2 of the current estimate, valid after solve() without recomputing the errors
+      double currentChi() const { return _currentChi;}
+
     protected:
       // Levenberg parameters
       Property<int>* _maxTrialsAfterFailure;
@@ -75,6 +78,7 @@ namespace g2o {
       double _goodStepUpperScale; ///< upper bound for lambda decrease if a good LM step
       double _ni;
       int _levenbergIterations;   ///< the numer of levenberg iterations performed to accept the last step
+      double _currentChi;         ///< robust chi2 of the estimate after the last call to solve()
       //RAUL
       int _nBad;
 
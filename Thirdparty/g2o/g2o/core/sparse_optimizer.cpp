@@ -513,16 +513,24 @@ namespace g2o{
     return _activeEdges.end();
   }
 
+  // the vertices keep their own stack of estimates, hence a large batch can be pushed/popped in parallel.
+  // Levenberg-Marquardt does this once per trial step on all active vertices.
   void SparseOptimizer::push(SparseOptimizer::VertexContainer& vlist)
   {
-    for (VertexContainer::iterator it = vlist.begin(); it != vlist.end(); ++it)
-      (*it)->push();
+#   ifdef G2O_OPENMP
+#   pragma omp parallel for default (shared) schedule(static, 256) if (vlist.size() > 1000)
+#   endif
+    for (int k = 0; k < static_cast<int>(vlist.size()); ++k)
+      vlist[k]->push();
   }
 
   void SparseOptimizer::pop(SparseOptimizer::VertexContainer& vlist)
   {
-    for (VertexContainer::iterator it = vlist.begin(); it != vlist.end(); ++it)
-      (*it)->pop();
+#   ifdef G2O_OPENMP
+#   pragma omp parallel for default (shared) schedule(static, 256) if (vlist.size() > 1000)
+#   endif
+    for (int k = 0; k < static_cast<int>(vlist.size()); ++k)
+      vlist[k]->pop();
   }
 
   void SparseOptimizer::push(HyperGraph::VertexSet& vlist)
@@ -549,8 +557,11 @@ namespace g2o{
 
   void SparseOptimizer::discardTop(SparseOptimizer::VertexContainer& vlist)
   {
-    for (VertexContainer::iterator it = vlist.begin(); it != vlist.end(); ++it)
-      (*it)->discardTop();
+#   ifdef G2O_OPENMP
+#   pragma omp parallel for default (shared) schedule(static, 256) if (vlist.size() > 1000)
+#   endif
+    for (int k = 0; k < static_cast<int>(vlist.size()); ++k)
+      vlist[k]->discardTop();
   }
 
   void SparseOptimizer::setVerbose(bool verbose)
@@ -0,0 +1,294 @@
+// g2o - General Graph Optimization
+// Copyright (C) 2011 R. Kuemmerle, G. Grisetti, W. Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright notice,
+//   this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+// IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+// TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+// PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+// TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+// LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+// NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef G2O_LINEAR_SOLVER_PCG_H
+#define G2O_LINEAR_SOLVER_PCG_H
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
+#include "../core/linear_solver.h"
+#include "../core/batch_stats.h"
+#include "../stuff/timeutil.h"
+#include "../stuff/macros.h"
+
+#include "../core/eigen_types.h"
+#include "../../config.h"
+
+#include <vector>
+#include <cmath>
+
+namespace g2o {
+
+/**
+ * \brief linear solver using a block-Jacobi preconditioned conjugate gradient
+ *
+ * Operates directly on the block structure of A, i.e., no fill-in is created
+ * and the memory consumption is linear in the number of non-zero blocks plus a
+ * few vectors. Well suited for the Schur-complemented camera system of large
+ * bundle adjustment problems and for large pose graphs, where a sparse
+ * Cholesky factor may not fit into memory. The solution is approximate, it is
+ * accepted once ||b - Ax|| <= tolerance * ||b|| or after maxIterations.
+ */
+template <typename MatrixType>
+class LinearSolverPCG : public LinearSolver<MatrixType>
+{
+  public:
+    LinearSolverPCG() :
+      LinearSolver<MatrixType>(),
+      _init(true), _tolerance(1e-6), _maxIterations(-1), _iterations(0), _residual(-1.)
+    {
+    }
+
+    virtual ~LinearSolverPCG()
+    {
+    }
+
+    virtual bool init()
+    {
+      _init = true;
+      return true;
+    }
+
+    bool solve(const SparseBlockMatrix<MatrixType>& A, double* x, double* b)
+    {
+      if (_init)
+        buildStructure(A);
+      _init = false;
+
+      double t=get_monotonic_time();
+      computePreconditioner();
+
+      const int n = A.rows();
+      VectorXD::MapType xx(x, n);
+      VectorXD::ConstMapType bb(b, n);
+
+      xx.setZero();
+      _residual = 0.;
+      _iterations = 0;
+      const double bNorm2 = bb.squaredNorm();
+      if (bNorm2 == 0.)
+        return true;
+      const double threshold2 = _tolerance * _tolerance * bNorm2;
+
+      _r = bb;
+      applyPreconditioner(_r, _z);
+      _p = _z;
+      double rz = _r.dot(_z);
+
+      const int maxIterations = _maxIterations > 0 ? _maxIterations : n;
+      bool ok = true;
+      double r2 = bNorm2;
+      while (_iterations < maxIterations) {
+        multiply(_p, _q);
+        const double pq = _p.dot(_q);
+        if (! (pq > 0.)) { // A is not positive definite in the direction of p
+          ok = _iterations > 0;
+          break;
+        }
+        const double alpha = rz / pq;
+        xx += alpha * _p;
+        _r -= alpha * _q;
+        ++_iterations;
+
+        r2 = _r.squaredNorm();
+        if (r2 <= threshold2)
+          break;
+
+        applyPreconditioner(_r, _z);
+        const double rzNew = _r.dot(_z);
+        const double beta = rzNew / rz;
+        rz = rzNew;
+        _p = _z + beta * _p;
+      }
+      _residual = std::sqrt(r2 / bNorm2);
+      if (! g2o_isfinite(_residual))
+        ok = false;
+
+      G2OBatchStatistics* globalStats = G2OBatchStatistics::globalStats();
+      if (globalStats) {
+        globalStats->timeNumericDecomposition = get_monotonic_time() - t;
+        globalStats->iterationsLinearSolver = _iterations;
+      }
+      return ok;
+    }
+
+    //! relative residual ||b - Ax|| / ||b|| at which the iterations stop
+    double tolerance() const { return _tolerance;}
+    void setTolerance(double tolerance) { _tolerance = tolerance;}
+
+    //! maximum number of iterations, values <= 0 use the dimension of the system
+    int maxIterations() const { return _maxIterations;}
+    void setMaxIterations(int maxIterations) { _maxIterations = maxIterations;}
+
+    //! number of iterations and relative residual of the last solve
+    int iterations() const { return _iterations;}
+    double residual() const { return _residual;}
+
+  protected:
+    typedef Eigen::Matrix<double, MatrixType::ColsAtCompileTime, 1> VectorBlock;
+    typedef std::vector<MatrixType, Eigen::aligned_allocator<MatrixType> > MatrixVector;
+
+    //! an off-diagonal block contributing to a block row of the product
+    struct RowEntry
+    {
+      const MatrixType* block;
+      int col;          ///< block column multiplied with the block
+      bool transposed;  ///< the block is stored in the upper triangle at (col, row)
+    };
+
+    bool _init;
+    double _tolerance;
+    int _maxIterations;
+    int _iterations;
+    double _residual;
+
+    std::vector<int> _blockBase;            ///< first scalar index of each block, with the dimension appended
+    std::vector<const MatrixType*> _diagonal;
+    MatrixVector _invDiagonal;
+    std::vector<int> _rowBegin;             ///< entries of block row i are [_rowBegin[i], _rowBegin[i+1])
+    std::vector<RowEntry> _rowEntries;
+    VectorXD _r, _z, _p, _q;
+
+    /**
+     * collect the diagonal and, for every block row, the off-diagonal blocks of
+     * the full symmetric matrix. A only stores its upper triangle, hence every
+     * off-diagonal block is referenced twice, once transposed. The pointers stay
+     * valid as long as the pattern of A does not change.
+     */
+    void buildStructure(const SparseBlockMatrix<MatrixType>& A)
+    {
+      const int numBlocks = static_cast<int>(A.blockCols().size());
+      _blockBase.resize(numBlocks + 1);
+      for (int i = 0; i < numBlocks; ++i)
+        _blockBase[i] = A.colBaseOfBlock(i);
+      _blockBase[numBlocks] = A.cols();
+
+      _diagonal.assign(numBlocks, static_cast<const MatrixType*>(0));
+      _invDiagonal.resize(numBlocks);
+      std::vector<int> rowSize(numBlocks, 0);
+      for (int c = 0; c < numBlocks; ++c) {
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+          const int r = it->first;
+          if (r == c) {
+            _diagonal[c] = it->second;
+          } else if (r < c) {
+            rowSize[r]++;
+            rowSize[c]++;
+          }
+        }
+      }
+
+      _rowBegin.resize(numBlocks + 1);
+      _rowBegin[0] = 0;
+      for (int i = 0; i < numBlocks; ++i)
+        _rowBegin[i+1] = _rowBegin[i] + rowSize[i];
+      _rowEntries.resize(_rowBegin[numBlocks]);
+
+      std::vector<int> fill(_rowBegin.begin(), _rowBegin.end() - 1);
+      for (int c = 0; c < numBlocks; ++c) {
+        const typename SparseBlockMatrix<MatrixType>::IntBlockMap& column = A.blockCols()[c];
+        for (typename SparseBlockMatrix<MatrixType>::IntBlockMap::const_iterator it = column.begin(); it != column.end(); ++it) {
+          const int r = it->first;
+          if (r >= c)
+            continue;
+          RowEntry upper = {it->second, c, false};
+          _rowEntries[fill[r]++] = upper;
+          RowEntry lower = {it->second, r, true};
+          _rowEntries[fill[c]++] = lower;
+        }
+      }
+
+      _r.resize(A.rows());
+      _z.resize(A.rows());
+      _p.resize(A.rows());
+      _q.resize(A.rows());
+    }
+
+    //! the diagonal changes between the calls (e.g., the damping of Levenberg-Marquardt)
+    void computePreconditioner()
+    {
+      const int numBlocks = static_cast<int>(_diagonal.size());
+#     ifdef G2O_OPENMP
+#     pragma omp parallel for default (shared) schedule(static, 64) if (numBlocks > 256)
+#     endif
+      for (int i = 0; i < numBlocks; ++i) {
+        const int dim = _blockBase[i+1] - _blockBase[i];
+        if (_diagonal[i]) {
+          Eigen::LDLT<MatrixType> ldlt(*_diagonal[i]);
+          _invDiagonal[i] = ldlt.solve(MatrixType::Identity(dim, dim));
+        } else {
+          _invDiagonal[i] = MatrixType::Identity(dim, dim);
+        }
+      }
+    }
+
+    //! dest = M^-1 * src
+    void applyPreconditioner(const VectorXD& src, VectorXD& dest) const
+    {
+      const int numBlocks = static_cast<int>(_diagonal.size());
+#     ifdef G2O_OPENMP
+#     pragma omp parallel for default (shared) schedule(static, 64) if (numBlocks > 256)
+#     endif
+      for (int i = 0; i < numBlocks; ++i) {
+        const int base = _blockBase[i];
+        const int dim = _blockBase[i+1] - base;
+        Eigen::Map<VectorBlock>(dest.data() + base, dim) = _invDiagonal[i] * Eigen::Map<const VectorBlock>(src.data() + base, dim);
+      }
+    }
+
+    //! dest = A * src, every thread writes its own block rows
+    void multiply(const VectorXD& src, VectorXD& dest) const
+    {
+      const int numBlocks = static_cast<int>(_diagonal.size());
+#     ifdef G2O_OPENMP
+#     pragma omp parallel for default (shared) schedule(dynamic, 16) if (numBlocks > 256)
+#     endif
+      for (int i = 0; i < numBlocks; ++i) {
+        const int base = _blockBase[i];
+        const int dim = _blockBase[i+1] - base;
+        Eigen::Map<VectorBlock> destBlock(dest.data() + base, dim);
+        if (_diagonal[i])
+          destBlock = *_diagonal[i] * Eigen::Map<const VectorBlock>(src.data() + base, dim);
+        else
+          destBlock.setZero();
+        for (int k = _rowBegin[i]; k < _rowBegin[i+1]; ++k) {
+          const RowEntry& entry = _rowEntries[k];
+          const int srcBase = _blockBase[entry.col];
+          Eigen::Map<const VectorBlock> srcBlock(src.data() + srcBase, _blockBase[entry.col+1] - srcBase);
+          if (entry.transposed)
+            destBlock.noalias() += entry.block->transpose() * srcBlock;
+          else
+            destBlock.noalias() += *entry.block * srcBlock;
+        }
+      }
+    }
+};
+
+} // end namespace
+
+#endif
@@ -85,6 +85,14 @@ public:
      * @return g2o::SE3Quat 
      */
     static g2o::SE3Quat toSE3Quat(const g2o::Sim3 &gSim3);
+    /**
+     * @brief 将以旋转矩阵和平移向量(单精度Eigen类型)存储的位姿转换成为g2o::SE3Quat类型
+     * 
+     * @param[in] R 旋转矩阵
+     * @param[in] t 平移向量
+     * @return g2o::SE3Quat 
+     */
+    static g2o::SE3Quat toSE3Quat(const Eigen::Matrix3f &R, const Eigen::Vector3f &t);
     
     /** @} */
 
@@ -140,6 +148,28 @@ public:
      * @return cv::Mat 李群SE3
      */
     static cv::Mat toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matrix<double,3,1> &t);
+    /**
+     * @brief 将单精度的3x3 Eigen矩阵转换成为cv::Mat格式
+     * 
+     * @param[in] m 3x3的Eigen矩阵
+     * @return cv::Mat 转换结果
+     */
+    static cv::Mat toCvMat(const Eigen::Matrix3f &m);
+    /**
+     * @brief 将单精度的3x1 Eigen向量转换成为cv::Mat格式
+     * 
+     * @param[in] m 3x1的Eigen向量
+     * @return cv::Mat 转换结果
+     */
+    static cv::Mat toCvMat(const Eigen::Vector3f &m);
+    /**
+     * @brief 将单精度的旋转矩阵和平移向量转换为以cv::Mat存储的李群SE3
+     * 
+     * @param[in] R 旋转矩阵
+     * @param[in] t 平移向量
+     * @return cv::Mat 李群SE3
+     */
+    static cv::Mat toCvSE3(const Eigen::Matrix3f &R, const Eigen::Vector3f &t);
     /** @} */
 
 
@@ -171,6 +201,20 @@ public:
      * @return Eigen::Matrix<double,3,3> 转换结果
      */
     static Eigen::Matrix<double,3,3> toMatrix3d(const cv::Mat &cvMat3);
+    /**
+     * @brief 将cv::Mat类型数据转换成为单精度的3x1 Eigen向量
+     * 
+     * @param[in] cvVector 待转换的数据
+     * @return Eigen::Vector3f 转换结果
+     */
+    static Eigen::Vector3f toVector3f(const cv::Mat &cvVector);
+    /**
+     * @brief 将一个3x3的cv::Mat矩阵转换成为单精度的Eigen矩阵
+     * 
+     * @param[in] cvMat3 输入
+     * @return Eigen::Matrix3f 转换结果
+     */
+    static Eigen::Matrix3f toMatrix3f(const cv::Mat &cvMat3);
     /**
      * @brief 将给定的cv::Mat类型的旋转矩阵转换成以std::vector<float>类型表示的四元数
      * 
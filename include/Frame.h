@@ -37,8 +37,10 @@
 #include "ORBVocabulary.h"
 #include "KeyFrame.h"
 #include "ORBextractor.h"
+#include "Converter.h"
 
 #include <opencv2/opencv.hpp>
+#include <Eigen/Core>
 
 namespace ORB_SLAM2
 {
@@ -159,7 +161,8 @@ public:
     // 存放在mBowVec中
     /**
      * @brief 计算词袋模型 
-     * @details 计算词包 mBowVec 和 mFeatVec ，其中 mFeatVec 记录了属于第i个node（在第4层）的ni个描述子
+     * @details 计算词包 mBowVec 和 mFeatVec ，其中 mFeatVec 记录了属于第i个node（在第4层）的ni个描述子.
+     * 每一帧最多计算一次,成为关键帧时结果随之复制过去,关键帧不需要再次计算
      * @see CreateInitialMapMonocular() TrackReferenceKeyFrame() Relocalization()
      */
     void ComputeBoW();
@@ -188,7 +191,17 @@ public:
      */
     inline cv::Mat GetCameraCenter()
 	{
-        return mOw.clone();
+        return Converter::toCvMat(mOw);
+    }
+
+    /**
+     * @brief 返回位于当前帧位姿时,相机的中心, 不会有堆内存分配
+     * 
+     * @return const Eigen::Vector3f& 相机中心在世界坐标系下的3D点坐标
+     */
+    inline const Eigen::Vector3f& GetCameraCenterEigen() const
+    {
+        return mOw;
     }
 
     // Returns inverse of rotation
@@ -202,7 +215,7 @@ public:
     inline cv::Mat GetRotationInverse()
 	{
 		//所以直接返回其实就是我们常谈的旋转的逆了
-        return mRwc.clone();
+        return Converter::toCvMat(mRwc);
     }
 
     // Check if a MapPoint is in the frustum of the camera
@@ -286,6 +299,16 @@ public:
      */
     cv::Mat UnprojectStereo(const int &i);
 
+    /**
+     * @brief 批量地将一组特征点反投影到三维世界坐标系中
+     * @details 调用者需要保证这些特征点的深度有效. 输出缓存由调用者提供并可以跨帧复用,
+     * 只有在容量不够时才会重新分配内存, 每个点不再单独生成cv::Mat
+     * 
+     * @param[in]  vIndices 特征点的ID
+     * @param[out] vx3Dw    和vIndices一一对应的世界坐标
+     */
+    void UnprojectStereo(const std::vector<int> &vIndices, std::vector<Eigen::Vector3f> &vx3Dw) const;
+
 public:
 
     // Vocabulary used for relocalization.
@@ -387,6 +410,8 @@ public:
     ///和词袋模型中特征有关的向量
     DBoW2::FeatureVector mFeatVec;
     ///@todo 这两个向量目前的具体含义还不是很清楚
+    ///是否已经计算过词袋. 不能用 mBowVec 是否为空来判断,没有特征点的帧词袋也是空的
+    bool mbBowComputed;
 
     // ORB descriptor, each row associated to a keypoint.
     /// 左目摄像头和右目摄像头特征点对应的描述子
@@ -501,10 +526,11 @@ private:
      * @{
      */
     // Rotation, translation and camera center
-    cv::Mat mRcw; ///< Rotation from world to camera
-    cv::Mat mtcw; ///< Translation from world to camera
-    cv::Mat mRwc; ///< Rotation from camera to world
-    cv::Mat mOw;  ///< mtwc,Translation from camera to world
+    // mTcw 作为对外接口仍然是cv::Mat, 由它导出的这些量以定长的Eigen类型保存
+    Eigen::Matrix3f mRcw; ///< Rotation from world to camera
+    Eigen::Vector3f mtcw; ///< Translation from world to camera
+    Eigen::Matrix3f mRwc; ///< Rotation from camera to world
+    Eigen::Vector3f mOw;  ///< mtwc,Translation from camera to world
 
     /** @} */
 };
@@ -41,6 +41,7 @@
 #include "Frame.h"
 #include "KeyFrameDatabase.h"
 
+#include <Eigen/Core>
 #include <mutex>
 
 namespace ORB_SLAM2
@@ -76,6 +77,12 @@ public:
      * @param[in] Tcw 位姿
      */
     void SetPose(const cv::Mat &Tcw);
+    /**
+     * @brief 设置当前关键帧的位姿, 不经过cv::Mat中转
+     * @param[in] Rcw 旋转
+     * @param[in] tcw 平移
+     */
+    void SetPose(const Eigen::Matrix3f &Rcw, const Eigen::Vector3f &tcw);
     cv::Mat GetPose();                  ///< 获取位姿
     cv::Mat GetPoseInverse();           ///< 获取位姿的逆
     cv::Mat GetCameraCenter();          ///< 获取(左目)相机的中心
@@ -83,9 +90,18 @@ public:
     cv::Mat GetRotation();              ///< 获取姿态
     cv::Mat GetTranslation();           ///< 获取位置
 
+    /**
+     * @brief 在一次加锁中获取位姿的旋转和平移部分, 不会有堆内存分配
+     * @param[out] Rcw 旋转
+     * @param[out] tcw 平移
+     */
+    void GetPose(Eigen::Matrix3f &Rcw, Eigen::Vector3f &tcw);
+    Eigen::Vector3f GetCameraCenterEigen();     ///< 获取(左目)相机的中心, 不会有堆内存分配
+
     /**
      * @brief Bag of Words Representation
-     * @detials 计算mBowVec，并且将描述子分散在第4层上，即mFeatVec记录了属于第i个node的ni个描述子
+     * @detials 计算mBowVec，并且将描述子分散在第4层上，即mFeatVec记录了属于第i个node的ni个描述子.
+     * 如果生成这个关键帧的普通帧已经计算过词袋(参考关键帧跟踪或者重定位时),构造时已经复制过来,这里什么都不做
      * @see ProcessNewKeyFrame()
      */
     void ComputeBoW();
@@ -233,6 +249,30 @@ public:
      */
     MapPoint* GetMapPoint(const size_t &idx);
 
+    // ====================== Redundancy counters for keyframe culling ==================================
+    /**
+     * @brief 设置第idx个特征点对应的观测是否冗余
+     * @details 冗余是指该地图点至少被其它3个关键帧在相同或更精细的尺度上观测到. \n
+     * 由MapPoint在增删观测的时候增量地维护,这样LocalMapping::KeyFrameCulling只需要比较计数,不用再遍历每个点的所有观测
+     * @param[in] idx        特征点索引
+     * @param[in] bRedundant 是否冗余
+     */
+    void SetRedundantObservation(const size_t &idx, const bool bRedundant);
+    /**
+     * @brief 获取关键帧剔除时使用的计数
+     * @param[in]  bOnlyClose 是否只统计近点(双目和RGBD只考虑近点)
+     * @param[out] nMPs       关联的地图点数目
+     * @param[out] nRedundant 其中被冗余观测的数目
+     */
+    void GetRedundancyCounts(const bool bOnlyClose, int &nMPs, int &nRedundant);
+    /**
+     * @brief 遍历所有的地图点和它们的观测重新计算上面的计数,用于校验增量维护的结果
+     * @param[in]  bOnlyClose 是否只统计近点
+     * @param[out] nMPs       关联的没有被删除的地图点数目
+     * @param[out] nRedundant 其中被冗余观测的数目
+     */
+    void ComputeRedundancyCounts(const bool bOnlyClose, int &nMPs, int &nRedundant);
+
     // KeyPoint functions
     /**
      * @brief 获取某个特征点的邻域中的特征点id
@@ -248,6 +288,12 @@ public:
      * @return   3D点（相对于世界坐标系）
      */
     cv::Mat UnprojectStereo(int i);
+    /**
+     * @brief 批量反投影一组深度有效的特征点, 整个过程只对位姿加一次锁
+     * @param[in]  vIndices 特征点的ID
+     * @param[out] vx3Dw    和vIndices一一对应的世界坐标,由调用者提供
+     */
+    void UnprojectStereo(const std::vector<int> &vIndices, std::vector<Eigen::Vector3f> &vx3Dw);
 
     // Image
     /**
@@ -323,20 +369,6 @@ public:
     long unsigned int mnBAFixedForKF;           ///< 在局部建图线程调用局部优化的时候使用,表示当前关键帧能够观测到某个地图点电视却不属于局部关键帧,so这个关键帧
                                                 ///< 只是提供约束信息但是却不会去优化这个关键帧;为了避免重复添加,这里要记录触发优化的关键帧的id
 
-    // Variables used by the keyframe database 下面的这些变量都是临时的,由外部调用暂时存放一些数据
-    /// 标记了当前关键帧是id为mnLoopQuery的回环检测的候选关键帧
-    long unsigned int mnLoopQuery;
-    /// 当前关键帧和这个形成回环的候选关键帧中,具有相同word的个数
-    int mnLoopWords;
-    /// 和那个形成回环的关键帧的词袋匹配程度的评分
-    float mLoopScore;
-    /// 和上面的变量作用差不多，不过这个变量是用来存储在辅助进行重定位的时候，要进行重定位的那个帧的id
-    long unsigned int mnRelocQuery;
-    /// 和那个要进行重定位的帧,所具有相同的单词的个数
-    int mnRelocWords;
-    /// 还有和那个帧的词袋的相似程度的评分
-    float mRelocScore;
-
     // Variables used by loop closing
     // 经过全局BA优化后的相机的位姿
     cv::Mat mTcwGBA;
@@ -362,6 +394,7 @@ public:
     //BoW
     DBoW2::BowVector mBowVec; ///< Vector of words to represent images 当前图像的词袋模型表示
     DBoW2::FeatureVector mFeatVec; ///< Vector of nodes with indexes of local features //?
+    bool mbBowComputed; ///< 是否已经计算过词袋,从普通帧继承
 
     /// Pose relative to parent (this is computed when bad flag is activated)
     cv::Mat mTcp;
@@ -386,15 +419,34 @@ public:
 protected:
 
     // SE3 Pose and camera center
-    cv::Mat Tcw;    ///< 当前相机的位姿
-    cv::Mat Twc;    ///< 当前相机位姿的逆
-    cv::Mat Ow;     ///< 相机光心(左目)在世界坐标系下的坐标,这里和普通帧中的定义是一样的
+    // 以定长的Eigen类型存储在对象内部, cv::Mat形式的位姿只在Get/Set接口处生成
+    Eigen::Matrix3f mRcw;   ///< 当前相机位姿的旋转部分
+    Eigen::Vector3f mtcw;   ///< 当前相机位姿的平移部分
+    Eigen::Matrix3f mRwc;   ///< 当前相机位姿的逆的旋转部分
+    Eigen::Vector3f mOw;    ///< 相机光心(左目)在世界坐标系下的坐标,这里和普通帧中的定义是一样的
 
-    cv::Mat Cw; ///< Stereo middel point. Only for visualization
+    Eigen::Vector3f mCw; ///< Stereo middel point. Only for visualization
 
     /// MapPoints associated to keypoints
     std::vector<MapPoint*> mvpMapPoints;
 
+    // Redundancy counters for keyframe culling, protected by mMutexRedundancy
+    std::vector<bool> mvbRedundantObservations;     ///< 每个特征点对应的观测是否冗余
+    int mnMapPoints;                                ///< 关联的地图点数目
+    int mnCloseMapPoints;                           ///< 其中近点的数目
+    int mnRedundantObservations;                    ///< 冗余观测的数目
+    int mnCloseRedundantObservations;               ///< 其中近点的冗余观测数目
+
+    /**
+     * @brief 第idx个特征点关联的地图点由pOld变为pNew时更新地图点计数
+     */
+    void UpdateMapPointCounts(const size_t &idx, MapPoint* pOld, MapPoint* pNew);
+    /** @brief 第idx个特征点是否是近点 */
+    bool IsCloseKeyPoint(const size_t &idx) const
+    {
+        return mvDepth[idx]>=0 && mvDepth[idx]<=mThDepth;
+    }
+
     // BoW
     KeyFrameDatabase* mpKeyFrameDB;
     /// 词袋对象,目测是封装了很多操作啊
@@ -430,6 +482,8 @@ protected:
     std::mutex mMutexConnections;
     /// 在操作和特征点有关的变量的时候的互斥锁
     std::mutex mMutexFeatures;
+    /// 操作冗余计数时的互斥锁,持有它的时候不会再去获取其他的锁
+    std::mutex mMutexRedundancy;
 };
 
 } //namespace ORB_SLAM
@@ -35,10 +35,13 @@
 #include <vector>
 #include <list>
 #include <set>
+#include <unordered_map>
 
 #include "KeyFrame.h"
 #include "Frame.h"
 #include "ORBVocabulary.h"
+#include "Thirdparty/DBoW2/DBoW2/BowVector.h"
+#include "SharedMutex.h"
 
 #include<mutex>
 
@@ -49,7 +52,14 @@ namespace ORB_SLAM2
 class KeyFrame;
 class Frame;
 
-/** @brief 关键帧数据库 */
+/**
+ * @brief 关键帧数据库
+ * @details 倒排索引中每个单词对应一个连续的数组,每一项是关键帧在数据库中的序号和该单词在关键帧词袋向量中的权重.
+ * 删除关键帧时只把它的序号标记为失效,失效的项在查询时被跳过,累计到一定数量后再统一压缩.
+ * 查询过程中的共有单词数和相似度评分保存在查询自己的数组中,不再写入关键帧对象.
+ * 查询只读取倒排索引,持有读锁,因此追踪线程的重定位和闭环线程的闭环检测可以同时进行;
+ * add, erase 和 clear 修改倒排索引,持有写锁.
+ */
 class KeyFrameDatabase
 {
 public:
@@ -99,14 +109,61 @@ public:
 
 protected:
 
+  /** @brief 倒排索引中的一项 */
+  struct Posting
+  {
+      unsigned int nSlot;   ///< 关键帧在数据库中的序号,即mvpKeyFrames中的下标
+      float fWeight;        ///< 该单词在关键帧词袋向量中的权重
+  };
+
+  /** @brief 一次查询中与查询的词袋向量有共同单词的关键帧 */
+  struct QueryCandidate
+  {
+      KeyFrame* pKF;        ///< 关键帧
+      int nWords;           ///< 与查询共有的单词数
+      float fScore;         ///< 与查询的相似度评分,小于0表示还没有计算
+  };
+
+  /**
+   * @brief 遍历词袋向量中每个单词的倒排索引,统计与它有共同单词的关键帧,调用者需要持有mMutex的读锁
+   * @details 词典使用L1评分时,相似度 sum_i min(v_i,w_i) 在遍历的同时累加得到,不需要再逐个关键帧调用mpVoc->score
+   * @param[in] vBowVec       查询的词袋向量
+   * @param[out] vCandidates  按照第一次出现的顺序排列的关键帧
+   */
+  void SearchSharedWords(const DBoW2::BowVector &vBowVec, std::vector<QueryCandidate> &vCandidates);
+
+  /**
+   * @brief 得到候选关键帧的相似度评分,还没有计算时用词典计算
+   * @param[in] vBowVec       查询的词袋向量
+   * @param[in&out] candidate 候选关键帧
+   * @return float            相似度评分
+   */
+  float GetScore(const DBoW2::BowVector &vBowVec, QueryCandidate &candidate);
+
+  /** @brief 删除倒排索引中已经失效的项,并重新为关键帧编号,调用者需要持有mMutex的写锁 */
+  void Compact();
+
   // Associated vocabulary
   const ORBVocabulary* mpVoc; ///< 预先训练好的词典
+  /// 词典是否使用L1评分,是的话相似度可以在倒排索引上直接累加
+  bool mbL1Scoring;
 
   // Inverted file
-  std::vector<list<KeyFrame*> > mvInvertedFile; ///< 倒排索引，mvInvertedFile[i]表示包含了第i个word id的所有关键帧
-
-  /// Mutex, 多用途的
-  std::mutex mMutex;
+  std::vector<std::vector<Posting> > mvInvertedFile; ///< 倒排索引，mvInvertedFile[i]表示包含了第i个word id的所有关键帧
+
+  /// 序号对应的关键帧,已经删除的关键帧为NULL
+  std::vector<KeyFrame*> mvpKeyFrames;
+  /// 序号对应的关键帧在倒排索引中的项数
+  std::vector<unsigned int> mvnSlotPostings;
+  /// 关键帧到序号的映射
+  std::unordered_map<KeyFrame*,unsigned int> mmKeyFrameSlots;
+  /// 倒排索引中的总项数,包括失效的项
+  size_t mnPostings;
+  /// 倒排索引中失效的项数
+  size_t mnDeadPostings;
+
+  /// 保护倒排索引的读写锁,查询持有读锁,修改持有写锁
+  SharedMutex mMutex;
 };
 
 } //namespace ORB_SLAM
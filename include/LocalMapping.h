@@ -41,6 +41,7 @@
 #include "KeyFrameDatabase.h"
 
 #include <mutex>
+#include <condition_variable>
 
 
 namespace ORB_SLAM2
@@ -49,6 +50,31 @@ namespace ORB_SLAM2
 class Tracking;
 class LoopClosing;
 class Map;
+class LocalBAProblem;
+
+/**
+ * @brief 局部BA的时间预算
+ * @details fTargetMs大于0时,根据之前的局部BA学到的单位观测耗时,估计本次窗口中最多可以包含的地图点观测数目,
+ * 按照共视权重从高到低加入局部关键帧,直到达到这个数目.每次优化后更新耗时统计,并记录本次实际的窗口和耗时
+ */
+struct LocalBABudget
+{
+    LocalBABudget(): fTargetMs(0), fMsPerObservation(0), fLastMs(0), nLastKFs(0), nLastCandidateKFs(0),
+        nLastPoints(0), nLastEdges(0), bLastTruncated(false), bLastAborted(false), nAborted(0) {}
+
+    float fTargetMs;            ///< 目标耗时(ms),小于等于0时不限制局部BA的窗口
+    float fMsPerObservation;    ///< 学到的每个地图点观测的耗时(ms),为0表示还没有统计数据
+
+    // Report of the most recent local BA
+    float fLastMs;              ///< 最近一次局部BA的实际耗时(ms)
+    int nLastKFs;               ///< 优化的局部关键帧数目
+    int nLastCandidateKFs;      ///< 不限制窗口时的局部关键帧数目
+    int nLastPoints;            ///< 优化的地图点数目
+    int nLastEdges;             ///< 误差边数目
+    bool bLastTruncated;        ///< 窗口是否因为预算被截断
+    bool bLastAborted;          ///< 是否被外部请求中断(新关键帧到来或者闭环),此时不更新单位观测耗时
+    int nAborted;               ///< 累计被中断的局部BA次数
+};
 
 /** @brief 局部建图线程类 */
 class LocalMapping
@@ -58,9 +84,9 @@ public:
     /**
      * @brief 构造函数
      * @param[in] pMap          局部地图的句柄？ //?
-     * @param[in] bMonocular    当前系统是否是单目输入
+     * @param[in] sensor        传感器类型,取值同System::eSensor
      */
-    LocalMapping(Map* pMap, const float bMonocular);
+    LocalMapping(Map* pMap, const int sensor);
 
     /**
      * @brief 设置回环检测线程句柄
@@ -101,6 +127,8 @@ public:
     void Release();
     /** @brief 检查mbStopped是否被置位了 */
     bool isStopped();
+    /** @brief 外部线程调用,阻塞直到当前线程真正地停止(或者已经终止) */
+    void WaitUntilStopped();
     /** @brief 是否有终止当前线程的请求 */
     bool stopRequested();
     /** @brief 查看当前是否允许接受关键帧 */
@@ -120,6 +148,16 @@ public:
     void RequestFinish();
     /** @brief 当前线程的run函数是否已经终止 */
     bool isFinished();
+    /** @brief 外部线程调用,阻塞直到当前线程的run函数终止 */
+    void WaitUntilFinished();
+    /**
+     * @brief 设置局部BA的时间预算
+     * @param[in] fTargetMs 目标耗时(ms),小于等于0时不限制局部BA的窗口
+     */
+    void SetLocalBABudget(const float fTargetMs);
+    /** @brief 获取局部BA的时间预算,以及最近一次局部BA实际的窗口大小和耗时 */
+    LocalBABudget GetLocalBABudget();
+
     //查看队列中等待插入的关键帧数目
     int KeyframesInQueue(){
         unique_lock<std::mutex> lock(mMutexNewKFs);
@@ -150,15 +188,19 @@ protected:
      * @see VI-B recent map points culling
      */
     void MapPointCulling();
-    /** @brief 检查并融合当前关键帧与相邻帧（两级相邻）重复的MapPoints */
-    void SearchInNeighbors();
+    /**
+     * @brief 检查并融合当前关键帧与相邻帧（两级相邻）重复的MapPoints
+     * @param[in] vpKFs 需要融合的一批关键帧,最后一个为最新的;积压时各关键帧的邻接关键帧取并集,只融合一次
+     */
+    void SearchInNeighbors(const std::vector<KeyFrame*> &vpKFs);
 
     /**
      * @brief 关键帧剔除
      * @detials 在Covisibility Graph中的关键帧，其90%以上的MapPoints能被其他关键帧（至少3个）观测到，则认为该关键帧为冗余关键帧。
+     * @param[in] vpBatchKFs 这一批新处理的关键帧,检查它们的共视关键帧,它们本身不会被剔除
      * @see VI-E Local Keyframe Culling
      */
-    void KeyFrameCulling();
+    void KeyFrameCulling(const std::vector<KeyFrame*> &vpBatchKFs);
 
     /**
      * 根据两关键帧的姿态计算两个关键帧之间的基本矩阵
@@ -174,8 +216,28 @@ protected:
      */
     cv::Mat SkewSymmetricMatrix(const cv::Mat &v);
 
+    /**
+     * @brief 通知run函数有新的事件(新的关键帧,停止,释放,复位,终止)需要处理
+     * @details 外部线程先修改自己的标志,再调用这个函数, 这样run函数就不会漏掉任何一次唤醒
+     */
+    void NotifyEvent();
+    /**
+     * @brief 由run函数调用,空闲时在条件变量上等待,直到有事件发生
+     * @param[in] bNewKeyFrames 缓冲队列中有关键帧时是否也视为有事件
+     */
+    void WaitForEvent(const bool bNewKeyFrames);
+
     /// 当前系统输入数单目还是双目RGB-D的标志
     bool mbMonocular;
+    /// 传感器类型,用于选择局部BA编译期特化的版本
+    int mSensor;
+
+    /// 局部BA的时间预算和统计
+    LocalBABudget mLocalBABudget;
+    std::mutex mMutexLocalBABudget;
+
+    /// 在相邻的局部BA之间复用的g2o优化问题,只在本线程中使用
+    LocalBAProblem* mpLocalBAProblem;
 
     /** @brief 检查当前是否有复位线程的请求 */
     void ResetIfRequested();
@@ -194,6 +256,10 @@ protected:
     bool mbFinished;
     // 和"线程真正结束"有关的互斥锁
     std::mutex mMutexFinish;
+    /// mbFinished被置位时通知等待的外部线程
+    std::condition_variable mcvFinished;
+    /// 复位完成时通知RequestReset的调用者
+    std::condition_variable mcvReset;
 
     // 指向局部地图的句柄
     Map* mpMap;
@@ -208,11 +274,15 @@ protected:
     /// 当前正在处理的关键帧
     KeyFrame* mpCurrentKeyFrame;
 
-    /// 存储当前关键帧生成的地图点,也是等待检查的地图点列表
-    std::list<MapPoint*> mlpRecentAddedMapPoints;
+    /// 存储当前关键帧生成的地图点,也是等待检查的地图点列表;连续存储,便于MapPointCulling分块并行检查
+    std::vector<MapPoint*> mvpRecentAddedMapPoints;
 
     /// 操作关键帧列表时使用的互斥量 
     std::mutex mMutexNewKFs;
+    /// 唤醒run函数的条件变量,和mMutexNewKFs配合使用
+    std::condition_variable mcvEvent;
+    /// 是否有尚未被run函数看到的事件
+    bool mbEventPending;
 
     /// 终止BA的标志
     bool mbAbortBA;
@@ -225,6 +295,8 @@ protected:
     bool mbNotStop;
     /// 和终止线程相关的互斥锁
     std::mutex mMutexStop;
+    /// mbStopped被置位时通知等待的外部线程
+    std::condition_variable mcvStopped;
 
     /// 当前局部建图线程是否允许关键帧输入
     bool mbAcceptKeyFrames;
@@ -42,6 +42,7 @@
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 //? 目前并不知道是用来做什么的
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
@@ -94,6 +95,13 @@ public:
     /** @brief 由外部线程调用,请求复位当前线程.在回环检测复位完成之前,该函数将一直保持堵塞状态 */
     void RequestReset();
 
+    /**
+     * @brief 选择本质图优化和全局BA使用的线性求解器,需要在线程启动之前调用
+     * @param[in] nEssentialGraph   本质图优化的线性求解器,取值为Optimizer::eLinearSolver
+     * @param[in] nGBA              全局BA的线性求解器
+     */
+    void SetLinearSolvers(const int nEssentialGraph, const int nGBA);
+
     // This function will run in a separate thread
     /**
      * @brief 全局BA线程,这个函数是这个线程的主函数
@@ -117,6 +125,9 @@ public:
     /** @brief 由外部线程调用,判断当前回环检测线程是否已经正确终止了  */
     bool isFinished();
 
+    /** @brief 由外部线程调用,阻塞直到回环检测线程终止并且没有正在运行的全局BA */
+    void WaitUntilFinished();
+
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 
 protected:
@@ -137,12 +148,14 @@ protected:
      * 3. 将闭环帧以及闭环帧相连的关键帧的MapPoints与当前帧的点进行匹配（当前帧---闭环帧+相连关键帧）      \n
      * \n
      * 注意以上匹配的结果均都存在成员变量mvpCurrentMatchedPoints中，实际的更新步骤见CorrectLoop()步骤3：Start Loop Fusion \n
-     * 对于双目或者是RGBD输入的情况,计算得到的尺度=1
+     * 对于双目或者是RGBD输入的情况,计算得到的尺度=1 \n
+     * 步骤1和2中各个候选帧在多个线程中同时验证,一旦有一个候选帧被接受,其余的候选帧就停止RANSAC迭代
      */
     bool ComputeSim3();
 
     /**
      * @brief 通过将闭环时相连关键帧的MapPoints投影到这些关键帧中，进行MapPoints检查与替换
+     * @details 各个关键帧中的投影匹配并行进行,需要替换的地图点在所有关键帧匹配完成后统一替换
      * @param[in] CorrectedPosesMap 关联的当前帧组中的关键帧和相应的纠正后的位姿
      */
     void SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap);
@@ -163,6 +176,17 @@ protected:
     bool mbResetRequested;
     /// 和复位当前线程相关的互斥量
     std::mutex mMutexReset;
+    /// 复位完成时通知RequestReset的调用者
+    std::condition_variable mcvReset;
+
+    /** @brief 通知线程主函数有新的事件(新的关键帧,复位,终止)需要处理 */
+    void NotifyEvent();
+    /** @brief 线程主函数空闲时在条件变量上等待,直到队列中有关键帧或者有其他事件发生 */
+    void WaitForEvent();
+    /// 唤醒线程主函数的条件变量,和mMutexLoopQueue配合使用
+    std::condition_variable mcvEvent;
+    /// 是否有尚未被线程主函数看到的事件
+    bool mbEventPending;
 
     /** @brief 当前线程调用,查看是否有外部线程请求当前线程  */
     bool CheckFinish();
@@ -174,6 +198,8 @@ protected:
     bool mbFinished;
     /// 和当前线程终止状态操作有关的互斥量
     std::mutex mMutexFinish;
+    /// mbFinished被置位时通知等待的外部线程
+    std::condition_variable mcvFinished;
 
     /// (全局)地图的指针
     Map* mpMap;
@@ -216,6 +242,8 @@ protected:
     cv::Mat mScw;
     // 当得到了当前关键帧的闭环关键帧以后,计算出来的从世界坐标系到当前帧的sim3变换
     g2o::Sim3 mg2oScw;
+    /// 闭环关键帧到当前关键帧的sim3变换,闭环关键帧的位姿在纠正之前被全局BA改变时用来重新计算 mg2oScw
+    g2o::Sim3 mg2oScm;
 
     /// 上一次闭环帧的id
     long unsigned int mLastLoopKFid;
@@ -229,15 +257,18 @@ protected:
     bool mbStopGBA;
     /// 在对和全局线程标志量有关的操作的时候使用的互斥量
     std::mutex mMutexGBA;
-    /// 全局BA线程句柄
+    /// 全局BA线程结束时通知等待的外部线程
+    std::condition_variable mcvGBA;
+    /// 全局BA线程句柄,新的闭环会中断并等待这个线程结束
     std::thread* mpThreadGBA;
 
     // Fix scale in the stereo/RGB-D case
     /// 如果是在双目或者是RGBD输入的情况下,就要固定尺度,这个变量就是是否要固定尺度的标志
     bool mbFixScale;
 
-    /// 已经进行了的全局BA次数(包含中途被打断的)
-    bool mnFullBAIdx;
+    /// 本质图优化和全局BA使用的线性求解器,取值为Optimizer::eLinearSolver
+    int mnEssentialGraphLinearSolver;
+    int mnGBALinearSolver;
 };
 
 } //namespace ORB_SLAM
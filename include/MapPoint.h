@@ -37,6 +37,7 @@
 #include"Map.h"
 
 #include<opencv2/core/core.hpp>
+#include<Eigen/Core>
 #include<mutex>
 
 
@@ -63,6 +64,8 @@ public:
      * @param[in] pMap      Map  //? 是输出吗
      */
     MapPoint(const cv::Mat &Pos, KeyFrame* pRefKF, Map* pMap);
+    /** @brief 同上, 坐标直接以Eigen::Vector3f给出 */
+    MapPoint(const Eigen::Vector3f &Pos, KeyFrame* pRefKF, Map* pMap);
     /**
      * @brief 给定坐标与frame构造MapPoint
      * @detials 被双目：UpdateLastFrame()调用
@@ -72,6 +75,8 @@ public:
      * @param[in] idxF      MapPoint在Frame中的索引，即对应的特征点的编号
      */
     MapPoint(const cv::Mat &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
+    /** @brief 同上, 坐标直接以Eigen::Vector3f给出 */
+    MapPoint(const Eigen::Vector3f &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
 
     /**
      * @brief 设置世界坐标系下地图点的位姿 
@@ -79,17 +84,33 @@ public:
      * @param[in] Pos 世界坐标系下地图点的位姿 
      */
     void SetWorldPos(const cv::Mat &Pos);
+    /**
+     * @brief 设置世界坐标系下地图点的位姿, 不经过cv::Mat中转
+     * 
+     * @param[in] Pos 世界坐标系下地图点的位姿 
+     */
+    void SetWorldPos(const Eigen::Vector3f &Pos);
     /**
      * @brief 获取当前地图点在世界坐标系下的位置
      * @return cv::Mat 位置
      */
     cv::Mat GetWorldPos();
+    /**
+     * @brief 获取当前地图点在世界坐标系下的位置, 按值返回,不会有堆内存分配
+     * @return Eigen::Vector3f 位置
+     */
+    Eigen::Vector3f GetWorldPosEigen();
 
     /**
      * @brief 获取当前地图点的平均观测方向
      * @return cv::Mat 一个向量
      */
     cv::Mat GetNormal();
+    /**
+     * @brief 获取当前地图点的平均观测方向, 按值返回,不会有堆内存分配
+     * @return Eigen::Vector3f 一个向量
+     */
+    Eigen::Vector3f GetNormalEigen();
     /**
      * @brief 获取生成当前地图点的参考关键帧
      * //? 那么对于由"当前帧"生成的地图点怎么办? 
@@ -198,7 +219,8 @@ public:
     /**
      * @brief 计算具有代表的描述子
      * @detials 由于一个MapPoint会被许多相机观测到，因此在插入关键帧后，需要判断是否更新当前点的最适合的描述子 \n
-     * 先获得当前点的所有描述子，然后计算描述子之间的两两距离，最好的描述子与其他描述子应该具有最小的距离中值
+     * 先获得当前点的所有描述子，然后计算描述子之间的两两距离，最好的描述子与其他描述子应该具有最小的距离中值 \n
+     * 两两之间的距离在增删观测时增量地维护(见mvvDescDistances),这里只需要对每一行求中值
      * @see III - C3.3
      */
     void ComputeDistinctiveDescriptors();
@@ -278,7 +300,8 @@ public:
 protected:
 
     // Position in absolute coordinates
-    cv::Mat mWorldPos; ///< MapPoint在世界坐标系下的坐标
+    // 位置和平均观测方向都是定长的栈上类型,只在接口处才转换成cv::Mat
+    Eigen::Vector3f mWorldPos; ///< MapPoint在世界坐标系下的坐标
 
     // Keyframes observing the point and associated index in keyframe
     std::map<KeyFrame*,size_t> mObservations; ///< 观测到该MapPoint的KF和该MapPoint在KF中的索引
@@ -286,7 +309,7 @@ protected:
     // Mean viewing direction
     // 该MapPoint平均观测方向
     //? 为什么要做这个呢? 
-    cv::Mat mNormalVector;
+    Eigen::Vector3f mNormalVector;
 
     // Best descriptor to fast matching
     // 每个3D点也有一个descriptor
@@ -294,6 +317,12 @@ protected:
     // MapPoint只与一帧的图像特征点对应（由frame来构造时），那么这个特征点的描述子就是该3D点的描述子 --  其实就是初始描述子呗
     cv::Mat mDescriptor; ///< 通过 ComputeDistinctiveDescriptors() 得到的最优描述子
 
+    // Descriptor distance cache, kept in sync with mObservations (protected by mMutexFeatures)
+    // 和mObservations同步维护的描述子缓存,增删一个观测只需要计算O(n)次描述子距离
+    std::vector<KeyFrame*> mvpDescKFs;                  ///< 缓存中每一项对应的观测关键帧
+    std::vector<cv::Mat> mvDescriptors;                 ///< 该关键帧中观测到本点的特征点的描述子
+    std::vector<std::vector<int> > mvvDescDistances;    ///< 缓存中描述子两两之间的距离
+
     /// Reference KeyFrame
     //? 什么意思? 就是生成它的关键帧吗?
     KeyFrame* mpRefKF;
@@ -315,6 +344,26 @@ protected:
     ///所属的地图
     Map* mpMap;
 
+    /**
+     * @brief 向描述子缓存中添加一个观测,并计算它和已有描述子之间的距离.调用时需要已经锁住mMutexFeatures
+     * @param[in] pKF 观测到本点的关键帧
+     * @param[in] idx 本点在关键帧中对应的特征点索引
+     */
+    void AddDescriptorToCache(KeyFrame* pKF, size_t idx);
+    /**
+     * @brief 从描述子缓存中删除一个观测.调用时需要已经锁住mMutexFeatures
+     * @param[in] pKF 被删除的观测关键帧
+     */
+    void EraseDescriptorFromCache(KeyFrame* pKF);
+    /** @brief 清空描述子缓存.调用时需要已经锁住mMutexFeatures */
+    void ClearDescriptorCache();
+
+    /**
+     * @brief 观测变化之后,重新判断每个观测是否冗余,并把变化通知给对应的关键帧.调用时需要已经锁住mMutexFeatures
+     * @see KeyFrame::SetRedundantObservation
+     */
+    void UpdateRedundantObservations();
+
     ///对当前地图点位姿进行操作的时候的互斥量
     std::mutex mMutexPos;
     ///对当前地图点的特征信息进行操作的时候的互斥量
@@ -109,7 +109,28 @@ public:
      */
     void operator()(cv::InputArray image, cv::InputArray mask, std::vector<cv::KeyPoint>& keypoints,cv::OutputArray descriptors);
 
+    /**
+     * @brief 修改要提取的特征点总数，并重新分配每层图像中的特征点数目
+     * @details 用于Tracking在超出单帧时间预算时临时降低特征点数目
+     * @param[in] nfeatures         新的特征点总数
+     */
+    void SetNumFeatures(int nfeatures);
+
+    /**
+     * @brief 设置开始提取特征点的最低金字塔层
+     * @details 大于0时跳过分辨率最高的若干层图像，相当于在降低了分辨率的图像上提取特征点;特征点的坐标和尺度信息不受影响
+     * @param[in] nMinLevel         最低的金字塔层,0表示从原始图像开始提取
+     */
+    void SetMinLevel(int nMinLevel);
+
 	//下面的这些内联函数都是用来直接获取类的成员变量的
+
+    /**
+     * @brief 获取当前设定的要提取的特征点总数
+     * @return int 特征点总数
+     */
+    int inline GetNumFeatures(){
+        return nfeatures;}
 	
     /**
      * @brief 获取图像金字塔的层数
@@ -198,6 +219,9 @@ protected:
      */
     void ComputeKeyPointsOld(std::vector<std::vector<cv::KeyPoint> >& allKeypoints);
 
+    /** @brief 根据nfeatures计算分配到每层图像中要提取的特征点数目mnFeaturesPerLevel */
+    void ComputeFeaturesPerLevel();
+
     //NOTE 作者不地道啊，这里是类的成员变量，说好的变量名的m前缀呢？
 
     std::vector<cv::Point> pattern;             ///<用于计算描述子的随机采样点集合
@@ -207,6 +231,7 @@ protected:
     int nlevels;			                    ///<图像金字塔的层数
     int iniThFAST;			                    ///<初始的FAST响应值阈值
     int minThFAST;			                    ///<最小的FAST响应值阈值
+    int mnMinLevel;			                    ///<开始提取特征点的最低金字塔层
 
     std::vector<int> mnFeaturesPerLevel;		///<分配到每层图像中，要提取的特征点数目
 
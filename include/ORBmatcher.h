@@ -90,11 +90,11 @@ public:
      * @param  CurrentFrame 当前帧
      * @param  LastFrame    上一帧
      * @param  th           阈值
-     * @param  bMono        是否为单目
+     * @param  sensor       传感器类型,根据它选择编译期特化的版本
      * @return              成功匹配的数量
      * @see SearchByBoW()
      */
-    int SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono);
+    int SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const int sensor);
 
     // Project MapPoints seen in KeyFrame into the Frame and search matches.
     // Used in relocalisation (Tracking)
@@ -217,6 +217,11 @@ public:
 
 protected:
 
+    // Monocular specialization of the constant velocity model search, see SensorConfig.h
+    /** @brief 单目和非单目两个特化版本,单目时在编译期去掉前进/后退判断和右目坐标检查的分支,双目和RGBD共用非单目的版本,参数同上 */
+    template<bool bMonocular>
+    int SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th);
+
     /**
      * @brief 检查极线距离
      * @param[in] kp1   特征点1
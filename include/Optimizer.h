@@ -37,19 +37,103 @@
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Frame.h"
+#include "PoseSolver.h"
 
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
+#include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
+#include "Thirdparty/g2o/g2o/core/sparse_optimizer.h"
+
+#include <map>
+#include <functional>
 
 namespace ORB_SLAM2
 {
 
 class LoopClosing;
 
+/**
+ * @brief 在相邻的局部BA之间保留的g2o优化问题
+ * @details 相邻两次局部BA的窗口大部分是重叠的.这里保存优化器(包括求解器)以及上一次的顶点和误差边,
+ * 每次局部BA只新建窗口中新出现的顶点和边、删除移出窗口的部分,其余的只更新估计值和状态. \n
+ * 顶点和边以关键帧和地图点的指针作为索引,所以只能在局部建图线程中使用,并且在地图复位之前需要调用Clear()
+ */
+class LocalBAProblem
+{
+public:
+    /** @brief 构造函数,创建LM优化器和求解器 */
+    LocalBAProblem();
+
+    /** @brief 删除所有的顶点和误差边 */
+    void Clear();
+
+protected:
+
+    friend class Optimizer;
+
+    /// 误差边以及创建它时的观测信息
+    struct EdgeInfo
+    {
+        g2o::OptimizableGraph::Edge* pEdge;     ///< 误差边
+        size_t idx;                             ///< 地图点在关键帧中的特征点索引
+        bool bStereo;                           ///< 是否是双目误差边
+        unsigned long nLastCall;                ///< 最近一次用到这条边的局部BA
+    };
+
+    /**
+     * @brief 获取关键帧对应的位姿顶点,没有的话就新建一个,并标记为本次用到
+     * @param[in] pKF   关键帧
+     * @param[in] nCall 本次局部BA的计数
+     * @return g2o::VertexSE3Expmap* 位姿顶点
+     */
+    g2o::VertexSE3Expmap* GetKeyFrameVertex(KeyFrame* pKF, const unsigned long nCall);
+    /**
+     * @brief 获取地图点对应的顶点,没有的话就新建一个,并标记为本次用到
+     * @param[in] pMP   地图点
+     * @param[in] nCall 本次局部BA的计数
+     * @return g2o::VertexSBAPointXYZ* 地图点顶点
+     */
+    g2o::VertexSBAPointXYZ* GetMapPointVertex(MapPoint* pMP, const unsigned long nCall);
+    /**
+     * @brief 查找可以复用的误差边,并标记为本次用到
+     * @details 观测的特征点索引或者类型(单目/双目)和上次不同时,删除旧的边并返回NULL
+     * @return g2o::OptimizableGraph::Edge* 可以复用的误差边,没有时返回NULL
+     */
+    g2o::OptimizableGraph::Edge* FindEdge(KeyFrame* pKF, MapPoint* pMP, const size_t idx, const bool bStereo, const unsigned long nCall);
+    /** @brief 记录新建的误差边(误差边需要已经加入了优化器) */
+    void AddEdge(KeyFrame* pKF, MapPoint* pMP, const size_t idx, const bool bStereo,
+                 g2o::OptimizableGraph::Edge* pEdge, const unsigned long nCall);
+    /** @brief 删除本次局部BA没有用到的误差边和顶点 */
+    void RemoveUnused(const unsigned long nCall);
+
+    /// 优化器,拥有求解器,所有的顶点和误差边
+    g2o::SparseOptimizer mOptimizer;
+    /// 关键帧对应的位姿顶点以及最近一次用到它的局部BA
+    std::map<KeyFrame*,std::pair<g2o::VertexSE3Expmap*,unsigned long> > mmKeyFrameVertices;
+    /// 地图点对应的顶点以及最近一次用到它的局部BA
+    std::map<MapPoint*,std::pair<g2o::VertexSBAPointXYZ*,unsigned long> > mmMapPointVertices;
+    /// 每一对关键帧和地图点之间的误差边
+    std::map<std::pair<KeyFrame*,MapPoint*>,EdgeInfo> mmEdges;
+    /// 已经进行的局部BA的次数
+    unsigned long mnCalls;
+};
+
 /** @brief 优化器,所有的优化相关的函数都在这个类中; 并且这个类只有成员函数没有成员变量,相对要好分析一点 */
 class Optimizer
 {
 public:
 
+    /**
+     * @brief BA的进度回调
+     * @details 每次LM迭代结束后调用,参数依次为已经完成的迭代次数、总的迭代次数和当前状态下的鲁棒卡方误差
+     */
+    typedef std::function<void(int,int,double)> BAProgressCallback;
+
+    /** @brief 全局BA和本质图优化可以选择的线性求解器 */
+    enum eLinearSolver{
+        LINEAR_SOLVER_CHOLESKY=0,   ///< 稀疏Cholesky分解,大地图上分解的填充会占用大量内存
+        LINEAR_SOLVER_PCG=1         ///< 块Jacobi预条件的共轭梯度法,内存只和非零块的数目成正比
+    };
+
     /**
      * @brief bundle adjustment Optimization
      * 
@@ -70,10 +154,14 @@ public:
      *          pbStopFlag  是否强制暂停
      *          nLoopKF  关键帧的个数 -- 但是我觉得形成了闭环关系的当前关键帧的id
      *          bRobust  是否使用核函数
+     *          nLinearSolver 求解(Schur补之后的)相机位姿系统的线性求解器,取值为eLinearSolver
+     *          progress 每次迭代结束后的进度回调,可以为空
+     * @return  实际完成的迭代次数,被pbStopFlag中断时会少于nIterations,此时的结果是最后一次迭代后的状态
      */
-    void static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
-                                 int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
-                                 const bool bRobust = true);
+    int static BundleAdjustment(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP,
+                                int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
+                                const bool bRobust = true, const int nLinearSolver = LINEAR_SOLVER_CHOLESKY,
+                                const BAProgressCallback &progress = BAProgressCallback());
 
     /**
      * @brief 进行全局BA优化，但主要功能还是调用 BundleAdjustment,这个函数相当于加了一个壳.
@@ -82,9 +170,14 @@ public:
      * @param[in] pbStopFlag    外界给的控制GBA停止的标志位
      * @param[in] nLoopKF       当前回环关键帧的id，其实也就是参与GBA的关键帧个数
      * @param[in] bRobust       是否使用鲁棒核函数
+     * @param[in] nLinearSolver 线性求解器,取值为eLinearSolver
+     * @param[in] progress      每次迭代结束后的进度回调,可以为空
+     * @return 实际完成的迭代次数
      */
-    void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
-                                       const unsigned long nLoopKF=0, const bool bRobust = true);
+    int static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
+                                      const unsigned long nLoopKF=0, const bool bRobust = true,
+                                      const int nLinearSolver = LINEAR_SOLVER_CHOLESKY,
+                                      const BAProgressCallback &progress = BAProgressCallback());
 
     
 /**
@@ -107,9 +200,23 @@ public:
  * @param pKF        KeyFrame
  * @param pbStopFlag 是否停止优化的标志
  * @param pMap       在优化后，更新状态时需要用到Map的互斥量mMutexMapUpdate
+ * @param sensor     传感器类型,根据它选择编译期特化的版本
  * @note 由局部建图线程调用,对局部地图进行优化的函数
  */
-    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap);
+    void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, const int sensor);
+
+    /**
+     * @brief 对一批关键帧进行一次联合的局部BA
+     * @details 局部关键帧为这一批关键帧以及它们一级共视关键帧的并集,其余同上
+     * @param[in] vpKFs      按插入顺序排列的一批关键帧,不能为空
+     * @param[in] pbStopFlag 是否停止优化的标志
+     * @param[in] pMap       地图
+     * @param[in] sensor     传感器类型
+     * @param[in,out] pBudget 时间预算,不为空并且设置了目标耗时时按照预算限制局部窗口,优化结束后更新其中的统计
+     * @param[in,out] pProblem 持久的优化问题,不为空时复用上一次局部BA的优化器,顶点和误差边
+     */
+    void static LocalBundleAdjustment(const std::vector<KeyFrame*> &vpKFs, bool *pbStopFlag, Map *pMap, const int sensor,
+                                      LocalBABudget *pBudget=NULL, LocalBAProblem *pProblem=NULL);
 
     /**
      * @brief Pose Only Optimization
@@ -117,6 +224,7 @@ public:
      * 3D-2D 最小化重投影误差 e = (u,v) - project(Tcw*Pw) \n
      * 只优化Frame的Tcw，不优化MapPoints的坐标
      * 
+     * 使用专用的求解器 PoseSolver,不再为每一帧建立g2o图,误差和雅克比与下面的g2o类型相同:
      * 1. Vertex: g2o::VertexSE3Expmap()，即当前帧的Tcw
      * 2. Edge:
      *     - g2o::EdgeSE3ProjectXYZOnlyPose()，BaseUnaryEdge
@@ -128,10 +236,12 @@ public:
      *         + measurement：MapPoint在当前帧中的二维位置(ul,v,ur)
      *         + InfoMatrix: invSigma2(与特征点所在的尺度有关)
      *
-     * @param   pFrame Frame
+     * @param   pFrame      Frame
+     * @param   sensor      传感器类型,根据它选择编译期特化的版本
+     * @param   pPrecision  数值精度设置,为NULL时使用双精度;开启校验时同时累计单精度和双精度的差异
      * @return  inliers数量
      */
-    int static PoseOptimization(Frame* pFrame);
+    int static PoseOptimization(Frame* pFrame, const int sensor, PoseBAPrecision *pPrecision=NULL);
 
     // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
     /**
@@ -151,12 +261,14 @@ public:
      * @param NonCorrectedSim3   未经过Sim3传播调整过的关键帧位姿
      * @param CorrectedSim3      经过Sim3传播调整过的关键帧位姿
      * @param LoopConnections    因闭环时MapPoints调整而新生成的边
+     * @param bFixScale          是否固定尺度
+     * @param nLinearSolver      线性求解器,取值为eLinearSolver
      */
     void static OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
-                                       const bool &bFixScale);
+                                       const bool &bFixScale, const int nLinearSolver = LINEAR_SOLVER_CHOLESKY);
 
     // if bFixScale is true, optimize SE3 (stereo,rgbd), Sim3 otherwise (mono)
     // 闭环刚刚形成的时候,对当前关键帧和闭环关键帧之间的sim3变换的优化
@@ -185,6 +297,18 @@ public:
      */
     static int OptimizeSim3(KeyFrame* pKF1, KeyFrame* pKF2, std::vector<MapPoint *> &vpMatches1,
                             g2o::Sim3 &g2oS12, const float th2, const bool bFixScale);
+
+protected:
+
+    // Monocular specializations, see SensorConfig.h. Monocular drops the stereo edges at compile time.
+    // 单目和非单目两个特化版本;单目时在编译期去掉双目误差边的分支,双目和RGBD的代码相同,共用非单目的版本,其中没有右目坐标的点仍然使用单目误差边
+    /** @brief 特化版本的PoseOptimization,参数同上 */
+    template<bool bMonocular>
+    int static PoseOptimization(Frame* pFrame, PoseBAPrecision *pPrecision);
+    /** @brief 特化版本的LocalBundleAdjustment,参数同上 */
+    template<bool bMonocular>
+    void static LocalBundleAdjustment(const std::vector<KeyFrame*> &vpKFs, bool *pbStopFlag, Map *pMap,
+                                      LocalBABudget *pBudget, LocalBAProblem *pProblem);
 };
 
 } //namespace ORB_SLAM
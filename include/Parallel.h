@@ -0,0 +1,125 @@
+/**
+ * @file Parallel.h
+ * @brief 简单的数据并行工具
+ * @details 把一段连续的下标区间切成若干块,分给多个线程处理.用于局部建图中对大量地图点逐个进行的独立操作,
+ * 元素比较少的时候直接在调用线程中串行执行.块由一个进程内共享的常驻线程池处理,不在每次调用时创建线程.
+ */
+
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ORB_SLAM2
+{
+
+/**
+ * @brief 常驻的线程池,由ParallelFor使用
+ * @details 工作线程的个数是硬件线程数减一,调用线程自己也参与计算.多个线程可以同时提交任务,
+ * 提交任务的线程在等待时只会处理自己提交的块,所以在块中再调用ParallelFor也不会死锁.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief 获取进程内共享的线程池,第一次调用时创建
+     * @details 线程池不会被析构,程序退出时各个线程还可能在使用它
+     */
+    static ThreadPool& Instance();
+
+    /** @brief 参与计算的线程数,包括调用线程 */
+    size_t NumThreads() const { return mvThreads.size()+1; }
+
+    /**
+     * @brief 把区间[0,n)按照nChunk切块并行处理,返回时所有块都已经处理完毕
+     * @param[in] n      元素个数
+     * @param[in] nChunk 每块的元素个数
+     * @param[in] f      处理一块的函数
+     */
+    void Run(const size_t n, const size_t nChunk, const std::function<void(size_t,size_t)> &f);
+
+private:
+    /// 一次Run提交的任务
+    struct Batch
+    {
+        const std::function<void(size_t,size_t)>* pFunc;
+        size_t n;
+        size_t nChunk;
+        size_t nNextBegin;          ///< 下一个还没有被领取的块的起点
+        size_t nPending;            ///< 交给工作线程之后还没有处理完的块数
+    };
+
+    ThreadPool();
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    /** @brief 工作线程的主循环 */
+    void Work();
+    /**
+     * @brief 领取pBatch的下一块,领完之后把它从队列中移除.调用时需要持有mMutex
+     * @return 块的起点
+     */
+    size_t Claim(Batch* pBatch);
+
+    std::vector<std::thread> mvThreads;
+    std::deque<Batch*> mdBatches;               ///< 还有块没有被领取的任务
+    std::mutex mMutex;
+    std::condition_variable mcvWork;            ///< 有新任务时通知工作线程
+    std::condition_variable mcvDone;            ///< 有任务完成时通知提交任务的线程
+};
+
+/**
+ * @brief 在多个线程上并行地处理下标区间[0,n)
+ * @details 区间被切成连续的块,每个线程处理一块,调用线程自己处理第一块,函数返回时所有块都已经处理完毕.
+ * 不同的块之间不能有依赖,对共享数据的访问需要由f自己保证线程安全.
+ * @param[in] n         元素个数
+ * @param[in] nMinGrain 每个线程至少处理的元素个数,n小于它的两倍时直接串行执行
+ * @param[in] f         处理一块的函数,原型为 void(size_t begin, size_t end)
+ */
+template<typename Func>
+void ParallelFor(const size_t n, const size_t nMinGrain, const Func &f)
+{
+    if(n==0)
+        return;
+
+    ThreadPool &pool = ThreadPool::Instance();
+    const size_t nThreads = std::min(pool.NumThreads(), n/std::max<size_t>(nMinGrain,1));
+
+    if(nThreads<=1)
+    {
+        f(0,n);
+        return;
+    }
+
+    pool.Run(n, (n+nThreads-1)/nThreads, std::function<void(size_t,size_t)>(std::cref(f)));
+}
+
+} //namespace ORB_SLAM
+
+#endif // PARALLEL_H
@@ -0,0 +1,185 @@
+/**
+ * @file PoseSolver.h
+ * @brief 只优化当前帧位姿的专用求解器(motion-only BA)
+ * @details Optimizer::PoseOptimization 每一帧都要执行,原来为一个6自由度顶点建立完整的g2o图,每个匹配点
+ * 都要在堆上分配一条一元边和一个鲁棒核.这里把同样的LM迭代直接写在连续的数组上:
+ * 观测按结构体数组(SoA)存放,残差和雅克比在一个没有分支的循环中计算,可以被编译器向量化;
+ * 信息矩阵 J^T W J 和 J^T W e 交给Eigen的矩阵乘法(SIMD)完成,最后求解一个6x6的方程.
+ * 求解器所用的内存在多次优化之间复用,稳定运行时不再有内存分配.
+ * 迭代策略(初始阻尼,阻尼的更新,失败重试次数,终止条件)与g2o::OptimizationAlgorithmLevenberg保持一致,
+ * 因此得到的位姿和内外点判断与原来的g2o实现只有舍入误差级别的差异.
+ * 观测,残差和雅克比的存储精度由模板参数决定,单精度时向量化的宽度加倍,内存带宽减半;
+ * 6x6方程的求解和位姿的更新总是使用双精度.
+ */
+
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
+#include "Thirdparty/g2o/g2o/types/se3quat.h"
+
+namespace ORB_SLAM2
+{
+
+/**
+ * @brief 只优化位姿的BA的数值精度设置,以及单精度相对于双精度的校验统计
+ * @details 通过配置文件中的 Optimizer.PoseSinglePrecision 和 Optimizer.PoseValidatePrecision 设置
+ */
+struct PoseBAPrecision
+{
+    bool bSinglePrecision;              ///< 使用单精度的求解器
+    bool bValidate;                     ///< 同时用双精度求解同一个问题并统计两者的差异
+    unsigned long nValidated;           ///< 参与校验的优化次数
+    unsigned long nObservations;        ///< 参与校验的观测总数
+    unsigned long nInlierMismatches;    ///< 单精度和双精度内外点判断不一致的观测数
+    double fMaxRotationError;           ///< 两者位姿的最大旋转差异(弧度)
+    double fMaxTranslationError;        ///< 两者位姿的最大平移差异(地图单位)
+
+    PoseBAPrecision(): bSinglePrecision(false), bValidate(false), nValidated(0), nObservations(0),
+        nInlierMismatches(0), fMaxRotationError(0), fMaxTranslationError(0) {}
+};
+
+/**
+ * @brief 只优化位姿的LM求解器
+ * @details 单目观测和双目观测分成两组分别存放,每一组内部的观测是连续的.
+ * 误差的定义和雅克比与 g2o::EdgeSE3ProjectXYZOnlyPose, g2o::EdgeStereoSE3ProjectXYZOnlyPose 相同,
+ * 位姿的更新方式与 g2o::VertexSE3Expmap 相同(左乘 exp(dx)).
+ * @tparam Scalar 观测,残差和雅克比的精度,float 或者 double,在PoseSolver.cc中显式实例化
+ */
+template<typename Scalar>
+class PoseSolver
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    PoseSolver();
+
+    /**
+     * @brief 开始一个新的问题,清空所有的观测,已经分配的内存会被保留
+     * @param[in] fx,fy,cx,cy   相机内参
+     * @param[in] bf            双目的基线乘以fx,单目时不使用
+     */
+    void Reset(const float fx, const float fy, const float cx, const float cy, const float bf);
+
+    /**
+     * @brief 添加一个单目观测
+     * @param[in] Xw        地图点的世界坐标
+     * @param[in] u,v       特征点去畸变后的坐标
+     * @param[in] invSigma2 特征点所在金字塔层的 1/sigma^2,作为信息矩阵
+     * @return size_t       这个观测在单目观测中的序号
+     */
+    size_t AddMonoObservation(const Eigen::Vector3d &Xw, const float u, const float v, const float invSigma2);
+
+    /**
+     * @brief 添加一个双目观测,参数同上
+     * @param[in] ur        右目的横坐标
+     * @return size_t       这个观测在双目观测中的序号
+     */
+    size_t AddStereoObservation(const Eigen::Vector3d &Xw, const float u, const float v, const float ur, const float invSigma2);
+
+    /**
+     * @brief 设置Huber鲁棒核的阈值,小于等于0时不使用鲁棒核
+     * @param[in] deltaMono     单目观测的阈值
+     * @param[in] deltaStereo   双目观测的阈值
+     */
+    void SetHuberDelta(const float deltaMono, const float deltaStereo);
+
+    /** @brief 设置观测是否参与优化(相当于g2o中边的level为0) */
+    void SetMonoInlier(const size_t i, const bool bInlier);
+    void SetStereoInlier(const size_t i, const bool bInlier);
+
+    /**
+     * @brief 最近一次计算残差时得到的卡方值 e^T*Omega*e
+     * @details 与g2o相同,最后一次计算残差可能是在一个被拒绝的LM步上进行的
+     */
+    double GetMonoChi2(const size_t i) const { return mvMonoChi2[i]; }
+    double GetStereoChi2(const size_t i) const { return mvStereoChi2[i]; }
+
+    /** @brief 单目/双目观测的数目 */
+    size_t NumMonoObservations() const { return mvMonoX.size(); }
+    size_t NumStereoObservations() const { return mvStereoX.size(); }
+
+    /** @brief 在当前位姿下重新计算某个观测的卡方值,用于不参与优化的外点 */
+    double ComputeMonoChi2(const size_t i);
+    double ComputeStereoChi2(const size_t i);
+
+    void SetPose(const g2o::SE3Quat &Tcw) { mTcw = Tcw; }
+    const g2o::SE3Quat &GetPose() const { return mTcw; }
+
+    /**
+     * @brief 用LM算法优化位姿,与 g2o::SparseOptimizer::optimize 配合 OptimizationAlgorithmLevenberg 的行为一致
+     * @param[in] nIterations 最大迭代次数
+     */
+    void Optimize(const int nIterations);
+
+protected:
+
+    /**
+     * @brief 在给定位姿下计算所有观测的残差,卡方值以及鲁棒核的权重
+     * @param[in] Tcw           位姿
+     * @param[in] bJacobians    是否同时计算雅克比
+     * @return double           参与优化的观测的鲁棒卡方值之和
+     */
+    double Evaluate(const g2o::SE3Quat &Tcw, const bool bJacobians);
+
+    /** @brief 保证雅克比等缓冲区可以容纳nRows行 */
+    void ReserveRows(const int nRows);
+
+    typedef Eigen::Matrix<Scalar,Eigen::Dynamic,1> VectorX;
+    typedef Eigen::Matrix<Scalar,Eigen::Dynamic,6> JacobianX;
+
+    // 相机参数
+    Scalar fx, fy, cx, cy, bf;
+    // Huber鲁棒核的阈值,小于等于0时不使用鲁棒核
+    Scalar mDeltaMono, mDeltaStereo;
+
+    // 单目观测,按结构体数组存放:地图点坐标,观测,信息,是否为内点(1或者0),卡方值,鲁棒卡方值
+    std::vector<Scalar> mvMonoX, mvMonoY, mvMonoZ, mvMonoU, mvMonoV, mvMonoInfo, mvMonoInlier, mvMonoChi2, mvMonoRho;
+    // 双目观测,多了右目的横坐标
+    std::vector<Scalar> mvStereoX, mvStereoY, mvStereoZ, mvStereoU, mvStereoV, mvStereoUr, mvStereoInfo, mvStereoInlier, mvStereoChi2, mvStereoRho;
+
+    /**
+     * 以下缓冲区按行存放所有观测的残差分量:
+     * 单目的u,单目的v,双目的u,双目的v,双目的ur 依次排列.只会变大,不会释放
+     */
+    JacobianX mJ;           ///< 残差对位姿的雅克比,列优先,每一列是连续的
+    JacobianX mWJ;          ///< 乘上权重后的雅克比
+    VectorX mResiduals;     ///< 残差
+    VectorX mWeights;       ///< 每一行的权重 = 是否为内点 * 鲁棒核的权重 * 信息
+
+    /// 当前的位姿估计
+    g2o::SE3Quat mTcw;
+
+    // LM的状态
+    Eigen::Matrix<double,6,6> mH;
+    Eigen::Matrix<double,6,1> mb;
+    Eigen::LDLT<Eigen::Matrix<double,6,6> > mLDLT;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSESOLVER_H
@@ -0,0 +1,72 @@
+/**
+ * @file SensorConfig.h
+ * @brief 编译期的传感器特化选项
+ * @details 追踪相关的热点函数(PoseOptimization,LocalBundleAdjustment,恒速模型下的SearchByProjection)
+ * 按照是否为单目进行特化,单目时编译器可以在编译期去掉双目相关的分支并静态地选择误差边的类型.
+ * 双目和RGB-D的追踪代码完全相同(两者都可能有没有深度的特征点,需要逐个判断),所以共用一个非单目的实例.
+ * 通过CMake选项 ORB_SLAM2_WITH_MONOCULAR / ORB_SLAM2_WITH_STEREO / ORB_SLAM2_WITH_RGBD 选择需要编译的特化版本,
+ * 如果一个都没有指定(比如不通过CMake编译),那么就编译全部三种.
+ */
+
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SENSORCONFIG_H
+#define SENSORCONFIG_H
+
+// Build options selecting which sensor specializations of the tracking path are compiled
+#if !defined(ORB_SLAM2_WITH_MONOCULAR) && !defined(ORB_SLAM2_WITH_STEREO) && !defined(ORB_SLAM2_WITH_RGBD)
+#define ORB_SLAM2_WITH_MONOCULAR
+#define ORB_SLAM2_WITH_STEREO
+#define ORB_SLAM2_WITH_RGBD
+#endif
+
+namespace ORB_SLAM2
+{
+
+/**
+ * @brief 判断某种传感器的特化版本是否被编译
+ * @param[in] sensor 传感器类型,取值同System::eSensor
+ * @return true 已编译
+ */
+inline bool IsSensorCompiled(const int sensor)
+{
+    switch(sensor)
+    {
+#ifdef ORB_SLAM2_WITH_MONOCULAR
+    case 0:     // System::MONOCULAR
+        return true;
+#endif
+#ifdef ORB_SLAM2_WITH_STEREO
+    case 1:     // System::STEREO
+        return true;
+#endif
+#ifdef ORB_SLAM2_WITH_RGBD
+    case 2:     // System::RGBD
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+} //namespace ORB_SLAM
+
+#endif // SENSORCONFIG_H
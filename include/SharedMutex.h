@@ -0,0 +1,114 @@
+/**
+ * @file SharedMutex.h
+ * @brief 读写锁
+ * @details C++11中没有std::shared_mutex,这里用一个互斥量和两个条件变量实现.
+ * 多个读者可以同时持有锁,写者独占;有写者在等待时新的读者也要等待,避免写者被持续的查询饿死.
+ */
+
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHAREDMUTEX_H
+#define SHAREDMUTEX_H
+
+#include <mutex>
+#include <condition_variable>
+
+namespace ORB_SLAM2
+{
+
+/**
+ * @brief 写者优先的读写锁
+ * @details lock/unlock 与 std::mutex 的接口相同,可以直接用于 std::unique_lock;读者使用 SharedLock
+ */
+class SharedMutex
+{
+public:
+
+    SharedMutex(): mnReaders(0), mnWaitingWriters(0), mbWriter(false) {}
+
+    /** @brief 以写者的身份加锁,等待所有的读者和写者离开 */
+    void lock()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mnWaitingWriters++;
+        while(mbWriter || mnReaders>0)
+            mcvWriters.wait(lock);
+        mnWaitingWriters--;
+        mbWriter = true;
+    }
+
+    void unlock()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mbWriter = false;
+        if(mnWaitingWriters>0)
+            mcvWriters.notify_one();
+        else
+            mcvReaders.notify_all();
+    }
+
+    /** @brief 以读者的身份加锁,没有写者持有或者等待这个锁时立即返回 */
+    void lock_shared()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while(mbWriter || mnWaitingWriters>0)
+            mcvReaders.wait(lock);
+        mnReaders++;
+    }
+
+    void unlock_shared()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mnReaders--;
+        if(mnReaders==0 && mnWaitingWriters>0)
+            mcvWriters.notify_one();
+    }
+
+private:
+
+    SharedMutex(const SharedMutex&);
+    SharedMutex& operator=(const SharedMutex&);
+
+    std::mutex mMutex;
+    std::condition_variable mcvReaders;
+    std::condition_variable mcvWriters;
+    int mnReaders;              ///< 当前持有锁的读者数目
+    int mnWaitingWriters;       ///< 正在等待的写者数目
+    bool mbWriter;              ///< 是否有写者持有锁
+};
+
+/** @brief 读者的锁守卫,作用同 std::unique_lock */
+class SharedLock
+{
+public:
+    explicit SharedLock(SharedMutex &mutex): mMutex(mutex) { mMutex.lock_shared(); }
+    ~SharedLock() { mMutex.unlock_shared(); }
+
+private:
+    SharedLock(const SharedLock&);
+    SharedLock& operator=(const SharedLock&);
+
+    SharedMutex &mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // SHAREDMUTEX_H
@@ -29,6 +29,7 @@
 //一些公用库的支持，字符串操作，多线程操作，以及opencv库等
 #include <string>
 #include <thread>
+#include <chrono>
 #include <opencv2/core/core.hpp>
 
 //下面则是本ORB-SLAM2系统中的其他模块
@@ -41,6 +42,7 @@
 #include "KeyFrameDatabase.h"
 #include "ORBVocabulary.h"
 #include "Viewer.h"
+#include "PoseSolver.h"
 
 namespace ORB_SLAM2
 {
@@ -52,6 +54,7 @@ class Map;
 class Tracking;
 class LocalMapping;
 class LoopClosing;
+struct LocalBABudget;
 
 //本类的定义
 class System
@@ -152,11 +155,37 @@ public:
     // You can call this right after TrackMonocular (or stereo or RGBD)
     //获取最近的运动追踪状态、地图点追踪状态、特征点追踪状态
     int GetTrackingState();
+    // Degradations applied to the most recent frame to meet Tracking.FrameDeadline (Tracking::eDegradation bit mask)
+    // 最近一帧为了满足单帧时间预算而采取的降级措施，是Tracking::eDegradation的按位组合
+    int GetTrackingDegradation();
+
+    // Counters of the frame admission control (load shedding)
+    // 帧准入控制的统计信息
+    struct AdmissionStats
+    {
+        unsigned long nReceived;            ///<输入的总帧数
+        unsigned long nDropped;             ///<因为局部建图严重积压而被丢弃的帧数
+        unsigned long nDownsampled;         ///<因为降采样而被跳过的帧数
+        unsigned long nReducedResolution;   ///<以降低的分辨率提取特征点的帧数
+    };
+    AdmissionStats GetAdmissionStats();
+    // Time budget of the local BA and the window/time achieved by the most recent one (LocalMapping.BABudget)
+    // 局部BA的时间预算，以及最近一次局部BA实际的窗口大小和耗时
+    LocalBABudget GetLocalBABudget();
+    // Precision of the pose-only BA and the single/double precision validation counters (Optimizer.PoseSinglePrecision)
+    // 只优化位姿的BA所用的数值精度,以及开启校验时单精度相对于双精度的差异
+    PoseBAPrecision GetPoseBAPrecision();
     std::vector<MapPoint*> GetTrackedMapPoints();
     std::vector<cv::KeyPoint> GetTrackedKeyPointsUn();
 
 private:
 
+    // Decide whether the incoming frame is tracked, based on mapping backlog and tracking latency
+    // 帧准入控制：根据局部建图的积压情况和追踪耗时决定是否追踪当前帧，并设置特征提取的分辨率
+    bool AdmitFrame();
+    // 更新追踪耗时的滑动平均值
+    void UpdateTrackingLatency(const std::chrono::steady_clock::time_point &tStart);
+
     //注意变量命名方式，类的变量有前缀m，如果这个变量是指针类型还要多加个前缀p，
     //如果是进程那么加个前缀t
 
@@ -222,9 +251,20 @@ private:
     // Tracking state
     // 追踪状态标志，注意前三个的类型和上面的函数类型相互对应
     int mTrackingState;
+    int mTrackingDegradation;
+    PoseBAPrecision mPoseBAPrecision;
     std::vector<MapPoint*> mTrackedMapPoints;
     std::vector<cv::KeyPoint> mTrackedKeyPointsUn;
     std::mutex mMutexState;
+
+    // Frame admission control
+    // 帧准入控制相关的参数和状态
+    int mnAdmissionMaxBacklog;
+    float mfAdmissionMaxLatency;
+    int mnAdmissionDownsampleRate;
+    float mfTrackingLatency;
+    unsigned long mnDownsampleCounter;
+    AdmissionStats mAdmissionStats;
 };
 
 }// namespace ORB_SLAM
@@ -48,8 +48,10 @@
 #include "Initializer.h"
 #include "MapDrawer.h"
 #include "System.h"
+#include "PoseSolver.h"
 
 #include <mutex>
+#include <chrono>
 
 namespace ORB_SLAM2
 {
@@ -150,6 +152,13 @@ public:
      */
     void InformOnlyTracking(const bool &flag);
 
+    /**
+     * @brief 设置是否以降低的分辨率提取特征点
+     * @details 由System的帧准入控制调用,降低分辨率时跳过图像金字塔的最底层
+     * @param[in] flag 是否降低分辨率
+     */
+    void SetReducedResolution(const bool &flag);
+
 
 public:
 
@@ -163,8 +172,21 @@ public:
         LOST=3                      ///<系统已经跟丢了的状态
     };
 
+    // Degradations applied when the frame deadline is under pressure (bit mask)
+    ///单帧时间预算紧张时所采取的降级措施,按位组合
+    enum eDegradation{
+        DEGRADE_NONE=0,                 ///<没有降级
+        DEGRADE_LOCAL_MAP=1,            ///<缩小了局部地图中的关键帧和地图点数目
+        DEGRADE_FEATURES=2,             ///<降低了ORB特征点的提取数目
+        DEGRADE_SEARCH_WIDENING=4       ///<跳过了恒速模型跟踪中扩大搜索半径的第二次投影匹配
+    };
+
     ///跟踪状态
     eTrackingState mState;
+    ///当前帧所采取的降级措施,eDegradation的按位组合
+    int mnDegradation;
+    ///只优化位姿的BA所用的数值精度,以及单精度的校验统计
+    PoseBAPrecision mPoseBAPrecision;
     ///上一帧的跟踪状态.这个变量在绘制当前帧的时候会被使用到
     eTrackingState mLastProcessedState;
 
@@ -294,6 +316,20 @@ protected:
      */
     void CreateNewKeyFrame();
 
+    /**
+     * @brief 开始处理一帧时记录时间,并根据上一帧的耗时决定本帧要提取的特征点数目
+     * @details 需要在构造Frame之前调用,因为特征点提取是在Frame的构造函数中完成的
+     */
+    void BeginFrameDeadline();
+    /** @brief 一帧处理结束时记录其耗时,作为下一帧是否降级的依据 */
+    void EndFrameDeadline();
+    /**
+     * @brief 判断当前帧是否处于时间预算紧张的状态
+     * @details 上一帧超出了预算,或者当前帧已经用掉了一半以上的预算,都认为时间紧张
+     * @return true 需要降级处理
+     */
+    bool UnderDeadlinePressure();
+
     // In case of performing only localization, this flag is true when there are no matches to
     // points in the map. Still tracking will continue if there are enough matches with temporal points.
     // In that case we are doing visual odometry. The system will try to do relocalization to recover
@@ -399,6 +435,28 @@ protected:
 
     ///临时的地图点,用于提高双目和RGBD摄像头的帧间效果,用完之后就扔了
     list<MapPoint*> mlpTemporalPoints;
+
+    // Buffers reused across frames by the batched stereo/RGB-D unprojection
+    ///需要批量反投影的特征点的索引
+    std::vector<int> mvUnprojectIndices;
+    ///批量反投影得到的世界坐标,和mvUnprojectIndices一一对应
+    std::vector<Eigen::Vector3f> mvUnprojectPoints;
+
+    // Per-frame deadline (Tracking.FrameDeadline in ms, 0 disables the deadline mode)
+    ///单帧处理的时间预算,单位ms;为0时表示不启用
+    float mfFrameDeadline;
+    ///配置文件中给出的特征点数目
+    int mnFeatures;
+    ///时间紧张时提取的特征点数目
+    int mnFeaturesDegraded;
+    ///时间紧张时局部关键帧的最大数目
+    int mnMaxLocalKFsDegraded;
+    ///时间紧张时局部地图点的最大数目
+    int mnMaxLocalPointsDegraded;
+    ///上一帧的处理耗时,单位ms
+    float mfLastFrameTime;
+    ///当前帧开始处理的时刻
+    std::chrono::steady_clock::time_point mtFrameStart;
 };  //class Tracking
 
 } //namespace ORB_SLAM
@@ -39,6 +39,7 @@
 #include "System.h"
 
 #include <mutex>
+#include <condition_variable>
 
 namespace ORB_SLAM2
 {
@@ -80,6 +81,10 @@ public:
     bool isStopped();
     /** @brief 释放变量，避免互斥关系 */
     void Release();
+    /** @brief 阻塞直到查看器真正地停止更新 */
+    void WaitUntilStopped();
+    /** @brief 阻塞直到查看器进程结束 */
+    void WaitUntilFinished();
 
 private:
 
@@ -128,6 +133,8 @@ private:
     ///线程锁对象,用于锁住和finsh,终止当前查看器进程相关的变量
     //? 但是我现在还是不明白,它是怎么知道我的这个线程锁对象和我的这个线程产生绑定关系的
     std::mutex mMutexFinish;
+    ///mbFinished被置位时通知等待的外部线程
+    std::condition_variable mcvFinished;
 
     ///当前进程是否停止
     bool mbStopped;
@@ -135,6 +142,8 @@ private:
     bool mbStopRequested;
     ///用于锁住stop,停止更新变量相关的互斥量
     std::mutex mMutexStop;
+    ///mbStopped发生变化时通知等待的线程
+    std::condition_variable mcvStopped;
 
 };
 
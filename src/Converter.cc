@@ -69,6 +69,12 @@ g2o::SE3Quat Converter::toSE3Quat(const cv::Mat &cvT)
     return g2o::SE3Quat(R,t);
 }
 
+//单精度的旋转矩阵和平移向量 -> g2o::SE3Quat
+g2o::SE3Quat Converter::toSE3Quat(const Eigen::Matrix3f &R, const Eigen::Vector3f &t)
+{
+    return g2o::SE3Quat(R.cast<double>(),t.cast<double>());
+}
+
 //李代数se3转换为变换矩阵：g2o::SE3Quat->cv::Mat
 cv::Mat Converter::toCvMat(const g2o::SE3Quat &SE3)
 {
@@ -156,6 +162,41 @@ cv::Mat Converter::toCvSE3(const Eigen::Matrix<double,3,3> &R, const Eigen::Matr
     return cvMat.clone();
 }
 
+//Eigen::Matrix3f -> cv::Mat
+cv::Mat Converter::toCvMat(const Eigen::Matrix3f &m)
+{
+    cv::Mat cvMat(3,3,CV_32F);
+    for(int i=0;i<3;i++)
+        for(int j=0; j<3; j++)
+            cvMat.at<float>(i,j)=m(i,j);
+
+    return cvMat;
+}
+
+//Eigen::Vector3f -> cv::Mat
+cv::Mat Converter::toCvMat(const Eigen::Vector3f &m)
+{
+    cv::Mat cvMat(3,1,CV_32F);
+    for(int i=0;i<3;i++)
+        cvMat.at<float>(i)=m(i);
+
+    return cvMat;
+}
+
+//单精度的旋转矩阵R和平移向量t -> 以cv::Mat格式存储的变换矩阵
+cv::Mat Converter::toCvSE3(const Eigen::Matrix3f &R, const Eigen::Vector3f &t)
+{
+    cv::Mat cvMat = cv::Mat::eye(4,4,CV_32F);
+    for(int i=0;i<3;i++)
+    {
+        for(int j=0;j<3;j++)
+            cvMat.at<float>(i,j)=R(i,j);
+        cvMat.at<float>(i,3)=t(i);
+    }
+
+    return cvMat;
+}
+
 // 将OpenCV中Mat类型的向量转化为Eigen中Matrix类型的变量
 Eigen::Matrix<double,3,1> Converter::toVector3d(const cv::Mat &cvVector)
 {
@@ -192,6 +233,22 @@ Eigen::Matrix<double,3,3> Converter::toMatrix3d(const cv::Mat &cvMat3)
     return M;
 }
 
+//cv::Mat -> Eigen::Vector3f
+Eigen::Vector3f Converter::toVector3f(const cv::Mat &cvVector)
+{
+    return Eigen::Vector3f(cvVector.at<float>(0), cvVector.at<float>(1), cvVector.at<float>(2));
+}
+
+//cv::Mat -> Eigen::Matrix3f
+Eigen::Matrix3f Converter::toMatrix3f(const cv::Mat &cvMat3)
+{
+    Eigen::Matrix3f M;
+    M << cvMat3.at<float>(0,0), cvMat3.at<float>(0,1), cvMat3.at<float>(0,2),
+         cvMat3.at<float>(1,0), cvMat3.at<float>(1,1), cvMat3.at<float>(1,2),
+         cvMat3.at<float>(2,0), cvMat3.at<float>(2,1), cvMat3.at<float>(2,2);
+    return M;
+}
+
 //将cv::Mat类型的四元数转换成为std::vector型
 std::vector<float> Converter::toQuaternion(const cv::Mat &M)
 {
@@ -54,6 +54,7 @@ float Frame::mfGridElementWidthInv, Frame::mfGridElementHeightInv;
 
 //无参的构造函数默认为空
 Frame::Frame()
+    :mbBowComputed(false)
 {}
 
 /** @details 另外注意，调用这个函数的时候，这个函数中隐藏的this指针其实是指向目标帧的
@@ -76,6 +77,7 @@ Frame::Frame(const Frame &frame)
      mvDepth(frame.mvDepth), 								//深拷贝
      mBowVec(frame.mBowVec), 								//深拷贝
      mFeatVec(frame.mFeatVec),								//深拷贝
+     mbBowComputed(frame.mbBowComputed),
      mDescriptors(frame.mDescriptors.clone()), 				//cv::Mat深拷贝
      mDescriptorsRight(frame.mDescriptorsRight.clone()),	//cv::Mat深拷贝
      mvpMapPoints(frame.mvpMapPoints), 						//深拷贝
@@ -124,6 +126,7 @@ Frame::Frame(const cv::Mat &imLeft, 			//左目图像
      mbf(bf), 
      mb(0), 									//这里将双目相机的基线设置为0其实没有什么道理，因为在其构造函数中mb还是会被正确计算的
      mThDepth(thDepth),
+     mbBowComputed(false),
      mpReferenceKF(static_cast<KeyFrame*>(NULL))//NOTICE 暂时先不设置参考关键帧
 {
     /** 主要步骤: */
@@ -251,7 +254,8 @@ Frame::Frame(const cv::Mat &imGray, 	//灰度化之后的彩色图像
      mK(K.clone()),
      mDistCoef(distCoef.clone()), 
      mbf(bf), 
-     mThDepth(thDepth)
+     mThDepth(thDepth),
+     mbBowComputed(false)
 {
     /** 主要步骤: */
     // Frame ID
@@ -363,7 +367,8 @@ Frame::Frame(const cv::Mat &imGray, 			//灰度化后的彩色图像
      mK(K.clone()),
      mDistCoef(distCoef.clone()), 
      mbf(bf), 
-     mThDepth(thDepth)
+     mThDepth(thDepth),
+     mbBowComputed(false)
 {
     /** 主要步骤: */
 
@@ -539,16 +544,16 @@ void Frame::UpdatePoseMatrices()
     // x_camera = R*x_world + t
 	//注意，rowRange这个只取到范围的左边界，而不取右边界
 	//所以下面这个其实就是从变换矩阵中提取出旋转矩阵
-    mRcw = mTcw.rowRange(0,3).colRange(0,3);
+    mRcw = Converter::toMatrix3f(mTcw.rowRange(0,3).colRange(0,3));
     /** 2. 相反的旋转就是取个逆，对于正交阵也就是取个转置: \n
      * \f$ \mathbf{R}_{wc}=\mathbf{R}_{cw}^{-1}=\mathbf{R}_{cw}^{\text{T}} \f$ \n
      * 得到 mRwc .
      */
-    mRwc = mRcw.t();
+    mRwc = mRcw.transpose();
 	/** 3. 同样地，从变换矩阵 \f$ \mathbf{T}_{cw} \f$中提取出平移向量 \f$ \mathbf{t}_{cw} \f$ \n 
      * 进而得到 mtcw. 
      */
-    mtcw = mTcw.rowRange(0,3).col(3);
+    mtcw = Converter::toVector3f(mTcw.rowRange(0,3).col(3));
     // mtcw, 即相机坐标系下相机坐标系到世界坐标系间的向量, 向量方向由相机坐标系指向世界坐标系
     // mOw, 即世界坐标系下世界坐标系到相机坐标系间的向量, 向量方向由世界坐标系指向相机坐标系
 
@@ -574,7 +579,7 @@ void Frame::UpdatePoseMatrices()
      * 也许你会想说为什么不是 \f$ \mathbf{O}_w=-\mathbf{t}_{cw} \f$,是因为如果这样做的话没有考虑到坐标系之间的旋转.
      */ 
 	
-    mOw = -mRcw.t()*mtcw;
+    mOw = -mRwc*mtcw;
 
 	/* 下面都是之前的推导,可能有错误,不要看!!!!!
 	其实上面的算式可以写成下面的形式：
@@ -616,7 +621,7 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
 
     // 3D in absolute coordinates
     /** <li> 2.获得这个地图点的世界坐标, 使用 MapPoint::GetWorldPos() 来获得。</li>\n*/
-    cv::Mat P = pMP->GetWorldPos(); 
+    const Eigen::Vector3f P = pMP->GetWorldPosEigen(); 
 
     // 3D in camera coordinates
     /** <li> 3.然后根据 Frame::mRcw 和 Frame::mtcw 计算这个点\f$\mathbf{P}\f$在当前相机坐标系下的坐标: </li>\n
@@ -624,11 +629,11 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
      * 并提取出三个坐标的坐标值.
      */ 
     
-    const cv::Mat Pc = mRcw*P+mtcw; // 这里的Rt是经过初步的优化后的
+    const Eigen::Vector3f Pc = mRcw*P+mtcw; // 这里的Rt是经过初步的优化后的
     //然后提取出三个坐标的坐标值
-    const float &PcX = Pc.at<float>(0);
-    const float &PcY = Pc.at<float>(1);
-    const float &PcZ = Pc.at<float>(2);
+    const float &PcX = Pc(0);
+    const float &PcY = Pc(1);
+    const float &PcZ = Pc(2);
 
     // Check positive depth
     /** <li> 4. <b>关卡一</b>：检查这个地图点在当前帧的相机坐标系下，是否有正的深度.如果是负的，就说明它在当前帧下不在相机视野中，也无法在当前帧下进行重投影. </li>*/
@@ -672,9 +677,9 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
      * 具体实现上是通过构造3D点P到相机光心的向量 \f$\mathbf{P}_0 \f$ ，通过对向量取模即可得到距离\f$dist\f$。
      * </ul>
      */
-    const cv::Mat PO = P-mOw;
+    const Eigen::Vector3f PO = P-mOw;
 	//取模就得到了距离
-    const float dist = cv::norm(PO);
+    const float dist = PO.norm();
 
 	//如果不在允许的尺度变化范围内，认为重投影不可靠
     if(dist<minDistance || dist>maxDistance)
@@ -688,7 +693,7 @@ bool Frame::isInFrustum(MapPoint *pMP, float viewingCosLimit)
     /** <li> 7.1 使用 MapPoint::GetNormal() 来获得平均视角(其实是一个单位向量\f$ \mathbf{P}_n \f$ ) </li> */
 	//获取平均视角，目测这个平均视角只是一个方向向量，模长为1，它表示了当前帧下观测到的点的分布情况
 	//TODO 但是这个平均视角估计是在map.cpp或者mapoint.cpp中计算的，还不是很清楚这个具体含义  其实现在我觉得就是普通的视角的理解吧
-    cv::Mat Pn = pMP->GetNormal();
+    const Eigen::Vector3f Pn = pMP->GetNormalEigen();
 
 	/** <li> 7.2 计算当前视角和平均视角夹角的余弦值，注意平均视角为单位向量 </li>  \n
      * 其实就是初中学的计算公式： \n
@@ -880,8 +885,8 @@ bool Frame::PosInGrid(			//返回值：true-说明找到了指定特征点所在
 void Frame::ComputeBoW()
 {
 	
-    /** 这个函数只有在当前帧的词袋是空的时候才回进行操作。步骤如下:<ul> */
-    if(mBowVec.empty())
+    /** 这个函数只有在当前帧还没有计算过词袋的时候才会进行操作。步骤如下:<ul> */
+    if(!mbBowComputed)
     {
 		/** <li> 1.要写入词袋信息,将以OpenCV格式存储的描述子 Frame::mDescriptors 转换成为vector<cv::Mat>存储</li> */
         vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
@@ -891,7 +896,8 @@ void Frame::ComputeBoW()
 								   mFeatVec,		//输出，保存有特征点索引的特征 vector
 								   4);				//获取某一层的节点索引
 		//@todo 为什么这里要指定“获取某一层的节点索引”？
-    }//判断当前帧的词袋是否是空的
+        mbBowComputed = true;
+    }//判断当前帧是否已经计算过词袋
     /** </ul> */
 }
 
@@ -1428,6 +1434,10 @@ void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)	//参数是深度图
     mvuRight = vector<float>(N,-1);
     mvDepth = vector<float>(N,-1);
 
+    // 直接通过行首指针和步长寻址深度图, 避免每个点都经过 cv::Mat::at 的行指针计算
+    const float* pDepth = imDepth.ptr<float>(0);
+    const size_t depthStep = imDepth.step1();
+
 	//开始遍历彩色图像中的所有特征点
     for(int i=0; i<N; i++)
     {
@@ -1437,11 +1447,11 @@ void Frame::ComputeStereoFromRGBD(const cv::Mat &imDepth)	//参数是深度图
         const cv::KeyPoint &kpU = mvKeysUn[i];
 
 		//获取其横纵坐标，注意 NOTICE 是校正前的特征点的
-        const float &v = kp.pt.y;
-        const float &u = kp.pt.x;
+        const int v = kp.pt.y;
+        const int u = kp.pt.x;
 		//从深度图像中获取这个特征点对应的深度点
         //NOTE 从这里看对深度图像进行去畸变处理是没有必要的,我们依旧可以直接通过未矫正的特征点的坐标来直接拿到深度数据
-        const float d = imDepth.at<float>(v,u);
+        const float d = pDepth[v*depthStep+u];
 
 		//
         /** <li> 如果获取到的深度点合法(d>0), 那么就保存这个特征点的深度,并且计算出等效的\在假想的右图中该特征点所匹配的特征点的横坐标 </li>
@@ -1488,9 +1498,9 @@ cv::Mat Frame::UnprojectStereo(const int &i)
         const float x = (u-cx)*z*invfx;
         const float y = (v-cy)*z*invfy;
 		//生成三维点（在当前相机坐标系下）
-        cv::Mat x3Dc = (cv::Mat_<float>(3,1) << x, y, z);
+        const Eigen::Vector3f x3Dc(x, y, z);
 		//然后计算这个点在世界坐标系下的坐标，这里是对的，但是公式还是要斟酌一下。首先变换成在没有旋转的相机坐标系下，最后考虑相机坐标系相对于世界坐标系的平移
-        return mRwc*x3Dc+mOw;
+        return Converter::toCvMat(Eigen::Vector3f(mRwc*x3Dc+mOw));
     }
     else
         /** <li> 如果深度值不合法，那么就返回一个空矩阵,表示计算失败 </li> */
@@ -1499,4 +1509,20 @@ cv::Mat Frame::UnprojectStereo(const int &i)
     /** </ul> */
 }
 
+// 批量反投影,输出写到调用者提供的缓存中
+void Frame::UnprojectStereo(const vector<int> &vIndices, vector<Eigen::Vector3f> &vx3Dw) const
+{
+    const size_t n = vIndices.size();
+    vx3Dw.resize(n);
+
+    for(size_t k=0; k<n; k++)
+    {
+        const int i = vIndices[k];
+        const float z = mvDepth[i];
+        const cv::KeyPoint &kp = mvKeysUn[i];
+        const Eigen::Vector3f x3Dc((kp.pt.x-cx)*z*invfx, (kp.pt.y-cy)*z*invfy, z);
+        vx3Dw[k] = mRwc*x3Dc+mOw;
+    }
+}
+
 } //namespace ORB_SLAM
@@ -46,14 +46,17 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
     mnFrameId(F.mnId),  mTimeStamp(F.mTimeStamp), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
     mfGridElementWidthInv(F.mfGridElementWidthInv), mfGridElementHeightInv(F.mfGridElementHeightInv),
     mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0),
-    mnLoopQuery(0), mnLoopWords(0), mnRelocQuery(0), mnRelocWords(0), mnBAGlobalForKF(0),
+    mnBAGlobalForKF(0),
     fx(F.fx), fy(F.fy), cx(F.cx), cy(F.cy), invfx(F.invfx), invfy(F.invfy),
     mbf(F.mbf), mb(F.mb), mThDepth(F.mThDepth), N(F.N), mvKeys(F.mvKeys), mvKeysUn(F.mvKeysUn),
     mvuRight(F.mvuRight), mvDepth(F.mvDepth), mDescriptors(F.mDescriptors.clone()),
-    mBowVec(F.mBowVec), mFeatVec(F.mFeatVec), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
+    mBowVec(F.mBowVec), mFeatVec(F.mFeatVec),
+    mbBowComputed(F.mbBowComputed), mnScaleLevels(F.mnScaleLevels), mfScaleFactor(F.mfScaleFactor),
     mfLogScaleFactor(F.mfLogScaleFactor), mvScaleFactors(F.mvScaleFactors), mvLevelSigma2(F.mvLevelSigma2),
     mvInvLevelSigma2(F.mvInvLevelSigma2), mnMinX(F.mnMinX), mnMinY(F.mnMinY), mnMaxX(F.mnMaxX),
-    mnMaxY(F.mnMaxY), mK(F.mK), mvpMapPoints(F.mvpMapPoints), mpKeyFrameDB(pKFDB),
+    mnMaxY(F.mnMaxY), mK(F.mK), mvpMapPoints(F.mvpMapPoints),
+    mvbRedundantObservations(F.N,false), mnMapPoints(0), mnCloseMapPoints(0),
+    mnRedundantObservations(0), mnCloseRedundantObservations(0), mpKeyFrameDB(pKFDB),
     mpORBvocabulary(F.mpORBvocabulary), mbFirstConnection(true), mpParent(NULL), mbNotErase(false),
     mbToBeErased(false), mbBad(false), 
     mHalfBaseline(F.mb/2),      // 计算双目相机长度的一半
@@ -73,86 +76,101 @@ KeyFrame::KeyFrame(Frame &F, Map *pMap, KeyFrameDatabase *pKFDB):
 
     // 设置当前关键帧的位姿
     SetPose(F.mTcw);
+
+    // 从普通帧中继承来的地图点计入冗余计数
+    for(size_t i=0; i<mvpMapPoints.size(); i++)
+        UpdateMapPointCounts(i,static_cast<MapPoint*>(NULL),mvpMapPoints[i]);
 }
 
 // Bag of Words Representation 计算词袋表示
 void KeyFrame::ComputeBoW()
 {
-    // 如果没有提取词袋信息
-    if(mBowVec.empty() || mFeatVec.empty())
+    // 如果没有提取词袋信息(生成它的普通帧也没有计算过)
+    if(!mbBowComputed)
     {
         // 那么就从当前帧的描述子中转换得到词袋信息
         vector<cv::Mat> vCurrentDesc = Converter::toDescriptorVector(mDescriptors);
         // Feature vector associate features with nodes in the 4th level (from leaves up)
         // We assume the vocabulary tree has 6 levels, change the 4 otherwise  //?
         mpORBvocabulary->transform(vCurrentDesc,mBowVec,mFeatVec,4);
+        mbBowComputed = true;
     }
 }
 
 // 设置当前关键帧的位姿
 void KeyFrame::SetPose(const cv::Mat &Tcw_)
+{
+    SetPose(Converter::toMatrix3f(Tcw_.rowRange(0,3).colRange(0,3)),Converter::toVector3f(Tcw_.rowRange(0,3).col(3)));
+}
+
+void KeyFrame::SetPose(const Eigen::Matrix3f &Rcw, const Eigen::Vector3f &tcw)
 {
     unique_lock<mutex> lock(mMutexPose);
-    Tcw_.copyTo(Tcw);
-    cv::Mat Rcw = Tcw.rowRange(0,3).colRange(0,3);
-    cv::Mat tcw = Tcw.rowRange(0,3).col(3);
-    cv::Mat Rwc = Rcw.t();
+    mRcw = Rcw;
+    mtcw = tcw;
+    mRwc = Rcw.transpose();
     // 和普通帧中进行的操作相同
-    Ow = -Rwc*tcw;
-
-    // 计算当前位姿的逆
-    Twc = cv::Mat::eye(4,4,Tcw.type());
-    Rwc.copyTo(Twc.rowRange(0,3).colRange(0,3));
-    Ow.copyTo(Twc.rowRange(0,3).col(3));
+    mOw = -mRwc*tcw;
 
-    // center为相机坐标系（左目）下，立体相机中心的坐标
     // 立体相机中心点坐标与左目相机坐标之间只是在x轴上相差mHalfBaseline,
-    // 因此可以看出，立体相机中两个摄像头的连线为x轴，正方向为左目相机指向右目相机 (齐次坐标)
-    cv::Mat center = (cv::Mat_<float>(4,1) << mHalfBaseline, 0 , 0, 1);
+    // 因此可以看出，立体相机中两个摄像头的连线为x轴，正方向为左目相机指向右目相机
     // 世界坐标系下，左目相机中心到立体相机中心的向量，方向由左目相机指向立体相机中心
-    Cw = Twc*center;
+    mCw = mRwc.col(0)*mHalfBaseline+mOw;
 }
 
 // 获取位姿
 cv::Mat KeyFrame::GetPose()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.clone();
+    return Converter::toCvSE3(mRcw,mtcw);
+}
+
+void KeyFrame::GetPose(Eigen::Matrix3f &Rcw, Eigen::Vector3f &tcw)
+{
+    unique_lock<mutex> lock(mMutexPose);
+    Rcw = mRcw;
+    tcw = mtcw;
 }
 
 // 获取位姿的逆
 cv::Mat KeyFrame::GetPoseInverse()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Twc.clone();
+    return Converter::toCvSE3(mRwc,mOw);
 }
 
 // 获取(左目)相机的中心
 cv::Mat KeyFrame::GetCameraCenter()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Ow.clone();
+    return Converter::toCvMat(mOw);
+}
+
+Eigen::Vector3f KeyFrame::GetCameraCenterEigen()
+{
+    unique_lock<mutex> lock(mMutexPose);
+    return mOw;
 }
 
 // 获取双目相机的中心,这个只有在可视化的时候才会用到
 cv::Mat KeyFrame::GetStereoCenter()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Cw.clone();
+    return Converter::toCvMat(mCw);
 }
 
 // 获取姿态
 cv::Mat KeyFrame::GetRotation()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).colRange(0,3).clone();
+    return Converter::toCvMat(mRcw);
 }
 
 // 获取位置
 cv::Mat KeyFrame::GetTranslation()
 {
     unique_lock<mutex> lock(mMutexPose);
-    return Tcw.rowRange(0,3).col(3).clone();
+    return Converter::toCvMat(mtcw);
 }
 
 // 为关键帧之间添加连接
@@ -284,6 +302,7 @@ int KeyFrame::GetWeight(KeyFrame *pKF)
 void KeyFrame::AddMapPoint(MapPoint *pMP, const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
+    UpdateMapPointCounts(idx,mvpMapPoints[idx],pMP);
     mvpMapPoints[idx]=pMP;
 }
 
@@ -292,6 +311,7 @@ void KeyFrame::EraseMapPointMatch(const size_t &idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
     // NOTE 使用这种方式表示其中的某个地图点被删除
+    UpdateMapPointCounts(idx,mvpMapPoints[idx],static_cast<MapPoint*>(NULL));
     mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
 }
 
@@ -301,15 +321,95 @@ void KeyFrame::EraseMapPointMatch(MapPoint* pMP)
     // 其实和上面函数的操作差不多,不过是先从指针获取到索引,然后再进行删除罢了
     int idx = pMP->GetIndexInKeyFrame(this);
     if(idx>=0)
+    {
+        UpdateMapPointCounts(idx,mvpMapPoints[idx],static_cast<MapPoint*>(NULL));
         mvpMapPoints[idx]=static_cast<MapPoint*>(NULL);
+    }
 }
 
 // 地图点的替换
 void KeyFrame::ReplaceMapPointMatch(const size_t &idx, MapPoint* pMP)
 {
+    UpdateMapPointCounts(idx,mvpMapPoints[idx],pMP);
     mvpMapPoints[idx]=pMP;
 }
 
+void KeyFrame::UpdateMapPointCounts(const size_t &idx, MapPoint* pOld, MapPoint* pNew)
+{
+    // 只有从无到有或者从有到无的时候计数才会变化
+    const int nDelta = (pNew?1:0) - (pOld?1:0);
+    if(nDelta==0)
+        return;
+
+    unique_lock<mutex> lock(mMutexRedundancy);
+    mnMapPoints += nDelta;
+    if(IsCloseKeyPoint(idx))
+        mnCloseMapPoints += nDelta;
+}
+
+void KeyFrame::SetRedundantObservation(const size_t &idx, const bool bRedundant)
+{
+    unique_lock<mutex> lock(mMutexRedundancy);
+    if(mvbRedundantObservations[idx]==bRedundant)
+        return;
+    mvbRedundantObservations[idx] = bRedundant;
+
+    const int nDelta = bRedundant?1:-1;
+    mnRedundantObservations += nDelta;
+    if(IsCloseKeyPoint(idx))
+        mnCloseRedundantObservations += nDelta;
+}
+
+void KeyFrame::GetRedundancyCounts(const bool bOnlyClose, int &nMPs, int &nRedundant)
+{
+    unique_lock<mutex> lock(mMutexRedundancy);
+    if(bOnlyClose)
+    {
+        nMPs = mnCloseMapPoints;
+        nRedundant = mnCloseRedundantObservations;
+    }
+    else
+    {
+        nMPs = mnMapPoints;
+        nRedundant = mnRedundantObservations;
+    }
+}
+
+void KeyFrame::ComputeRedundancyCounts(const bool bOnlyClose, int &nMPs, int &nRedundant)
+{
+    const vector<MapPoint*> vpMapPoints = GetMapPointMatches();
+    const int thObs = 3;
+
+    nMPs = 0;
+    nRedundant = 0;
+    for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
+    {
+        MapPoint* pMP = vpMapPoints[i];
+        if(!pMP || pMP->isBad())
+            continue;
+        if(bOnlyClose && !IsCloseKeyPoint(i))
+            continue;
+
+        nMPs++;
+        if(pMP->Observations()<=thObs)
+            continue;
+
+        // 至少有thObs个其它关键帧在相同或者更精细的尺度上观测到该点
+        const int &scaleLevel = mvKeysUn[i].octave;
+        const map<KeyFrame*, size_t> observations = pMP->GetObservations();
+        int nObs=0;
+        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            if(mit->first==this)
+                continue;
+            if(mit->first->mvKeysUn[mit->second].octave<=scaleLevel+1)
+                nObs++;
+        }
+        if(nObs>=thObs)
+            nRedundant++;
+    }
+}
+
 // 获取当前关键帧中的所有地图点
 set<MapPoint*> KeyFrame::GetMapPoints()
 {
@@ -711,7 +811,7 @@ void KeyFrame::SetBadFlag()
 
         mpParent->EraseChild(this);
         // 如果当前的关键帧要被删除的话就要计算这个,表示当前关键帧到原本的父关键帧的位姿变换 (注意在这个删除的过程中,其实并没有将当前关键帧中存储的父关键帧的指针删除掉)
-        mTcp = Tcw*mpParent->GetPoseInverse();
+        mTcp = Converter::toCvSE3(mRcw,mtcw)*mpParent->GetPoseInverse();
         // 嗯,确定当前关键帧已经完蛋了
         mbBad = true;
     }   //退出互斥锁的保护区域
@@ -817,43 +917,64 @@ cv::Mat KeyFrame::UnprojectStereo(int i)
         const float v = mvKeys[i].pt.y;
         const float x = (u-cx)*z*invfx;
         const float y = (v-cy)*z*invfy;
-        cv::Mat x3Dc = (cv::Mat_<float>(3,1) << x, y, z);
+        const Eigen::Vector3f x3Dc(x, y, z);
 
         unique_lock<mutex> lock(mMutexPose);
         // 由相机坐标系转换到世界坐标系
-        // Twc为相机坐标系到世界坐标系的变换矩阵
-        // Twc.rosRange(0,3).colRange(0,3)取Twc矩阵的前3行与前3列
-        return Twc.rowRange(0,3).colRange(0,3)*x3Dc+Twc.rowRange(0,3).col(3);
+        return Converter::toCvMat(Eigen::Vector3f(mRwc*x3Dc+mOw));
     }
     else
         return cv::Mat();
 }
 
+// 批量反投影,和单个点的版本一样使用校正前的特征点
+void KeyFrame::UnprojectStereo(const vector<int> &vIndices, vector<Eigen::Vector3f> &vx3Dw)
+{
+    const size_t n = vIndices.size();
+    vx3Dw.resize(n);
+
+    Eigen::Matrix3f Rwc;
+    Eigen::Vector3f Ow;
+    {
+        unique_lock<mutex> lock(mMutexPose);
+        Rwc = mRwc;
+        Ow = mOw;
+    }
+
+    for(size_t k=0; k<n; k++)
+    {
+        const int i = vIndices[k];
+        const float z = mvDepth[i];
+        const cv::KeyPoint &kp = mvKeys[i];
+        const Eigen::Vector3f x3Dc((kp.pt.x-cx)*z*invfx, (kp.pt.y-cy)*z*invfy, z);
+        vx3Dw[k] = Rwc*x3Dc+Ow;
+    }
+}
+
 // Compute Scene Depth (q=2 median). Used in monocular. 评估当前关键帧场景深度，q=2表示中值. 只是在单目情况下才会使用
 // 其实过程就是对当前关键帧下所有地图点的深度进行从小到大排序,返回距离头部其中1/q处的深度值作为当前场景的平均深度
 float KeyFrame::ComputeSceneMedianDepth(const int q)
 {
     vector<MapPoint*> vpMapPoints;
-    cv::Mat Tcw_;
+    Eigen::Vector3f Rcw2;
+    float zcw;
     {
         unique_lock<mutex> lock(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPose);
         vpMapPoints = mvpMapPoints;
-        Tcw_ = Tcw.clone();
+        Rcw2 = mRcw.row(2).transpose();
+        zcw = mtcw(2);
     }
 
     vector<float> vDepths;
     vDepths.reserve(N);
-    cv::Mat Rcw2 = Tcw_.row(2).colRange(0,3);
-    Rcw2 = Rcw2.t();
-    float zcw = Tcw_.at<float>(2,3);
     // 遍历每一个地图点,计算并保存其在当前关键帧下的深度
     for(int i=0; i<N; i++)
     {
         if(mvpMapPoints[i])
         {
             MapPoint* pMP = mvpMapPoints[i];
-            cv::Mat x3Dw = pMP->GetWorldPos();
+            const Eigen::Vector3f x3Dw = pMP->GetWorldPosEigen();
             float z = Rcw2.dot(x3Dw)+zcw; // (R*x3Dw+t)的第三行，即z
             vDepths.push_back(z);
         }
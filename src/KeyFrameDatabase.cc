@@ -35,59 +35,174 @@
 #include "Thirdparty/DBoW2/DBoW2/BowVector.h"
 
 #include<mutex>
+#include<algorithm>
 
 using namespace std;
 
 namespace ORB_SLAM2
 {
 
+/// 失效的项至少有这么多,并且超过总项数的一半时才压缩倒排索引;压缩需要遍历整个倒排索引(单词数在百万量级)
+static const size_t kMinDeadPostingsToCompact = 100000;
+
 // 构造函数
 KeyFrameDatabase::KeyFrameDatabase (const ORBVocabulary &voc):
-    mpVoc(&voc)
+    mpVoc(&voc), mnPostings(0), mnDeadPostings(0)
 {
     // 数据库的主要内容了
     mvInvertedFile.resize(voc.size()); // number of words
+    mbL1Scoring = voc.getScoringType()==DBoW2::L1_NORM;
 }
 
 // 根据关键帧的词包，更新数据库的倒排索引
 void KeyFrameDatabase::add(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    unique_lock<SharedMutex> lock(mMutex);
+
+    if(mmKeyFrameSlots.count(pKF))
+        return;
+
+    // 为关键帧分配一个新的序号
+    const unsigned int nSlot = mvpKeyFrames.size();
+    mvpKeyFrames.push_back(pKF);
+    mvnSlotPostings.push_back(pKF->mBowVec.size());
+    mmKeyFrameSlots[pKF] = nSlot;
 
     // 为每一个word添加该KeyFrame
     for(DBoW2::BowVector::const_iterator vit= pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
-        mvInvertedFile[vit->first].push_back(pKF);
+    {
+        Posting posting;
+        posting.nSlot = nSlot;
+        posting.fWeight = vit->second;
+        mvInvertedFile[vit->first].push_back(posting);
+    }
+    mnPostings += pKF->mBowVec.size();
 }
 
 // 关键帧被删除后，更新数据库的倒排索引
 void KeyFrameDatabase::erase(KeyFrame* pKF)
 {
-    unique_lock<mutex> lock(mMutex);
+    unique_lock<SharedMutex> lock(mMutex);
+
+    unordered_map<KeyFrame*,unsigned int>::iterator mit = mmKeyFrameSlots.find(pKF);
+    if(mit==mmKeyFrameSlots.end())
+        return;
 
     // Erase elements in the Inverse File for the entry
-    // 每一个KeyFrame包含多个words，遍历mvInvertedFile中的这些words，然后在word中删除该KeyFrame
-    for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit!=vend; vit++)
+    // 只把序号标记为失效,倒排索引中对应的项在查询时被跳过,不需要逐个单词查找和删除
+    const unsigned int nSlot = mit->second;
+    mvpKeyFrames[nSlot] = static_cast<KeyFrame*>(NULL);
+    mnDeadPostings += mvnSlotPostings[nSlot];
+    mmKeyFrameSlots.erase(mit);
+
+    if(mnDeadPostings>=kMinDeadPostingsToCompact && 2*mnDeadPostings>mnPostings)
+        Compact();
+}
+
+// 删除倒排索引中已经失效的项,重新为关键帧编号
+void KeyFrameDatabase::Compact()
+{
+    // 旧序号到新序号的映射,失效的序号映射为nDead
+    const unsigned int nDead = static_cast<unsigned int>(-1);
+    vector<unsigned int> vnNewSlots(mvpKeyFrames.size(), nDead);
+    unsigned int nLive = 0;
+    for(size_t i=0, iend=mvpKeyFrames.size(); i<iend; i++)
     {
-        // List of keyframes that share the word
+        KeyFrame* pKF = mvpKeyFrames[i];
+        if(!pKF)
+            continue;
+        vnNewSlots[i] = nLive;
+        mvpKeyFrames[nLive] = pKF;
+        mvnSlotPostings[nLive] = mvnSlotPostings[i];
+        mmKeyFrameSlots[pKF] = nLive;
+        nLive++;
+    }
+    mvpKeyFrames.resize(nLive);
+    mvnSlotPostings.resize(nLive);
 
-        list<KeyFrame*> &lKFs = mvInvertedFile[vit->first];
-        // 这个效率有点低啊
-        for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
+    for(size_t w=0, wend=mvInvertedFile.size(); w<wend; w++)
+    {
+        vector<Posting> &vPostings = mvInvertedFile[w];
+        size_t nKept = 0;
+        for(size_t j=0, jend=vPostings.size(); j<jend; j++)
         {
-            if(pKF==*lit)
-            {
-                lKFs.erase(lit);
-                break;
-            }
+            const unsigned int nSlot = vnNewSlots[vPostings[j].nSlot];
+            if(nSlot==nDead)
+                continue;
+            vPostings[nKept].nSlot = nSlot;
+            vPostings[nKept].fWeight = vPostings[j].fWeight;
+            nKept++;
         }
+        vPostings.resize(nKept);
     }
+
+    mnPostings -= mnDeadPostings;
+    mnDeadPostings = 0;
 }
 
 // 清空关键帧数据库
 void KeyFrameDatabase::clear()
 {
+    unique_lock<SharedMutex> lock(mMutex);
+
     mvInvertedFile.clear();// mvInvertedFile[i]表示包含了第i个word id的所有关键帧
     mvInvertedFile.resize(mpVoc->size());// mpVoc：预先训练好的词典
+    mvpKeyFrames.clear();
+    mvnSlotPostings.clear();
+    mmKeyFrameSlots.clear();
+    mnPostings = 0;
+    mnDeadPostings = 0;
+}
+
+// 统计与词袋向量有共同单词的关键帧,以及共有的单词数和相似度评分
+void KeyFrameDatabase::SearchSharedWords(const DBoW2::BowVector &vBowVec, vector<QueryCandidate> &vCandidates)
+{
+    // 按序号存放的累加器,只在这次查询中使用
+    const size_t nSlots = mvpKeyFrames.size();
+    vector<int> vnWords(nSlots,0);
+    vector<double> vScores(mbL1Scoring ? nSlots : 0, 0.0);
+    vector<unsigned int> vnTouched;
+
+    // words是检测图像是否匹配的枢纽，遍历每一个word
+    for(DBoW2::BowVector::const_iterator vit=vBowVec.begin(), vend=vBowVec.end(); vit != vend; vit++)
+    {
+        // 提取所有包含该word的KeyFrame
+        const vector<Posting> &vPostings = mvInvertedFile[vit->first];
+        const double qi = vit->second;
+        for(vector<Posting>::const_iterator pit=vPostings.begin(), pend=vPostings.end(); pit!=pend; pit++)
+        {
+            const unsigned int nSlot = pit->nSlot;
+            // 已经删除的关键帧
+            if(!mvpKeyFrames[nSlot])
+                continue;
+            if(vnWords[nSlot]==0)
+                vnTouched.push_back(nSlot);
+            vnWords[nSlot]++;
+            // L1评分: 对两者都不为0的单词累加 min(v_i,w_i),与DBoW2::L1Scoring::score相同
+            if(mbL1Scoring)
+                vScores[nSlot] += std::min(qi,static_cast<double>(pit->fWeight));
+        }
+    }
+
+    vCandidates.clear();
+    vCandidates.reserve(vnTouched.size());
+    for(size_t i=0, iend=vnTouched.size(); i<iend; i++)
+    {
+        const unsigned int nSlot = vnTouched[i];
+        QueryCandidate candidate;
+        candidate.pKF = mvpKeyFrames[nSlot];
+        candidate.nWords = vnWords[nSlot];
+        candidate.fScore = mbL1Scoring ? static_cast<float>(vScores[nSlot]) : -1.0f;
+        vCandidates.push_back(candidate);
+    }
+}
+
+// 得到候选关键帧的相似度评分
+float KeyFrameDatabase::GetScore(const DBoW2::BowVector &vBowVec, QueryCandidate &candidate)
+{
+    if(candidate.fScore<0)
+        candidate.fScore = mpVoc->score(vBowVec,candidate.pKF->mBowVec);
+    return candidate.fScore;
 }
 
 /*
@@ -105,40 +220,28 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 {
     // 提出所有与该pKF相连的KeyFrame，这些相连Keyframe都是局部相连，在闭环检测的时候将被剔除
     set<KeyFrame*> spConnectedKeyFrames = pKF->GetConnectedKeyFrames();
-    list<KeyFrame*> lKFsSharingWords;// 用于保存可能与pKF形成回环的候选帧（只要有相同的word，且不属于局部相连帧）
+    vector<QueryCandidate> vCandidates;// 用于保存可能与pKF形成回环的候选帧（只要有相同的word，且不属于局部相连帧）
     //这里的局部相连帧,就是和当前关键帧具有共视关系的关键帧
 
     // Search all keyframes that share a word with current keyframes
     // Discard keyframes connected to the query keyframe
     //. 步骤1：找出和当前帧具有公共单词的所有关键帧（不包括与当前帧链接的关键帧）
     {
-        unique_lock<mutex> lock(mMutex);
+        SharedLock lock(mMutex);
+        SearchSharedWords(pKF->mBowVec,vCandidates);
+    }
 
-        // words是检测图像是否匹配的枢纽，遍历该pKF的每一个word
-        for(DBoW2::BowVector::const_iterator vit=pKF->mBowVec.begin(), vend=pKF->mBowVec.end(); vit != vend; vit++)
-        {
-            // 提取所有包含该word的KeyFrame
-            list<KeyFrame*> &lKFs =   mvInvertedFile[vit->first];
-            // 然后对这些关键帧展开遍历
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnLoopQuery!=pKF->mnId)// pKFi还没有标记为pKF的候选帧
-                {
-                    pKFi->mnLoopWords=0;
-                    if(!spConnectedKeyFrames.count(pKFi))// 与pKF局部链接的关键帧不进入闭环候选帧
-                    {
-                        pKFi->mnLoopQuery=pKF->mnId;// pKFi标记为pKF的候选帧，之后直接跳过判断
-                        lKFsSharingWords.push_back(pKFi);
-                    }
-                }
-                pKFi->mnLoopWords++;// 记录pKFi与pKF具有相同word的个数
-            }
-        }
+    // 与pKF局部链接的关键帧不进入闭环候选帧
+    size_t nCandidates = 0;
+    for(size_t i=0, iend=vCandidates.size(); i<iend; i++)
+    {
+        if(!spConnectedKeyFrames.count(vCandidates[i].pKF))
+            vCandidates[nCandidates++] = vCandidates[i];
     }
+    vCandidates.resize(nCandidates);
 
     // 如果没有关键帧和这个关键帧具有相同的单词,那么就返回空
-    if(lKFsSharingWords.empty())
+    if(vCandidates.empty())
         return vector<KeyFrame*>();
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
@@ -146,33 +249,31 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
     // Only compare against those keyframes that share enough words
     //. 步骤2：统计所有闭环候选帧中与pKF具有共同单词最多的单词数
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(size_t i=0, iend=vCandidates.size(); i<iend; i++)
     {
-        if((*lit)->mnLoopWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnLoopWords;
+        if(vCandidates[i].nWords>maxCommonWords)
+            maxCommonWords=vCandidates[i].nWords;
     }
 
     int minCommonWords = maxCommonWords*0.8f;
 
-    int nscores=0;
-
     // Compute similarity score. Retain the matches whose score is higher than minScore
     //. 步骤3：遍历所有闭环候选帧，挑选出共有单词数大于minCommonWords且单词匹配度大于minScore存入lScoreAndMatch
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    // 同时记录共有单词数大于minCommonWords的候选帧,步骤4中查找共视关键帧的评分
+    unordered_map<KeyFrame*,float> mCandidateScores;
+    for(size_t i=0, iend=vCandidates.size(); i<iend; i++)
     {
-        KeyFrame* pKFi = *lit;
+        QueryCandidate &candidate = vCandidates[i];
 
         // pKF只和具有共同单词较多的关键帧进行比较，需要大于minCommonWords
-        if(pKFi->mnLoopWords>minCommonWords)
+        if(candidate.nWords>minCommonWords)
         {
-            nscores++;// 这个变量后面没有用到
-
             // 相似度评分就是在这里计算的
-            float si = mpVoc->score(pKF->mBowVec,pKFi->mBowVec);
+            float si = GetScore(pKF->mBowVec,candidate);
 
-            pKFi->mLoopScore = si;
+            mCandidateScores[candidate.pKF] = si;
             if(si>=minScore)
-                lScoreAndMatch.push_back(make_pair(si,pKFi));
+                lScoreAndMatch.push_back(make_pair(si,candidate.pKF));
         }
     }
 
@@ -198,13 +299,15 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnLoopQuery==pKF->mnId && pKF2->mnLoopWords>minCommonWords)
+            // 只有pKF2也在闭环候选帧中,并且共有单词数大于minCommonWords，才能贡献分数
+            unordered_map<KeyFrame*,float>::const_iterator mit = mCandidateScores.find(pKF2);
+            if(mit!=mCandidateScores.end())
             {
-                accScore+=pKF2->mLoopScore;// 因为pKF2->mnLoopQuery==pKF->mnId，所以只有pKF2也在闭环候选帧中，才能贡献分数
-                if(pKF2->mLoopScore>bestScore)// 统计得到组里分数最高的KeyFrame
+                accScore+=mit->second;
+                if(mit->second>bestScore)// 统计得到组里分数最高的KeyFrame
                 {
                     pBestKF=pKF2;
-                    bestScore = pKF2->mLoopScore;
+                    bestScore = mit->second;
                 }
             }
         }
@@ -252,63 +355,46 @@ vector<KeyFrame*> KeyFrameDatabase::DetectLoopCandidates(KeyFrame* pKF, float mi
 vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
 {
     // 相对于关键帧的闭环检测DetectLoopCandidates，重定位检测中没法获得相连的关键帧
-    list<KeyFrame*> lKFsSharingWords;// 用于保存可能与F形成回环的候选帧（只要有相同的word，且不属于局部相连帧(这里其实已经没有了所谓的"局部相连帧"的概念了)）
+    vector<QueryCandidate> vCandidates;// 用于保存可能与F形成回环的候选帧（只要有相同的word，且不属于局部相连帧(这里其实已经没有了所谓的"局部相连帧"的概念了)）
 
     // Search all keyframes that share a word with current frame
     //. 步骤1：找出和当前帧具有公共单词的所有关键帧
     {
-        unique_lock<mutex> lock(mMutex);
-
-        // words是检测图像是否匹配的枢纽，遍历该pKF的每一个word
-        for(DBoW2::BowVector::const_iterator vit=F->mBowVec.begin(), vend=F->mBowVec.end(); vit != vend; vit++)
-        {
-            // 提取所有包含该word的KeyFrame
-            list<KeyFrame*> &lKFs = mvInvertedFile[vit->first];
-
-            for(list<KeyFrame*>::iterator lit=lKFs.begin(), lend= lKFs.end(); lit!=lend; lit++)
-            {
-                KeyFrame* pKFi=*lit;
-                if(pKFi->mnRelocQuery!=F->mnId)// pKFi还没有标记为pKF的候选帧
-                {
-                    pKFi->mnRelocWords=0;
-                    pKFi->mnRelocQuery=F->mnId;
-                    lKFsSharingWords.push_back(pKFi);
-                }
-                pKFi->mnRelocWords++;
-            }
-        }
+        SharedLock lock(mMutex);
+        SearchSharedWords(F->mBowVec,vCandidates);
     }
-    if(lKFsSharingWords.empty())
+    if(vCandidates.empty())
         return vector<KeyFrame*>();
 
     // Only compare against those keyframes that share enough words
     //. 步骤2：统计所有闭环候选帧中与当前帧F具有共同单词最多的单词数，并以此决定阈值 
     int maxCommonWords=0;
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    for(size_t i=0, iend=vCandidates.size(); i<iend; i++)
     {
-        if((*lit)->mnRelocWords>maxCommonWords)
-            maxCommonWords=(*lit)->mnRelocWords;
+        if(vCandidates[i].nWords>maxCommonWords)
+            maxCommonWords=vCandidates[i].nWords;
     }
 
     int minCommonWords = maxCommonWords*0.8f;
 
     list<pair<float,KeyFrame*> > lScoreAndMatch;
 
-    int nscores=0;
+    // 所有候选帧在vCandidates中的位置,步骤4中查找共视关键帧的评分
+    unordered_map<KeyFrame*,size_t> mCandidateIndices;
+    mCandidateIndices.reserve(vCandidates.size());
 
     // Compute similarity score.
-    //. 步骤3：遍历所有闭环候选帧，挑选出共有单词数大于阈值minCommonWords且单词匹配度大于minScore存入lScoreAndMatch
-    for(list<KeyFrame*>::iterator lit=lKFsSharingWords.begin(), lend= lKFsSharingWords.end(); lit!=lend; lit++)
+    //. 步骤3：遍历所有闭环候选帧，挑选出共有单词数大于阈值minCommonWords的关键帧存入lScoreAndMatch
+    for(size_t i=0, iend=vCandidates.size(); i<iend; i++)
     {
-        KeyFrame* pKFi = *lit;
+        QueryCandidate &candidate = vCandidates[i];
+        mCandidateIndices[candidate.pKF] = i;
 
         // 当前帧F只和具有共同单词较多的关键帧进行比较，需要大于minCommonWords
-        if(pKFi->mnRelocWords>minCommonWords)
+        if(candidate.nWords>minCommonWords)
         {
-            nscores++;// 这个变量后面没有用到
-            float si = mpVoc->score(F->mBowVec,pKFi->mBowVec);
-            pKFi->mRelocScore=si;
-            lScoreAndMatch.push_back(make_pair(si,pKFi));
+            float si = GetScore(F->mBowVec,candidate);
+            lScoreAndMatch.push_back(make_pair(si,candidate.pKF));
         }
     }
 
@@ -333,14 +419,17 @@ vector<KeyFrame*> KeyFrameDatabase::DetectRelocalizationCandidates(Frame *F)
         for(vector<KeyFrame*>::iterator vit=vpNeighs.begin(), vend=vpNeighs.end(); vit!=vend; vit++)
         {
             KeyFrame* pKF2 = *vit;
-            if(pKF2->mnRelocQuery!=F->mnId)
+            unordered_map<KeyFrame*,size_t>::const_iterator mit = mCandidateIndices.find(pKF2);
+            if(mit==mCandidateIndices.end())
                 continue;
 
-            accScore+=pKF2->mRelocScore;// 只有pKF2也在闭环候选帧中，才能贡献分数
-            if(pKF2->mRelocScore>bestScore)// 统计得到组里分数最高的KeyFrame
+            // 只有pKF2也在闭环候选帧中，才能贡献分数
+            const float score2 = GetScore(F->mBowVec,vCandidates[mit->second]);
+            accScore+=score2;
+            if(score2>bestScore)// 统计得到组里分数最高的KeyFrame
             {
                 pBestKF=pKF2;
-                bestScore = pKF2->mRelocScore;
+                bestScore = score2;
             }
 
         }
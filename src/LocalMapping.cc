@@ -33,6 +33,8 @@
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
 #include "Optimizer.h"
+#include "Converter.h"
+#include "Parallel.h"
 
 #include<mutex>
 
@@ -40,10 +42,12 @@ namespace ORB_SLAM2
 {
 
 // 构造函数
-LocalMapping::LocalMapping(Map *pMap, const float bMonocular):
-    mbMonocular(bMonocular), mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
-    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true)
+LocalMapping::LocalMapping(Map *pMap, const int sensor):
+    mbMonocular(sensor==System::MONOCULAR), mSensor(sensor), mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
+    mbEventPending(false), mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true)
 {
+    mpLocalBAProblem = new LocalBAProblem();
+
     /*
      * NOTE 这里的终止机制看得我有点晕,大概整理一下,可能还有错误:
      * 首先是有个标志 mbNotStop ,如过这个标志位被置位那么线程就被禁止进入到 stop 状态
@@ -56,6 +60,20 @@ LocalMapping::LocalMapping(Map *pMap, const float bMonocular):
      */
 }
 
+// 设置局部BA的时间预算
+void LocalMapping::SetLocalBABudget(const float fTargetMs)
+{
+    unique_lock<mutex> lock(mMutexLocalBABudget);
+    mLocalBABudget.fTargetMs = fTargetMs;
+}
+
+// 获取局部BA的时间预算和最近一次的统计
+LocalBABudget LocalMapping::GetLocalBABudget()
+{
+    unique_lock<mutex> lock(mMutexLocalBABudget);
+    return mLocalBABudget;
+}
+
 // 设置回环检测线程句柄
 void LocalMapping::SetLoopCloser(LoopClosing* pLoopCloser)
 {
@@ -87,27 +105,41 @@ void LocalMapping::Run()
         // 等待处理的关键帧列表不为空
         if(CheckNewKeyFrames())
         {
-            // BoW conversion and insertion in Map
-            // VI-A keyframe insertion
-            // 计算关键帧特征点的BoW映射，将关键帧插入地图
-            ProcessNewKeyFrame();
-
-            // Check recent MapPoints
-            // VI-B recent map points culling
-            // 剔除ProcessNewKeyFrame函数中引入的不合格MapPoints
-            MapPointCulling();
-
-            // Triangulate new MapPoints
-            // VI-C new map points creation
-            // 相机运动过程中与相邻关键帧通过三角化恢复出一些MapPoints
-            CreateNewMapPoints();
+            // 队列中积压了多个关键帧时,把它们作为一批依次插入,剔除和三角化,
+            // 然后对这一批只做一次邻域融合和一次局部BA,而不是每个关键帧都跳过这两步.
+            // 一批最多包含进入时队列中的关键帧,并且不超过nMaxBatchKFs个,避免跟踪线程持续插入关键帧时
+            // 邻域融合和局部BA被一直推迟,而且它们的窗口无限增长
+            const int nMaxBatchKFs = 4;
+            const size_t nBatchKFs = min(KeyframesInQueue(),nMaxBatchKFs);
+            vector<KeyFrame*> vpBatchKFs;
+            vpBatchKFs.reserve(nBatchKFs);
+            do
+            {
+                // BoW conversion and insertion in Map
+                // VI-A keyframe insertion
+                // 计算关键帧特征点的BoW映射，将关键帧插入地图
+                ProcessNewKeyFrame();
+
+                // Check recent MapPoints
+                // VI-B recent map points culling
+                // 剔除ProcessNewKeyFrame函数中引入的不合格MapPoints
+                MapPointCulling();
+
+                // Triangulate new MapPoints
+                // VI-C new map points creation
+                // 相机运动过程中与相邻关键帧通过三角化恢复出一些MapPoints
+                CreateNewMapPoints();
+
+                vpBatchKFs.push_back(mpCurrentKeyFrame);
+            }
+            while(vpBatchKFs.size()<nBatchKFs && CheckNewKeyFrames() && !stopRequested());
 
             // 已经处理完队列中的最后的一个关键帧
             if(!CheckNewKeyFrames())
             {
                 // Find more matches in neighbor keyframes and fuse point duplications
-                // 检查并融合当前关键帧与相邻帧（两级相邻）重复的MapPoints
-                SearchInNeighbors();
+                // 检查并融合这一批关键帧与相邻帧（两级相邻）重复的MapPoints
+                SearchInNeighbors(vpBatchKFs);
             }
 
             // 终止BA的标志
@@ -117,10 +149,17 @@ void LocalMapping::Run()
             if(!CheckNewKeyFrames() && !stopRequested())
             {
                 // VI-D Local BA
-                // 当局部地图中的关键帧大于2个的时候进行局部地图的BA
+                // 当局部地图中的关键帧大于2个的时候进行局部地图的BA,局部窗口是这一批关键帧的局部地图的并集
                 if(mpMap->KeyFramesInMap()>2)
+                {
+                    // 优化时不持有锁,结束后把统计结果写回(保留期间可能被重新设置的目标耗时)
+                    LocalBABudget budget = GetLocalBABudget();
                     // 注意这里的第二个参数是按地址传递的,当这里的 mbAbortBA 状态发生变化的时候,这个优化函数也能够及时地注意到
-                    Optimizer::LocalBundleAdjustment(mpCurrentKeyFrame,&mbAbortBA, mpMap);
+                    Optimizer::LocalBundleAdjustment(vpBatchKFs,&mbAbortBA, mpMap, mSensor, &budget, mpLocalBAProblem);
+                    unique_lock<mutex> lock(mMutexLocalBABudget);
+                    budget.fTargetMs = mLocalBABudget.fTargetMs;
+                    mLocalBABudget = budget;
+                }
 
                 // Check redundant local Keyframes
                 // VI-E local keyframes culling
@@ -131,21 +170,26 @@ void LocalMapping::Run()
                 // 并且在Tracking中InsertKeyFrame函数的条件比较松，交给LocalMapping线程的关键帧会比较密
                 // 在这里再删除冗余的关键帧
                 // 也是本文的创新点之一吧(guoqing)
-                KeyFrameCulling();
+                // 批处理时检查这一批中每个关键帧的共视关键帧,这一批关键帧本身不会被剔除
+                KeyFrameCulling(vpBatchKFs);
             }
 
-            // 将当前帧加入到闭环检测队列中
-            // 注意这里不排除一开始的时候插入的关键帧是阔以的,但是在后来被设置成为了bad的情况,这个需要注意
-            mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
+            // 将这一批关键帧按顺序加入到闭环检测队列中
+            // 在这之前已经被剔除的关键帧已经从关键帧数据库中删除了,不能再交给闭环检测
+            for(size_t i=0; i<vpBatchKFs.size(); i++)
+            {
+                if(vpBatchKFs[i]->isBad())
+                    continue;
+                mpLoopCloser->InsertKeyFrame(vpBatchKFs[i]);
+            }
         }
         else if(Stop())     // 当要终止当前线程的时候
         {
             // Safe area to stop
             while(isStopped() && !CheckFinish())
             {
-                // 如果还没有结束利索,那么等
-                // usleep(3000);
-                std::this_thread::sleep_for(std::chrono::milliseconds(3));
+                // 如果还没有结束利索,那么等待Release或者RequestFinish的唤醒
+                WaitForEvent(false);
             }
             // 然后确定终止了就跳出这个线程的主循环
             if(CheckFinish())
@@ -162,9 +206,8 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        //usleep(3000);
-        std::this_thread::sleep_for(std::chrono::milliseconds(3));
-
+        // 空闲时在条件变量上等待,而不是每次都固定睡眠3ms
+        WaitForEvent(true);
     }
 
     // 设置线程已经终止
@@ -173,11 +216,33 @@ void LocalMapping::Run()
 
 // 插入关键帧,由外部线程调用;这里只是插入到列表中,等待线程主函数对其进行处理
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
+{
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        // 将关键帧插入到列表中
+        mlNewKeyFrames.push_back(pKF);
+        mbAbortBA=true;
+    }
+    mcvEvent.notify_one();
+}
+
+// 通知run函数有事件需要处理
+void LocalMapping::NotifyEvent()
+{
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mbEventPending = true;
+    }
+    mcvEvent.notify_one();
+}
+
+// run函数空闲时等待事件
+void LocalMapping::WaitForEvent(const bool bNewKeyFrames)
 {
     unique_lock<mutex> lock(mMutexNewKFs);
-    // 将关键帧插入到列表中
-    mlNewKeyFrames.push_back(pKF);
-    mbAbortBA=true;
+    while(!mbEventPending && !(bNewKeyFrames && !mlNewKeyFrames.empty()))
+        mcvEvent.wait(lock);
+    mbEventPending = false;
 }
 
 // 查看列表中是否有等待被插入的关键帧,
@@ -207,7 +272,7 @@ void LocalMapping::ProcessNewKeyFrame()
     }
 
     // Compute Bags of Words structures
-    // 步骤2：计算该关键帧特征点的Bow映射关系
+    // 步骤2：计算该关键帧特征点的Bow映射关系,生成它的普通帧已经计算过时直接复用
     mpCurrentKeyFrame->ComputeBoW();
 
     // Associate MapPoints to the new keyframe and update normal and descriptor
@@ -215,6 +280,9 @@ void LocalMapping::ProcessNewKeyFrame()
     // 在TrackLocalMap函数中将局部地图中的MapPoints与当前帧进行了匹配，
     // 但没有对这些匹配上的MapPoints与当前帧进行关联
     const vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
+    // 需要添加当前关键帧观测的地图点在vpMapPointMatches中的索引,后面并行地处理
+    vector<size_t> vnNewObservations;
+    vnNewObservations.reserve(vpMapPointMatches.size());
     // 对当前处理的这个关键帧中的所有的地图点展开遍历
     for(size_t i=0; i<vpMapPointMatches.size(); i++)
     {
@@ -227,27 +295,45 @@ void LocalMapping::ProcessNewKeyFrame()
 				// 为当前帧在tracking过程跟踪到的MapPoints更新属性
                 if(!pMP->IsInKeyFrame(mpCurrentKeyFrame))
                 {
-                    // 添加观测
-                    pMP->AddObservation(mpCurrentKeyFrame, i);
-                    // 获得该点的平均观测方向和观测距离范围
-                    pMP->UpdateNormalAndDepth();
-                    // 加入关键帧后，更新3d点的最佳描述子
-                    pMP->ComputeDistinctiveDescriptors();
+                    vnNewObservations.push_back(i);
                 }
                 else // this can only happen for new stereo points inserted by the Tracking
                 {
                     // 这种情况对应着,当前帧中已经包含了这个地图点,但是这个地图点中却没有包含这个关键帧的信息
 
                     // 当前帧生成的MapPoints
-                    // 将双目或RGBD跟踪过程中新插入的MapPoints放入mlpRecentAddedMapPoints，等待检查
+                    // 将双目或RGBD跟踪过程中新插入的MapPoints放入mvpRecentAddedMapPoints，等待检查
                     // CreateNewMapPoints函数中通过三角化也会生成MapPoints
                     // 这些MapPoints都会经过MapPointCulling函数的检验
-                    mlpRecentAddedMapPoints.push_back(pMP);  // 认为这些由当前关键帧生成的地图点不靠谱,将其加入到待检查的地图点列表中
+                    mvpRecentAddedMapPoints.push_back(pMP);  // 认为这些由当前关键帧生成的地图点不靠谱,将其加入到待检查的地图点列表中
                 }
             }
+            else
+            {
+                // 普通帧持有它的期间这个地图点已经被删除了,它不会再给这个关键帧发EraseMapPointMatch,
+                // 这里直接解除关联,否则它会一直算在关键帧剔除的地图点计数里
+                mpCurrentKeyFrame->EraseMapPointMatch(i);
+            }
         }
     }    
 
+    // 各个地图点的更新互相独立,只会锁住地图点自己的互斥量和读取观测关键帧的数据,所以可以分块并行.
+    // 其中ComputeDistinctiveDescriptors的复杂度和观测数目的平方成正比,对观测多的点是主要的开销
+    ParallelFor(vnNewObservations.size(), 32, [&](size_t begin, size_t end)
+    {
+        for(size_t j=begin; j<end; j++)
+        {
+            const size_t i = vnNewObservations[j];
+            MapPoint* pMP = vpMapPointMatches[i];
+            // 添加观测
+            pMP->AddObservation(mpCurrentKeyFrame, i);
+            // 获得该点的平均观测方向和观测距离范围
+            pMP->UpdateNormalAndDepth();
+            // 加入关键帧后，更新3d点的最佳描述子
+            pMP->ComputeDistinctiveDescriptors();
+        }
+    });
+
     // Update links in the Covisibility Graph
     // 步骤4：更新关键帧间的连接关系，Covisibility图和Essential图(tree)
     mpCurrentKeyFrame->UpdateConnections();
@@ -261,7 +347,6 @@ void LocalMapping::ProcessNewKeyFrame()
 void LocalMapping::MapPointCulling()
 {
     // Check Recent Added MapPoints
-    list<MapPoint*>::iterator lit = mlpRecentAddedMapPoints.begin();
     const unsigned long int nCurrentKFid = mpCurrentKeyFrame->mnId;
 
     // 观测阈值
@@ -272,39 +357,57 @@ void LocalMapping::MapPointCulling()
         nThObs = 3;
     const int cnThObs = nThObs;
 	
-	// 遍历等待检查的MapPoints
-    while(lit!=mlpRecentAddedMapPoints.end())
+    // 每个待检查MapPoint的检查结果
+    const int nKeep = 0;        // 继续留在检查列表中
+    const int nErase = 1;       // 从检查列表中删除
+    const int nCull = 2;        // 设置为坏点并从检查列表中删除
+    const size_t N = mvpRecentAddedMapPoints.size();
+    vector<int> vnResults(N,nKeep);
+
+	// 遍历等待检查的MapPoints,判断只读取每个点自己的状态,可以分块并行
+    ParallelFor(N, 256, [&](size_t begin, size_t end)
     {
-        MapPoint* pMP = *lit;
-        if(pMP->isBad())
-        {
-            // 步骤1：已经是坏点的MapPoints直接从检查链表中删除
-            lit = mlpRecentAddedMapPoints.erase(lit);
-        }
-        else if(pMP->GetFoundRatio()<0.25f)
+        for(size_t i=begin; i<end; i++)
         {
-            // 步骤2：将不满足VI-B条件的MapPoint剔除
-            // VI-B 条件1：
-            // 跟踪到该MapPoint的Frame数相比预计可观测到该MapPoint的Frame数的比例需大于25%
-            // IncreaseFound / IncreaseVisible < 25%，注意不一定是关键帧。
-            pMP->SetBadFlag();
-            lit = mlpRecentAddedMapPoints.erase(lit);
+            MapPoint* pMP = mvpRecentAddedMapPoints[i];
+            if(pMP->isBad())
+            {
+                // 步骤1：已经是坏点的MapPoints直接从检查链表中删除
+                vnResults[i] = nErase;
+            }
+            else if(pMP->GetFoundRatio()<0.25f)
+            {
+                // 步骤2：将不满足VI-B条件的MapPoint剔除
+                // VI-B 条件1：
+                // 跟踪到该MapPoint的Frame数相比预计可观测到该MapPoint的Frame数的比例需大于25%
+                // IncreaseFound / IncreaseVisible < 25%，注意不一定是关键帧。
+                vnResults[i] = nCull;
+            }
+            else if(((int)nCurrentKFid-(int)pMP->mnFirstKFid)>=2 && pMP->Observations()<=cnThObs)
+            {
+                // 步骤3：将不满足VI-B条件的MapPoint剔除
+                // VI-B 条件2：从该点建立开始，到现在已经过了不小于2个关键帧
+                // 但是观测到该点的关键帧数却不超过cnThObs帧，那么该点检验不合格
+                vnResults[i] = nCull;
+            }
+            else if(((int)nCurrentKFid-(int)pMP->mnFirstKFid)>=3)
+                // 步骤4：从建立该点开始，已经过了3个关键帧而没有被剔除，则认为是质量高的点
+                // 因此没有SetBadFlag()，仅从队列中删除，放弃继续对该MapPoint的检测
+                vnResults[i] = nErase;
         }
-        else if(((int)nCurrentKFid-(int)pMP->mnFirstKFid)>=2 && pMP->Observations()<=cnThObs)
-        {
-            // 步骤3：将不满足VI-B条件的MapPoint剔除
-            // VI-B 条件2：从该点建立开始，到现在已经过了不小于2个关键帧
-            // 但是观测到该点的关键帧数却不超过cnThObs帧，那么该点检验不合格
+    });
+
+    // SetBadFlag会修改观测关键帧和地图,串行执行;同时原地压缩检查列表
+    size_t nKept = 0;
+    for(size_t i=0; i<N; i++)
+    {
+        MapPoint* pMP = mvpRecentAddedMapPoints[i];
+        if(vnResults[i]==nCull)
             pMP->SetBadFlag();
-            lit = mlpRecentAddedMapPoints.erase(lit);
-        }
-        else if(((int)nCurrentKFid-(int)pMP->mnFirstKFid)>=3)
-            // 步骤4：从建立该点开始，已经过了3个关键帧而没有被剔除，则认为是质量高的点
-            // 因此没有SetBadFlag()，仅从队列中删除，放弃继续对该MapPoint的检测
-            lit = mlpRecentAddedMapPoints.erase(lit);
-        else
-            lit++;
+        else if(vnResults[i]==nKeep)
+            mvpRecentAddedMapPoints[nKept++] = pMP;
     }
+    mvpRecentAddedMapPoints.resize(nKept);
 }
 
 // 相机运动过程中和共视程度比较高的关键帧通过三角化恢复出一些MapPoints
@@ -345,6 +448,18 @@ void LocalMapping::CreateNewMapPoints()
     // 三角化成功的地图点的计数
     int nnew=0;
 
+    // 双目/RGBD: 当前关键帧的所有特征点一次性反投影, 结果按特征点的索引存放;
+    // 邻接关键帧则在得到匹配后只对匹配上的特征点批量反投影. 深度无效的点的结果不会被用到
+    vector<int> vUnprojectIdx1, vUnprojectIdx2;
+    vector<Eigen::Vector3f> vx3Dw1, vx3Dw2;
+    if(!mbMonocular)
+    {
+        vUnprojectIdx1.resize(mpCurrentKeyFrame->N);
+        for(int i=0; i<mpCurrentKeyFrame->N; i++)
+            vUnprojectIdx1[i] = i;
+        mpCurrentKeyFrame->UnprojectStereo(vUnprojectIdx1,vx3Dw1);
+    }
+
     // Search matches with epipolar restriction and triangulate
     // step 2：遍历相邻关键帧vpNeighKFs
     for(size_t i=0; i<vpNeighKFs.size(); i++)
@@ -392,6 +507,14 @@ void LocalMapping::CreateNewMapPoints()
         vector<pair<size_t,size_t> > vMatchedIndices;
         matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false);
 
+        if(!mbMonocular)
+        {
+            vUnprojectIdx2.resize(vMatchedIndices.size());
+            for(size_t ikp=0; ikp<vMatchedIndices.size(); ikp++)
+                vUnprojectIdx2[ikp] = vMatchedIndices[ikp].second;
+            pKF2->UnprojectStereo(vUnprojectIdx2,vx3Dw2);
+        }
+
         cv::Mat Rcw2 = pKF2->GetRotation();
         cv::Mat Rwc2 = Rcw2.t();
         cv::Mat tcw2 = pKF2->GetTranslation();
@@ -489,11 +612,11 @@ void LocalMapping::CreateNewMapPoints()
             }
             else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)  // 视差大的时候使用双目信息来恢复 - 直接反投影了
             {
-                x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);                
+                x3D = Converter::toCvMat(vx3Dw1[idx1]);
             }
             else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)  // 同上
             {
-                x3D = pKF2->UnprojectStereo(idx2);
+                x3D = Converter::toCvMat(vx3Dw2[ikp]);
             }
             else
                 continue; //No stereo and very low parallax, 放弃
@@ -617,7 +740,7 @@ void LocalMapping::CreateNewMapPoints()
 
             // step 6.10：将新产生的点放入检测队列
             // 这些MapPoints都会经过MapPointCulling函数的检验
-            mlpRecentAddedMapPoints.push_back(pMP);
+            mvpRecentAddedMapPoints.push_back(pMP);
 
             nnew++;
         }
@@ -625,8 +748,12 @@ void LocalMapping::CreateNewMapPoints()
 }
 
 // 检查并融合当前关键帧与相邻帧（两级相邻）重复的MapPoints
-void LocalMapping::SearchInNeighbors()
+void LocalMapping::SearchInNeighbors(const vector<KeyFrame*> &vpKFs)
 {
+    // 积压时这里的vpKFs是一批关键帧,它们的邻接关键帧取并集后只做一次融合;
+    // 用最新关键帧的id作为各种标记,正常情况下vpKFs中只有当前关键帧一个
+    KeyFrame* pLastKF = vpKFs.back();
+
     // Retrieve neighbor keyframes
     // STEP 1：获得当前关键帧在covisibility图中权重排名前nn的邻接关键帧
     // 找到当前帧一级相邻与二级相邻关键帧
@@ -636,30 +763,42 @@ void LocalMapping::SearchInNeighbors()
     if(mbMonocular)
         nn=20;
 
-    // 候选的一级相邻关键帧
-    const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
     // 筛选之后的一级相邻关键帧以及二级相邻关键帧
     vector<KeyFrame*> vpTargetKFs;
-    // 开始对所有候选的一级关键帧展开遍历：
-    for(vector<KeyFrame*>::const_iterator vit=vpNeighKFs.begin(), vend=vpNeighKFs.end(); vit!=vend; vit++)
+
+    // 这一批关键帧本身先做标记,不会被重复地当作邻接关键帧;多于一个时它们彼此之间也需要融合,所以也作为目标
+    for(vector<KeyFrame*>::const_iterator vit=vpKFs.begin(), vend=vpKFs.end(); vit!=vend; vit++)
     {
-        KeyFrame* pKFi = *vit;
-        // 没有和当前帧进行过融合的操作
-        if(pKFi->isBad() || pKFi->mnFuseTargetForKF == mpCurrentKeyFrame->mnId)
-            continue;
-        vpTargetKFs.push_back(pKFi);// 加入一级相邻帧
-        pKFi->mnFuseTargetForKF = mpCurrentKeyFrame->mnId;// 并标记已经加入
+        (*vit)->mnFuseTargetForKF = pLastKF->mnId;
+        if(vpKFs.size()>1 && !(*vit)->isBad())
+            vpTargetKFs.push_back(*vit);
+    }
 
-        // Extend to some second neighbors
-        const vector<KeyFrame*> vpSecondNeighKFs = pKFi->GetBestCovisibilityKeyFrames(5);
-        // 遍历得到的二级相邻关键帧
-        for(vector<KeyFrame*>::const_iterator vit2=vpSecondNeighKFs.begin(), vend2=vpSecondNeighKFs.end(); vit2!=vend2; vit2++)
+    for(vector<KeyFrame*>::const_iterator vitKF=vpKFs.begin(), vendKF=vpKFs.end(); vitKF!=vendKF; vitKF++)
+    {
+        // 候选的一级相邻关键帧
+        const vector<KeyFrame*> vpNeighKFs = (*vitKF)->GetBestCovisibilityKeyFrames(nn);
+        // 开始对所有候选的一级关键帧展开遍历：
+        for(vector<KeyFrame*>::const_iterator vit=vpNeighKFs.begin(), vend=vpNeighKFs.end(); vit!=vend; vit++)
         {
-            KeyFrame* pKFi2 = *vit2;
-            // 当然这个二级关键帧要求没有和当前关键帧发生融合,并且这个二级关键帧也不是当前关键帧
-            if(pKFi2->isBad() || pKFi2->mnFuseTargetForKF==mpCurrentKeyFrame->mnId || pKFi2->mnId==mpCurrentKeyFrame->mnId)
+            KeyFrame* pKFi = *vit;
+            // 没有和当前帧进行过融合的操作
+            if(pKFi->isBad() || pKFi->mnFuseTargetForKF == pLastKF->mnId)
                 continue;
-            vpTargetKFs.push_back(pKFi2);// 存入二级相邻帧
+            vpTargetKFs.push_back(pKFi);// 加入一级相邻帧
+            pKFi->mnFuseTargetForKF = pLastKF->mnId;// 并标记已经加入
+
+            // Extend to some second neighbors
+            const vector<KeyFrame*> vpSecondNeighKFs = pKFi->GetBestCovisibilityKeyFrames(5);
+            // 遍历得到的二级相邻关键帧
+            for(vector<KeyFrame*>::const_iterator vit2=vpSecondNeighKFs.begin(), vend2=vpSecondNeighKFs.end(); vit2!=vend2; vit2++)
+            {
+                KeyFrame* pKFi2 = *vit2;
+                // 当然这个二级关键帧要求没有和当前关键帧发生融合,并且这个二级关键帧也不是当前的关键帧
+                if(pKFi2->isBad() || pKFi2->mnFuseTargetForKF==pLastKF->mnId)
+                    continue;
+                vpTargetKFs.push_back(pKFi2);// 存入二级相邻帧
+            }
         }
     }
 
@@ -668,7 +807,19 @@ void LocalMapping::SearchInNeighbors()
     ORBmatcher matcher;
 
     // STEP 2：将当前帧的MapPoints分别与一级二级相邻帧(的MapPoints)进行融合 -- 正向
-    vector<MapPoint*> vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
+    // 多个关键帧时使用它们的MapPoints的并集
+    vector<MapPoint*> vpMapPointMatches = vpKFs.front()->GetMapPointMatches();
+    if(vpKFs.size()>1)
+    {
+        set<MapPoint*> spMapPoints;
+        for(vector<KeyFrame*>::const_iterator vit=vpKFs.begin(), vend=vpKFs.end(); vit!=vend; vit++)
+        {
+            const vector<MapPoint*> vpMPs = (*vit)->GetMapPointMatches();
+            spMapPoints.insert(vpMPs.begin(),vpMPs.end());
+        }
+        spMapPoints.erase(static_cast<MapPoint*>(NULL));
+        vpMapPointMatches.assign(spMapPoints.begin(),spMapPoints.end());
+    }
     for(vector<KeyFrame*>::iterator vit=vpTargetKFs.begin(), vend=vpTargetKFs.end(); vit!=vend; vit++)
     {
         KeyFrame* pKFi = *vit;
@@ -676,7 +827,7 @@ void LocalMapping::SearchInNeighbors()
         // 投影当前帧的MapPoints到相邻关键帧pKFi中，并判断是否有重复的MapPoints
         // 1.如果MapPoint能匹配关键帧的特征点，并且该点有对应的MapPoint，那么将两个MapPoint合并（选择观测数多的）
         // 2.如果MapPoint能匹配关键帧的特征点，并且该点没有对应的MapPoint，那么为该点添加MapPoint
-        // 注意这个时候对地图点融合的操作是立即生效的
+        // 注意这个时候对地图点融合的操作是立即生效的;已经在pKFi中的MapPoint会被Fuse跳过
         matcher.Fuse(pKFi,vpMapPointMatches);
     }
 
@@ -701,41 +852,55 @@ void LocalMapping::SearchInNeighbors()
                 continue;
             
             // 判断MapPoints是否为坏点，或者是否已经加进集合vpFuseCandidates
-            if(pMP->isBad() || pMP->mnFuseCandidateForKF == mpCurrentKeyFrame->mnId)
+            if(pMP->isBad() || pMP->mnFuseCandidateForKF == pLastKF->mnId)
                 continue;
 
             // 加入集合，并标记已经加入
-            pMP->mnFuseCandidateForKF = mpCurrentKeyFrame->mnId;
+            pMP->mnFuseCandidateForKF = pLastKF->mnId;
             vpFuseCandidates.push_back(pMP);
         }
     }
     // 进行融合操作,其实这里的操作和上面的那个融合操作是完全相同的,不过上个是"每个关键帧和当前关键帧的地图点进行融合",而这里的是"当前关键帧和所有邻接关键帧的地图点进行融合"
-    matcher.Fuse(mpCurrentKeyFrame,vpFuseCandidates);
+    // 候选点集合只构造一次,分别融合到这一批的每个关键帧中
+    for(vector<KeyFrame*>::const_iterator vit=vpKFs.begin(), vend=vpKFs.end(); vit!=vend; vit++)
+    {
+        if(!(*vit)->isBad())
+            matcher.Fuse(*vit,vpFuseCandidates);
+    }
 
     // Update points
-    // STEP4：更新当前帧MapPoints的描述子，深度，观测主方向等属性
-    vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
-    for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
+    // STEP4：更新当前帧MapPoints的描述子，深度，观测主方向等属性;被多个关键帧共享的点只更新一次
+    set<MapPoint*> spUpdatedMPs;
+    for(vector<KeyFrame*>::const_iterator vit=vpKFs.begin(), vend=vpKFs.end(); vit!=vend; vit++)
     {
-        MapPoint* pMP=vpMapPointMatches[i];
-        if(pMP)
+        vpMapPointMatches = (*vit)->GetMapPointMatches();
+        for(size_t i=0, iend=vpMapPointMatches.size(); i<iend; i++)
         {
-            if(!pMP->isBad())
-            {
-                // 在所有找到pMP的关键帧中，获得最佳的描述子
-                pMP->ComputeDistinctiveDescriptors();
-
-                // 更新平均观测方向和观测距离
-                pMP->UpdateNormalAndDepth();
-            }
+            MapPoint* pMP=vpMapPointMatches[i];
+            if(pMP && !pMP->isBad())
+                spUpdatedMPs.insert(pMP);
         }
     }
+    // 各点之间互相独立,分块并行
+    const vector<MapPoint*> vpUpdatedMPs(spUpdatedMPs.begin(),spUpdatedMPs.end());
+    ParallelFor(vpUpdatedMPs.size(), 32, [&](size_t begin, size_t end)
+    {
+        for(size_t i=begin; i<end; i++)
+        {
+            // 在所有找到pMP的关键帧中，获得最佳的描述子
+            vpUpdatedMPs[i]->ComputeDistinctiveDescriptors();
+
+            // 更新平均观测方向和观测距离
+            vpUpdatedMPs[i]->UpdateNormalAndDepth();
+        }
+    });
 
     // Update connections in covisibility graph
 
     // STEP5：更新当前帧的MapPoints后更新与其它帧的连接关系
     // 更新covisibility图
-    mpCurrentKeyFrame->UpdateConnections();
+    for(vector<KeyFrame*>::const_iterator vit=vpKFs.begin(), vend=vpKFs.end(); vit!=vend; vit++)
+        (*vit)->UpdateConnections();
 }
 
 // 根据两关键帧的姿态计算两个关键帧之间的基本矩阵
@@ -780,10 +945,13 @@ cv::Mat LocalMapping::ComputeF12(KeyFrame *&pKF1, KeyFrame *&pKF2)
 // 外部线程调用,请求停止当前线程的工作; 其实是回环检测线程调用,来避免在进行全局优化的过程中局部建图线程添加新的关键帧
 void LocalMapping::RequestStop()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    mbStopRequested = true;
-    unique_lock<mutex> lock2(mMutexNewKFs);
-    mbAbortBA = true;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        mbStopRequested = true;
+        unique_lock<mutex> lock2(mMutexNewKFs);
+        mbAbortBA = true;
+    }
+    NotifyEvent();
 }
 
 // 检查是否要把当前的局部建图线程停止工作,运行的时候要检查是否有终止请求,如果有就执行. 由run函数调用
@@ -795,6 +963,7 @@ bool LocalMapping::Stop()
     {
         mbStopped = true;
         cout << "Local Mapping STOP" << endl;
+        mcvStopped.notify_all();
         return true;
     }
 
@@ -808,6 +977,14 @@ bool LocalMapping::isStopped()
     return mbStopped;
 }
 
+// 阻塞直到当前线程真正地停止;线程终止时mbStopped也会被置位
+void LocalMapping::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexStop);
+    while(!mbStopped)
+        mcvStopped.wait(lock);
+}
+
 // 是否有终止当前线程的请求
 bool LocalMapping::stopRequested()
 {
@@ -819,17 +996,20 @@ bool LocalMapping::stopRequested()
 //? ! 现在感觉之前的理解好像有问题,这个函数由LoopClosing在执行了回环的关键帧组优化之后调用的,是为了恢复LoopMapping线程的正常工作的
 void LocalMapping::Release()
 {
-    unique_lock<mutex> lock(mMutexStop);
-    unique_lock<mutex> lock2(mMutexFinish);
-    if(mbFinished)
-        return;
-    mbStopped = false;
-    mbStopRequested = false;
-    for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
-        delete *lit;
-    mlNewKeyFrames.clear();
-
-    cout << "Local Mapping RELEASE" << endl;
+    {
+        unique_lock<mutex> lock(mMutexStop);
+        unique_lock<mutex> lock2(mMutexFinish);
+        if(mbFinished)
+            return;
+        mbStopped = false;
+        mbStopRequested = false;
+        for(list<KeyFrame*>::iterator lit = mlNewKeyFrames.begin(), lend=mlNewKeyFrames.end(); lit!=lend; lit++)
+            delete *lit;
+        mlNewKeyFrames.clear();
+
+        cout << "Local Mapping RELEASE" << endl;
+    }
+    NotifyEvent();
 }
 
 // 查看当前是否允许接受关键帧
@@ -849,16 +1029,21 @@ void LocalMapping::SetAcceptKeyFrames(bool flag)
 // 设置 mbnotStop标志的状态
 bool LocalMapping::SetNotStop(bool flag)
 {
-    unique_lock<mutex> lock(mMutexStop);
+    {
+        unique_lock<mutex> lock(mMutexStop);
 
-    //已经处于!flag的状态了
-    // 就是我希望线程先不要停止,但是经过检查这个时候线程已经停止了...
-    if(flag && mbStopped)
-        //设置失败
-        return false;
+        //已经处于!flag的状态了
+        // 就是我希望线程先不要停止,但是经过检查这个时候线程已经停止了...
+        if(flag && mbStopped)
+            //设置失败
+            return false;
 
-    //设置为要设置的状态
-    mbNotStop = flag;
+        //设置为要设置的状态
+        mbNotStop = flag;
+    }
+    // 解除限制后, 之前被挡住的停止请求需要run函数重新检查
+    if(!flag)
+        NotifyEvent();
     //设置成功
     return true;
 }
@@ -870,15 +1055,23 @@ void LocalMapping::InterruptBA()
 }
 
 // 关键帧剔除,在Covisibility Graph中的关键帧，其90%以上的MapPoints能被其他关键帧（至少3个）观测到，则认为该关键帧为冗余关键帧。
-void LocalMapping::KeyFrameCulling()
+void LocalMapping::KeyFrameCulling(const vector<KeyFrame*> &vpBatchKFs)
 {
     // Check redundant keyframes (only local keyframes)
     // A keyframe is considered redundant if the 90% of the MapPoints it sees, are seen
     // in at least other 3 keyframes (in the same or finer scale)
     // We only consider close stereo points
 
-    // STEP1：根据Covisibility Graph提取当前帧的共视关键帧 (所有)
-    vector<KeyFrame*> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+    // STEP1：根据Covisibility Graph提取这一批关键帧的共视关键帧 (所有),这一批关键帧本身不参与剔除
+    // (其中最新的关键帧是跟踪线程的参考关键帧)
+    vector<KeyFrame*> vpLocalKeyFrames;
+    for(size_t i=0; i<vpBatchKFs.size(); i++)
+    {
+        if(vpBatchKFs[i]->isBad())
+            continue;
+        const vector<KeyFrame*> vpNeighs = vpBatchKFs[i]->GetVectorCovisibleKeyFrames();
+        vpLocalKeyFrames.insert(vpLocalKeyFrames.end(),vpNeighs.begin(),vpNeighs.end());
+    }
 
     // 对所有的局部关键帧进行遍历 ; 这里的局部关键帧就理解为当前关键帧的共视帧
     for(vector<KeyFrame*>::iterator vit=vpLocalKeyFrames.begin(), vend=vpLocalKeyFrames.end(); vit!=vend; vit++)
@@ -886,69 +1079,26 @@ void LocalMapping::KeyFrameCulling()
         KeyFrame* pKF = *vit;
         if(pKF->mnId==0)
             continue;
-        // STEP2：提取每个共视关键帧的MapPoints
-        const vector<MapPoint*> vpMapPoints = pKF->GetMapPointMatches();
-
-        int nObs = 3;                       // 接下来程序中使用到的循环变量,记录了某个点的被观测次数 (其实这里初始化是没有意义的)
-        const int thObs=nObs;               // 观测阈值,默认为3
+        // 已经剔除过的(多个关键帧的共视关键帧会重复出现)和这一批中的关键帧
+        if(pKF->isBad() || find(vpBatchKFs.begin(),vpBatchKFs.end(),pKF)!=vpBatchKFs.end())
+            continue;
+        // STEP2：获取该局部关键帧的冗余计数
+        // 地图点被冗余观测是指它在该关键帧中的特征尺度和在其它至少3个关键帧中的相比变化不大,
+        // 这个判断在地图点增删观测的时候就已经增量地完成了,见MapPoint::UpdateRedundantObservations
         int nRedundantObservations=0;       // 冗余观测地图点的计数器
-                                            // 不是说我从地图点中得到了其观测数据我就信了,这里还要求这个地图点在当前关键帧和在邻接关键帧中的特征尺度变化不太大才可以
-                                            // 认为这个地图点被"冗余观测"了
         int nMPs=0;                         // 计数器,参与到检测的地图点的总数目
-
-        // STEP3：遍历该局部关键帧的MapPoints，判断是否90%以上的MapPoints能被其它关键帧（至少3个）观测到
-        for(size_t i=0, iend=vpMapPoints.size(); i<iend; i++)
-        {
-            MapPoint* pMP = vpMapPoints[i];
-            if(pMP)
-            {
-                if(!pMP->isBad())
-                {
-                    if(!mbMonocular)
-                    {
-                        // 对于双目，仅考虑近处的MapPoints，不超过mbf * 35 / fx 
-                        // 不过配置文件中给的是近点的定义是 40 * fx
-                        if(pKF->mvDepth[i]>pKF->mThDepth || pKF->mvDepth[i]<0)
-                            continue;
-                    }
-
-                    nMPs++;
-                    // MapPoints至少被三个关键帧观测到
-                    if(pMP->Observations()>thObs)
-                    {
-                        const int &scaleLevel = pKF->mvKeysUn[i].octave;
-                        const map<KeyFrame*, size_t> observations = pMP->GetObservations();
-                        // 判断该MapPoint是否同时被三个关键帧观测到
-                        int nObs=0;
-                        // 遍历当前这个邻接关键帧上的地图点的所有观测信息
-                        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-                        {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            const int &scaleLeveli = pKFi->mvKeysUn[mit->second].octave;
-
-                            // Scale Condition 
-                            // 尺度约束，要求MapPoint在该局部关键帧的特征尺度大于（或近似于）其它关键帧的特征尺度
-                            if(scaleLeveli<=scaleLevel+1)
-                            {
-                                nObs++;
-                                // 已经找到三个同尺度的关键帧可以观测到该MapPoint，不用继续找了
-                                if(nObs>=thObs)
-                                    break;
-                            }
-                        }
-                        // 该MapPoint至少被三个关键帧观测到
-                        if(nObs>=thObs)
-                        {
-                            nRedundantObservations++;
-                        }
-                    }
-                }
-            }
-        }
-
-        // STEP4：该局部关键帧90%以上的MapPoints能被其它关键帧（至少3个）观测到，则认为是冗余关键帧
+        // 对于双目，仅考虑近处的MapPoints，不超过mbf * 35 / fx 
+        pKF->GetRedundancyCounts(!mbMonocular,nMPs,nRedundantObservations);
+#ifndef NDEBUG
+        // 调试版本中和完整遍历的结果比较,检查增量维护的计数
+        int nMPsFull=0, nRedundantFull=0;
+        pKF->ComputeRedundancyCounts(!mbMonocular,nMPsFull,nRedundantFull);
+        if(nMPsFull!=nMPs || nRedundantFull!=nRedundantObservations)
+            cerr << "KeyFrame " << pKF->mnId << " redundancy counts " << nRedundantObservations << "/" << nMPs
+                 << " differ from the full scan " << nRedundantFull << "/" << nMPsFull << endl;
+#endif
+
+        // STEP3：该局部关键帧90%以上的MapPoints能被其它关键帧（至少3个）观测到，则认为是冗余关键帧
         if(nRedundantObservations>0.9*nMPs)
             // 剔除的时候就设置一个 bad flag 就可以了
             pKF->SetBadFlag();
@@ -971,19 +1121,12 @@ void LocalMapping::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    NotifyEvent();
 
     // 一直等到局部建图线程响应之后才可以退出
-    while(1)
-    {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequested)
-                break;
-        }
-        //usleep(3000);
-        std::this_thread::sleep_for(std::chrono::milliseconds(3));
-
-    }
+    unique_lock<mutex> lock2(mMutexReset);
+    while(mbResetRequested)
+        mcvReset.wait(lock2);
 }
 
 // 检查是否有复位线程的请求
@@ -994,17 +1137,23 @@ void LocalMapping::ResetIfRequested()
     if(mbResetRequested)
     {
         mlNewKeyFrames.clear();
-        mlpRecentAddedMapPoints.clear();
+        mvpRecentAddedMapPoints.clear();
+        // 复用的优化问题以关键帧和地图点的指针为索引,地图清空之前也要清空
+        mpLocalBAProblem->Clear();
         // 恢复为false表示复位过程完成
         mbResetRequested=false;
+        mcvReset.notify_all();
     }
 }
 
 // 请求终止当前线程
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    NotifyEvent();
 }
 
 // 检查是否已经有外部线程请求终止当前线程
@@ -1021,6 +1170,8 @@ void LocalMapping::SetFinish()
     mbFinished = true;    // 线程已经被结束
     unique_lock<mutex> lock2(mMutexStop);
     mbStopped = true;     //既然已经都结束了,那么当前线程也已经停止工作了
+    mcvFinished.notify_all();
+    mcvStopped.notify_all();
 }
 
 // 当前线程的run函数是否已经终止
@@ -1029,5 +1180,12 @@ bool LocalMapping::isFinished()
     unique_lock<mutex> lock(mMutexFinish);
     return mbFinished;
 }
+// 阻塞直到当前线程的run函数终止
+void LocalMapping::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    while(!mbFinished)
+        mcvFinished.wait(lock);
+}
 
 } //namespace ORB_SLAM
@@ -39,8 +39,12 @@
 
 #include "ORBmatcher.h"
 
+#include "Parallel.h"
+
 #include<mutex>
 #include<thread>
+#include<atomic>
+#include<chrono>
 
 
 namespace ORB_SLAM2
@@ -48,14 +52,22 @@ namespace ORB_SLAM2
 
 // 构造函数
 LoopClosing::LoopClosing(Map *pMap, KeyFrameDatabase *pDB, ORBVocabulary *pVoc, const bool bFixScale):
-    mbResetRequested(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
+    mbResetRequested(false), mbEventPending(false), mbFinishRequested(false), mbFinished(true), mpMap(pMap),
     mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
-    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0)
+    mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnEssentialGraphLinearSolver(Optimizer::LINEAR_SOLVER_CHOLESKY),
+    mnGBALinearSolver(Optimizer::LINEAR_SOLVER_CHOLESKY)
 {
     // 连续性阈值
     mnCovisibilityConsistencyTh = 3;
 }
 
+// 选择本质图优化和全局BA的线性求解器
+void LoopClosing::SetLinearSolvers(const int nEssentialGraph, const int nGBA)
+{
+    mnEssentialGraphLinearSolver = nEssentialGraph;
+    mnGBALinearSolver = nGBA;
+}
+
 // 设置追踪线程句柄
 void LoopClosing::SetTracker(Tracking *pTracker)
 {
@@ -101,9 +113,8 @@ void LoopClosing::Run()
         if(CheckFinish())
             break;
 
-        //usleep(5000);
-		std::this_thread::sleep_for(std::chrono::milliseconds(5));
-
+        // 空闲时在条件变量上等待新的关键帧或者复位/终止请求,而不是每次都固定睡眠5ms
+        WaitForEvent();
 	}
 
     // 运行到这里说明有外部线程请求终止当前线程,在这个函数中执行终止当前线程的一些操作
@@ -113,10 +124,33 @@ void LoopClosing::Run()
 // 将某个关键帧加入到回环检测的过程中,由局部建图线程调用
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexLoopQueue);
-    // NOTICE 这里第0个关键帧不能够参与到回环检测的过程中,因为第0关键帧定义了整个地图的世界坐标系
-    if(pKF->mnId!=0)
+    {
+        unique_lock<mutex> lock(mMutexLoopQueue);
+        // NOTICE 这里第0个关键帧不能够参与到回环检测的过程中,因为第0关键帧定义了整个地图的世界坐标系
+        if(pKF->mnId==0)
+            return;
         mlpLoopKeyFrameQueue.push_back(pKF);
+    }
+    mcvEvent.notify_one();
+}
+
+// 通知线程主函数有事件需要处理
+void LoopClosing::NotifyEvent()
+{
+    {
+        unique_lock<mutex> lock(mMutexLoopQueue);
+        mbEventPending = true;
+    }
+    mcvEvent.notify_one();
+}
+
+// 线程主函数空闲时等待事件
+void LoopClosing::WaitForEvent()
+{
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    while(!mbEventPending && mlpLoopKeyFrameQueue.empty())
+        mcvEvent.wait(lock);
+    mbEventPending = false;
 }
 
 /*
@@ -137,6 +171,9 @@ bool LoopClosing::DetectLoop()
         unique_lock<mutex> lock(mMutexLoopQueue);
         mpCurrentKF = mlpLoopKeyFrameQueue.front();
         mlpLoopKeyFrameQueue.pop_front();
+        // 在队列中等待的时候被局部建图剔除的关键帧已经从关键帧数据库中删除了,不能再加回去
+        if(mpCurrentKF->isBad())
+            return false;
         // Avoid that a keyframe can be erased while it is being process by this thread
         mpCurrentKF->SetNotErase();
     }
@@ -325,7 +362,8 @@ bool LoopClosing::DetectLoop()
  * 3. 将闭环帧以及闭环帧相连的关键帧的MapPoints与当前帧的点进行匹配（当前帧---闭环帧+相连关键帧）      \n
  * \n
  * 注意以上匹配的结果均都存在成员变量mvpCurrentMatchedPoints中，实际的更新步骤见CorrectLoop()步骤3：Start Loop Fusion \n
- * 对于双目或者是RGBD输入的情况,计算得到的尺度=1
+ * 对于双目或者是RGBD输入的情况,计算得到的尺度=1 \n
+ * 步骤1和2中各个候选帧在多个线程中同时验证,一旦有一个候选帧被接受,其余的候选帧就停止RANSAC迭代
  */
 bool LoopClosing::ComputeSim3()
 {
@@ -333,146 +371,159 @@ bool LoopClosing::ComputeSim3()
 
     const int nInitialCandidates = mvpEnoughConsistentCandidates.size();
 
-    // We compute first ORB matches for each candidate
-    // If enough matches are found, we setup a Sim3Solver
-    ORBmatcher matcher(0.75,true);
+    // 候选帧之间互相独立,分给多个线程同时验证;一个候选帧通过Sim3的求解与优化后,其它线程在下一轮RANSAC之前停止
+    // 只有一个线程时,所有候选帧在同一块中处理,与原来逐个候选帧轮流迭代的过程完全一致
+    std::atomic<bool> bMatch(false);// 用于标记是否有一个候选帧通过Sim3的求解与优化
+    mutex mutexMatch;               // 保护下面这个被接受的候选帧的结果
 
-    vector<Sim3Solver*> vpSim3Solvers;
-    vpSim3Solvers.resize(nInitialCandidates);// 每个候选帧都有一个Sim3Solver
+    ParallelFor(nInitialCandidates, 1, [&](size_t begin, size_t end)
+    {
+        const int nBlock = end-begin;
 
-    vector<vector<MapPoint*> > vvpMapPointMatches;
-    vvpMapPointMatches.resize(nInitialCandidates);  // 同样每个候选帧也都有自己的一个匹配的地图点
+        // We compute first ORB matches for each candidate
+        // If enough matches are found, we setup a Sim3Solver
+        ORBmatcher matcher(0.75,true);
 
-    vector<bool> vbDiscarded;
-    vbDiscarded.resize(nInitialCandidates);         // 表示在计算的过程中哪些候选帧被标记为"放弃"了的
+        vector<Sim3Solver*> vpSim3Solvers(nBlock,static_cast<Sim3Solver*>(NULL));// 每个候选帧都有一个Sim3Solver
 
-    int nCandidates=0; //candidates with enough matches
-    // 开始遍历每一个候选的闭环帧
-    for(int i=0; i<nInitialCandidates; i++)
-    {
-        // STEP 1：从筛选的闭环候选帧中取出一帧关键帧pKF
-        KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
+        vector<vector<MapPoint*> > vvpMapPointMatches(nBlock);  // 同样每个候选帧也都有自己的一个匹配的地图点
 
-        // avoid that local mapping erase it while it is being processed in this thread
-        // 防止在LocalMapping中KeyFrameCulling函数将此关键帧作为冗余帧剔除
-        pKF->SetNotErase();
+        vector<bool> vbDiscarded(nBlock,false);         // 表示在计算的过程中哪些候选帧被标记为"放弃"了的
 
-        if(pKF->isBad())
+        int nCandidates=0; //candidates with enough matches
+        // 开始遍历这一块中每一个候选的闭环帧
+        for(int i=0; i<nBlock && !bMatch; i++)
         {
-            vbDiscarded[i] = true;// 直接将该候选帧舍弃
-            continue;
-        }
+            // STEP 1：从筛选的闭环候选帧中取出一帧关键帧pKF
+            KeyFrame* pKF = mvpEnoughConsistentCandidates[begin+i];
 
-        // STEP 2：将当前帧mpCurrentKF与闭环候选关键帧pKF匹配
-        // 通过bow加速得到mpCurrentKF与pKF之间的匹配特征点，vvpMapPointMatches是匹配特征点对应的MapPoints,本质上来自于候选闭环帧
-        int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
+            // avoid that local mapping erase it while it is being processed in this thread
+            // 防止在LocalMapping中KeyFrameCulling函数将此关键帧作为冗余帧剔除
+            pKF->SetNotErase();
 
-        // 匹配的特征点数太少，该候选帧剔除
-        if(nmatches<20)
-        {
-            vbDiscarded[i] = true;
-            continue;
-        }
-        else
-        {
-            // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
-            // 构造Sim3求解器
-            // 如果mbFixScale为true，则是6DoFf优化（双目 RGBD），如果是false，则是7DoF优化（单目）
-            Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i],mbFixScale);
-            pSolver->SetRansacParameters(0.99,20,300);// 至少20个inliers 300次迭代
-            vpSim3Solvers[i] = pSolver;
-        }
-
-        // 参与Sim3计算的候选关键帧数加1
-        nCandidates++;
-    }
+            if(pKF->isBad())
+            {
+                vbDiscarded[i] = true;// 直接将该候选帧舍弃
+                continue;
+            }
 
-    bool bMatch = false;// 用于标记是否有一个候选帧通过Sim3的求解与优化
+            // STEP 2：将当前帧mpCurrentKF与闭环候选关键帧pKF匹配
+            // 通过bow加速得到mpCurrentKF与pKF之间的匹配特征点，vvpMapPointMatches是匹配特征点对应的MapPoints,本质上来自于候选闭环帧
+            int nmatches = matcher.SearchByBoW(mpCurrentKF,pKF,vvpMapPointMatches[i]);
 
-    // Perform alternatively RANSAC iterations for each candidate
-    // until one is succesful or all fail
-    // 一直循环所有的候选帧，每个候选帧迭代5次，如果5次迭代后得不到结果，就换下一个候选帧
-    // 直到有一个候选帧首次迭代成功bMatch为true，或者某个候选帧总的迭代次数超过限制，直接将它剔除
-    while(nCandidates>0 && !bMatch)
-    {
-        // 遍历每一个候选帧
-        for(int i=0; i<nInitialCandidates; i++)
-        {
-            if(vbDiscarded[i])
+            // 匹配的特征点数太少，该候选帧剔除
+            if(nmatches<20)
+            {
+                vbDiscarded[i] = true;
                 continue;
+            }
+            else
+            {
+                // if bFixScale is true, 6DoF optimization (stereo,rgbd), 7DoF otherwise (mono)
+                // 构造Sim3求解器
+                // 如果mbFixScale为true，则是6DoFf优化（双目 RGBD），如果是false，则是7DoF优化（单目）
+                Sim3Solver* pSolver = new Sim3Solver(mpCurrentKF,pKF,vvpMapPointMatches[i],mbFixScale);
+                pSolver->SetRansacParameters(0.99,20,300);// 至少20个inliers 300次迭代
+                vpSim3Solvers[i] = pSolver;
+            }
+
+            // 参与Sim3计算的候选关键帧数加1
+            nCandidates++;
+        }
 
-            KeyFrame* pKF = mvpEnoughConsistentCandidates[i];
+        // Perform alternatively RANSAC iterations for each candidate
+        // until one is succesful or all fail
+        // 一直循环这一块中所有的候选帧，每个候选帧迭代5次，如果5次迭代后得不到结果，就换下一个候选帧
+        // 直到有一个候选帧(可能在别的线程中)首次迭代成功bMatch为true，或者某个候选帧总的迭代次数超过限制，直接将它剔除
+        while(nCandidates>0 && !bMatch)
+        {
+            // 遍历每一个候选帧
+            for(int i=0; i<nBlock && !bMatch; i++)
+            {
+                if(vbDiscarded[i])
+                    continue;
 
-            // Perform 5 Ransac Iterations
-            vector<bool> vbInliers;    // 标记经过RANSAC sim3 求解后,vvpMapPointMatches中的哪些作为内点
-            int nInliers;
-            bool bNoMore;// 这是局部变量，在pSolver->iterate(...)内进行初始化(由sim3Solver进行赋值操作)
-                        //? 具体含义? 如果在下面的这5次RANSAC操作中能够达到要求,那么后续过程中又无法达到要求,那么这里在什么时候才会置位?
-                        //? 是说之前的RABSAC过程和当前的过程如果相差不多甚至没有任何变化的时候,这个才会被置位吗?
+                KeyFrame* pKF = mvpEnoughConsistentCandidates[begin+i];
 
-            // STEP 3：对步骤2中有较好的匹配的关键帧求取Sim3变换
-            Sim3Solver* pSolver = vpSim3Solvers[i];
-            // 最多迭代5次，返回的Scm是候选帧pKF到当前帧mpCurrentKF的Sim3变换（T12）
-            cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
+                // Perform 5 Ransac Iterations
+                vector<bool> vbInliers;    // 标记经过RANSAC sim3 求解后,vvpMapPointMatches中的哪些作为内点
+                int nInliers;
+                bool bNoMore;// 这是局部变量，在pSolver->iterate(...)内进行初始化(由sim3Solver进行赋值操作)
+                            //? 具体含义? 如果在下面的这5次RANSAC操作中能够达到要求,那么后续过程中又无法达到要求,那么这里在什么时候才会置位?
+                            //? 是说之前的RABSAC过程和当前的过程如果相差不多甚至没有任何变化的时候,这个才会被置位吗?
 
-            // If Ransac reachs max. iterations discard keyframe
-            // 经过n次循环，每次迭代5次，总共迭代 n*5 次
-            // 总迭代次数达到最大限制还没有求出合格的Sim3变换，该候选帧剔除 ; 也有可能是因为Sim3Solver处理后的点的数目还没有进行RANSAC就已经小于期望的内点个数了
-            if(bNoMore)
-            {
-                vbDiscarded[i]=true;
-                nCandidates--;
-            }
+                // STEP 3：对步骤2中有较好的匹配的关键帧求取Sim3变换
+                Sim3Solver* pSolver = vpSim3Solvers[i];
+                // 最多迭代5次，返回的Scm是候选帧pKF到当前帧mpCurrentKF的Sim3变换（T12）
+                cv::Mat Scm  = pSolver->iterate(5,bNoMore,vbInliers,nInliers);
 
-            // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
-            if(!Scm.empty())
-            {
-                vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
-                for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
+                // If Ransac reachs max. iterations discard keyframe
+                // 经过n次循环，每次迭代5次，总共迭代 n*5 次
+                // 总迭代次数达到最大限制还没有求出合格的Sim3变换，该候选帧剔除 ; 也有可能是因为Sim3Solver处理后的点的数目还没有进行RANSAC就已经小于期望的内点个数了
+                if(bNoMore)
                 {
-                    // 保存inlier的MapPoint
-                    if(vbInliers[j])
-                       vpMapPointMatches[j]=vvpMapPointMatches[i][j];
+                    vbDiscarded[i]=true;
+                    nCandidates--;
                 }
 
-                // STEP 4：通过步骤3求取的Sim3变换引导关键帧匹配弥补步骤2中的漏匹配
-                // [sR t;0 1]
-                cv::Mat R = pSolver->GetEstimatedRotation();// 候选帧pKF到当前帧mpCurrentKF的R（R12）
-                cv::Mat t = pSolver->GetEstimatedTranslation();// 候选帧pKF到当前帧mpCurrentKF的t（t12），当前帧坐标系下，方向由pKF指向当前帧
-                const float s = pSolver->GetEstimatedScale();// 候选帧pKF到当前帧mpCurrentKF的变换尺度s（s12）
-                // 查找更多的匹配（成功的闭环匹配需要满足足够多的匹配特征点数，之前使用SearchByBoW进行特征点匹配时会有漏匹配）
-                // 通过Sim3变换，确定pKF1的特征点在pKF2中的大致区域，同理，确定pKF2的特征点在pKF1中的大致区域
-                // 在该区域内通过描述子进行匹配捕获pKF1和pKF2之前漏匹配的特征点，更新匹配vpMapPointMatches
-                matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
-
-                // STEP 5：Sim3优化，只要有一个候选帧通过Sim3的求解与优化，就跳出停止对其它候选帧的判断
-                // OpenCV的Mat矩阵转成Eigen的Matrix类型
-                g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
-                // 如果mbFixScale为true，则是6DoFf优化（双目 RGBD），如果是false，则是7DoF优化（单目）
-                // 优化mpCurrentKF与pKF对应的MapPoints间的Sim3，得到优化后的量gScm
-                const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale);// 卡方chi2检验阈值10 //?
-
-                // If optimization is succesful stop ransacs and continue
-                if(nInliers>=20)
+                // If RANSAC returns a Sim3, perform a guided matching and optimize with all correspondences
+                if(!Scm.empty())
                 {
-                    bMatch = true;
-                    // mpMatchedKF就是最终闭环检测出来与当前帧形成闭环的关键帧
-                    mpMatchedKF = pKF;
-                    // 得到从世界坐标系到该候选帧的Sim3变换，Scale=1
-                    g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
-                    // 得到g2o优化后从世界坐标系到当前帧的Sim3变换
-                    mg2oScw = gScm*gSmw;
-                    mScw = Converter::toCvMat(mg2oScw);
-
-                    mvpCurrentMatchedPoints = vpMapPointMatches;
-                    break;// 只要有一个候选帧通过Sim3的求解与优化，就跳出停止对其它候选帧的判断
-                    // 这就放弃后面的所有候选帧了... 这样操作的目的还是为了节省时间,其实后面的操作中也还是不能够保证我们现在挑选出来的闭环关键帧就能够通过后面
-                    // 程序中设置的重重考验;而一旦不通过,那么无论后面的候选关键帧是否能够通过考验,都将会被直接取消以后参与到回环检测中的资格了
-                    // (当然如果某个关键帧已经和某个关键帧形成了闭环关系,它不会真正地被取消掉这个资格的)
+                    vector<MapPoint*> vpMapPointMatches(vvpMapPointMatches[i].size(), static_cast<MapPoint*>(NULL));
+                    for(size_t j=0, jend=vbInliers.size(); j<jend; j++)
+                    {
+                        // 保存inlier的MapPoint
+                        if(vbInliers[j])
+                           vpMapPointMatches[j]=vvpMapPointMatches[i][j];
+                    }
+
+                    // STEP 4：通过步骤3求取的Sim3变换引导关键帧匹配弥补步骤2中的漏匹配
+                    // [sR t;0 1]
+                    cv::Mat R = pSolver->GetEstimatedRotation();// 候选帧pKF到当前帧mpCurrentKF的R（R12）
+                    cv::Mat t = pSolver->GetEstimatedTranslation();// 候选帧pKF到当前帧mpCurrentKF的t（t12），当前帧坐标系下，方向由pKF指向当前帧
+                    const float s = pSolver->GetEstimatedScale();// 候选帧pKF到当前帧mpCurrentKF的变换尺度s（s12）
+                    // 查找更多的匹配（成功的闭环匹配需要满足足够多的匹配特征点数，之前使用SearchByBoW进行特征点匹配时会有漏匹配）
+                    // 通过Sim3变换，确定pKF1的特征点在pKF2中的大致区域，同理，确定pKF2的特征点在pKF1中的大致区域
+                    // 在该区域内通过描述子进行匹配捕获pKF1和pKF2之前漏匹配的特征点，更新匹配vpMapPointMatches
+                    matcher.SearchBySim3(mpCurrentKF,pKF,vpMapPointMatches,s,R,t,7.5);
+
+                    // STEP 5：Sim3优化，只要有一个候选帧通过Sim3的求解与优化，就跳出停止对其它候选帧的判断
+                    // OpenCV的Mat矩阵转成Eigen的Matrix类型
+                    g2o::Sim3 gScm(Converter::toMatrix3d(R),Converter::toVector3d(t),s);
+                    // 如果mbFixScale为true，则是6DoFf优化（双目 RGBD），如果是false，则是7DoF优化（单目）
+                    // 优化mpCurrentKF与pKF对应的MapPoints间的Sim3，得到优化后的量gScm
+                    const int nInliers = Optimizer::OptimizeSim3(mpCurrentKF, pKF, vpMapPointMatches, gScm, 10, mbFixScale);// 卡方chi2检验阈值10 //?
+
+                    // If optimization is succesful stop ransacs and continue
+                    if(nInliers>=20)
+                    {
+                        // 多个线程可能同时得到结果,只接受第一个
+                        unique_lock<mutex> lock(mutexMatch);
+                        if(bMatch)
+                            break;
+                        bMatch = true;
+                        // mpMatchedKF就是最终闭环检测出来与当前帧形成闭环的关键帧
+                        mpMatchedKF = pKF;
+                        // 得到从世界坐标系到该候选帧的Sim3变换，Scale=1
+                        g2o::Sim3 gSmw(Converter::toMatrix3d(pKF->GetRotation()),Converter::toVector3d(pKF->GetTranslation()),1.0);
+                        // 得到g2o优化后从世界坐标系到当前帧的Sim3变换
+                        mg2oScm = gScm;
+                        mg2oScw = gScm*gSmw;
+                        mScw = Converter::toCvMat(mg2oScw);
+
+                        mvpCurrentMatchedPoints = vpMapPointMatches;
+                        break;// 只要有一个候选帧通过Sim3的求解与优化，就跳出停止对其它候选帧的判断
+                        // 这就放弃后面的所有候选帧了... 这样操作的目的还是为了节省时间,其实后面的操作中也还是不能够保证我们现在挑选出来的闭环关键帧就能够通过后面
+                        // 程序中设置的重重考验;而一旦不通过,那么无论后面的候选关键帧是否能够通过考验,都将会被直接取消以后参与到回环检测中的资格了
+                        // (当然如果某个关键帧已经和某个关键帧形成了闭环关系,它不会真正地被取消掉这个资格的)
+                    }
                 }
             }
         }
-    }
+
+        for(int i=0; i<nBlock; i++)
+            delete vpSim3Solvers[i];
+    });
 
     // 退出上面while循环的原因有两种,一种是求解到了bMatch置位后出的,另外一种是nCandidates耗尽为0
     // 没有一个闭环匹配候选帧通过Sim3的求解与优化
@@ -523,6 +574,7 @@ bool LoopClosing::ComputeSim3()
     // 根据Sim3变换，将每个mvpLoopMapPoints投影到mpCurrentKF上，并根据尺度确定一个搜索区域，
     // 根据该MapPoint的描述子与该区域内的特征点进行匹配，如果匹配误差小于TH_LOW即匹配成功，更新mvpCurrentMatchedPoints
     // mvpCurrentMatchedPoints将用于SearchAndFuse中检测当前帧MapPoints与匹配的MapPoints是否存在冲突
+    ORBmatcher matcher(0.75,true);
     matcher.SearchByProjection(mpCurrentKF, mScw, mvpLoopMapPoints, mvpCurrentMatchedPoints,10);// 搜索范围系数为10
 
     // If enough matches accept Loop
@@ -566,34 +618,39 @@ void LoopClosing::CorrectLoop()
     // 卧槽,原来是有输出的啊
     cout << "Loop detected!" << endl;
 
-    // Send a stop signal to Local Mapping
-    // Avoid new keyframes are inserted while correcting the loop
-    // STEP 0：请求局部地图停止，防止局部地图线程中InsertKeyFrame函数插入新的关键帧
-    mpLocalMapper->RequestStop();
-
     // If a Global Bundle Adjustment is running, abort it
-    if(isRunningGBA())
+    // 中断正在进行的全局BA并等待线程退出.全局BA在当前的线性系统构建或者试探步长结束后停止,并且会先把已经完成的迭代结果更新到地图中,
+    // 不再丢弃之前的计算. 更新地图时全局BA线程自己也要停止和释放局部建图,所以这一步要在下面请求局部建图停止之前完成.
+    // 大地图上这里的等待最多是构建或求解一次线性系统的时间,再加上把结果更新到地图的时间
+    if(mpThreadGBA)
     {
-        // 这个标志位仅用于控制输出提示，可忽略
-        unique_lock<mutex> lock(mMutexGBA);
-        mbStopGBA = true;
-
-        mnFullBAIdx++;
-
-        if(mpThreadGBA)
         {
-            // 卧槽,直接抛弃了正在运行的全局BA线程~! mpThreadGBA将不会再和之前创建的全局BA线程绑定,但是之前的那个全局BA线程中有检测停止的机制,会自己停止工作的
-            mpThreadGBA->detach();
-            delete mpThreadGBA;
+            unique_lock<mutex> lock(mMutexGBA);
+            mbStopGBA = true;
         }
+        mpThreadGBA->join();
+        delete mpThreadGBA;
+        mpThreadGBA = NULL;
+
+        // 全局BA(无论是被中断还是在ComputeSim3之后正常结束)可能移动了闭环关键帧,
+        // 用Sim3求解得到的相对变换重新计算当前关键帧纠正后的位姿
+        g2o::Sim3 gSmw(Converter::toMatrix3d(mpMatchedKF->GetRotation()),Converter::toVector3d(mpMatchedKF->GetTranslation()),1.0);
+        mg2oScw = mg2oScm*gSmw;
+        mScw = Converter::toCvMat(mg2oScw);
     }
 
+    // 统计局部建图被停止的时间,这段时间内不会有新的关键帧进入地图,跟踪线程只能依靠已有的局部地图
+    const chrono::steady_clock::time_point tStop = chrono::steady_clock::now();
+
+    // Send a stop signal to Local Mapping
+    // Avoid new keyframes are inserted while correcting the loop
+    // STEP 0：请求局部地图停止，防止局部地图线程中InsertKeyFrame函数插入新的关键帧
+    mpLocalMapper->RequestStop();
+
     // Wait until Local Mapping has effectively stopped
-    while(!mpLocalMapper->isStopped())
-    {
-        //usleep(1000);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
+    mpLocalMapper->WaitUntilStopped();
+
+    const chrono::steady_clock::time_point tStopped = chrono::steady_clock::now();
 
     // Ensure current keyframe is updated
     // STEP 1：根据共视关系更新当前帧与其它关键帧之间的连接
@@ -611,9 +668,6 @@ void LoopClosing::CorrectLoop()
     mvpCurrentConnectedKFs.push_back(mpCurrentKF);
 
     KeyFrameAndPose CorrectedSim3, NonCorrectedSim3;
-    // 先将mpCurrentKF的Sim3变换存入，固定不动
-    CorrectedSim3[mpCurrentKF]=mg2oScw;
-    cv::Mat Twc = mpCurrentKF->GetPoseInverse();
 
     // 对地图点操作的临界区
     {
@@ -621,46 +675,64 @@ void LoopClosing::CorrectLoop()
         unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
 
         // STEP 2.1：通过位姿传播，得到Sim3调整后其它与当前帧相连关键帧的位姿（只是得到，还没有修正）
-        // 遍历"当前关键帧组""
-        for(vector<KeyFrame*>::iterator vit=mvpCurrentConnectedKFs.begin(), vend=mvpCurrentConnectedKFs.end(); vit!=vend; vit++)
-        {
-            KeyFrame* pKFi = *vit;
+        // 每个关键帧的计算是独立的,并行地算到数组中再填到KeyFrameAndPose里
+        const size_t nConnected = mvpCurrentConnectedKFs.size();
+        vector<g2o::Sim3> vCorrectedSiw(nConnected), vNonCorrectedSiw(nConnected);
 
-            cv::Mat Tiw = pKFi->GetPose();
+        Eigen::Matrix3f Rcw;
+        Eigen::Vector3f tcw;
+        mpCurrentKF->GetPose(Rcw,tcw);
+        const g2o::Sim3 g2oSwc = g2o::Sim3(Rcw.cast<double>(),tcw.cast<double>(),1.0).inverse();
 
-            // currentKF在前面已经添加
-            if(pKFi!=mpCurrentKF)
+        ParallelFor(nConnected, 16, [&](size_t begin, size_t end)
+        {
+            for(size_t i=begin; i<end; i++)
             {
-                // 得到当前帧到pKFi帧的相对变换
-                cv::Mat Tic = Tiw*Twc;
-                cv::Mat Ric = Tic.rowRange(0,3).colRange(0,3);
-                cv::Mat tic = Tic.rowRange(0,3).col(3);
-                g2o::Sim3 g2oSic(Converter::toMatrix3d(Ric),Converter::toVector3d(tic),1.0);
-                // 当前帧的位姿固定不动，其它的关键帧根据相对关系得到Sim3调整的位姿
-                g2o::Sim3 g2oCorrectedSiw = g2oSic*mg2oScw;
+                KeyFrame* pKFi = mvpCurrentConnectedKFs[i];
+
+                Eigen::Matrix3f Riw;
+                Eigen::Vector3f tiw;
+                pKFi->GetPose(Riw,tiw);
+                // Pose without correction
+                // 当前帧相连关键帧，没有进行闭环g2o优化的位姿
+                vNonCorrectedSiw[i] = g2o::Sim3(Riw.cast<double>(),tiw.cast<double>(),1.0);
+
+                // 当前帧的位姿固定为Sim3求解的结果，其它的关键帧根据和当前帧之间的相对变换得到Sim3调整的位姿
                 // Pose corrected with the Sim3 of the loop closure
-                // 得到闭环g2o优化后各个关键帧的位姿 //? 只是因为当前关键帧的位姿是被优化了的吗?
-                CorrectedSim3[pKFi]=g2oCorrectedSiw;
+                if(pKFi==mpCurrentKF)
+                    vCorrectedSiw[i] = mg2oScw;
+                else
+                    vCorrectedSiw[i] = vNonCorrectedSiw[i]*g2oSwc*mg2oScw;
             }
+        });
 
-            cv::Mat Riw = Tiw.rowRange(0,3).colRange(0,3);
-            cv::Mat tiw = Tiw.rowRange(0,3).col(3);
-            g2o::Sim3 g2oSiw(Converter::toMatrix3d(Riw),Converter::toVector3d(tiw),1.0);
-            // Pose without correction
-            // 当前帧相连关键帧，没有进行闭环g2o优化的位姿 -- 还是指的是当前的关键帧位姿没有进行优化吧,所以也就认为和它相连的关键帧的位姿也没有经过优化
-            NonCorrectedSim3[pKFi]=g2oSiw;
+        for(size_t i=0; i<nConnected; i++)
+        {
+            CorrectedSim3[mvpCurrentConnectedKFs[i]] = vCorrectedSiw[i];
+            NonCorrectedSim3[mvpCurrentConnectedKFs[i]] = vNonCorrectedSiw[i];
         } // 得到修正后的当前关键帧组中的关键帧的位姿
 
         // Correct all MapPoints obsrved by current keyframe and neighbors, so that they align with the other side of the loop
         // STEP 2.2：得到调整相连帧位姿后，修正这些关键帧的MapPoints
+        // 先按照CorrectedSim3的顺序串行地为每个地图点指定修正它的关键帧(第一个观测到它的关键帧),同时更新关键帧的位姿,
+        // 然后并行地修正地图点.地图点的平均观测方向在所有关键帧的位姿都纠正之后才计算
+        vector<KeyFrame*> vpCorrectedKFs;
+        vector<g2o::Sim3> vCorrectedSwi, vUncorrectedSiw;
+        vector<pair<MapPoint*,size_t> > vCorrections;   // 需要修正的地图点和修正它的关键帧在上面数组中的下标
+        vpCorrectedKFs.reserve(nConnected);
+        vCorrectedSwi.reserve(nConnected);
+        vUncorrectedSiw.reserve(nConnected);
+
         // 遍历当前关键帧组中的每一个关键帧
         for(KeyFrameAndPose::iterator mit=CorrectedSim3.begin(), mend=CorrectedSim3.end(); mit!=mend; mit++)
         {
             KeyFrame* pKFi = mit->first;
-            g2o::Sim3 g2oCorrectedSiw = mit->second;
-            g2o::Sim3 g2oCorrectedSwi = g2oCorrectedSiw.inverse();
+            const g2o::Sim3 &g2oCorrectedSiw = mit->second;
+            const size_t idx = vpCorrectedKFs.size();
 
-            g2o::Sim3 g2oSiw =NonCorrectedSim3[pKFi];
+            vpCorrectedKFs.push_back(pKFi);
+            vCorrectedSwi.push_back(g2oCorrectedSiw.inverse());
+            vUncorrectedSiw.push_back(NonCorrectedSim3[pKFi]);
 
             vector<MapPoint*> vpMPsi = pKFi->GetMapPointMatches();
             // 遍历这个关键帧中的每一个地图点
@@ -674,39 +746,45 @@ void LoopClosing::CorrectLoop()
                 if(pMPi->mnCorrectedByKF==mpCurrentKF->mnId) // 防止重复修正
                     continue;
 
-                // 修正过程开始,本质上也是基于当前关键帧的优化后的位姿展开的
-                // Project with non-corrected pose and project back with corrected pose
-                // 将该未校正的eigP3Dw先从世界坐标系映射到未校正的pKFi相机坐标系，然后再反映射到校正后的世界坐标系下
-                cv::Mat P3Dw = pMPi->GetWorldPos();
-                Eigen::Matrix<double,3,1> eigP3Dw = Converter::toVector3d(P3Dw);
-                Eigen::Matrix<double,3,1> eigCorrectedP3Dw = g2oCorrectedSwi.map(g2oSiw.map(eigP3Dw));
-
-                cv::Mat cvCorrectedP3Dw = Converter::toCvMat(eigCorrectedP3Dw);
-                pMPi->SetWorldPos(cvCorrectedP3Dw);
                 pMPi->mnCorrectedByKF = mpCurrentKF->mnId;
                 pMPi->mnCorrectedReference = pKFi->mnId;
-                // 勿忘更新
-                pMPi->UpdateNormalAndDepth();
-            } // 遍历这个关键帧中的每一个地图点并且进行位姿的修正
+                vCorrections.push_back(make_pair(pMPi,idx));
+            }
 
             // Update keyframe pose with corrected Sim3. First transform Sim3 to SE3 (scale translation)
-            // STEP 2.3：将Sim3转换为SE3，根据更新的Sim3，更新关键帧的位姿
-            // 其实是现在已经有了更新后的关键帧组中关键帧的位姿,但是在上面的操作时只是暂时存储到了 KeyFrameAndPose 类型的变量中,还没有写回到关键帧对象中
-            Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();  //调用toRotationMatrix来去除尺度信息的
-            Eigen::Vector3d eigt = g2oCorrectedSiw.translation();                   //目测是其中还包含有尺度信息,还得去除
-            double s = g2oCorrectedSiw.scale();
+            // STEP 2.3：将Sim3转换为SE3，根据更新的Sim3，更新关键帧的位姿 [R t/s;0 1]
+            const Eigen::Matrix3d eigR = g2oCorrectedSiw.rotation().toRotationMatrix();
+            const Eigen::Vector3d eigt = g2oCorrectedSiw.translation()/g2oCorrectedSiw.scale();
 
-            eigt *=(1./s); //[R t/s;0 1]
+            pKFi->SetPose(eigR.cast<float>(),eigt.cast<float>());
+        }
 
-            cv::Mat correctedTiw = Converter::toCvSE3(eigR,eigt);
+        // Project with non-corrected pose and project back with corrected pose
+        // 将地图点先用未校正的位姿映射到pKFi相机坐标系，然后再用校正后的位姿反映射到世界坐标系下
+        ParallelFor(vCorrections.size(), 256, [&](size_t begin, size_t end)
+        {
+            for(size_t i=begin; i<end; i++)
+            {
+                MapPoint* pMPi = vCorrections[i].first;
+                const size_t idx = vCorrections[i].second;
 
-            pKFi->SetPose(correctedTiw);
+                const Eigen::Vector3d eigP3Dw = pMPi->GetWorldPosEigen().cast<double>();
+                const Eigen::Vector3d eigCorrectedP3Dw = vCorrectedSwi[idx].map(vUncorrectedSiw[idx].map(eigP3Dw));
 
-            // Make sure connections are updated
-            // STEP 2.4：根据共视关系更新当前帧与其它关键帧之间的连接
-            // 地图点的位置改变了,可能会引起共视关系\权值的改变 
-            pKFi->UpdateConnections();
-        } // 遍历当前关键帧组中的每一个关键帧,修正其中的地图点的位姿,并且写入修正后的该关键帧的位姿
+                pMPi->SetWorldPos(Eigen::Vector3f(eigCorrectedP3Dw.cast<float>()));
+                // 勿忘更新
+                pMPi->UpdateNormalAndDepth();
+            }
+        });
+
+        // Make sure connections are updated
+        // STEP 2.4：根据共视关系更新当前帧与其它关键帧之间的连接
+        // 地图点的位置改变了,可能会引起共视关系\权值的改变
+        ParallelFor(vpCorrectedKFs.size(), 4, [&](size_t begin, size_t end)
+        {
+            for(size_t i=begin; i<end; i++)
+                vpCorrectedKFs[i]->UpdateConnections();
+        });
 
         // Start Loop Fusion
         // Update matched map points and replace if duplicated
@@ -734,6 +812,8 @@ void LoopClosing::CorrectLoop()
 
     } // 对地图点操作的临界区
 
+    const chrono::steady_clock::time_point tCorrected = chrono::steady_clock::now();
+
     // Project MapPoints observed in the neighborhood of the loop keyframe
     // into the current keyframe and neighbors using corrected poses.
     // Fuse duplications.
@@ -742,37 +822,54 @@ void LoopClosing::CorrectLoop()
     SearchAndFuse(CorrectedSim3);
 
 
+    const chrono::steady_clock::time_point tFused = chrono::steady_clock::now();
+
     // After the MapPoint fusion, new links in the covisibility graph will appear attaching both sides of the loop
     // STEP 5：更新当前关键帧之间的共视相连关系，得到因闭环时MapPoints融合而新得到的连接关系
     map<KeyFrame*, set<KeyFrame*> > LoopConnections;   // 这个变量中将会存储那些因为闭环关系的形成,而新形成的链接关系
 
-    // STEP 5.1：遍历当前帧相连关键帧（一级相连）
-    for(vector<KeyFrame*>::iterator vit=mvpCurrentConnectedKFs.begin(), vend=mvpCurrentConnectedKFs.end(); vit!=vend; vit++)
+    // 各个关键帧并行地更新连接关系.一个关键帧更新时只会给当前关键帧组中的关键帧添加连接,它们在5.6中都会被去掉,
+    // 所以并行执行得到的新连接关系和依次执行相同
+    vector<set<KeyFrame*> > vLoopConnections(mvpCurrentConnectedKFs.size());
+    ParallelFor(mvpCurrentConnectedKFs.size(), 4, [&](size_t begin, size_t end)
     {
-        KeyFrame* pKFi = *vit;
-        // STEP 5.2：得到与当前帧相连关键帧的相连关键帧（二级相连）
-        vector<KeyFrame*> vpPreviousNeighbors = pKFi->GetVectorCovisibleKeyFrames();
-
-        // Update connections. Detect new links.
-        // STEP 5.3：更新一级相连关键帧的连接关系(会把当前关键帧添加进去,因为地图点已经更新和替换了)
-        pKFi->UpdateConnections();
-        // STEP 5.4：取出该帧更新后的连接关系
-        LoopConnections[pKFi]=pKFi->GetConnectedKeyFrames();
-        // STEP 5.5：从连接关系中去除闭环之前的二级连接关系，剩下的连接就是由闭环得到的连接关系
-        for(vector<KeyFrame*>::iterator vit_prev=vpPreviousNeighbors.begin(), vend_prev=vpPreviousNeighbors.end(); vit_prev!=vend_prev; vit_prev++)
-        {
-            LoopConnections[pKFi].erase(*vit_prev);
-        }
-        // STEP 5.6：从连接关系中去除闭环之前的一级连接关系，剩下的连接就是由闭环得到的连接关系
-        for(vector<KeyFrame*>::iterator vit2=mvpCurrentConnectedKFs.begin(), vend2=mvpCurrentConnectedKFs.end(); vit2!=vend2; vit2++)
+        // STEP 5.1：遍历当前帧相连关键帧（一级相连）
+        for(size_t i=begin; i<end; i++)
         {
-            LoopConnections[pKFi].erase(*vit2);
+            KeyFrame* pKFi = mvpCurrentConnectedKFs[i];
+            // STEP 5.2：得到与当前帧相连关键帧的相连关键帧（二级相连）
+            vector<KeyFrame*> vpPreviousNeighbors = pKFi->GetVectorCovisibleKeyFrames();
+
+            // Update connections. Detect new links.
+            // STEP 5.3：更新一级相连关键帧的连接关系(会把当前关键帧添加进去,因为地图点已经更新和替换了)
+            pKFi->UpdateConnections();
+            // STEP 5.4：取出该帧更新后的连接关系
+            set<KeyFrame*> &sLoopConnections = vLoopConnections[i];
+            sLoopConnections = pKFi->GetConnectedKeyFrames();
+            // STEP 5.5：从连接关系中去除闭环之前的二级连接关系，剩下的连接就是由闭环得到的连接关系
+            for(vector<KeyFrame*>::iterator vit_prev=vpPreviousNeighbors.begin(), vend_prev=vpPreviousNeighbors.end(); vit_prev!=vend_prev; vit_prev++)
+            {
+                sLoopConnections.erase(*vit_prev);
+            }
+            // STEP 5.6：从连接关系中去除闭环之前的一级连接关系，剩下的连接就是由闭环得到的连接关系
+            for(vector<KeyFrame*>::iterator vit2=mvpCurrentConnectedKFs.begin(), vend2=mvpCurrentConnectedKFs.end(); vit2!=vend2; vit2++)
+            {
+                sLoopConnections.erase(*vit2);
+            }
         }
-    }
+    });
+
+    for(size_t i=0; i<mvpCurrentConnectedKFs.size(); i++)
+        LoopConnections[mvpCurrentConnectedKFs[i]].swap(vLoopConnections[i]);
+
+    const chrono::steady_clock::time_point tConnected = chrono::steady_clock::now();
 
     // Optimize graph
     // STEP 6：进行EssentialGraph优化，LoopConnections是形成闭环后新生成的连接关系，不包括步骤7中当前帧与闭环匹配帧之间的连接关系
-    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale);
+    Optimizer::OptimizeEssentialGraph(mpMap, mpMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, mbFixScale,
+                                      mnEssentialGraphLinearSolver);
+
+    const chrono::steady_clock::time_point tOptimized = chrono::steady_clock::now();
 
     // Add loop edge
     // STEP 7：添加当前帧与闭环匹配帧之间的边（这个连接关系不优化）
@@ -792,8 +889,19 @@ void LoopClosing::CorrectLoop()
     // Loop closed. Release Local Mapping.
     mpLocalMapper->Release();    
 
+    const chrono::steady_clock::time_point tReleased = chrono::steady_clock::now();
+
     cout << "Loop Closed!" << endl;
 
+    auto ElapsedMs = [](const chrono::steady_clock::time_point &t0, const chrono::steady_clock::time_point &t1)
+    {
+        return chrono::duration_cast<chrono::duration<double,milli> >(t1-t0).count();
+    };
+    cout << "Loop correction: local mapping stopped for " << ElapsedMs(tStop,tReleased) << " ms (wait "
+         << ElapsedMs(tStop,tStopped) << ", propagation " << ElapsedMs(tStopped,tCorrected) << ", fusion "
+         << ElapsedMs(tCorrected,tFused) << ", connections " << ElapsedMs(tFused,tConnected) << ", essential graph "
+         << ElapsedMs(tConnected,tOptimized) << " ms)" << endl;
+
     mLastLoopKFid = mpCurrentKF->mnId;
 }
 
@@ -801,35 +909,63 @@ void LoopClosing::CorrectLoop()
 // 因为回环关键帧处的时间比较久远,而当前关键帧组中的关键帧的地图点会有累计的误差啊
 void LoopClosing::SearchAndFuse(const KeyFrameAndPose &CorrectedPosesMap)
 {
-    // 明显匹配器的要求要高一些
-    ORBmatcher matcher(0.8);
-
-    // 遍历闭环相连的关键帧  -- //NOTICE 为什么我觉得，应该是当前关键帧组中的关键帧呢？  
-    // NOTICE 我觉得师兄这里应该有问题的,这里遍历的就是当前关键帧组中的关键帧
+    vector<KeyFrame*> vpKFs;
+    vector<g2o::Sim3> vScw;
+    vpKFs.reserve(CorrectedPosesMap.size());
+    vScw.reserve(CorrectedPosesMap.size());
     for(KeyFrameAndPose::const_iterator mit=CorrectedPosesMap.begin(), mend=CorrectedPosesMap.end(); mit!=mend;mit++)
     {
-        KeyFrame* pKF = mit->first;
+        vpKFs.push_back(mit->first);
+        vScw.push_back(mit->second);
+    }
 
-        g2o::Sim3 g2oScw = mit->second;
-        cv::Mat cvScw = Converter::toCvMat(g2oScw);
+    const int nLP = mvpLoopMapPoints.size();
 
-        // 将闭环相连帧的MapPoints坐标变换到pKF帧坐标系，然后投影，检查冲突并融合
-        vector<MapPoint*> vpReplacePoints(mvpLoopMapPoints.size(),static_cast<MapPoint*>(NULL));
-        // vpReplacePoints中存储的将会是这个关键帧中的地图点（也就是需要替换掉的新的地图点）,原地图点的id则对应这个变量的下标
-        matcher.Fuse(pKF,cvScw,mvpLoopMapPoints,4,vpReplacePoints);// 搜索区域系数为4
+    // vvpReplacePoints[i]中存储的是第i个关键帧中需要被替换掉的地图点,下标和mvpLoopMapPoints中替换它的地图点相同
+    vector<vector<MapPoint*> > vvpReplacePoints(vpKFs.size());
 
-        // Get Map Mutex -- 卧槽还有这种操作
-        // 之所以不在前面的 Fuse 函数中进行地图点融合更新的原因是需要对地图加锁,而这里的设计中matcher中并不保存地图的指针
-        unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
-        const int nLP = mvpLoopMapPoints.size();
+    // 每个关键帧的投影匹配是独立的,并行地进行. Fuse只会修改这个关键帧自己的地图点,需要替换的地图点先记录下来,
+    // 所有的关键帧都匹配完之后再统一在地图锁中替换
+    // 遍历当前关键帧组中的关键帧
+    ParallelFor(vpKFs.size(), 2, [&](size_t begin, size_t end)
+    {
+        // 明显匹配器的要求要高一些
+        ORBmatcher matcher(0.8);
+
+        for(size_t i=begin; i<end; i++)
+        {
+            cv::Mat cvScw = Converter::toCvMat(vScw[i]);
+
+            // 将闭环相连帧的MapPoints坐标变换到pKF帧坐标系，然后投影，检查冲突并融合
+            vvpReplacePoints[i].assign(nLP,static_cast<MapPoint*>(NULL));
+            matcher.Fuse(vpKFs[i],cvScw,mvpLoopMapPoints,4,vvpReplacePoints[i]);// 搜索区域系数为4
+        }
+    });
+
+    // Get Map Mutex
+    // 之所以不在前面的 Fuse 函数中进行地图点融合更新的原因是需要对地图加锁,而这里的设计中matcher中并不保存地图的指针
+    unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
+    for(size_t iKF=0; iKF<vvpReplacePoints.size(); iKF++)
+    {
+        const vector<MapPoint*> &vpReplacePoints = vvpReplacePoints[iKF];
         // 遍历闭环帧组的所有的地图点
         for(int i=0; i<nLP;i++)
         {
             MapPoint* pRep = vpReplacePoints[i];
-            if(pRep)
-            {
-                pRep->Replace(mvpLoopMapPoints[i]);// 用mvpLoopMapPoints替换掉之前的
-            }
+            if(!pRep)
+                continue;
+
+            // 前面的关键帧中的替换可能已经把这两个地图点替换掉了,沿着替换关系找到现在代替它们的地图点
+            MapPoint* pLoopMP = mvpLoopMapPoints[i];
+            while(pRep && pRep->isBad())
+                pRep = pRep->GetReplaced();
+            while(pLoopMP && pLoopMP->isBad())
+                pLoopMP = pLoopMP->GetReplaced();
+
+            if(!pRep || !pLoopMP || pRep==pLoopMP)
+                continue;
+
+            pRep->Replace(pLoopMP);// 用mvpLoopMapPoints替换掉之前的
         }
     }
 }
@@ -843,18 +979,12 @@ void LoopClosing::RequestReset()
         mbResetRequested = true;
     }
 
-    // 堵塞,直到回环检测线程复位完成
-    while(1)
-    {
-        {
-        unique_lock<mutex> lock2(mMutexReset);
-        if(!mbResetRequested)
-            break;
-        }
-		//usleep(5000);
-		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    NotifyEvent();
 
-    }
+    // 堵塞,直到回环检测线程复位完成
+    unique_lock<mutex> lock2(mMutexReset);
+    while(mbResetRequested)
+        mcvReset.wait(lock2);
 }
 
 // 当前线程调用,检查是否有外部线程请求复位当前线程,如果有的话就复位回环检测线程
@@ -867,6 +997,7 @@ void LoopClosing::ResetIfRequested()
         mlpLoopKeyFrameQueue.clear();   // 清空参与和进行回环检测的关键帧队列
         mLastLoopKFid=0;                // 上一次没有和任何关键帧形成闭环关系
         mbResetRequested=false;         // 复位请求标志复位
+        mcvReset.notify_all();
     }
 }
 // 全局BA线程,这个是这个线程的主函数; 输入的函数参数看上去是闭环关键帧,但是在调用的时候给的其实是当前关键帧的id
@@ -874,18 +1005,27 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
 {
     cout << "Starting Global Bundle Adjustment" << endl;
 
-    // 记录当前迭代id,用来检查全局BA过程是否是因为意外结束的
-    int idx =  mnFullBAIdx;
+    const int nIterations = 10;
+    const chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+    // 每次迭代结束后输出进度,大地图上一次迭代就可能需要数十秒
+    Optimizer::BAProgressCallback progress = [tStart](int nIter, int nTotal, double chi2)
+    {
+        const double t = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now()-tStart).count();
+        cout << "Global Bundle Adjustment iteration " << nIter << "/" << nTotal << ", chi2: " << chi2 << ", " << t << " s" << endl;
+    };
+
     // 牛逼,直接调优化器中的函数了
-    // 10是迭代次数
     // mbStopGBA直接传引用过去了,这样当有外部请求的时候这个优化函数能够及时相应并且结束掉
     //? 提问:进行完这个过程后我们能够获得哪些信息?
     // 目测是能够得到全部关键帧优化后的位姿,以及部分地图点优化之后的位姿
-    Optimizer::GlobalBundleAdjustemnt(mpMap,        // 地图点对象
-                                      10,           // 迭代次数
-                                      &mbStopGBA,   // 外界控制 GBA 停止的标志
-                                      nLoopKF,      // 形成了闭环的当前关键帧的id
-                                      false);       // 不使用鲁棒核函数
+    const int nDone = Optimizer::GlobalBundleAdjustemnt(mpMap,        // 地图点对象
+                                                        nIterations,  // 迭代次数
+                                                        &mbStopGBA,   // 外界控制 GBA 停止的标志
+                                                        nLoopKF,      // 形成了闭环的当前关键帧的id
+                                                        false,        // 不使用鲁棒核函数
+                                                        mnGBALinearSolver,
+                                                        progress);
 
     // Update all MapPoints and KeyFrames
     // Local Mapping was active during BA, that means that there might be new keyframes
@@ -893,27 +1033,23 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
     // We need to propagate the correction through the spanning tree
     {
         unique_lock<mutex> lock(mMutexGBA);
-        // 如果全局BA过程是因为意外结束的,那么后面的内容就都不用管了
-        if(idx!=mnFullBAIdx)
-            return;
 
-        // 如果没有中断当前次BA的请求
-        // 这里和上面那句话的功能还有些不同,因为如果一次全局优化被中断,往往意味又要重新开启一个新的全局BA;为了中断当前正在执行的优化过程mbStopGBA将会被置位,同时会有一定的时间
-        // 使得该线程进行响应;而在开启一个新的全局优化进程之前 mbStopGBA 将会被置为False
-        // 因此,如果被强行中断的线程退出时已经有新的线程启动了,mbStopGBA=false,为了避免进行后面的程序,所以有了上面的程序;
-        // 而如果被强行终端的线程退出时新的线程还没有启动,那么上面的条件就不起作用了(虽然概率很小,前面的程序中mbStopGBA置位后很快mnFullBAIdx就++了,保险起见),所以这里要再判断一次
-        if(!mbStopGBA)
+        // 被新的闭环中断时,CorrectLoop会等待这个线程退出之后才开始纠正,所以这里更新地图是安全的.
+        // LM只保留使误差下降的步长,只要完成了至少一次迭代,优化结果就比优化之前的地图更好,同样更新到地图中
+        if(mbStopGBA && nDone<=0)
+            cout << "Global Bundle Adjustment stopped before the first iteration" << endl;
+        else
         {
-            cout << "Global Bundle Adjustment finished" << endl;
+            if(mbStopGBA)
+                cout << "Global Bundle Adjustment stopped after " << nDone << "/" << nIterations << " iterations, keeping the partial result" << endl;
+            else
+                cout << "Global Bundle Adjustment finished" << endl;
             cout << "Updating map ..." << endl;
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped() && !mpLocalMapper->isFinished())
-            {
-				//usleep(1000);
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-			}
+            // 局部建图线程终止时mbStopped也会被置位,所以这里同样不会一直等下去
+            mpLocalMapper->WaitUntilStopped();
 
             // Get Map Mutex
             unique_lock<mutex> lock(mpMap->mMutexMapUpdate);
@@ -1004,14 +1140,18 @@ void LoopClosing::RunGlobalBundleAdjustment(unsigned long nLoopKF)
 
         mbFinishedGBA = true;
         mbRunningGBA = false;
+        mcvGBA.notify_all();
     } // 更新(几乎)所有的关键帧和地图点
 }
 
 // 由外部线程调用,请求终止当前线程
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    NotifyEvent();
 }
 
 // 当前线程调用,查看是否有外部线程请求当前线程
@@ -1026,6 +1166,7 @@ void LoopClosing::SetFinish()
 {
     unique_lock<mutex> lock(mMutexFinish);
     mbFinished = true;
+    mcvFinished.notify_all();
 }
 
 // 由外部线程调用,判断当前回环检测线程是否已经正确终止了
@@ -1035,5 +1176,19 @@ bool LoopClosing::isFinished()
     return mbFinished;
 }
 
+// 阻塞直到线程主函数退出并且没有正在运行的全局BA
+void LoopClosing::WaitUntilFinished()
+{
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        while(!mbFinished)
+            mcvFinished.wait(lock);
+    }
+
+    unique_lock<mutex> lock(mMutexGBA);
+    while(mbRunningGBA)
+        mcvGBA.wait(lock);
+}
+
 
 } //namespace ORB_SLAM
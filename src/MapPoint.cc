@@ -20,8 +20,10 @@
 
 #include "MapPoint.h"
 #include "ORBmatcher.h"
+#include "Converter.h"
 
 #include<mutex>
+#include<algorithm>
 
 namespace ORB_SLAM2
 {
@@ -39,7 +41,7 @@ mutex MapPoint::mGlobalMutex;
  * @param pRefKF KeyFrame
  * @param pMap   Map
  */
-MapPoint::MapPoint(const cv::Mat &Pos,  //地图点的世界坐标
+MapPoint::MapPoint(const Eigen::Vector3f &Pos,  //地图点的世界坐标
                    KeyFrame *pRefKF,    //生成地图点的关键帧
                    Map* pMap):          //地图点所存在的地图
     mnFirstKFid(pRefKF->mnId),              //第一次观测/生成它的关键帧 id
@@ -62,15 +64,20 @@ MapPoint::MapPoint(const cv::Mat &Pos,  //地图点的世界坐标
     mfMaxDistance(0),                       //上界
     mpMap(pMap)                             //从属地图
 {
-    Pos.copyTo(mWorldPos);
+    mWorldPos = Pos;
     //平均观测方向初始化为0
-    mNormalVector = cv::Mat::zeros(3,1,CV_32F);
+    mNormalVector.setZero();
 
     // MapPoints can be created from Tracking and Local Mapping. This mutex avoid conflicts with id.
     unique_lock<mutex> lock(mpMap->mMutexPointCreation);
     mnId=nNextId++;
 }
 
+MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
+    MapPoint(Converter::toVector3f(Pos),pRefKF,pMap)
+{
+}
+
 /*
  * @brief 给定坐标与frame构造MapPoint
  *
@@ -80,20 +87,16 @@ MapPoint::MapPoint(const cv::Mat &Pos,  //地图点的世界坐标
  * @param pFrame Frame
  * @param idxF   MapPoint在Frame中的索引，即对应的特征点的编号
  */
-MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
+MapPoint::MapPoint(const Eigen::Vector3f &Pos, Map* pMap, Frame* pFrame, const int &idxF):
     mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
     mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
     mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap)
 {
-    Pos.copyTo(mWorldPos);
-    cv::Mat Ow = pFrame->GetCameraCenter();
-    mNormalVector = mWorldPos - Ow;// 世界坐标系下相机到3D点的向量 (当前关键帧的观测方向)
-    mNormalVector = mNormalVector/cv::norm(mNormalVector);// 单位化
-
-    //这个算重了吧
-    cv::Mat PC = Pos - Ow;
-    const float dist = cv::norm(PC);    //到相机的距离
+    mWorldPos = Pos;
+    const Eigen::Vector3f PC = mWorldPos - pFrame->GetCameraCenterEigen();
+    const float dist = PC.norm();       //到相机的距离
+    mNormalVector = PC/dist;            // 世界坐标系下相机到3D点的单位向量 (当前关键帧的观测方向)
     const int level = pFrame->mvKeysUn[idxF].octave;
     const float levelScaleFactor =  pFrame->mvScaleFactors[level];
     const int nLevels = pFrame->mnScaleLevels;
@@ -115,25 +118,49 @@ MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF
     mnId=nNextId++;
 }
 
+MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
+    MapPoint(Converter::toVector3f(Pos),pMap,pFrame,idxF)
+{
+}
+
 //设置地图点在世界坐标系下的坐标
 void MapPoint::SetWorldPos(const cv::Mat &Pos)
 {
     //TODO 为什么这里多了个线程锁
     unique_lock<mutex> lock2(mGlobalMutex);
     unique_lock<mutex> lock(mMutexPos);
-    Pos.copyTo(mWorldPos);
+    mWorldPos = Converter::toVector3f(Pos);
+}
+
+void MapPoint::SetWorldPos(const Eigen::Vector3f &Pos)
+{
+    unique_lock<mutex> lock2(mGlobalMutex);
+    unique_lock<mutex> lock(mMutexPos);
+    mWorldPos = Pos;
 }
 //获取地图点在世界坐标系下的坐标
 cv::Mat MapPoint::GetWorldPos()
 {
     unique_lock<mutex> lock(mMutexPos);
-    return mWorldPos.clone();
+    return Converter::toCvMat(mWorldPos);
+}
+
+Eigen::Vector3f MapPoint::GetWorldPosEigen()
+{
+    unique_lock<mutex> lock(mMutexPos);
+    return mWorldPos;
 }
-//设置地图点的平均观测方向
+//获取地图点的平均观测方向
 cv::Mat MapPoint::GetNormal()
 {
     unique_lock<mutex> lock(mMutexPos);
-    return mNormalVector.clone();
+    return Converter::toCvMat(mNormalVector);
+}
+
+Eigen::Vector3f MapPoint::GetNormalEigen()
+{
+    unique_lock<mutex> lock(mMutexPos);
+    return mNormalVector;
 }
 //获取地图点的参考关键帧
 KeyFrame* MapPoint::GetReferenceKeyFrame()
@@ -158,11 +185,14 @@ void MapPoint::AddObservation(KeyFrame* pKF, size_t idx)
         return;
     // 记录下能观测到该MapPoint的KF和该MapPoint在KF中的索引
     mObservations[pKF]=idx;
+    AddDescriptorToCache(pKF,idx);
 
     if(pKF->mvuRight[idx]>=0)
         nObs+=2; // 双目或者grbd
     else
         nObs++; // 单目
+
+    UpdateRedundantObservations();
 }
 
 
@@ -182,6 +212,9 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
                 nObs--;
 
             mObservations.erase(pKF);
+            EraseDescriptorFromCache(pKF);
+            pKF->SetRedundantObservation(idx,false);
+            UpdateRedundantObservations();
 
             // 如果该keyFrame是参考帧，该Frame被删除后重新指定RefFrame
             if(mpRefKF==pKF)
@@ -223,10 +256,12 @@ void MapPoint::SetBadFlag()
         mbBad=true;
         obs = mObservations;// 把mObservations转存到obs，obs和mObservations里存的是指针，赋值过程为浅拷贝
         mObservations.clear();// 把mObservations指向的内存释放，obs作为局部变量之后自动删除
+        ClearDescriptorCache();
     }
     for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
+        pKF->SetRedundantObservation(mit->second,false);
         pKF->EraseMapPointMatch(mit->second);// 告诉可以观测到该MapPoint的KeyFrame，该MapPoint被删了
     }
 
@@ -261,6 +296,7 @@ void MapPoint::Replace(MapPoint* pMP)
         obs=mObservations;
         //清除当前地图点的原有观测
         mObservations.clear();
+        ClearDescriptorCache();
         //当前的地图点被删除了
         mbBad=true;
         //暂存当前地图点的可视次数和被找到的次数
@@ -276,6 +312,8 @@ void MapPoint::Replace(MapPoint* pMP)
     {
         // Replace measurement in keyframe
         KeyFrame* pKF = mit->first;
+        // 本点的冗余标记清除,如果由pMP接管这个观测,pMP->AddObservation会重新设置
+        pKF->SetRedundantObservation(mit->second,false);
 
         //其中又有两种情况:
         //- 一种情况是, 这个关键帧中没有对"要替换本地图点的地图点"的观测
@@ -358,83 +396,156 @@ float MapPoint::GetFoundRatio()
  */
 void MapPoint::ComputeDistinctiveDescriptors()
 {
-    // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
-
-    map<KeyFrame*,size_t> observations;
-
-    //获取所有观测
+    // 观测关键帧的isBad()需要锁住关键帧的互斥量,先在不持有本点的锁的情况下找出已经是坏的关键帧
+    vector<KeyFrame*> vpDescKFs;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         if(mbBad)
             return;
-        observations=mObservations;
+        vpDescKFs = mvpDescKFs;
     }
 
-    if(observations.empty())
+    if(vpDescKFs.empty())
         return;
 
-    vDescriptors.reserve(observations.size());
-
-    // 遍历观测到3d点的所有关键帧，获得orb描述子，并插入到vDescriptors中
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    vector<KeyFrame*> vpBadKFs;
+    for(size_t i=0; i<vpDescKFs.size(); i++)
     {
-        KeyFrame* pKF = mit->first;
-
-        if(!pKF->isBad())
-            vDescriptors.push_back(pKF->mDescriptors.row(mit->second));
+        if(vpDescKFs[i]->isBad())
+            vpBadKFs.push_back(vpDescKFs[i]);
     }
 
-    if(vDescriptors.empty())
+    unique_lock<mutex> lock(mMutexFeatures);
+    if(mbBad)
         return;
 
-    // Compute distances between them
-    // 获得这些描述子两两之间的距离
-    const size_t N = vDescriptors.size();
-	
-    //float Distances[N][N];
-	std::vector<std::vector<float> > Distances;
-	Distances.resize(N, vector<float>(N, 0));
-	for (size_t i = 0; i<N; i++)
+    // 有效的描述子在缓存中的索引.按照关键帧指针排序,和遍历mObservations的顺序一致,中值相同时选出的描述子也就和逐个比较时相同
+    vector<pair<KeyFrame*,size_t> > vValid;
+    vValid.reserve(mvpDescKFs.size());
+    for(size_t i=0; i<mvpDescKFs.size(); i++)
     {
-        //和自己的距离当然是0
-        Distances[i][i]=0;
-        for(size_t j=i+1;j<N;j++)
-        {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
-        }
+        if(find(vpBadKFs.begin(),vpBadKFs.end(),mvpDescKFs[i])==vpBadKFs.end())
+            vValid.push_back(make_pair(mvpDescKFs[i],i));
     }
 
+    if(vValid.empty())
+        return;
+
+    sort(vValid.begin(),vValid.end());
+
     // Take the descriptor with least median distance to the rest
+    // 距离已经缓存好了,对每一行求中值即可
+    const size_t N = vValid.size();
+    vector<int> vDists(N);
     int BestMedian = INT_MAX;
-    int BestIdx = 0;
+    size_t BestIdx = vValid[0].second;
     for(size_t i=0;i<N;i++)
     {
         // 第i个描述子到其它所有所有描述子之间的距离
-        //vector<int> vDists(Distances[i],Distances[i]+N);
-		vector<int> vDists(Distances[i].begin(), Distances[i].end());
-		sort(vDists.begin(), vDists.end());
+        const vector<int> &vDistancesi = mvvDescDistances[vValid[i].second];
+        for(size_t j=0; j<N; j++)
+            vDists[j] = vDistancesi[vValid[j].second];
 
         // 获得中值
-        int median = vDists[0.5*(N-1)];
-        
+        nth_element(vDists.begin(), vDists.begin()+(N-1)/2, vDists.end());
+        const int median = vDists[(N-1)/2];
+
         // 寻找最小的中值
         if(median<BestMedian)
         {
             BestMedian = median;
-            BestIdx = i;
+            BestIdx = vValid[i].second;
         }
     }
 
+    // 最好的描述子，该描述子相对于其他描述子有最小的距离中值
+    // 简化来讲，中值代表了这个描述子到其它描述子的平均距离
+    // 最好的描述子就是和其它描述子的平均距离最小
+    mDescriptor = mvDescriptors[BestIdx].clone();
+}
+
+void MapPoint::AddDescriptorToCache(KeyFrame* pKF, size_t idx)
+{
+    const cv::Mat descriptor = pKF->mDescriptors.row(idx);
+
+    // 新的一行,同时在已有的每一行末尾追加新描述子到它们的距离
+    const size_t N = mvpDescKFs.size();
+    vector<int> vDistances(N+1,0);
+    for(size_t i=0; i<N; i++)
     {
-        unique_lock<mutex> lock(mMutexFeatures);
-        
-        // 最好的描述子，该描述子相对于其他描述子有最小的距离中值
-        // 简化来讲，中值代表了这个描述子到其它描述子的平均距离
-        // 最好的描述子就是和其它描述子的平均距离最小
-        mDescriptor = vDescriptors[BestIdx].clone();       
+        const int dist = ORBmatcher::DescriptorDistance(mvDescriptors[i],descriptor);
+        vDistances[i] = dist;
+        mvvDescDistances[i].push_back(dist);
+    }
+
+    mvpDescKFs.push_back(pKF);
+    mvDescriptors.push_back(descriptor);
+    mvvDescDistances.push_back(vDistances);
+}
+
+void MapPoint::EraseDescriptorFromCache(KeyFrame* pKF)
+{
+    const vector<KeyFrame*>::iterator vit = find(mvpDescKFs.begin(),mvpDescKFs.end(),pKF);
+    if(vit==mvpDescKFs.end())
+        return;
+
+    // 把最后一项交换到被删除的位置上,行和列都要交换
+    const size_t k = vit-mvpDescKFs.begin();
+    const size_t last = mvpDescKFs.size()-1;
+    if(k!=last)
+    {
+        mvpDescKFs[k] = mvpDescKFs[last];
+        mvDescriptors[k] = mvDescriptors[last];
+        mvvDescDistances[k].swap(mvvDescDistances[last]);
+        for(size_t i=0; i<=last; i++)
+            mvvDescDistances[i][k] = mvvDescDistances[i][last];
+        mvvDescDistances[k][k] = 0;
+    }
+
+    mvpDescKFs.pop_back();
+    mvDescriptors.pop_back();
+    mvvDescDistances.pop_back();
+    for(size_t i=0; i<mvvDescDistances.size(); i++)
+        mvvDescDistances[i].pop_back();
+}
+
+void MapPoint::ClearDescriptorCache()
+{
+    mvpDescKFs.clear();
+    mvDescriptors.clear();
+    mvvDescDistances.clear();
+}
+
+void MapPoint::UpdateRedundantObservations()
+{
+    // 和LocalMapping::KeyFrameCulling中的判断相同:观测数目要多于thObs,
+    // 并且至少有thObs个其它关键帧在相同或者更精细(金字塔层级不超过本观测层级+1)的尺度上观测到该点
+    const int thObs = 3;
+    if(nObs<=thObs)
+    {
+        for(map<KeyFrame*,size_t>::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+            mit->first->SetRedundantObservation(mit->second,false);
+        return;
+    }
+
+    // 统计每个金字塔层级上的观测数目,再求前缀和,得到层级不超过l的观测数目
+    vector<int> vnLevelCounts;
+    for(map<KeyFrame*,size_t>::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+    {
+        const size_t level = mit->first->mvKeysUn[mit->second].octave;
+        if(level+2>vnLevelCounts.size())
+            vnLevelCounts.resize(level+2,0);
+        vnLevelCounts[level]++;
+    }
+    for(size_t l=1; l<vnLevelCounts.size(); l++)
+        vnLevelCounts[l] += vnLevelCounts[l-1];
+
+    for(map<KeyFrame*,size_t>::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+    {
+        const size_t level = mit->first->mvKeysUn[mit->second].octave;
+        // 减去自己这一次观测
+        const int nOthers = vnLevelCounts[level+1]-1;
+        mit->first->SetRedundantObservation(mit->second,nOthers>=thObs);
     }
 }
 
@@ -478,7 +589,7 @@ void MapPoint::UpdateNormalAndDepth()
 {
     map<KeyFrame*,size_t> observations;
     KeyFrame* pRefKF;
-    cv::Mat Pos;
+    Eigen::Vector3f Pos;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
@@ -487,26 +598,25 @@ void MapPoint::UpdateNormalAndDepth()
 
         observations=mObservations; // 获得观测到该3d点的所有关键帧
         pRefKF=mpRefKF;             // 观测到该点的参考关键帧
-        Pos = mWorldPos.clone();    // 3d点在世界坐标系中的位置
+        Pos = mWorldPos;            // 3d点在世界坐标系中的位置
     }
 
     if(observations.empty())
         return;
 
     //初始值为0向量用于累加;但是放心每次累加的变量都是经过归一化之后的
-    cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
     int n=0;
     for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
-        cv::Mat Owi = pKF->GetCameraCenter();
-        cv::Mat normali = mWorldPos - Owi;
-        normal = normal + normali/cv::norm(normali); // 对所有关键帧对该点的观测方向归一化为单位向量进行求和
+        const Eigen::Vector3f normali = Pos - pKF->GetCameraCenterEigen();
+        normal += normali/normali.norm(); // 对所有关键帧对该点的观测方向归一化为单位向量进行求和
         n++;
     } 
 
-    cv::Mat PC = Pos - pRefKF->GetCameraCenter(); // 参考关键帧相机指向3D点的向量（在世界坐标系下的表示）
-    const float dist = cv::norm(PC); // 该点到参考关键帧相机的距离
+    const Eigen::Vector3f PC = Pos - pRefKF->GetCameraCenterEigen(); // 参考关键帧相机指向3D点的向量（在世界坐标系下的表示）
+    const float dist = PC.norm(); // 该点到参考关键帧相机的距离
     const int level = pRefKF->mvKeysUn[observations[pRefKF]].octave;
     const float levelScaleFactor =  pRefKF->mvScaleFactors[level];
     const int nLevels = pRefKF->mnScaleLevels; // 金字塔层数
@@ -496,7 +496,8 @@ ORBextractor::ORBextractor(int _nfeatures,		//指定要提取的特征点数目
 						   int _minThFAST):		//如果因为图像纹理不丰富提取出的特征点不多，为了达到想要的特征点数目，
 												//就使用这个参数提取出不是那么明显的角点
     nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
-    iniThFAST(_iniThFAST), minThFAST(_minThFAST)//设置这些参数
+    iniThFAST(_iniThFAST), minThFAST(_minThFAST),//设置这些参数
+    mnMinLevel(0)									//默认从金字塔底层开始提取
 {
 	//存储每层图像缩放系数的vector调整为符合图层数目的大小
     mvScaleFactor.resize(nlevels);
@@ -526,32 +527,8 @@ ORBextractor::ORBextractor(int _nfeatures,		//指定要提取的特征点数目
     //调整图像金字塔vector以使得其符合咱们设定的图像层数
     mvImagePyramid.resize(nlevels);
 
-	//每层需要提取出来的特征点个数，这个向量也要根据图像金字塔设定的层数进行调整
-    mnFeaturesPerLevel.resize(nlevels);
-	
-	//这个变量名起的我有点儿无言以对啊。。。敢不敢再乱点儿
-	//图片降采样缩放系数的倒数
-    float factor = 1.0f / scaleFactor;
-	//每个单位缩放系数所希望的特征点个数？
-	//TODO 不明白这个公式是怎么的出来的，根据资料[https://blog.csdn.net/luoshixian099/article/details/48523267]来看貌似是
-	//从opencv那里借鉴过来的
-    //NOTICE 其实这里有很多函数，本身就是opencv的源码
-    float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)nlevels));
-
-	//用于在特征点个数分配的，特征点的累计计数清空
-    int sumFeatures = 0;
-	//开始逐层计算要分配的特征点个数，顶层图像除外（看循环后面）
-    for( int level = 0; level < nlevels-1; level++ )
-    {
-		//分配 cvRound : 返回个参数最接近的整数值
-        mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);
-		//累计
-        sumFeatures += mnFeaturesPerLevel[level];
-		//乘系数
-        nDesiredFeaturesPerScale *= factor;
-    }
-    //由于前面的特征点个数取整操作，可能会导致剩余一些特征点个数没有被分配，所以这里就将这个余出来的特征点分配到最高的图层中
-    mnFeaturesPerLevel[nlevels-1] = std::max(nfeatures - sumFeatures, 0);
+	//每层需要提取出来的特征点个数
+    ComputeFeaturesPerLevel();
 
 	//成员变量pattern的长度，也就是点的个数，这里的512表示512个点（上面的数组中是存储的坐标所以是256*2*2）
     const int npoints = 512;
@@ -602,6 +579,56 @@ ORBextractor::ORBextractor(int _nfeatures,		//指定要提取的特征点数目
     }
 }
 
+//设置要提取的特征点总数，并重新分配每层图像中要提取的特征点数目
+void ORBextractor::SetNumFeatures(int _nfeatures)
+{
+    if(_nfeatures==nfeatures)
+        return;
+    nfeatures = _nfeatures;
+    ComputeFeaturesPerLevel();
+}
+
+//设置开始提取特征点的最低金字塔层，并重新分配每层图像中要提取的特征点数目
+void ORBextractor::SetMinLevel(int nMinLevel)
+{
+    nMinLevel = std::max(0,std::min(nMinLevel,nlevels-1));
+    if(nMinLevel==mnMinLevel)
+        return;
+    mnMinLevel = nMinLevel;
+    ComputeFeaturesPerLevel();
+}
+
+//根据特征点总数计算每层图像中要提取的特征点数目，低于mnMinLevel的图层不分配特征点
+void ORBextractor::ComputeFeaturesPerLevel()
+{
+	//每层需要提取出来的特征点个数，这个向量也要根据图像金字塔设定的层数进行调整
+    mnFeaturesPerLevel.assign(nlevels,0);
+	
+	//这个变量名起的我有点儿无言以对啊。。。敢不敢再乱点儿
+	//图片降采样缩放系数的倒数
+    float factor = 1.0f / scaleFactor;
+	//每个单位缩放系数所希望的特征点个数？
+	//TODO 不明白这个公式是怎么的出来的，根据资料[https://blog.csdn.net/luoshixian099/article/details/48523267]来看貌似是
+	//从opencv那里借鉴过来的
+    //NOTICE 其实这里有很多函数，本身就是opencv的源码
+    float nDesiredFeaturesPerScale = nfeatures*(1 - factor)/(1 - (float)pow((double)factor, (double)(nlevels-mnMinLevel)));
+
+	//用于在特征点个数分配的，特征点的累计计数清空
+    int sumFeatures = 0;
+	//开始逐层计算要分配的特征点个数，顶层图像除外（看循环后面）
+    for( int level = mnMinLevel; level < nlevels-1; level++ )
+    {
+		//分配 cvRound : 返回个参数最接近的整数值
+        mnFeaturesPerLevel[level] = cvRound(nDesiredFeaturesPerScale);
+		//累计
+        sumFeatures += mnFeaturesPerLevel[level];
+		//乘系数
+        nDesiredFeaturesPerScale *= factor;
+    }
+    //由于前面的特征点个数取整操作，可能会导致剩余一些特征点个数没有被分配，所以这里就将这个余出来的特征点分配到最高的图层中
+    mnFeaturesPerLevel[nlevels-1] = std::max(nfeatures - sumFeatures, 0);
+}
+
 /**
  * @brief 计算特征点s的方向
  * @detials 注意这个也不是类的成员函数
@@ -1057,6 +1084,13 @@ void ORBextractor::ComputeKeyPointsOctTree(
 	//遍历所有图像
     for (int level = 0; level < nlevels; ++level)
     {
+        //低于mnMinLevel的图层不提取特征点，相当于降低了提取的分辨率
+        if(level<mnMinLevel)
+        {
+            allKeypoints[level].clear();
+            continue;
+        }
+
 		//计算这层图像的坐标边界， NOTICE 注意这里是坐标边界，EDGE_THRESHOLD指的应该是可以提取特征点的有效图像边界，后面会一直使用“有效图像边界“这个自创名词
         const int minBorderX = EDGE_THRESHOLD-3;			//这里的3是因为在计算FAST特征点的时候，需要建立一个半径为3的圆
         const int minBorderY = minBorderX;					//minY的计算就可以直接拷贝上面的计算结果了
@@ -37,6 +37,9 @@
 #include<opencv2/features2d/features2d.hpp>
 
 #include "Thirdparty/DBoW2/DBoW2/FeatureVector.h"
+#include "System.h"
+#include "SensorConfig.h"
+#include "Converter.h"
 
 #include<stdint.h>
 
@@ -257,8 +260,8 @@ int ORBmatcher::SearchByBoW(KeyFrame* pKF,Frame &F, vector<MapPoint*> &vpMapPoin
         // first 元素就是node
         if(KFit->first == Fit->first) //步骤1：分别取出属于同一node的ORB特征点(只有属于同一node，才有可能是匹配点)
         {
-            const vector<unsigned int> vIndicesKF = KFit->second;
-            const vector<unsigned int> vIndicesF = Fit->second;
+            const vector<unsigned int> &vIndicesKF = KFit->second;
+            const vector<unsigned int> &vIndicesF = Fit->second;
 
             // 步骤2：遍历KF中属于该node的特征点
             for(size_t iKF=0; iKF<vIndicesKF.size(); iKF++)
@@ -1017,8 +1020,9 @@ int ORBmatcher::SearchForTriangulation(KeyFrame *pKF1, KeyFrame *pKF2, cv::Mat F
  */
 int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const float th)
 {
-    cv::Mat Rcw = pKF->GetRotation();
-    cv::Mat tcw = pKF->GetTranslation();
+    Eigen::Matrix3f Rcw;
+    Eigen::Vector3f tcw;
+    pKF->GetPose(Rcw,tcw);
 
     const float &fx = pKF->fx;
     const float &fy = pKF->fy;
@@ -1026,7 +1030,7 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
     const float &cy = pKF->cy;
     const float &bf = pKF->mbf;
 
-    cv::Mat Ow = pKF->GetCameraCenter();
+    const Eigen::Vector3f Ow = pKF->GetCameraCenterEigen();
 
     int nFused=0;
 
@@ -1043,16 +1047,16 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
         if(pMP->isBad() || pMP->IsInKeyFrame(pKF))
             continue;
 
-        cv::Mat p3Dw = pMP->GetWorldPos();
-        cv::Mat p3Dc = Rcw*p3Dw + tcw;
+        const Eigen::Vector3f p3Dw = pMP->GetWorldPosEigen();
+        const Eigen::Vector3f p3Dc = Rcw*p3Dw + tcw;
 
         // Depth must be positive
-        if(p3Dc.at<float>(2)<0.0f)
+        if(p3Dc(2)<0.0f)
             continue;
 
-        const float invz = 1/p3Dc.at<float>(2);
-        const float x = p3Dc.at<float>(0)*invz;
-        const float y = p3Dc.at<float>(1)*invz;
+        const float invz = 1/p3Dc(2);
+        const float x = p3Dc(0)*invz;
+        const float y = p3Dc(1)*invz;
 
         const float u = fx*x+cx;
         const float v = fy*y+cy;// 步骤1：得到MapPoint在图像上的投影坐标
@@ -1065,15 +1069,15 @@ int ORBmatcher::Fuse(KeyFrame *pKF, const vector<MapPoint *> &vpMapPoints, const
 
         const float maxDistance = pMP->GetMaxDistanceInvariance();
         const float minDistance = pMP->GetMinDistanceInvariance();
-        cv::Mat PO = p3Dw-Ow;
-        const float dist3D = cv::norm(PO);
+        const Eigen::Vector3f PO = p3Dw-Ow;
+        const float dist3D = PO.norm();
 
         // Depth must be inside the scale pyramid of the image
         if(dist3D<minDistance || dist3D>maxDistance )
             continue;
 
         // Viewing angle must be less than 60 deg
-        cv::Mat Pn = pMP->GetNormal();
+        const Eigen::Vector3f Pn = pMP->GetNormalEigen();
 
         if(PO.dot(Pn)<0.5*dist3D)
             continue;
@@ -1560,12 +1564,40 @@ int ORBmatcher::SearchBySim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint*> &
  * @param  CurrentFrame 当前帧
  * @param  LastFrame    上一帧
  * @param  th           阈值
- * @param  bMono        是否为单目
+ * @param  sensor       传感器类型
  * @return              成功匹配的数量
  * @see SearchByBoW()
  */
-int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const bool bMono)
+int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th, const int sensor)
 {
+    // 根据传感器类型分发到编译期特化的版本
+    switch(sensor)
+    {
+#ifdef ORB_SLAM2_WITH_MONOCULAR
+    case System::MONOCULAR:
+        return SearchByProjection<true>(CurrentFrame,LastFrame,th);
+#endif
+    // 双目和RGB-D的代码完全相同(没有右目坐标的特征点仍然使用单目误差边),共用同一个实例
+#ifdef ORB_SLAM2_WITH_STEREO
+    case System::STEREO:
+#endif
+#ifdef ORB_SLAM2_WITH_RGBD
+    case System::RGBD:
+#endif
+#if defined(ORB_SLAM2_WITH_STEREO) || defined(ORB_SLAM2_WITH_RGBD)
+        return SearchByProjection<false>(CurrentFrame,LastFrame,th);
+#endif
+    default:
+        cerr << "ERROR: SearchByProjection was not compiled for sensor " << sensor << endl;
+        exit(-1);
+    }
+}
+
+template<bool bMonocular>
+int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame, const float th)
+{
+    const bool bMono = bMonocular;
+
     int nmatches = 0;
 
     // Rotation Histogram (to check rotation consistency)
@@ -1574,20 +1606,20 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
         rotHist[i].reserve(500);
     const float factor = HISTO_LENGTH/360.0f;
 
-    const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
-    const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0,3).col(3);
+    const Eigen::Matrix3f Rcw = Converter::toMatrix3f(CurrentFrame.mTcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3f tcw = Converter::toVector3f(CurrentFrame.mTcw.rowRange(0,3).col(3));
 
-    const cv::Mat twc = -Rcw.t()*tcw; // twc(w)
+    const Eigen::Vector3f twc = -Rcw.transpose()*tcw; // twc(w)
 
-    const cv::Mat Rlw = LastFrame.mTcw.rowRange(0,3).colRange(0,3);
-    const cv::Mat tlw = LastFrame.mTcw.rowRange(0,3).col(3); // tlw(l)
+    const Eigen::Matrix3f Rlw = Converter::toMatrix3f(LastFrame.mTcw.rowRange(0,3).colRange(0,3));
+    const Eigen::Vector3f tlw = Converter::toVector3f(LastFrame.mTcw.rowRange(0,3).col(3)); // tlw(l)
 
     // vector from LastFrame to CurrentFrame expressed in LastFrame
-    const cv::Mat tlc = Rlw*twc+tlw; // Rlw*twc(w) = twc(l), twc(l) + tlw(l) = tlc(l)
+    const Eigen::Vector3f tlc = Rlw*twc+tlw; // Rlw*twc(w) = twc(l), twc(l) + tlw(l) = tlc(l)
 
     // 判断前进还是后退
-    const bool bForward = tlc.at<float>(2) > CurrentFrame.mb && !bMono; // 非单目情况，如果Z大于基线，则表示相机明显前进
-    const bool bBackward = -tlc.at<float>(2) > CurrentFrame.mb && !bMono; // 非单目情况，如果-Z小于基线，则表示相机明显后退
+    const bool bForward = tlc(2) > CurrentFrame.mb && !bMono; // 非单目情况，如果Z大于基线，则表示相机明显前进
+    const bool bBackward = -tlc(2) > CurrentFrame.mb && !bMono; // 非单目情况，如果-Z小于基线，则表示相机明显后退
 
     // 遍历上一帧中有效的地图点
     for(int i=0; i<LastFrame.N; i++)
@@ -1600,12 +1632,12 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
             {
                 // 对上一帧有效的MapPoints进行跟踪
                 // Project
-                cv::Mat x3Dw = pMP->GetWorldPos();
-                cv::Mat x3Dc = Rcw*x3Dw+tcw;
+                const Eigen::Vector3f x3Dw = pMP->GetWorldPosEigen();
+                const Eigen::Vector3f x3Dc = Rcw*x3Dw+tcw;
 
-                const float xc = x3Dc.at<float>(0);
-                const float yc = x3Dc.at<float>(1);
-                const float invzc = 1.0/x3Dc.at<float>(2);
+                const float xc = x3Dc(0);
+                const float yc = x3Dc(1);
+                const float invzc = 1.0/x3Dc(2);
 
                 if(invzc<0)
                     continue;
@@ -1657,7 +1689,7 @@ int ORBmatcher::SearchByProjection(Frame &CurrentFrame, const Frame &LastFrame,
                         if(CurrentFrame.mvpMapPoints[i2]->Observations()>0)
                             continue;
 
-                    if(CurrentFrame.mvuRight[i2]>0)
+                    if(!bMono && CurrentFrame.mvuRight[i2]>0)
                     {
                         // 双目和rgbd的情况，需要保证右图的点也在搜索半径以内
                         const float ur = u - CurrentFrame.mbf*invzc;
@@ -34,32 +34,83 @@
 #include "Thirdparty/g2o/g2o/core/block_solver.h"
 #include "Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
 #include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+#include "Thirdparty/g2o/g2o/core/hyper_graph_action.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
 #include "Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
+#include "Thirdparty/g2o/g2o/solvers/linear_solver_pcg.h"
 #include "Thirdparty/g2o/g2o/types/types_six_dof_expmap.h"
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 #include<Eigen/StdVector>
 
 #include "Converter.h"
+#include "System.h"
+#include "SensorConfig.h"
+#include "PoseSolver.h"
 
 #include<mutex>
+#include<chrono>
+#include<limits>
+#include<memory>
 
 namespace ORB_SLAM2
 {
 
+/**
+ * @brief 在g2o每次迭代结束后调用BA的进度回调
+ * @details 边上保存的误差可能是被拒绝的试探步长的,这里不重新计算,而是使用LM记录的当前状态的卡方误差
+ */
+class BAProgressAction : public g2o::HyperGraphAction
+{
+public:
+    BAProgressAction(g2o::OptimizationAlgorithmLevenberg* pAlgorithm, int nIterations, const Optimizer::BAProgressCallback &progress):
+        mpAlgorithm(pAlgorithm), mnIterations(nIterations), mProgress(progress) {}
+
+    virtual g2o::HyperGraphAction* operator()(const g2o::HyperGraph*, Parameters* parameters = 0)
+    {
+        ParametersIteration* pParams = dynamic_cast<ParametersIteration*>(parameters);
+        // LM在迭代中已经算过当前状态的误差,直接取出来,不再额外遍历一遍所有的边
+        mProgress(pParams ? pParams->iteration+1 : 0, mnIterations, mpAlgorithm->currentChi());
+        return this;
+    }
+
+private:
+    g2o::OptimizationAlgorithmLevenberg* mpAlgorithm;
+    int mnIterations;
+    const Optimizer::BAProgressCallback &mProgress;
+};
+
+/**
+ * @brief 创建全局BA或本质图优化使用的线性求解器
+ * @param[in] nLinearSolver 取值为Optimizer::eLinearSolver
+ * @param[in] dPCGTolerance PCG停止迭代时的相对残差
+ */
+template<typename BlockSolverType>
+static typename BlockSolverType::LinearSolverType* CreateLinearSolver(const int nLinearSolver, const double dPCGTolerance)
+{
+    if(nLinearSolver==Optimizer::LINEAR_SOLVER_PCG)
+    {
+        g2o::LinearSolverPCG<typename BlockSolverType::PoseMatrixType>* pLinearSolver =
+                new g2o::LinearSolverPCG<typename BlockSolverType::PoseMatrixType>();
+        pLinearSolver->setTolerance(dPCGTolerance);
+        return pLinearSolver;
+    }
+    return new g2o::LinearSolverEigen<typename BlockSolverType::PoseMatrixType>();
+}
+
 // pMap中所有的MapPoints和关键帧做bundle adjustment优化
 // 这个全局BA优化在本程序中有两个地方使用：
 // a.单目初始化：CreateInitialMapMonocular函数
 // b.闭环优化：RunGlobalBundleAdjustment函数
-void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+int Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                      const int nLinearSolver, const BAProgressCallback &progress)
 {
     // 获取地图中的所有关键帧
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     // 获取地图中的所有地图点
     vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
     // 调用GBA
-    BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
+    return BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust, nLinearSolver, progress);
 }
 
 /*
@@ -82,9 +133,13 @@ void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopF
  *          pbStopFlag  是否强制暂停
  *          nLoopKF  关键帧的个数 -- 但是我觉得是,形成了闭环关系的当前关键帧的id
  *          bRobust  是否使用核函数
+ *          nLinearSolver 线性求解器
+ *          progress 进度回调
+ * @return  实际完成的迭代次数
  */
-void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
-                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+int Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP,
+                                int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust,
+                                const int nLinearSolver, const BAProgressCallback &progress)
 {
     // 不参与优化的地图点
     vector<bool> vbNotIncludedMP;
@@ -93,9 +148,9 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     // step 1 初始化g2o优化器
     g2o::SparseOptimizer optimizer;
     // ? 雅克比是6x3的?
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
+    // 地图点被边缘化,线性求解器求解的是Schur补之后的相机位姿系统.
+    // PCG的步长不需要很精确,LM会拒绝不好的步长;相对残差1e-3时的结果和Cholesky分解的卡方误差相同,迭代次数少一半以上
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver = CreateLinearSolver<g2o::BlockSolver_6_3>(nLinearSolver, 1e-3);
 
     g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
 
@@ -108,6 +163,12 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         // 那么就终止吧,代码这样写
         optimizer.setForceStopFlag(pbStopFlag);
     // ! BTW,GBA中也只有这一处才存在对这个停止请求的响应,也就是说如果进行到了下面的步骤中,外部再请求中断的话,基本上GBA的这个优化过程就已经结束了
+    // LM只接受使误差下降的步长,被拒绝的步长会回退,所以被中断时顶点中保存的总是最后一次迭代之后的有效状态
+    // 停止标志在构建线性系统之后以及每次试探步长之后都会检查,所以大地图上的响应延迟最多是构建或求解一次线性系统的时间
+
+    BAProgressAction progressAction(solver, nIterations, progress);
+    if(progress)
+        optimizer.addPostIterationAction(&progressAction);
 
     // 记录添加到优化器中的顶点的最大关键帧id
     long unsigned int maxKFid = 0;
@@ -126,7 +187,10 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         
         // 对于每一个能用的关键帧构造SE3顶点,其实就是当前关键帧的位姿
         g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKF->GetPose()));
+        Eigen::Matrix3f Rcw;
+        Eigen::Vector3f tcw;
+        pKF->GetPose(Rcw,tcw);
+        vSE3->setEstimate(Converter::toSE3Quat(Rcw,tcw));
         vSE3->setId(pKF->mnId);
         // 只有第0帧关键帧,才是不进行位姿调整的
         vSE3->setFixed(pKF->mnId==0);
@@ -154,7 +218,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         // 根据还能够使用的地图点来创建顶点,其实就是地图点在世界坐标系下的位置
         g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
         // 注意由于地图点的位置是使用cv::Mat数据类型表示的,这里需要转换成为Eigen::Vector3d类型
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
+        vPoint->setEstimate(pMP->GetWorldPosEigen().cast<double>());
         // 这里的id却是这样计算的 NOTE
         const int id = pMP->mnId+maxKFid+1;
         vPoint->setId(id);
@@ -277,7 +341,9 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
     // Optimize!
     // step 4：开始优化
     optimizer.initializeOptimization();
-    optimizer.optimize(nIterations);
+    const int nDone = optimizer.optimize(nIterations);
+    if(progress)
+        optimizer.removePostIterationAction(&progressAction);
 
     // Recover optimized data
     // step 5：得到优化的结果
@@ -297,7 +363,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         {
             // 原则上来讲不会出现"当前闭环关键帧是第0帧"的情况,如果这种情况出现,只能够说明是在创建初始地图点的时候调用的这个全局BA函数.
             // 这个时候,地图中就只有两个关键帧,其中优化后的位姿数据可以直接写入到帧的成员变量中
-            pKF->SetPose(Converter::toCvMat(SE3quat));
+            pKF->SetPose(SE3quat.rotation().toRotationMatrix().cast<float>(),SE3quat.translation().cast<float>());
         }
         else
         {
@@ -327,7 +393,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
         if(nLoopKF==0)  
         {
             // 如果这个GBA是在创建初始地图的时候调用的话,那么地图点的位姿也可以直接写入
-            pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+            pMP->SetWorldPos(Eigen::Vector3f(vPoint->estimate().cast<float>()));
             pMP->UpdateNormalAndDepth();
         }
         else
@@ -338,6 +404,8 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
             pMP->mnBAGlobalForKF = nLoopKF;
         }// 判断是因为什么原因调用的GBA
     } // 遍历所有地图点,保存优化之后地图点的位姿
+
+    return nDone;
 }
 
 /*
@@ -346,6 +414,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
  * 3D-2D 最小化重投影误差 e = (u,v) - project(Tcw*Pw) \n
  * 只优化Frame的Tcw，不优化MapPoints的坐标
  * 
+ * 使用专用的求解器 PoseSolver,不再为每一帧建立g2o图,误差和雅克比与下面的g2o类型相同:
  * 1. Vertex: g2o::VertexSE3Expmap()，即当前帧的Tcw
  * 2. Edge:
  *     - g2o::EdgeSE3ProjectXYZOnlyPose()，BaseUnaryEdge
@@ -357,57 +426,166 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
  *         + measurement：MapPoint在当前帧中的二维位置(ul,v,ur)
  *         + InfoMatrix: invSigma2(与特征点所在的尺度有关)
  *
- * @param   pFrame Frame
+ * @param   pFrame      Frame
+ * @param   sensor      传感器类型
+ * @param   pPrecision  数值精度设置和校验统计
  * @return  inliers数量
  */
-int Optimizer::PoseOptimization(Frame *pFrame)
+int Optimizer::PoseOptimization(Frame *pFrame, const int sensor, PoseBAPrecision *pPrecision)
 {
-    // 该优化函数主要用于Tracking线程中：运动跟踪、参考帧跟踪、地图跟踪、重定位
+    // 根据传感器类型分发到编译期特化的版本
+    switch(sensor)
+    {
+#ifdef ORB_SLAM2_WITH_MONOCULAR
+    case System::MONOCULAR:
+        return PoseOptimization<true>(pFrame,pPrecision);
+#endif
+    // 双目和RGB-D的代码完全相同(没有右目坐标的特征点仍然使用单目误差边),共用同一个实例
+#ifdef ORB_SLAM2_WITH_STEREO
+    case System::STEREO:
+#endif
+#ifdef ORB_SLAM2_WITH_RGBD
+    case System::RGBD:
+#endif
+#if defined(ORB_SLAM2_WITH_STEREO) || defined(ORB_SLAM2_WITH_RGBD)
+        return PoseOptimization<false>(pFrame,pPrecision);
+#endif
+    default:
+        cerr << "ERROR: PoseOptimization was not compiled for sensor " << sensor << endl;
+        exit(-1);
+    }
+}
 
-    // step 1：构造g2o优化器
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
+/**
+ * @brief 在已经添加好观测的求解器上进行四次优化,每次优化后重新划分内外点
+ * @param[in] solver                求解器
+ * @param[in] Tcw                   优化的初值,每一次优化都从它开始
+ * @param[in] vnIndexEdgeMono       求解器中第i个单目观测对应的特征点索引
+ * @param[in] vnIndexEdgeStereo     求解器中第i个双目观测对应的特征点索引
+ * @param[in] nInitialCorrespondences 参与优化的2D-3D点对数目
+ * @param[in&out] vbOutlier         每个特征点是否为外点
+ * @return int                      最后一次判断得到的外点数目
+ */
+template<typename Scalar>
+static int OptimizePoseRounds(PoseSolver<Scalar> &solver, const g2o::SE3Quat &Tcw,
+                              const vector<size_t> &vnIndexEdgeMono, const vector<size_t> &vnIndexEdgeStereo,
+                              const int nInitialCorrespondences, vector<bool> &vbOutlier)
+{
+    // 卡方分布阈值,根据重投影误差的形式不同
+    const float deltaMono = sqrt(5.991);        // 两个平方项(\delta x^2 \delta y^2),自由度为2
+    const float deltaStereo = sqrt(7.815);      // 三个平方项(\delta x^2 \delta y^2 \delta rx^2),自由度为3
 
-    linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>();
+    // 前两次优化使用Huber鲁棒核,阈值为前面的卡方阈值
+    solver.SetHuberDelta(deltaMono, deltaStereo);
 
-    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    // We perform 4 optimizations, after each optimization we classify observation as inlier/outlier
+    // At the next optimization, outliers are not included, but at the end they can be classified as inliers again.
+    // 开始优化，总共优化四次，每次优化迭代10次,每次优化后，将观测分为outlier和inlier，outlier不参与下次优化
+    // 由于每次优化后是对所有的观测进行outlier和inlier判别，因此之前被判别为outlier有可能变成inlier，反之亦然
+    // 基于卡方检验计算出的阈值（假设测量有一个像素的偏差）
+    const float chi2Mono[4]={5.991,5.991,5.991,5.991};          // 单目
+    const float chi2Stereo[4]={7.815,7.815,7.815, 7.815};       // 双目
+    const int its[4]={10,10,10,10};// 四次迭代，每次迭代的次数
 
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    // bad 的地图点个数
+    int nBad=0;
+    // 一共进行四次优化
+    for(size_t it=0; it<4; it++)
+    {
+        // 每一次都从输入的位姿开始优化
+        solver.SetPose(Tcw);
+        // 优化!盘它!
+        solver.Optimize(its[it]);
+
+        nBad=0;
+        // 优化结束,开始遍历参与优化的每一个观测(单目)
+        for(size_t i=0, iend=vnIndexEdgeMono.size(); i<iend; i++)
+        {
+            const size_t idx = vnIndexEdgeMono[i];
+
+            // 就是error*\Omega*error,表征了这个点的误差大小(考虑置信度以后)
+            // 外点没有参与优化,需要在当前位姿下重新计算误差
+            const float chi2 = vbOutlier[idx] ? solver.ComputeMonoChi2(i) : solver.GetMonoChi2(i);
+
+            if(chi2>chi2Mono[it])
+            {
+                vbOutlier[idx]=true;
+                solver.SetMonoInlier(i,false);  // 设置为outlier, 下一次优化中不使用
+                nBad++;
+            }
+            else
+            {
+                vbOutlier[idx]=false;
+                solver.SetMonoInlier(i,true);   // 设置为inlier, 下一次优化中使用
+            }
+        } // 对单目观测的处理
+        // 同样的原理遍历双目的观测
+        for(size_t i=0, iend=vnIndexEdgeStereo.size(); i<iend; i++)
+        {
+            const size_t idx = vnIndexEdgeStereo[i];
+
+            const float chi2 = vbOutlier[idx] ? solver.ComputeStereoChi2(i) : solver.GetStereoChi2(i);
+
+            if(chi2>chi2Stereo[it])
+            {
+                vbOutlier[idx]=true;
+                solver.SetStereoInlier(i,false);
+                nBad++;
+            }
+            else
+            {
+                vbOutlier[idx]=false;
+                solver.SetStereoInlier(i,true);
+            }
+        } // 对双目观测的处理
+
+        // 除了前两次优化需要RobustKernel以外, 其余的优化都不需要 -- 因为重投影的误差已经有明显的下降了
+        if(it==2)
+            solver.SetHuberDelta(0,0);
+
+        if(nInitialCorrespondences<10)
+            break;
+    } // 一共要进行四次优化
+
+    return nBad;
+}
+
+template<bool bMonocular>
+int Optimizer::PoseOptimization(Frame *pFrame, PoseBAPrecision *pPrecision)
+{
+    // 该优化函数主要用于Tracking线程中：运动跟踪、参考帧跟踪、地图跟踪、重定位
+
+    // 单精度求解器和双精度求解器中用哪个给出结果;开启校验时两个都要运行
+    const bool bSingle = pPrecision && pPrecision->bSinglePrecision;
+    const bool bValidate = pPrecision && pPrecision->bValidate;
+    const bool bUseDouble = !bSingle || bValidate;
+    const bool bUseFloat = bSingle || bValidate;
+
+    // step 1：准备只优化位姿的求解器,每个线程复用同一个求解器,避免每一帧重新分配内存
+    static thread_local PoseSolver<double> solver;
+    static thread_local PoseSolver<float> solverf;
+    if(bUseDouble)
+        solver.Reset(pFrame->fx, pFrame->fy, pFrame->cx, pFrame->cy, pFrame->mbf);
+    if(bUseFloat)
+        solverf.Reset(pFrame->fx, pFrame->fy, pFrame->cx, pFrame->cy, pFrame->mbf);
 
     // 输入的帧中,有效的,参与优化过程的2D-3D点对
     int nInitialCorrespondences=0;
 
-    // Set Frame vertex
-    // step 2：添加顶点：待优化当前帧的Tcw
-    g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-    vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
-    vSE3->setId(0);
-    vSE3->setFixed(false);
-    optimizer.addVertex(vSE3);
-
     // Set MapPoint vertices
     const int N = pFrame->N;
 
-    // for Monocular
-    vector<g2o::EdgeSE3ProjectXYZOnlyPose*> vpEdgesMono;
+    // for Monocular, 求解器中第i个单目观测对应的特征点索引
     vector<size_t> vnIndexEdgeMono;
-    vpEdgesMono.reserve(N);
     vnIndexEdgeMono.reserve(N);
 
     // for Stereo
-    vector<g2o::EdgeStereoSE3ProjectXYZOnlyPose*> vpEdgesStereo;
     vector<size_t> vnIndexEdgeStereo;
-    vpEdgesStereo.reserve(N);
     vnIndexEdgeStereo.reserve(N);
 
-    // 卡方分布阈值,根据重投影误差的形式不同
-    const float deltaMono = sqrt(5.991);        // 两个平方项(\delta x^2 \delta y^2),自由度为2
-    const float deltaStereo = sqrt(7.815);      // 三个平方项(\delta x^2 \delta y^2 \delta rx^2),自由度为3
-
-    // step 3：添加一元边：相机投影模型
+    // step 2：添加观测：相机投影模型
     {
-    // 由于需要使用地图点来构造顶点和边,因此不希望在构造的过程中部分地图点被改写造成不一致甚至是段错误,so,这里进入临界区
+    // 由于需要使用地图点来构造观测,因此不希望在构造的过程中部分地图点被改写造成不一致甚至是段错误,so,这里进入临界区
     unique_lock<mutex> lock(MapPoint::mGlobalMutex);
 
     // 遍历当前地图中的所有地图点
@@ -417,84 +595,31 @@ int Optimizer::PoseOptimization(Frame *pFrame)
         // 如果这个地图点还存在没有被剔除掉
         if(pMP)
         {
+            const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
+            // 这个点的可信程度和特征点所在的图层有关
+            const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
+            const Eigen::Vector3d Xw = Converter::toVector3d(pMP->GetWorldPos());
+
+            nInitialCorrespondences++;
+            pFrame->mvbOutlier[i] = false;
+
             // Monocular observation
             // 单目情况, 也有可能在双目下, 当前帧的左兴趣点找不到匹配的右兴趣点
-            if(pFrame->mvuRight[i]<0)
+            // 单目的特化版本中这个条件在编译期就确定为真,下面双目的分支会被编译器去掉
+            if(bMonocular || pFrame->mvuRight[i]<0)
             {
-                nInitialCorrespondences++;
-                pFrame->mvbOutlier[i] = false;
-
-                // 对这个地图点的观测
-                Eigen::Matrix<double,2,1> obs;
-                const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                obs << kpUn.pt.x, kpUn.pt.y;
-                // 新建节点,注意这个节点的只是优化位姿Pose
-                g2o::EdgeSE3ProjectXYZOnlyPose* e = new g2o::EdgeSE3ProjectXYZOnlyPose();
-                // 填充
-                e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                e->setMeasurement(obs);
-                // 这个点的可信程度和特征点所在的图层有关
-                const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
-                // 在这里使用了鲁棒核函数
-                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                e->setRobustKernel(rk);
-                rk->setDelta(deltaMono);    // 前面提到过的卡方阈值
-
-                // 设置相机内参
-                e->fx = pFrame->fx;
-                e->fy = pFrame->fy;
-                e->cx = pFrame->cx;
-                e->cy = pFrame->cy;
-                // 地图点的空间位置,作为迭代的初始值
-                cv::Mat Xw = pMP->GetWorldPos();
-                e->Xw[0] = Xw.at<float>(0);
-                e->Xw[1] = Xw.at<float>(1);
-                e->Xw[2] = Xw.at<float>(2);
-
-                optimizer.addEdge(e);
-
-                vpEdgesMono.push_back(e);
+                if(bUseDouble)
+                    solver.AddMonoObservation(Xw, kpUn.pt.x, kpUn.pt.y, invSigma2);
+                if(bUseFloat)
+                    solverf.AddMonoObservation(Xw, kpUn.pt.x, kpUn.pt.y, invSigma2);
                 vnIndexEdgeMono.push_back(i);
             }
-            else  // Stereo observation 双目
+            else  // Stereo observation 双目, 观测多了一项右目的坐标
             {
-                nInitialCorrespondences++;
-                pFrame->mvbOutlier[i] = false;
-
-                //SET EDGE
-                // 观测多了一项右目的坐标
-                Eigen::Matrix<double,3,1> obs;// 这里和单目不同
-                const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
-                const float &kp_ur = pFrame->mvuRight[i];
-                obs << kpUn.pt.x, kpUn.pt.y, kp_ur;// 这里和单目不同
-                // 新建节点,注意这里也是只优化位姿
-                g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = new g2o::EdgeStereoSE3ProjectXYZOnlyPose();// 这里和单目不同
-
-                e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(0)));
-                e->setMeasurement(obs);
-                // 置信程度主要是看左目特征点所在的图层
-                const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
-                Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
-                e->setInformation(Info);
-
-                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                e->setRobustKernel(rk);
-                rk->setDelta(deltaStereo);
-
-                e->fx = pFrame->fx;
-                e->fy = pFrame->fy;
-                e->cx = pFrame->cx;
-                e->cy = pFrame->cy;
-                e->bf = pFrame->mbf;
-                cv::Mat Xw = pMP->GetWorldPos();
-                e->Xw[0] = Xw.at<float>(0);
-                e->Xw[1] = Xw.at<float>(1);
-                e->Xw[2] = Xw.at<float>(2);
-
-                optimizer.addEdge(e);
-
-                vpEdgesStereo.push_back(e);
+                if(bUseDouble)
+                    solver.AddStereoObservation(Xw, kpUn.pt.x, kpUn.pt.y, pFrame->mvuRight[i], invSigma2);
+                if(bUseFloat)
+                    solverf.AddStereoObservation(Xw, kpUn.pt.x, kpUn.pt.y, pFrame->mvuRight[i], invSigma2);
                 vnIndexEdgeStereo.push_back(i);
             } // 根据单目和双目不同的相机输入执行不同的操作过程
         }
@@ -506,102 +631,182 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     if(nInitialCorrespondences<3)
         return 0;
 
-    // We perform 4 optimizations, after each optimization we classify observation as inlier/outlier
-    // At the next optimization, outliers are not included, but at the end they can be classified as inliers again.
-    // step 4：开始优化，总共优化四次，每次优化迭代10次,每次优化后，将观测分为outlier和inlier，outlier不参与下次优化
-    // 由于每次优化后是对所有的观测进行outlier和inlier判别，因此之前被判别为outlier有可能变成inlier，反之亦然
-    // 基于卡方检验计算出的阈值（假设测量有一个像素的偏差）
-    const float chi2Mono[4]={5.991,5.991,5.991,5.991};          // 单目
-    const float chi2Stereo[4]={7.815,7.815,7.815, 7.815};       // 双目
-    const int its[4]={10,10,10,10};// 四次迭代，每次迭代的次数
+    // step 3：开始优化,四次优化和内外点的划分见 OptimizePoseRounds
+    const g2o::SE3Quat Tcw0 = Converter::toSE3Quat(pFrame->mTcw);
+
+    // 校验时另一个精度的求解器从同样的初始内外点状态开始
+    vector<bool> vbOutlierCheck;
+    if(bValidate)
+        vbOutlierCheck = pFrame->mvbOutlier;
 
-    // bad 的地图点个数
     int nBad=0;
-    // 一共进行四次优化
-    for(size_t it=0; it<4; it++)
+    g2o::SE3Quat Tcw;
+    if(bSingle)
     {
+        nBad = OptimizePoseRounds(solverf, Tcw0, vnIndexEdgeMono, vnIndexEdgeStereo, nInitialCorrespondences, pFrame->mvbOutlier);
+        Tcw = solverf.GetPose();
+    }
+    else
+    {
+        nBad = OptimizePoseRounds(solver, Tcw0, vnIndexEdgeMono, vnIndexEdgeStereo, nInitialCorrespondences, pFrame->mvbOutlier);
+        Tcw = solver.GetPose();
+    }
 
-        vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
-        // 其实就是初始化优化器,这里的参数0就算是不填写,默认也是0,也就是只对level为0的边进行优化
-        optimizer.initializeOptimization(0);
-        // 优化!盘它!
-        optimizer.optimize(its[it]);
-
-        nBad=0;
-        // 优化结束,开始遍历参与优化的每一条误差边(单目)
-        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)
+    // step 4：校验模式下用另一个精度再解一次,统计内外点判断和位姿的差异,结果不影响当前帧
+    if(bValidate)
+    {
+        g2o::SE3Quat TcwCheck;
+        if(bSingle)
         {
-            g2o::EdgeSE3ProjectXYZOnlyPose* e = vpEdgesMono[i];
+            OptimizePoseRounds(solver, Tcw0, vnIndexEdgeMono, vnIndexEdgeStereo, nInitialCorrespondences, vbOutlierCheck);
+            TcwCheck = solver.GetPose();
+        }
+        else
+        {
+            OptimizePoseRounds(solverf, Tcw0, vnIndexEdgeMono, vnIndexEdgeStereo, nInitialCorrespondences, vbOutlierCheck);
+            TcwCheck = solverf.GetPose();
+        }
 
-            const size_t idx = vnIndexEdgeMono[i];
+        unsigned long nMismatches = 0;
+        for(size_t i=0, iend=vnIndexEdgeMono.size(); i<iend; i++)
+            if(pFrame->mvbOutlier[vnIndexEdgeMono[i]]!=vbOutlierCheck[vnIndexEdgeMono[i]])
+                nMismatches++;
+        for(size_t i=0, iend=vnIndexEdgeStereo.size(); i<iend; i++)
+            if(pFrame->mvbOutlier[vnIndexEdgeStereo[i]]!=vbOutlierCheck[vnIndexEdgeStereo[i]])
+                nMismatches++;
+
+        // 两个位姿之间的相对变换,前三维是旋转
+        const g2o::SE3Quat dT = TcwCheck.inverse()*Tcw;
+        pPrecision->nValidated++;
+        pPrecision->nObservations += nInitialCorrespondences;
+        pPrecision->nInlierMismatches += nMismatches;
+        pPrecision->fMaxRotationError = max(pPrecision->fMaxRotationError, dT.log().head<3>().norm());
+        pPrecision->fMaxTranslationError = max(pPrecision->fMaxTranslationError, dT.translation().norm());
+    }
 
-            // 如果这条误差边是来自于outlire
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError(); // NOTE g2o只会计算active edge的误差
-            }
+    // Recover optimized pose and return number of inliers
+    // 得到优化后的当前帧的位姿
+    cv::Mat pose = Converter::toCvMat(Tcw);
+    pFrame->SetPose(pose);
 
-            // 就是error*\Omega*error,表征了这个点的误差大小(考虑置信度以后)
-            const float chi2 = e->chi2();
+    // 并且返回内点数目
+    return nInitialCorrespondences-nBad;
+}
 
-            if(chi2>chi2Mono[it])
-            {                
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);                 // 设置为outlier , level 1 对应为外点,上面的过程中我们设置其为不优化
-                nBad++;
-            }
-            else
-            {
-                pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);                 // 设置为inlier, level 0 对应为内点,上面的过程中我们就是要优化这些关系
-            }
+LocalBAProblem::LocalBAProblem(): mnCalls(0)
+{
+    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
 
-            if(it==2)
-                e->setRobustKernel(0); // 除了前两次优化需要RobustKernel以外, 其余的优化都不需要 -- 因为重投影的误差已经有明显的下降了
-        } // 对单目误差边的处理
-        // 同样的原理遍历双目的误差边
-        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
-        {
-            g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = vpEdgesStereo[i];
+    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
 
-            const size_t idx = vnIndexEdgeStereo[i];
+    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
+    // LM大法好
+    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+    mOptimizer.setAlgorithm(solver);
+}
 
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
+void LocalBAProblem::Clear()
+{
+    mOptimizer.clear();
+    mmKeyFrameVertices.clear();
+    mmMapPointVertices.clear();
+    mmEdges.clear();
+}
 
-            const float chi2 = e->chi2();
+g2o::VertexSE3Expmap* LocalBAProblem::GetKeyFrameVertex(KeyFrame* pKF, const unsigned long nCall)
+{
+    std::pair<g2o::VertexSE3Expmap*,unsigned long> &vertex = mmKeyFrameVertices[pKF];
+    if(!vertex.first)
+    {
+        // 关键帧和地图点的顶点id分别取偶数和奇数,这样不同次的局部BA之间id保持不变
+        vertex.first = new g2o::VertexSE3Expmap();
+        vertex.first->setId(2*pKF->mnId);
+        mOptimizer.addVertex(vertex.first);
+    }
+    vertex.second = nCall;
+    return vertex.first;
+}
 
-            if(chi2>chi2Stereo[it])
-            {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {                
-                e->setLevel(0);
-                pFrame->mvbOutlier[idx]=false;
-            }
+g2o::VertexSBAPointXYZ* LocalBAProblem::GetMapPointVertex(MapPoint* pMP, const unsigned long nCall)
+{
+    std::pair<g2o::VertexSBAPointXYZ*,unsigned long> &vertex = mmMapPointVertices[pMP];
+    if(!vertex.first)
+    {
+        vertex.first = new g2o::VertexSBAPointXYZ();
+        vertex.first->setId(2*pMP->mnId+1);
+        vertex.first->setMarginalized(true);
+        mOptimizer.addVertex(vertex.first);
+    }
+    vertex.second = nCall;
+    return vertex.first;
+}
 
-            if(it==2)
-                e->setRobustKernel(0);
-        } // 对双目误差边的处理
+g2o::OptimizableGraph::Edge* LocalBAProblem::FindEdge(KeyFrame* pKF, MapPoint* pMP, const size_t idx, const bool bStereo,
+                                                      const unsigned long nCall)
+{
+    std::map<std::pair<KeyFrame*,MapPoint*>,EdgeInfo>::iterator mit = mmEdges.find(make_pair(pKF,pMP));
+    if(mit==mmEdges.end())
+        return static_cast<g2o::OptimizableGraph::Edge*>(NULL);
 
-        if(optimizer.edges().size()<10)
-            break;
-    } // 一共要进行四次优化
+    // 地图点在关键帧中对应的特征点变了,测量值也就不同了,需要重新建立
+    if(mit->second.idx!=idx || mit->second.bStereo!=bStereo)
+    {
+        mOptimizer.removeEdge(mit->second.pEdge);
+        mmEdges.erase(mit);
+        return static_cast<g2o::OptimizableGraph::Edge*>(NULL);
+    }
 
-    // Recover optimized pose and return number of inliers
-    // 得到优化后的当前帧的位姿
-    g2o::VertexSE3Expmap* vSE3_recov = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(0));
-    g2o::SE3Quat SE3quat_recov = vSE3_recov->estimate();
-    cv::Mat pose = Converter::toCvMat(SE3quat_recov);
-    pFrame->SetPose(pose);
+    mit->second.nLastCall = nCall;
+    return mit->second.pEdge;
+}
 
-    // 并且返回内点数目
-    return nInitialCorrespondences-nBad;
+void LocalBAProblem::AddEdge(KeyFrame* pKF, MapPoint* pMP, const size_t idx, const bool bStereo,
+                             g2o::OptimizableGraph::Edge* pEdge, const unsigned long nCall)
+{
+    EdgeInfo &info = mmEdges[make_pair(pKF,pMP)];
+    info.pEdge = pEdge;
+    info.idx = idx;
+    info.bStereo = bStereo;
+    info.nLastCall = nCall;
+}
+
+void LocalBAProblem::RemoveUnused(const unsigned long nCall)
+{
+    // 先删除误差边,这样被删除的顶点上就不会再连着本次用到的边
+    for(std::map<std::pair<KeyFrame*,MapPoint*>,EdgeInfo>::iterator mit=mmEdges.begin(); mit!=mmEdges.end(); )
+    {
+        if(mit->second.nLastCall!=nCall)
+        {
+            mOptimizer.removeEdge(mit->second.pEdge);
+            mmEdges.erase(mit++);
+        }
+        else
+            mit++;
+    }
+
+    for(std::map<KeyFrame*,std::pair<g2o::VertexSE3Expmap*,unsigned long> >::iterator mit=mmKeyFrameVertices.begin();
+        mit!=mmKeyFrameVertices.end(); )
+    {
+        if(mit->second.second!=nCall)
+        {
+            mOptimizer.removeVertex(mit->second.first);
+            mmKeyFrameVertices.erase(mit++);
+        }
+        else
+            mit++;
+    }
+
+    for(std::map<MapPoint*,std::pair<g2o::VertexSBAPointXYZ*,unsigned long> >::iterator mit=mmMapPointVertices.begin();
+        mit!=mmMapPointVertices.end(); )
+    {
+        if(mit->second.second!=nCall)
+        {
+            mOptimizer.removeVertex(mit->second.first);
+            mmMapPointVertices.erase(mit++);
+        }
+        else
+            mit++;
+    }
 }
 
 /*
@@ -624,35 +829,132 @@ int Optimizer::PoseOptimization(Frame *pFrame)
  * @param pKF        KeyFrame
  * @param pbStopFlag 是否停止优化的标志
  * @param pMap       在优化后，更新状态时需要用到Map的互斥量mMutexMapUpdate
+ * @param sensor     传感器类型
  * @note 由局部建图线程调用,对局部地图进行优化的函数
  */
-void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap)
+void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, const int sensor)
+{
+    LocalBundleAdjustment(vector<KeyFrame*>(1,pKF),pbStopFlag,pMap,sensor);
+}
+
+/**
+ * @brief 对一批关键帧共同的局部地图进行一次BA
+ * @details 局部建图线程积压了多个关键帧时使用:局部关键帧是这批关键帧以及它们一级共视关键帧的并集,
+ * 只做一次优化,而不是每个关键帧各做一次(前面的几次在积压时本来也会被跳过)
+ * @param vpKFs      这一批关键帧,按插入顺序排列,最后一个是最新的关键帧,其id用作本次优化的标记
+ * @param pbStopFlag 是否停止优化的标志
+ * @param pMap       在优化后，更新状态时需要用到Map的互斥量mMutexMapUpdate
+ * @param sensor     传感器类型
+ * @param pBudget    时间预算,为NULL时不限制局部窗口
+ * @param pProblem   持久的优化问题,为NULL时本次局部BA单独构造一个
+ */
+void Optimizer::LocalBundleAdjustment(const vector<KeyFrame*> &vpKFs, bool* pbStopFlag, Map* pMap, const int sensor,
+                                      LocalBABudget *pBudget, LocalBAProblem *pProblem)
+{
+    if(vpKFs.empty())
+        return;
+
+    // 根据传感器类型分发到编译期特化的版本
+    switch(sensor)
+    {
+#ifdef ORB_SLAM2_WITH_MONOCULAR
+    case System::MONOCULAR:
+        LocalBundleAdjustment<true>(vpKFs,pbStopFlag,pMap,pBudget,pProblem);
+        break;
+#endif
+    // 双目和RGB-D的代码完全相同(没有右目坐标的特征点仍然使用单目误差边),共用同一个实例
+#ifdef ORB_SLAM2_WITH_STEREO
+    case System::STEREO:
+#endif
+#ifdef ORB_SLAM2_WITH_RGBD
+    case System::RGBD:
+#endif
+#if defined(ORB_SLAM2_WITH_STEREO) || defined(ORB_SLAM2_WITH_RGBD)
+        LocalBundleAdjustment<false>(vpKFs,pbStopFlag,pMap,pBudget,pProblem);
+        break;
+#endif
+    default:
+        cerr << "ERROR: LocalBundleAdjustment was not compiled for sensor " << sensor << endl;
+        exit(-1);
+    }
+}
+
+template<bool bMonocular>
+void Optimizer::LocalBundleAdjustment(const vector<KeyFrame*> &vpKFs, bool* pbStopFlag, Map* pMap,
+                                      LocalBABudget *pBudget, LocalBAProblem *pProblem)
 {
     // 该优化函数用于LocalMapping线程的局部BA优化
+    const std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+
+    // 最新的关键帧,用它的id标记局部关键帧,局部地图点和固定关键帧
+    KeyFrame* pKF = vpKFs.back();
 
     // Local KeyFrames: First Breadth Search from Current Keyframe
     list<KeyFrame*> lLocalKeyFrames;
 
-    // step 1：将当前关键帧加入lLocalKeyFrames
-    lLocalKeyFrames.push_back(pKF);
-    pKF->mnBALocalForKF = pKF->mnId;
-
-    // step 2：找到关键帧连接的关键帧（一级相连），加入lLocalKeyFrames中
-    const vector<KeyFrame*> vNeighKFs = pKF->GetVectorCovisibleKeyFrames();
-    for(int i=0, iend=vNeighKFs.size(); i<iend; i++)
+    // step 1：将当前的(一批)关键帧加入lLocalKeyFrames
+    for(size_t i=0; i<vpKFs.size(); i++)
     {
-        KeyFrame* pKFi = vNeighKFs[i];
+        KeyFrame* pKFi = vpKFs[i];
+        if(pKFi->mnBALocalForKF==pKF->mnId)
+            continue;
         pKFi->mnBALocalForKF = pKF->mnId;
         if(!pKFi->isBad())
             lLocalKeyFrames.push_back(pKFi);
     }
 
+    // step 2：找到关键帧连接的关键帧（一级相连）作为候选的局部关键帧;多个关键帧时取并集
+    // 这里先不做标记,有时间预算时没有被选中的候选关键帧还可以作为固定关键帧
+    vector<pair<int,KeyFrame*> > vNeighKFs;
+    set<KeyFrame*> spNeighKFs;
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        const vector<KeyFrame*> vpCovKFs = vpKFs[i]->GetVectorCovisibleKeyFrames();
+        for(int j=0, jend=vpCovKFs.size(); j<jend; j++)
+        {
+            KeyFrame* pKFi = vpCovKFs[j];
+            if(pKFi->mnBALocalForKF==pKF->mnId || pKFi->isBad() || !spNeighKFs.insert(pKFi).second)
+                continue;
+            vNeighKFs.push_back(make_pair(vpKFs[i]->GetWeight(pKFi),pKFi));
+        }
+    }
+
+    // 有时间预算时,根据学到的单位观测耗时估计可以优化的观测数目,并按照共视权重从高到低选择局部关键帧
+    const bool bBudget = pBudget && pBudget->fTargetMs>0 && pBudget->fMsPerObservation>0;
+    int nMaxObservations = 0;
+    if(bBudget)
+    {
+        nMaxObservations = max(1,static_cast<int>(pBudget->fTargetMs/pBudget->fMsPerObservation));
+        stable_sort(vNeighKFs.begin(),vNeighKFs.end(),
+                    [](const pair<int,KeyFrame*> &a, const pair<int,KeyFrame*> &b){ return a.first>b.first; });
+    }
+
     // Local MapPoints seen in Local KeyFrames
     // step 3：遍历 lLocalKeyFrames 中关键帧，将它们观测的MapPoints加入到lLocalMapPoints
     list<MapPoint*> lLocalMapPoints;
-    // 遍历 lLocalKeyFrames 中的每一个关键帧
-    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin() , lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    // 局部地图点的观测总数,用来估计误差边的数目和优化耗时
+    int nObservations = 0;
+    const size_t nBatchKFs = lLocalKeyFrames.size();
+    bool bTruncated = false;
+    size_t nNextNeighbor = 0;
+    // 遍历 lLocalKeyFrames 中的每一个关键帧,遍历的同时把候选关键帧逐个加入,直到用完预算
+    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(); ; lit++)
     {
+        if(lit==lLocalKeyFrames.end())
+        {
+            if(nNextNeighbor==vNeighKFs.size())
+                break;
+            // 这一批关键帧自己总是要优化的,其余的关键帧受预算限制
+            if(bBudget && nObservations>=nMaxObservations)
+            {
+                bTruncated = true;
+                break;
+            }
+            KeyFrame* pKFi = vNeighKFs[nNextNeighbor++].second;
+            pKFi->mnBALocalForKF = pKF->mnId;
+            lit = lLocalKeyFrames.insert(lit,pKFi);
+        }
+
         vector<MapPoint*> vpMPs = (*lit)->GetMapPointMatches();
         // 遍历这个关键帧观测到的每一个地图点
         for(vector<MapPoint*>::iterator vit=vpMPs.begin(), vend=vpMPs.end(); vit!=vend; vit++)
@@ -665,6 +967,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
                     {
                         lLocalMapPoints.push_back(pMP);
                         pMP->mnBALocalForKF=pKF->mnId;// 防止重复添加
+                        nObservations += pMP->Observations();
                     }
             }   // 判断这个地图点是否靠谱
         } // 遍历这个关键帧观测到的每一个地图点
@@ -694,35 +997,33 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     }
 
     // Setup optimizer
-    // step 5：构造g2o优化器
-    g2o::SparseOptimizer optimizer;
-    g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
-
-    linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_6_3::PoseMatrixType>();
-
-    g2o::BlockSolver_6_3 * solver_ptr = new g2o::BlockSolver_6_3(linearSolver);
-    // LM大法好
-    g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
-    optimizer.setAlgorithm(solver);
+    // step 5：准备g2o优化器.传入了持久的优化问题时复用上一次局部BA的优化器,顶点和误差边,只增删窗口变化的部分
+    // 没有传入时才临时构造一个,构造优化器本身就要分配求解器等对象
+    std::unique_ptr<LocalBAProblem> pLocalProblem;
+    if(!pProblem)
+        pLocalProblem.reset(new LocalBAProblem());
+    LocalBAProblem* pP = pProblem ? pProblem : pLocalProblem.get();
+    g2o::SparseOptimizer &optimizer = pP->mOptimizer;
+    // 本次用到的顶点和边都用这个计数标记,没有被标记的会在最后删除
+    const unsigned long nCall = ++pP->mnCalls;
 
     // 外界设置的停止标志
-    if(pbStopFlag)
-        optimizer.setForceStopFlag(pbStopFlag);
-
-    unsigned long maxKFid = 0;
+    optimizer.setForceStopFlag(pbStopFlag);
 
     // Set Local KeyFrame vertices
     // step 6：添加顶点：Pose of Local KeyFrame
+    vector<g2o::VertexSE3Expmap*> vpLocalKFVertices;
+    vpLocalKFVertices.reserve(lLocalKeyFrames.size());
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
-        g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
-        vSE3->setId(pKFi->mnId);
+        g2o::VertexSE3Expmap * vSE3 = pP->GetKeyFrameVertex(pKFi,nCall);
+        Eigen::Matrix3f Rcw;
+        Eigen::Vector3f tcw;
+        pKFi->GetPose(Rcw,tcw);
+        vSE3->setEstimate(Converter::toSE3Quat(Rcw,tcw));
         vSE3->setFixed(pKFi->mnId==0);//第一帧位置固定
-        optimizer.addVertex(vSE3);
-        if(pKFi->mnId>maxKFid)
-            maxKFid=pKFi->mnId;
+        vpLocalKFVertices.push_back(vSE3);
     }
 
     // Set Fixed KeyFrame vertices
@@ -730,13 +1031,12 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     for(list<KeyFrame*>::iterator lit=lFixedCameras.begin(), lend=lFixedCameras.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
-        g2o::VertexSE3Expmap * vSE3 = new g2o::VertexSE3Expmap();
-        vSE3->setEstimate(Converter::toSE3Quat(pKFi->GetPose()));
-        vSE3->setId(pKFi->mnId);
+        g2o::VertexSE3Expmap * vSE3 = pP->GetKeyFrameVertex(pKFi,nCall);
+        Eigen::Matrix3f Rcw;
+        Eigen::Vector3f tcw;
+        pKFi->GetPose(Rcw,tcw);
+        vSE3->setEstimate(Converter::toSE3Quat(Rcw,tcw));
         vSE3->setFixed(true);   // 所有的这些节点的未知都固定
-        optimizer.addVertex(vSE3);
-        if(pKFi->mnId>maxKFid)
-            maxKFid=pKFi->mnId;
     }
 
     // Set MapPoint vertices
@@ -764,22 +1064,23 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     const float thHuberMono = sqrt(5.991);
     const float thHuberStereo = sqrt(7.815);
 
+    vector<g2o::VertexSBAPointXYZ*> vpLocalMPVertices;
+    vpLocalMPVertices.reserve(lLocalMapPoints.size());
+
     // 遍历所有的局部地图中的地图点
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
         // 添加顶点：MapPoint
         MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = new g2o::VertexSBAPointXYZ();
-        vPoint->setEstimate(Converter::toVector3d(pMP->GetWorldPos()));
-        int id = pMP->mnId+maxKFid+1;
-        vPoint->setId(id);
-        vPoint->setMarginalized(true);  //? 一直不明白这个是做什么的,设置可以被边缘化?
-        optimizer.addVertex(vPoint);
+        g2o::VertexSBAPointXYZ* vPoint = pP->GetMapPointVertex(pMP,nCall);
+        vPoint->setEstimate(pMP->GetWorldPosEigen().cast<double>());
+        vpLocalMPVertices.push_back(vPoint);
 
         const map<KeyFrame*,size_t> observations = pMP->GetObservations();
 
         // Set edges
         // step 8：在添加完了一个地图点之后, 对每一对关联的MapPoint和KeyFrame构建边
+        // 上一次已经存在的边直接复用,只需要恢复第一阶段优化时的状态
         // 遍历所有观测到当前地图点的关键帧
         for(map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
         {
@@ -791,60 +1092,78 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
 
                 // Monocular observation
                 // 和前面基本上都是一样的
-                if(pKFi->mvuRight[mit->second]<0)
+                if(bMonocular || pKFi->mvuRight[mit->second]<0)
                 {
-                    Eigen::Matrix<double,2,1> obs;
-                    obs << kpUn.pt.x, kpUn.pt.y;
+                    g2o::EdgeSE3ProjectXYZ* e = static_cast<g2o::EdgeSE3ProjectXYZ*>(
+                        pP->FindEdge(pKFi,pMP,mit->second,false,nCall));
+
+                    if(!e)
+                    {
+                        Eigen::Matrix<double,2,1> obs;
+                        obs << kpUn.pt.x, kpUn.pt.y;
 
-                    g2o::EdgeSE3ProjectXYZ* e = new g2o::EdgeSE3ProjectXYZ();
+                        e = new g2o::EdgeSE3ProjectXYZ();
 
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
-                    e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
-                    e->setMeasurement(obs);
-                    const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
-                    e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
+                        e->setVertex(0, vPoint);
+                        e->setVertex(1, pP->GetKeyFrameVertex(pKFi,nCall));
+                        e->setMeasurement(obs);
+                        const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
+                        e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
-                    // 这里也是使用鲁棒核函数
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberMono);
+                        // 这里也是使用鲁棒核函数
+                        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+                        e->setRobustKernel(rk);
 
-                    e->fx = pKFi->fx;
-                    e->fy = pKFi->fy;
-                    e->cx = pKFi->cx;
-                    e->cy = pKFi->cy;
+                        e->fx = pKFi->fx;
+                        e->fy = pKFi->fy;
+                        e->cx = pKFi->cx;
+                        e->cy = pKFi->cy;
+
+                        optimizer.addEdge(e);
+                        pP->AddEdge(pKFi,pMP,mit->second,false,e,nCall);
+                    }
+                    e->setLevel(0);
+                    e->robustKernel()->setDelta(thHuberMono);
 
-                    optimizer.addEdge(e);
                     vpEdgesMono.push_back(e);
                     vpEdgeKFMono.push_back(pKFi);
                     vpMapPointEdgeMono.push_back(pMP);
                 }
                 else // Stereo observation
                 {
-                    Eigen::Matrix<double,3,1> obs;
-                    const float kp_ur = pKFi->mvuRight[mit->second];
-                    obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
-
-                    g2o::EdgeStereoSE3ProjectXYZ* e = new g2o::EdgeStereoSE3ProjectXYZ();
-
-                    e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id)));
-                    e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
-                    e->setMeasurement(obs);
-                    const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
-                    Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
-                    e->setInformation(Info);
-
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberStereo);
+                    g2o::EdgeStereoSE3ProjectXYZ* e = static_cast<g2o::EdgeStereoSE3ProjectXYZ*>(
+                        pP->FindEdge(pKFi,pMP,mit->second,true,nCall));
 
-                    e->fx = pKFi->fx;
-                    e->fy = pKFi->fy;
-                    e->cx = pKFi->cx;
-                    e->cy = pKFi->cy;
-                    e->bf = pKFi->mbf;
+                    if(!e)
+                    {
+                        Eigen::Matrix<double,3,1> obs;
+                        const float kp_ur = pKFi->mvuRight[mit->second];
+                        obs << kpUn.pt.x, kpUn.pt.y, kp_ur;
+
+                        e = new g2o::EdgeStereoSE3ProjectXYZ();
+
+                        e->setVertex(0, vPoint);
+                        e->setVertex(1, pP->GetKeyFrameVertex(pKFi,nCall));
+                        e->setMeasurement(obs);
+                        const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
+                        Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
+                        e->setInformation(Info);
+
+                        g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
+                        e->setRobustKernel(rk);
+
+                        e->fx = pKFi->fx;
+                        e->fy = pKFi->fy;
+                        e->cx = pKFi->cx;
+                        e->cy = pKFi->cy;
+                        e->bf = pKFi->mbf;
+
+                        optimizer.addEdge(e);
+                        pP->AddEdge(pKFi,pMP,mit->second,true,e,nCall);
+                    }
+                    e->setLevel(0);
+                    e->robustKernel()->setDelta(thHuberStereo);
 
-                    optimizer.addEdge(e);
                     vpEdgesStereo.push_back(e);
                     vpEdgeKFStereo.push_back(pKFi);
                     vpMapPointEdgeStereo.push_back(pMP);
@@ -853,11 +1172,45 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
         } // 遍历所有观测到当前地图点的关键帧
     } // 遍历所有的局部地图中的地图点
 
+    // 删除上一次窗口中有而这一次没有的误差边和顶点
+    pP->RemoveUnused(nCall);
+
+    // 记录本次的窗口和耗时,被外部中断的局部BA也要记录;完整地跑完两个阶段的优化时才更新单位观测耗时的估计
+    auto RecordBudget = [&](const bool bAborted)
+    {
+        if(!pBudget)
+            return;
+
+        const float fElapsed = std::chrono::duration_cast<std::chrono::duration<float,std::milli> >(
+            std::chrono::steady_clock::now()-tStart).count();
+        pBudget->fLastMs = fElapsed;
+        pBudget->nLastKFs = lLocalKeyFrames.size();
+        pBudget->nLastCandidateKFs = nBatchKFs+vNeighKFs.size();
+        pBudget->nLastPoints = lLocalMapPoints.size();
+        pBudget->nLastEdges = vpEdgesMono.size()+vpEdgesStereo.size();
+        pBudget->bLastTruncated = bTruncated;
+        pBudget->bLastAborted = bAborted;
+
+        if(bAborted)
+            pBudget->nAborted++;
+        else if(nObservations>0)
+        {
+            const float fMsPerObservation = fElapsed/nObservations;
+            if(pBudget->fMsPerObservation<=0)
+                pBudget->fMsPerObservation = fMsPerObservation;
+            else
+                pBudget->fMsPerObservation = 0.8f*pBudget->fMsPerObservation + 0.2f*fMsPerObservation;
+        }
+    };
+
     // 检查是否外部请求停止
     // ? 查看一下其他有这个标志的函数都是什么时候进行停止操作的
     if(pbStopFlag)
         if(*pbStopFlag)
+        {
+            RecordBudget(true);
             return;
+        }
 
     // step 9：开始优化 -- 第一阶段优化
     optimizer.initializeOptimization();
@@ -891,7 +1244,8 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
             e->setLevel(1);// 不优化
         }
         // 第二阶段优化的时候就属于精求解了,所以就不使用核函数
-        e->setRobustKernel(0);
+        // 为了让误差边在下一次局部BA中复用,这里不删除核函数,而是把Huber核的阈值设为无穷大,效果和不使用核函数相同
+        e->robustKernel()->setDelta(numeric_limits<double>::infinity());
     }
 
     // 对于所有的双目的误差边也都进行类似的操作
@@ -908,7 +1262,7 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
             e->setLevel(1);
         }
 
-        e->setRobustKernel(0);
+        e->robustKernel()->setDelta(numeric_limits<double>::infinity());
     }
 
     // Optimize again without the outliers
@@ -978,22 +1332,27 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     // step 13：优化后更新关键帧位姿以及MapPoints的位置、平均观测方向等属性
 
     //Keyframes
-    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    size_t nKFVertex = 0;
+    for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++, nKFVertex++)
     {
         KeyFrame* pKF = *lit;
-        g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(optimizer.vertex(pKF->mnId));
+        g2o::VertexSE3Expmap* vSE3 = vpLocalKFVertices[nKFVertex];
         g2o::SE3Quat SE3quat = vSE3->estimate();
-        pKF->SetPose(Converter::toCvMat(SE3quat));
+        pKF->SetPose(SE3quat.rotation().toRotationMatrix().cast<float>(),SE3quat.translation().cast<float>());
     }
 
     //Points
-    for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
+    size_t nMPVertex = 0;
+    for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++, nMPVertex++)
     {
         MapPoint* pMP = *lit;
-        g2o::VertexSBAPointXYZ* vPoint = static_cast<g2o::VertexSBAPointXYZ*>(optimizer.vertex(pMP->mnId+maxKFid+1));
-        pMP->SetWorldPos(Converter::toCvMat(vPoint->estimate()));
+        g2o::VertexSBAPointXYZ* vPoint = vpLocalMPVertices[nMPVertex];
+        pMP->SetWorldPos(Eigen::Vector3f(vPoint->estimate().cast<float>()));
         pMP->UpdateNormalAndDepth();
     }
+
+    // step 14：记录本次的窗口和耗时,第二阶段被外部中断时记为中断
+    RecordBudget(!bDoMore);
 }
 
 /*
@@ -1017,15 +1376,16 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
 void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale,
+                                       const int nLinearSolver)
 {
     // Setup optimizer
     // step 1：构造优化器
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
-    // 指定线性方程求解器使用Eigen的块求解器
-    g2o::BlockSolver_7_3::LinearSolverType * linearSolver =
-           new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+    // 指定线性方程求解器,默认使用Eigen的稀疏Cholesky分解
+    // 本质图中的误差主要是沿着闭环分布的低频分量,块Jacobi预条件对它们的效果不好,所以PCG需要解得比较精确
+    g2o::BlockSolver_7_3::LinearSolverType * linearSolver = CreateLinearSolver<g2o::BlockSolver_7_3>(nLinearSolver, 1e-6);
     // 构造线性求解器
     g2o::BlockSolver_7_3 * solver_ptr= new g2o::BlockSolver_7_3(linearSolver);
     // 使用LM算法进行非线性迭代
@@ -0,0 +1,112 @@
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file Parallel.cc
+ * @brief 常驻线程池的实现
+ */
+
+#include "Parallel.h"
+
+namespace ORB_SLAM2
+{
+
+ThreadPool& ThreadPool::Instance()
+{
+    // 故意不释放:局部建图等线程在程序退出时不会被join,析构线程池会让它们访问已经销毁的对象
+    static ThreadPool* pPool = new ThreadPool();
+    return *pPool;
+}
+
+ThreadPool::ThreadPool()
+{
+    size_t nThreads = std::thread::hardware_concurrency();
+    if(nThreads==0)
+        nThreads = 1;
+
+    // 调用线程自己也参与计算,所以少创建一个
+    mvThreads.reserve(nThreads-1);
+    for(size_t i=1; i<nThreads; i++)
+        mvThreads.push_back(std::thread(&ThreadPool::Work,this));
+}
+
+size_t ThreadPool::Claim(Batch* pBatch)
+{
+    const size_t begin = pBatch->nNextBegin;
+    pBatch->nNextBegin += pBatch->nChunk;
+    if(pBatch->nNextBegin>=pBatch->n)
+        mdBatches.erase(std::find(mdBatches.begin(),mdBatches.end(),pBatch));
+    return begin;
+}
+
+void ThreadPool::Run(const size_t n, const size_t nChunk, const std::function<void(size_t,size_t)> &f)
+{
+    // 第一块留给调用线程,其余的块交给线程池
+    Batch batch;
+    batch.pFunc = &f;
+    batch.n = n;
+    batch.nChunk = nChunk;
+    batch.nNextBegin = nChunk;
+    batch.nPending = (n-1)/nChunk;
+
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if(batch.nPending>0)
+            mdBatches.push_back(&batch);
+    }
+    mcvWork.notify_all();
+
+    f(0,std::min(n,nChunk));
+
+    // 工作线程都在忙的时候自己处理剩下的块,只处理自己提交的,避免其它线程的任务拖慢调用者
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(batch.nNextBegin<n)
+    {
+        const size_t begin = Claim(&batch);
+        lock.unlock();
+        f(begin,std::min(n,begin+nChunk));
+        lock.lock();
+        batch.nPending--;
+    }
+
+    while(batch.nPending>0)
+        mcvDone.wait(lock);
+}
+
+void ThreadPool::Work()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(1)
+    {
+        while(mdBatches.empty())
+            mcvWork.wait(lock);
+
+        Batch* pBatch = mdBatches.front();
+        const size_t begin = Claim(pBatch);
+        lock.unlock();
+        (*pBatch->pFunc)(begin,std::min(pBatch->n,begin+pBatch->nChunk));
+        lock.lock();
+
+        if(--pBatch->nPending==0)
+            mcvDone.notify_all();
+    }
+}
+
+} //namespace ORB_SLAM
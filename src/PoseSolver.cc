@@ -0,0 +1,413 @@
+/**
+ * @file PoseSolver.cc
+ * @brief 只优化当前帧位姿的专用求解器(motion-only BA)
+ */
+
+/**
+* This file is part of ORB-SLAM2.
+*
+* Copyright (C) 2014-2016 Raúl Mur-Artal <raulmur at unizar dot es> (University of Zaragoza)
+* For more information see <https://github.com/raulmur/ORB_SLAM2>
+*
+* ORB-SLAM2 is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-SLAM2 is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with ORB-SLAM2. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PoseSolver.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace ORB_SLAM2
+{
+
+// 与 g2o::OptimizationAlgorithmLevenberg 的默认参数相同
+/// 初始阻尼因子与信息矩阵对角线最大值的比例
+static const double kLambdaTau = 1e-5;
+/// 一次迭代中最多尝试的LM步数
+static const int kMaxTrialsAfterFailure = 10;
+/// 成功的LM步之后阻尼因子的缩放范围
+static const double kGoodStepLowerScale = 1./3.;
+static const double kGoodStepUpperScale = 2./3.;
+
+template<typename Scalar>
+PoseSolver<Scalar>::PoseSolver():
+    fx(0), fy(0), cx(0), cy(0), bf(0), mDeltaMono(0), mDeltaStereo(0)
+{
+}
+
+template<typename Scalar>
+void PoseSolver<Scalar>::Reset(const float fx_, const float fy_, const float cx_, const float cy_, const float bf_)
+{
+    fx = fx_;
+    fy = fy_;
+    cx = cx_;
+    cy = cy_;
+    bf = bf_;
+    mDeltaMono = 0;
+    mDeltaStereo = 0;
+
+    // clear不会释放内存,下一帧可以直接复用
+    mvMonoX.clear(); mvMonoY.clear(); mvMonoZ.clear();
+    mvMonoU.clear(); mvMonoV.clear();
+    mvMonoInfo.clear(); mvMonoInlier.clear(); mvMonoChi2.clear(); mvMonoRho.clear();
+
+    mvStereoX.clear(); mvStereoY.clear(); mvStereoZ.clear();
+    mvStereoU.clear(); mvStereoV.clear(); mvStereoUr.clear();
+    mvStereoInfo.clear(); mvStereoInlier.clear(); mvStereoChi2.clear(); mvStereoRho.clear();
+}
+
+template<typename Scalar>
+size_t PoseSolver<Scalar>::AddMonoObservation(const Eigen::Vector3d &Xw, const float u, const float v, const float invSigma2)
+{
+    mvMonoX.push_back(Xw[0]);
+    mvMonoY.push_back(Xw[1]);
+    mvMonoZ.push_back(Xw[2]);
+    mvMonoU.push_back(u);
+    mvMonoV.push_back(v);
+    mvMonoInfo.push_back(invSigma2);
+    mvMonoInlier.push_back(1);
+    mvMonoChi2.push_back(0);
+    mvMonoRho.push_back(0);
+    return mvMonoX.size()-1;
+}
+
+template<typename Scalar>
+size_t PoseSolver<Scalar>::AddStereoObservation(const Eigen::Vector3d &Xw, const float u, const float v, const float ur, const float invSigma2)
+{
+    mvStereoX.push_back(Xw[0]);
+    mvStereoY.push_back(Xw[1]);
+    mvStereoZ.push_back(Xw[2]);
+    mvStereoU.push_back(u);
+    mvStereoV.push_back(v);
+    mvStereoUr.push_back(ur);
+    mvStereoInfo.push_back(invSigma2);
+    mvStereoInlier.push_back(1);
+    mvStereoChi2.push_back(0);
+    mvStereoRho.push_back(0);
+    return mvStereoX.size()-1;
+}
+
+template<typename Scalar>
+void PoseSolver<Scalar>::SetHuberDelta(const float deltaMono, const float deltaStereo)
+{
+    mDeltaMono = deltaMono;
+    mDeltaStereo = deltaStereo;
+}
+
+template<typename Scalar>
+void PoseSolver<Scalar>::SetMonoInlier(const size_t i, const bool bInlier)
+{
+    mvMonoInlier[i] = bInlier ? 1 : 0;
+}
+
+template<typename Scalar>
+void PoseSolver<Scalar>::SetStereoInlier(const size_t i, const bool bInlier)
+{
+    mvStereoInlier[i] = bInlier ? 1 : 0;
+}
+
+template<typename Scalar>
+double PoseSolver<Scalar>::ComputeMonoChi2(const size_t i)
+{
+    const Eigen::Matrix<Scalar,3,1> Xc = mTcw.map(Eigen::Vector3d(mvMonoX[i],mvMonoY[i],mvMonoZ[i])).cast<Scalar>();
+    const Scalar eu = mvMonoU[i] - (Xc[0]/Xc[2]*fx + cx);
+    const Scalar ev = mvMonoV[i] - (Xc[1]/Xc[2]*fy + cy);
+    mvMonoChi2[i] = mvMonoInfo[i]*(eu*eu+ev*ev);
+    return mvMonoChi2[i];
+}
+
+template<typename Scalar>
+double PoseSolver<Scalar>::ComputeStereoChi2(const size_t i)
+{
+    const Eigen::Matrix<Scalar,3,1> Xc = mTcw.map(Eigen::Vector3d(mvStereoX[i],mvStereoY[i],mvStereoZ[i])).cast<Scalar>();
+    // 与 g2o::EdgeStereoSE3ProjectXYZOnlyPose::cam_project 一样用单精度的1/z
+    const float invz = 1.0f/Xc[2];
+    const Scalar u = Xc[0]*invz*fx + cx;
+    const Scalar eu = mvStereoU[i] - u;
+    const Scalar ev = mvStereoV[i] - (Xc[1]*invz*fy + cy);
+    const Scalar er = mvStereoUr[i] - (u - bf*invz);
+    mvStereoChi2[i] = mvStereoInfo[i]*(eu*eu+ev*ev+er*er);
+    return mvStereoChi2[i];
+}
+
+template<typename Scalar>
+void PoseSolver<Scalar>::ReserveRows(const int nRows)
+{
+    if(mJ.rows()>=nRows)
+        return;
+
+    const int nCapacity = std::max(nRows, 2*(int)mJ.rows());
+    mJ.resize(nCapacity,6);
+    mWJ.resize(nCapacity,6);
+    mResiduals.resize(nCapacity);
+    mWeights.resize(nCapacity);
+}
+
+template<typename Scalar>
+double PoseSolver<Scalar>::Evaluate(const g2o::SE3Quat &Tcw, const bool bJacobians)
+{
+    const Eigen::Matrix<Scalar,3,3> R = Tcw.rotation().toRotationMatrix().cast<Scalar>();
+    const Eigen::Matrix<Scalar,3,1> t = Tcw.translation().cast<Scalar>();
+    const Scalar r00 = R(0,0), r01 = R(0,1), r02 = R(0,2);
+    const Scalar r10 = R(1,0), r11 = R(1,1), r12 = R(1,2);
+    const Scalar r20 = R(2,0), r21 = R(2,1), r22 = R(2,2);
+    const Scalar t0 = t[0], t1 = t[1], t2 = t[2];
+
+    const int Nm = mvMonoX.size();
+    const int Ns = mvStereoX.size();
+    ReserveRows(2*Nm+3*Ns);
+
+    Scalar* J0 = mJ.col(0).data();
+    Scalar* J1 = mJ.col(1).data();
+    Scalar* J2 = mJ.col(2).data();
+    Scalar* J3 = mJ.col(3).data();
+    Scalar* J4 = mJ.col(4).data();
+    Scalar* J5 = mJ.col(5).data();
+    Scalar* r = mResiduals.data();
+    Scalar* w = mWeights.data();
+
+    // 下面两个循环中没有依赖于数据的分支(条件表达式会被编译成select),编译器可以对它们向量化.
+    // 外点的权重和残差置为0,不参与信息矩阵的计算
+
+    // step 1 单目观测, 第 i 个观测对应第 i 行(u) 和第 Nm+i 行(v)
+    {
+        const Scalar* X = mvMonoX.data();
+        const Scalar* Y = mvMonoY.data();
+        const Scalar* Z = mvMonoZ.data();
+        const Scalar* U = mvMonoU.data();
+        const Scalar* V = mvMonoV.data();
+        const Scalar* Info = mvMonoInfo.data();
+        const Scalar* Inlier = mvMonoInlier.data();
+        Scalar* Chi2 = mvMonoChi2.data();
+        Scalar* Rho = mvMonoRho.data();
+        const Scalar delta = mDeltaMono;
+        const Scalar dsqr = delta*delta;
+        const bool bRobust = delta>0;
+
+        for(int i=0; i<Nm; i++)
+        {
+            const Scalar x = r00*X[i] + r01*Y[i] + r02*Z[i] + t0;
+            const Scalar y = r10*X[i] + r11*Y[i] + r12*Z[i] + t1;
+            const Scalar z = r20*X[i] + r21*Y[i] + r22*Z[i] + t2;
+
+            const Scalar eu = U[i] - (x/z*fx + cx);
+            const Scalar ev = V[i] - (y/z*fy + cy);
+            const Scalar e2 = Info[i]*(eu*eu+ev*ev);
+            Chi2[i] = e2;
+
+            // Huber鲁棒核: rho(e) = e 或者 2*delta*sqrt(e)-delta^2, 权重为rho'(e)
+            const Scalar sqrte = std::sqrt(e2);
+            const bool bHuber = bRobust && e2>dsqr;
+            const bool bInlier = Inlier[i]>0;
+            Rho[i] = bInlier ? (bHuber ? 2*sqrte*delta-dsqr : e2) : 0;
+            const Scalar wi = bInlier ? Info[i]*(bHuber ? delta/sqrte : 1) : 0;
+
+            r[i] = bInlier ? eu : 0;
+            r[Nm+i] = bInlier ? ev : 0;
+            w[i] = wi;
+            w[Nm+i] = wi;
+
+            if(bJacobians)
+            {
+                // 同 g2o::EdgeSE3ProjectXYZOnlyPose::linearizeOplus
+                const Scalar invz = z!=0 ? 1/z : 0;
+                const Scalar invz_2 = invz*invz;
+
+                J0[i] = x*y*invz_2*fx;
+                J1[i] = -(1+(x*x*invz_2))*fx;
+                J2[i] = y*invz*fx;
+                J3[i] = -invz*fx;
+                J4[i] = 0;
+                J5[i] = x*invz_2*fx;
+
+                J0[Nm+i] = (1+y*y*invz_2)*fy;
+                J1[Nm+i] = -x*y*invz_2*fy;
+                J2[Nm+i] = -x*invz*fy;
+                J3[Nm+i] = 0;
+                J4[Nm+i] = -invz*fy;
+                J5[Nm+i] = y*invz_2*fy;
+            }
+        }
+    }
+
+    // step 2 双目观测, 第 i 个观测对应第 2Nm+i 行(u), 第 2Nm+Ns+i 行(v) 和第 2Nm+2Ns+i 行(ur)
+    {
+        const Scalar* X = mvStereoX.data();
+        const Scalar* Y = mvStereoY.data();
+        const Scalar* Z = mvStereoZ.data();
+        const Scalar* U = mvStereoU.data();
+        const Scalar* V = mvStereoV.data();
+        const Scalar* Ur = mvStereoUr.data();
+        const Scalar* Info = mvStereoInfo.data();
+        const Scalar* Inlier = mvStereoInlier.data();
+        Scalar* Chi2 = mvStereoChi2.data();
+        Scalar* Rho = mvStereoRho.data();
+        const Scalar delta = mDeltaStereo;
+        const Scalar dsqr = delta*delta;
+        const bool bRobust = delta>0;
+        const int iu = 2*Nm, iv = 2*Nm+Ns, ir = 2*Nm+2*Ns;
+
+        for(int i=0; i<Ns; i++)
+        {
+            const Scalar x = r00*X[i] + r01*Y[i] + r02*Z[i] + t0;
+            const Scalar y = r10*X[i] + r11*Y[i] + r12*Z[i] + t1;
+            const Scalar z = r20*X[i] + r21*Y[i] + r22*Z[i] + t2;
+
+            // 与 g2o::EdgeStereoSE3ProjectXYZOnlyPose::cam_project 一样用单精度的1/z
+            const float invzf = 1.0f/z;
+            const Scalar u = x*invzf*fx + cx;
+            const Scalar eu = U[i] - u;
+            const Scalar ev = V[i] - (y*invzf*fy + cy);
+            const Scalar er = Ur[i] - (u - bf*invzf);
+            const Scalar e2 = Info[i]*(eu*eu+ev*ev+er*er);
+            Chi2[i] = e2;
+
+            const Scalar sqrte = std::sqrt(e2);
+            const bool bHuber = bRobust && e2>dsqr;
+            const bool bInlier = Inlier[i]>0;
+            Rho[i] = bInlier ? (bHuber ? 2*sqrte*delta-dsqr : e2) : 0;
+            const Scalar wi = bInlier ? Info[i]*(bHuber ? delta/sqrte : 1) : 0;
+
+            r[iu+i] = bInlier ? eu : 0;
+            r[iv+i] = bInlier ? ev : 0;
+            r[ir+i] = bInlier ? er : 0;
+            w[iu+i] = wi;
+            w[iv+i] = wi;
+            w[ir+i] = wi;
+
+            if(bJacobians)
+            {
+                // 同 g2o::EdgeStereoSE3ProjectXYZOnlyPose::linearizeOplus
+                const Scalar invz = z!=0 ? 1/z : 0;
+                const Scalar invz_2 = invz*invz;
+
+                J0[iu+i] = x*y*invz_2*fx;
+                J1[iu+i] = -(1+(x*x*invz_2))*fx;
+                J2[iu+i] = y*invz*fx;
+                J3[iu+i] = -invz*fx;
+                J4[iu+i] = 0;
+                J5[iu+i] = x*invz_2*fx;
+
+                J0[iv+i] = (1+y*y*invz_2)*fy;
+                J1[iv+i] = -x*y*invz_2*fy;
+                J2[iv+i] = -x*invz*fy;
+                J3[iv+i] = 0;
+                J4[iv+i] = -invz*fy;
+                J5[iv+i] = y*invz_2*fy;
+
+                J0[ir+i] = J0[iu+i]-bf*y*invz_2;
+                J1[ir+i] = J1[iu+i]+bf*x*invz_2;
+                J2[ir+i] = J2[iu+i];
+                J3[ir+i] = J3[iu+i];
+                J4[ir+i] = 0;
+                J5[ir+i] = J5[iu+i]-bf*invz_2;
+            }
+        }
+    }
+
+    return (double)Eigen::Map<const VectorX>(mvMonoRho.data(),Nm).sum() +
+           (double)Eigen::Map<const VectorX>(mvStereoRho.data(),Ns).sum();
+}
+
+template<typename Scalar>
+void PoseSolver<Scalar>::Optimize(const int nIterations)
+{
+    const int Nm = mvMonoX.size();
+    const int Ns = mvStereoX.size();
+    const int nRows = 2*Nm+3*Ns;
+
+    // 没有参与优化的观测,g2o在这种情况下同样不会改变位姿
+    if(std::count(mvMonoInlier.begin(),mvMonoInlier.end(),Scalar(1))==0 &&
+       std::count(mvStereoInlier.begin(),mvStereoInlier.end(),Scalar(1))==0)
+        return;
+
+    double lambda = 0;
+    double ni = 2;
+    int nBad = 0;
+
+    for(int iteration=0; iteration<nIterations; iteration++)
+    {
+        // step 1 在当前位姿处线性化, H = J^T*W*J, b = -J^T*W*e
+        double currentChi = Evaluate(mTcw,true);
+        const double iniChi = currentChi;
+
+        // 乘法在Scalar精度下完成,得到的6x6系统转换成双精度求解
+        mWJ.topRows(nRows).noalias() = mWeights.head(nRows).asDiagonal()*mJ.topRows(nRows);
+        mH = (mJ.topRows(nRows).transpose()*mWJ.topRows(nRows)).template cast<double>();
+        mb = (-mWJ.topRows(nRows).transpose()*mResiduals.head(nRows)).template cast<double>();
+
+        if(iteration==0)
+        {
+            lambda = kLambdaTau*mH.diagonal().cwiseAbs().maxCoeff();
+            ni = 2;
+            nBad = 0;
+        }
+
+        // step 2 求解带阻尼的方程,如果代价没有下降就增大阻尼重新求解
+        double rho = 0;
+        int nTrials = 0;
+        do
+        {
+            Eigen::Matrix<double,6,6> Hl = mH;
+            Hl.diagonal().array() += lambda;
+            mLDLT.compute(Hl);
+            const bool bSolved = mLDLT.isPositive();
+            Eigen::Matrix<double,6,1> dx = Eigen::Matrix<double,6,1>::Zero();
+            if(bSolved)
+                dx = mLDLT.solve(mb);
+
+            const g2o::SE3Quat Tcw = g2o::SE3Quat::exp(dx)*mTcw;
+            double tempChi = Evaluate(Tcw,false);
+            if(!bSolved)
+                tempChi = std::numeric_limits<double>::max();
+
+            rho = (currentChi-tempChi) / (dx.dot(lambda*dx+mb) + 1e-3);
+
+            if(rho>0 && std::isfinite(tempChi))
+            {
+                double alpha = 1.-std::pow((2*rho-1),3);
+                alpha = std::min(alpha, kGoodStepUpperScale);
+                lambda *= std::max(kGoodStepLowerScale, alpha);
+                ni = 2;
+                currentChi = tempChi;
+                mTcw = Tcw;
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2;
+            }
+            nTrials++;
+        } while(rho<0 && nTrials<kMaxTrialsAfterFailure);
+
+        if(nTrials==kMaxTrialsAfterFailure || rho==0)
+            break;
+
+        // 同g2o中ORB-SLAM添加的终止条件:连续3次代价下降不足千分之一
+        if((iniChi-currentChi)*1e3<iniChi)
+            nBad++;
+        else
+            nBad = 0;
+
+        if(nBad>=3)
+            break;
+    }
+}
+
+// 只需要单精度和双精度两个版本
+template class PoseSolver<float>;
+template class PoseSolver<double>;
+
+} //namespace ORB_SLAM
@@ -23,6 +23,9 @@
 //包含了一些自建库
 #include "System.h"
 #include "Converter.h"		// TODO 目前还不是很明白这个是做什么的
+#include "SensorConfig.h"		//编译期的传感器特化选项
+#include "Optimizer.h"		//全局BA和本质图优化可选的线性求解器
+#include "Parallel.h"		//词袋转换使用的线程池
 //包含共有库
 #include <thread>					//多线程
 #include <pangolin/pangolin.h>		//可视化界面
@@ -40,7 +43,10 @@ System::System(const string &strVocFile,					//词典文件路径
 					 mpViewer(static_cast<Viewer*>(NULL)),		//空。。。对象指针？  TODO 
 					 mbReset(false),							//无复位标志
 					 mbActivateLocalizationMode(false),			//没有这个模式转换标志
-        			 mbDeactivateLocalizationMode(false)		//没有这个模式转换标志
+        			 mbDeactivateLocalizationMode(false),		//没有这个模式转换标志
+        			 mTrackingDegradation(0),					//没有降级
+        			 mfTrackingLatency(0),						//还没有追踪过任何一帧
+        			 mnDownsampleCounter(0)
 {
     // Output welcome message
     cout << endl <<
@@ -59,6 +65,14 @@ System::System(const string &strVocFile,					//词典文件路径
     else if(mSensor==RGBD)
         cout << "RGB-D" << endl;
 
+    //Check that the tracking path was compiled for this sensor (see SensorConfig.h)
+    if(!IsSensorCompiled(mSensor))
+    {
+        cerr << "This build of ORB-SLAM2 was not compiled for the requested sensor. "
+             << "Enable it with the ORB_SLAM2_WITH_* CMake options." << endl;
+        exit(-1);
+    }
+
     //Check settings file
     cv::FileStorage fsSettings(strSettingsFile.c_str(), 	//将配置文件名转换成为字符串
     						   cv::FileStorage::READ);		//只读
@@ -70,13 +84,39 @@ System::System(const string &strVocFile,					//词典文件路径
        exit(-1);
     }
 
+    //Load frame admission parameters
+    //帧准入控制(load shedding):局部建图积压的关键帧过多或者追踪耗时过长时，依次降低特征提取的分辨率、对输入帧降采样、直接丢帧
+    //局部建图队列中关键帧数目的阈值，为0时不根据积压情况进行控制
+    mnAdmissionMaxBacklog = fsSettings["Admission.MaxBacklog"];
+    //追踪耗时的阈值(ms)，为0时不根据追踪耗时进行控制
+    mfAdmissionMaxLatency = fsSettings["Admission.MaxLatency"];
+    //降采样时每多少帧保留一帧
+    mnAdmissionDownsampleRate = fsSettings["Admission.DownsampleRate"];
+    if(mnAdmissionDownsampleRate<2)
+        mnAdmissionDownsampleRate = 2;
+    mAdmissionStats.nReceived = 0;
+    mAdmissionStats.nDropped = 0;
+    mAdmissionStats.nDownsampled = 0;
+    mAdmissionStats.nReducedResolution = 0;
+
+    if(mnAdmissionMaxBacklog>0 || mfAdmissionMaxLatency>0)
+    {
+        cout << "Frame admission control: max backlog " << mnAdmissionMaxBacklog
+             << " keyframes, max latency " << mfAdmissionMaxLatency << " ms, downsample rate 1/"
+             << mnAdmissionDownsampleRate << endl;
+    }
+
     //Load ORB Vocabulary
     cout << endl << "Loading ORB Vocabulary. This could take a while..." << endl;
 
     //建立一个新的ORB字典
     mpVocabulary = new ORBVocabulary();
-    //获取字典加载状态
-    bool bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
+    //获取字典加载状态. 以.bin结尾的是 Examples/Tools/bin_vocabulary 生成的二进制字典,直接映射到内存中使用
+    bool bVocLoad;
+    if(strVocFile.size()>4 && strVocFile.compare(strVocFile.size()-4,4,".bin")==0)
+        bVocLoad = mpVocabulary->loadFromBinaryFile(strVocFile);
+    else
+        bVocLoad = mpVocabulary->loadFromTextFile(strVocFile);
     //如果加载失败，就输出调试信息
     if(!bVocLoad)
     {
@@ -88,6 +128,19 @@ System::System(const string &strVocFile,					//词典文件路径
     //否则则说明加载成功
     cout << "Vocabulary loaded!" << endl << endl;
 
+    //计算一帧的词袋向量时使用的线程数，为0或1时在调用线程中串行计算
+    //并行时使用和局部建图、闭环检测共享的线程池，通过加大每块的大小把块数限制在设置的线程数以内
+    int nTransformThreads = fsSettings["Vocabulary.TransformThreads"];
+    if(nTransformThreads>1)
+    {
+        const size_t nMaxChunks = nTransformThreads;
+        mpVocabulary->setParallelFor([nMaxChunks](size_t n, size_t nMinGrain, const std::function<void(size_t,size_t)> &f)
+        {
+            ParallelFor(n, std::max(nMinGrain,(n+nMaxChunks-1)/nMaxChunks), f);
+        });
+        cout << "Bag of words transform: " << nTransformThreads << " threads" << endl << endl;
+    }
+
     //Create KeyFrame Database
     mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
 
@@ -114,7 +167,14 @@ System::System(const string &strVocFile,					//词典文件路径
     //初始化局部建图线程并运行
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(mpMap, 				//指定使iomanip
-    								 mSensor==MONOCULAR);	// TODO 为什么这个要设置成为MONOCULAR？？？
+    								 mSensor);				//传感器类型
+    //局部BA的时间预算(ms)，为0时不限制局部BA的窗口
+    const float fLocalBABudget = fsSettings["LocalMapping.BABudget"];
+    if(fLocalBABudget>0)
+    {
+        mpLocalMapper->SetLocalBABudget(fLocalBABudget);
+        cout << "Local BA time budget: " << fLocalBABudget << " ms" << endl;
+    }
     //运行这个局部建图线程
     mptLocalMapping = new thread(&ORB_SLAM2::LocalMapping::Run,	//这个线程会调用的函数
     							 mpLocalMapper);				//这个调用函数的参数
@@ -124,6 +184,23 @@ System::System(const string &strVocFile,					//词典文件路径
     							   mpKeyFrameDatabase, 			//关键帧数据库
     							   mpVocabulary, 				//ORB字典
     							   mSensor!=MONOCULAR);			//当前的传感器是否是单目
+    //本质图优化和全局BA的线性求解器: 0 稀疏Cholesky分解, 1 块Jacobi预条件的共轭梯度法(PCG)
+    //PCG的内存只和非零块的数目成正比,适合Cholesky分解的填充放不进内存的大地图;在长的闭环上本质图的PCG收敛较慢
+    const int nEssentialGraphSolver = fsSettings["LoopClosing.EssentialGraphLinearSolver"];
+    const int nGBASolver = fsSettings["LoopClosing.GBALinearSolver"];
+    if((nEssentialGraphSolver!=Optimizer::LINEAR_SOLVER_CHOLESKY && nEssentialGraphSolver!=Optimizer::LINEAR_SOLVER_PCG) ||
+       (nGBASolver!=Optimizer::LINEAR_SOLVER_CHOLESKY && nGBASolver!=Optimizer::LINEAR_SOLVER_PCG))
+    {
+        cerr << "Unknown linear solver in LoopClosing.EssentialGraphLinearSolver (" << nEssentialGraphSolver
+             << ") or LoopClosing.GBALinearSolver (" << nGBASolver << "), use 0 for Cholesky or 1 for PCG." << endl;
+        exit(-1);
+    }
+    if(nEssentialGraphSolver!=Optimizer::LINEAR_SOLVER_CHOLESKY || nGBASolver!=Optimizer::LINEAR_SOLVER_CHOLESKY)
+    {
+        mpLoopCloser->SetLinearSolvers(nEssentialGraphSolver, nGBASolver);
+        cout << "Linear solvers: essential graph " << (nEssentialGraphSolver==Optimizer::LINEAR_SOLVER_PCG ? "PCG" : "Cholesky")
+             << ", global BA " << (nGBASolver==Optimizer::LINEAR_SOLVER_PCG ? "PCG" : "Cholesky") << endl;
+    }
     //创建回环检测线程
     mptLoopClosing = new thread(&ORB_SLAM2::LoopClosing::Run,	//线程的主函数
     							mpLoopCloser);					//该函数的参数
@@ -181,10 +258,7 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, 		//左侧图像
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
             //运行到这里的时候，局部建图部分就真正地停止了
             //告知追踪器，现在 只有追踪工作
             mpTracker->InformOnlyTracking(true);// 定位时，只跟踪
@@ -217,13 +291,22 @@ cv::Mat System::TrackStereo(const cv::Mat &imLeft, 		//左侧图像
 	    }//是否有复位请求
     }//检查是否有复位的操作
 
+    // Frame admission: the frame may be dropped if Local Mapping falls behind
+    //帧准入控制，被丢弃的帧返回空的位姿
+    if(!AdmitFrame())
+        return cv::Mat();
+
     //用矩阵Tcw来保存估计的相机 位姿，运动追踪器的GrabImageStereo函数才是真正进行运动估计的函数
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
     cv::Mat Tcw = mpTracker->GrabImageStereo(imLeft,imRight,timestamp);
+    UpdateTrackingLatency(t1);
 
     //给运动追踪状态上锁
     unique_lock<mutex> lock2(mMutexState);
     //获取运动追踪状态
     mTrackingState = mpTracker->mState;
+    mTrackingDegradation = mpTracker->mnDegradation;
+    mPoseBAPrecision = mpTracker->mPoseBAPrecision;
     //获取当前帧追踪到的地图点向量指针
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     //获取当前帧追踪到的关键帧特征点向量的指针
@@ -251,10 +334,7 @@ cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const doub
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -278,11 +358,19 @@ cv::Mat System::TrackRGBD(const cv::Mat &im, const cv::Mat &depthmap, const doub
     }
     }
 
+    //帧准入控制
+    if(!AdmitFrame())
+        return cv::Mat();
+
     //获得相机位姿的估计
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
     cv::Mat Tcw = mpTracker->GrabImageRGBD(im,depthmap,timestamp);
+    UpdateTrackingLatency(t1);
 
     unique_lock<mutex> lock2(mMutexState);
     mTrackingState = mpTracker->mState;
+    mTrackingDegradation = mpTracker->mnDegradation;
+    mPoseBAPrecision = mpTracker->mPoseBAPrecision;
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
     return Tcw;
@@ -305,10 +393,7 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
             mpLocalMapper->RequestStop();
 
             // Wait until Local Mapping has effectively stopped
-            while(!mpLocalMapper->isStopped())
-            {
-                usleep(1000);
-            }
+            mpLocalMapper->WaitUntilStopped();
 
             mpTracker->InformOnlyTracking(true);
             mbActivateLocalizationMode = false;
@@ -331,11 +416,19 @@ cv::Mat System::TrackMonocular(const cv::Mat &im, const double &timestamp)
     }
     }
 
+    //帧准入控制
+    if(!AdmitFrame())
+        return cv::Mat();
+
     //获取相机位姿的估计结果
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
     cv::Mat Tcw = mpTracker->GrabImageMonocular(im,timestamp);
+    UpdateTrackingLatency(t1);
 
     unique_lock<mutex> lock2(mMutexState);
     mTrackingState = mpTracker->mState;
+    mTrackingDegradation = mpTracker->mnDegradation;
+    mPoseBAPrecision = mpTracker->mPoseBAPrecision;
     mTrackedMapPoints = mpTracker->mCurrentFrame.mvpMapPoints;
     mTrackedKeyPointsUn = mpTracker->mCurrentFrame.mvKeysUn;
 
@@ -392,16 +485,24 @@ void System::Shutdown()
     	//向查看器发送终止请求
         mpViewer->RequestFinish();
         //等到，知道真正地停止
-        while(!mpViewer->isFinished())
-            usleep(5000);
+        mpViewer->WaitUntilFinished();
     }
 
     // Wait until all thread have effectively stopped
-    while(!mpLocalMapper->isFinished() || 
-    	  !mpLoopCloser->isFinished()  || 
-    	   mpLoopCloser->isRunningGBA())			//说实在话不是很理解这个 TODO isRunningGBA函数是用来做什么的？
+    // 回环检测线程还要等正在运行的全局BA结束
+    mpLocalMapper->WaitUntilFinished();
+    mpLoopCloser->WaitUntilFinished();
+
+    // 输出单精度位姿优化的校验结果
+    const PoseBAPrecision precision = GetPoseBAPrecision();
+    if(precision.bValidate && precision.nValidated>0)
     {
-        usleep(5000);
+        cout << endl << "Pose optimization precision check (" << (precision.bSinglePrecision ? "single" : "double")
+             << " precision used, compared against " << (precision.bSinglePrecision ? "double" : "single") << "): " << endl;
+        cout << "- Optimizations: " << precision.nValidated << endl;
+        cout << "- Inlier/outlier mismatches: " << precision.nInlierMismatches << " / " << precision.nObservations << endl;
+        cout << "- Max rotation difference: " << precision.fMaxRotationError << " rad" << endl;
+        cout << "- Max translation difference: " << precision.fMaxTranslationError << endl;
     }
 
     if(mpViewer)
@@ -613,6 +714,97 @@ int System::GetTrackingState()
     return mTrackingState;
 }
 
+//获取最近一帧因为超出时间预算而采取的降级措施
+int System::GetTrackingDegradation()
+{
+    unique_lock<mutex> lock(mMutexState);
+    return mTrackingDegradation;
+}
+
+//获取帧准入控制的统计信息
+System::AdmissionStats System::GetAdmissionStats()
+{
+    unique_lock<mutex> lock(mMutexState);
+    return mAdmissionStats;
+}
+
+//局部BA的时间预算以及最近一次局部BA实际的窗口大小和耗时
+LocalBABudget System::GetLocalBABudget()
+{
+    return mpLocalMapper->GetLocalBABudget();
+}
+
+//只优化位姿的BA所用的数值精度,以及单精度相对于双精度的校验统计
+PoseBAPrecision System::GetPoseBAPrecision()
+{
+    unique_lock<mutex> lock(mMutexState);
+    return mPoseBAPrecision;
+}
+
+//帧准入控制：根据局部建图积压的关键帧数目和追踪耗时决定如何处理当前输入的帧
+//返回false表示这一帧被丢弃，不进行追踪
+bool System::AdmitFrame()
+{
+    // 压力等级: 0 正常; 1 降低特征提取分辨率; 2 同时对输入帧降采样; 3 丢弃输入帧
+    int nLevel = 0;
+
+    // 只在正常追踪的时候进行控制，初始化和重定位的过程需要连续的图像
+    if(mpTracker->mState==Tracking::OK)
+    {
+        if(mnAdmissionMaxBacklog>0)
+        {
+            const int nBacklog = mpLocalMapper->KeyframesInQueue();
+            if(nBacklog>=3*mnAdmissionMaxBacklog)
+                nLevel = 3;
+            else if(nBacklog>=2*mnAdmissionMaxBacklog)
+                nLevel = 2;
+            else if(nBacklog>=mnAdmissionMaxBacklog)
+                nLevel = 1;
+        }
+
+        // 丢帧时追踪耗时得不到更新，所以追踪耗时最多只会导致降采样
+        if(mfAdmissionMaxLatency>0)
+        {
+            if(mfTrackingLatency>2*mfAdmissionMaxLatency)
+                nLevel = max(nLevel,2);
+            else if(mfTrackingLatency>mfAdmissionMaxLatency)
+                nLevel = max(nLevel,1);
+        }
+    }
+
+    mpTracker->SetReducedResolution(nLevel>=1);
+
+    bool bAdmit = true;
+    if(nLevel>=3)
+        bAdmit = false;
+    else if(nLevel==2)
+        bAdmit = (mnDownsampleCounter++ % mnAdmissionDownsampleRate)==0;
+    else
+        mnDownsampleCounter = 0;
+
+    unique_lock<mutex> lock(mMutexState);
+    mAdmissionStats.nReceived++;
+    if(nLevel>=3)
+        mAdmissionStats.nDropped++;
+    else if(!bAdmit)
+        mAdmissionStats.nDownsampled++;
+    else if(nLevel>=1)
+        mAdmissionStats.nReducedResolution++;
+
+    return bAdmit;
+}
+
+//更新追踪耗时的滑动平均值
+void System::UpdateTrackingLatency(const std::chrono::steady_clock::time_point &tStart)
+{
+    const float fLatency = std::chrono::duration_cast<std::chrono::duration<float,std::milli> >(
+        std::chrono::steady_clock::now()-tStart).count();
+    if(mfTrackingLatency==0)
+        mfTrackingLatency = fLatency;
+    else
+        mfTrackingLatency = 0.8f*mfTrackingLatency+0.2f*fLatency;
+}
+
 //获取追踪到的地图点（其实实际上得到的是一个指针）
 vector<MapPoint*> System::GetTrackedMapPoints()
 {
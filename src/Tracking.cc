@@ -49,6 +49,7 @@
 #include<iostream>
 #include<cmath>
 #include<mutex>
+#include<algorithm>
 
 
 using namespace std;
@@ -77,6 +78,7 @@ Tracking::Tracking(
     const string &strSettingPath,       //配置文件路径
     const int sensor):                  //传感器类型
         mState(NO_IMAGES_YET),                              //当前系统还没有准备好
+        mnDegradation(DEGRADE_NONE),                        //还没有进行任何降级
         mSensor(sensor),                                
         mbOnlyTracking(false),                              //处于SLAM模式
         mbVO(false),                                        //当处于纯跟踪模式的时候，这个变量表示了当前跟踪状态的好坏
@@ -198,6 +200,46 @@ Tracking::Tracking(
     cout << "- Initial Fast Threshold: " << fIniThFAST << endl;
     cout << "- Minimum Fast Threshold: " << fMinThFAST << endl;
 
+    // step 3 加载单帧时间预算有关的参数,为0时不启用
+    mnFeatures = nFeatures;
+    mfFrameDeadline = fSettings["Tracking.FrameDeadline"];
+    mfLastFrameTime = 0;
+    // 时间紧张时特征点数目相对于nFeatures的比例,默认为0.6
+    float fDegradedFeatureRatio = fSettings["Tracking.DegradedFeatureRatio"];
+    if(fDegradedFeatureRatio<=0 || fDegradedFeatureRatio>1)
+        fDegradedFeatureRatio = 0.6f;
+    mnFeaturesDegraded = cvRound(nFeatures*fDegradedFeatureRatio);
+    // 时间紧张时局部关键帧的最大数目,默认为30(正常为80)
+    mnMaxLocalKFsDegraded = fSettings["Tracking.DegradedLocalKFs"];
+    if(mnMaxLocalKFsDegraded<=0)
+        mnMaxLocalKFsDegraded = 30;
+    // 时间紧张时局部地图点的最大数目,默认为3000
+    mnMaxLocalPointsDegraded = fSettings["Tracking.DegradedLocalPoints"];
+    if(mnMaxLocalPointsDegraded<=0)
+        mnMaxLocalPointsDegraded = 3000;
+
+    if(mfFrameDeadline>0)
+    {
+        cout << endl  << "Frame Deadline Parameters: " << endl;
+        cout << "- Frame Deadline: " << mfFrameDeadline << " ms" << endl;
+        cout << "- Degraded Number of Features: " << mnFeaturesDegraded << endl;
+        cout << "- Degraded Local KeyFrames: " << mnMaxLocalKFsDegraded << endl;
+        cout << "- Degraded Local MapPoints: " << mnMaxLocalPointsDegraded << endl;
+    }
+
+    // 只优化位姿的BA是否使用单精度求解器,以及是否同时用双精度求解来校验,默认都不启用.
+    // 只作用于PoseOptimization,局部BA和全局BA仍然通过g2o以双精度求解
+    int nSinglePrecision = fSettings["Optimizer.PoseSinglePrecision"];
+    int nValidatePrecision = fSettings["Optimizer.PoseValidatePrecision"];
+    mPoseBAPrecision.bSinglePrecision = nSinglePrecision!=0;
+    mPoseBAPrecision.bValidate = nValidatePrecision!=0;
+    if(mPoseBAPrecision.bSinglePrecision || mPoseBAPrecision.bValidate)
+    {
+        cout << endl  << "Pose Optimization Precision: " << endl;
+        cout << "- Single Precision: " << (mPoseBAPrecision.bSinglePrecision ? "on" : "off") << endl;
+        cout << "- Validate Against Other Precision: " << (mPoseBAPrecision.bValidate ? "on" : "off") << endl;
+    }
+
     if(sensor==System::STEREO || sensor==System::RGBD)
     {
         // 判断一个3D点远/近的阈值 mbf * 35 / fx
@@ -278,6 +320,7 @@ cv::Mat Tracking::GrabImageStereo(
     }
 
     // step 2 ：构造Frame
+    BeginFrameDeadline();
     mCurrentFrame = Frame(
         mImGray,                //左目图像
         imGrayRight,            //右目图像
@@ -292,6 +335,7 @@ cv::Mat Tracking::GrabImageStereo(
 
     // step 3 ：跟踪
     Track();
+    EndFrameDeadline();
 
     //返回位姿
     return mCurrentFrame.mTcw.clone();
@@ -338,6 +382,7 @@ cv::Mat Tracking::GrabImageRGBD(
             mDepthMapFactor);   //缩放系数
 
     // 步骤3：构造Frame
+    BeginFrameDeadline();
     mCurrentFrame = Frame(
         mImGray,                //灰度图像
         imDepth,                //深度图像
@@ -351,6 +396,7 @@ cv::Mat Tracking::GrabImageRGBD(
 
     // 步骤4：跟踪
     Track();
+    EndFrameDeadline();
 
     //返回当前帧的位姿
     return mCurrentFrame.mTcw.clone();
@@ -384,6 +430,7 @@ cv::Mat Tracking::GrabImageMonocular(
     }
 
     // step 2 ：构造Frame
+    BeginFrameDeadline();
     if(mState==NOT_INITIALIZED || mState==NO_IMAGES_YET)// 没有成功初始化的前一个状态就是NO_IMAGES_YET
         mCurrentFrame = Frame(
             mImGray,
@@ -407,6 +454,7 @@ cv::Mat Tracking::GrabImageMonocular(
 
     // step 3 ：跟踪
     Track();
+    EndFrameDeadline();
     //返回当前帧的位姿
     return mCurrentFrame.mTcw.clone();
 }
@@ -810,39 +858,44 @@ void Tracking::StereoInitialization()
 
         // Create MapPoints and asscoiate to KeyFrame
         // step 4：为每个特征点构造MapPoint
+        //只有具有正深度的点才会被构造地图点
+        mvUnprojectIndices.clear();
         for(int i=0; i<mCurrentFrame.N;i++)
         {
-            //只有具有正深度的点才会被构造地图点
-            float z = mCurrentFrame.mvDepth[i];
-            if(z>0)
-            {
-                // step 4.1：通过反投影得到该特征点的3D坐标
-                cv::Mat x3D = mCurrentFrame.UnprojectStereo(i);
-                // step 4.2：将3D点构造为MapPoint
-                MapPoint* pNewMP = new MapPoint(x3D,pKFini,mpMap);
-
-                // step 4.3：为该MapPoint添加属性：
-                // a.观测到该MapPoint的关键帧
-                // b.该MapPoint的描述子
-                // c.该MapPoint的平均观测方向和深度范围
-
-                // a.表示该MapPoint可以被哪个KeyFrame的哪个特征点观测到
-                pNewMP->AddObservation(pKFini,i);
-                // b.从众多观测到该MapPoint的特征点中挑选区分度最高的描述子
-                //? 如何定义的这个区分度?
-                pNewMP->ComputeDistinctiveDescriptors();
-                // c.更新该MapPoint平均观测方向以及观测距离的范围
-                pNewMP->UpdateNormalAndDepth();
+            if(mCurrentFrame.mvDepth[i]>0)
+                mvUnprojectIndices.push_back(i);
+        }
 
-                // step 4.4：在地图中添加该MapPoint
-                mpMap->AddMapPoint(pNewMP);
-                // step 4.5：表示该KeyFrame的哪个特征点可以观测到哪个3D点
-                pKFini->AddMapPoint(pNewMP,i);
+        // step 4.1：一次性地反投影得到这些特征点的3D坐标
+        mCurrentFrame.UnprojectStereo(mvUnprojectIndices,mvUnprojectPoints);
 
-                // step 4.6：将该MapPoint添加到当前帧的mvpMapPoints中
-                // 为当前Frame的特征点与MapPoint之间建立索引
-                mCurrentFrame.mvpMapPoints[i]=pNewMP;
-            }
+        for(size_t k=0; k<mvUnprojectIndices.size(); k++)
+        {
+            const int i = mvUnprojectIndices[k];
+            // step 4.2：将3D点构造为MapPoint
+            MapPoint* pNewMP = new MapPoint(mvUnprojectPoints[k],pKFini,mpMap);
+
+            // step 4.3：为该MapPoint添加属性：
+            // a.观测到该MapPoint的关键帧
+            // b.该MapPoint的描述子
+            // c.该MapPoint的平均观测方向和深度范围
+
+            // a.表示该MapPoint可以被哪个KeyFrame的哪个特征点观测到
+            pNewMP->AddObservation(pKFini,i);
+            // b.从众多观测到该MapPoint的特征点中挑选区分度最高的描述子
+            //? 如何定义的这个区分度?
+            pNewMP->ComputeDistinctiveDescriptors();
+            // c.更新该MapPoint平均观测方向以及观测距离的范围
+            pNewMP->UpdateNormalAndDepth();
+
+            // step 4.4：在地图中添加该MapPoint
+            mpMap->AddMapPoint(pNewMP);
+            // step 4.5：表示该KeyFrame的哪个特征点可以观测到哪个3D点
+            pKFini->AddMapPoint(pNewMP,i);
+
+            // step 4.6：将该MapPoint添加到当前帧的mvpMapPoints中
+            // 为当前Frame的特征点与MapPoint之间建立索引
+            mCurrentFrame.mvpMapPoints[i]=pNewMP;
         }
 
         cout << "New map created with " << mpMap->MapPointsInMap() << " points" << endl;
@@ -1206,7 +1259,7 @@ bool Tracking::TrackReferenceKeyFrame()
     mCurrentFrame.SetPose(mLastFrame.mTcw); // 用上一次的Tcw设置初值，在PoseOptimization可以收敛快一些
 
     // step 4:通过优化3D-2D的重投影误差来获得位姿
-    Optimizer::PoseOptimization(&mCurrentFrame);
+    Optimizer::PoseOptimization(&mCurrentFrame,mSensor,&mPoseBAPrecision);
 
     // Discard outliers
     // step 5：剔除优化后的outlier匹配点（MapPoints）
@@ -1289,55 +1342,50 @@ void Tracking::UpdateLastFrame()
     // We insert all close points (depth<mThDepth)
     // If less than 100 close points, we insert the 100 closest ones.
     // step 2.3：将距离比较近的点包装成MapPoints
+    // 先挑出需要生成临时地图点的特征点,然后一次性地反投影
+    mvUnprojectIndices.clear();
     int nPoints = 0;
     for(size_t j=0; j<vDepthIdx.size();j++)
     {
         int i = vDepthIdx[j].second;
 
-        bool bCreateNew = false;
-
         //如果这个点对应在上一帧中的地图点没有,或者创建后就没有被观测到,那么就生成一个临时的地图点
+        //? 从地图点被创建后就没有观测到,意味这是在上一帧中新添加的地图点吗
         MapPoint* pMP = mLastFrame.mvpMapPoints[i];
-        if(!pMP)
-            bCreateNew = true;
-        else if(pMP->Observations()<1)      //? 从地图点被创建后就没有观测到,意味这是在上一帧中新添加的地图点吗
-        {
-            bCreateNew = true;
-        }
-
-        //如果需要创建新的临时地图点
-        if(bCreateNew)
-        {
-            // 这些生UpdateLastFrameints后并没有通过：
-            // a.AddMaUpdateLastFrame、
-            // b.AddObUpdateLastFrameion、
-            // c.CompuUpdateLastFrameinctiveDescriptors、
-            // d.UpdatUpdateLastFramelAndDepth添加属性，
-            // 这些MapPoint仅仅为了提高双目和RGBD的跟踪成功率   -- 我觉得可以这么说是因为在临时地图中增加了地图点，能够和局部地图一并进行定位工作
-            cv::Mat x3D = mLastFrame.UnprojectStereo(i);
-            MapPoint* pNewMP = new MapPoint(
-                x3D,            //该点对应的空间点坐标
-                mpMap,          //? 不明白为什么还要有这个参数
-                &mLastFrame,    //存在这个特征点的帧(上一帧)
-                i);             //特征点id
-
-            //? 上一帧在处理结束的时候,没有进行添加的操作吗?
-            mLastFrame.mvpMapPoints[i]=pNewMP; // 添加新的MapPoint
-
-            // 标记为临时添加的MapPoint，之后在CreateNewKeyFrame之前会全部删除
-            mlpTemporalPoints.push_back(pNewMP);
-            nPoints++;
-        }
-        else//如果不需要创建新的 临时地图点
-        {
-            nPoints++;
-        }
+        if(!pMP || pMP->Observations()<1)
+            mvUnprojectIndices.push_back(i);
 
+        nPoints++;
 
         //当当前的点的深度已经超过了远点的阈值,并且已经这样处理了超过100个点的时候,说明就足够了
         if(vDepthIdx[j].first>mThDepth && nPoints>100)
             break;
     }
+
+    mLastFrame.UnprojectStereo(mvUnprojectIndices,mvUnprojectPoints);
+
+    for(size_t k=0; k<mvUnprojectIndices.size(); k++)
+    {
+        const int i = mvUnprojectIndices[k];
+
+        // 这些生UpdateLastFrameints后并没有通过：
+        // a.AddMaUpdateLastFrame、
+        // b.AddObUpdateLastFrameion、
+        // c.CompuUpdateLastFrameinctiveDescriptors、
+        // d.UpdatUpdateLastFramelAndDepth添加属性，
+        // 这些MapPoint仅仅为了提高双目和RGBD的跟踪成功率   -- 我觉得可以这么说是因为在临时地图中增加了地图点，能够和局部地图一并进行定位工作
+        MapPoint* pNewMP = new MapPoint(
+            mvUnprojectPoints[k],   //该点对应的空间点坐标
+            mpMap,                  //? 不明白为什么还要有这个参数
+            &mLastFrame,            //存在这个特征点的帧(上一帧)
+            i);                     //特征点id
+
+        //? 上一帧在处理结束的时候,没有进行添加的操作吗?
+        mLastFrame.mvpMapPoints[i]=pNewMP; // 添加新的MapPoint
+
+        // 标记为临时添加的MapPoint，之后在CreateNewKeyFrame之前会全部删除
+        mlpTemporalPoints.push_back(pNewMP);
+    }
 }
 
 /**
@@ -1379,14 +1427,18 @@ bool Tracking::TrackWithMotionModel()
 
     // step 2：根据匀速度模型进行对上一帧的MapPoints进行跟踪, 根据上一帧特征点对应的3D点投影的位置缩小特征点匹配范围
     //我觉的这个才是使用恒速模型的根本目的
-    int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,th,mSensor==System::MONOCULAR);
+    int nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,th,mSensor);
 
     // If few matches, uses a wider window search
-    // 如果跟踪的点少，则扩大搜索半径再来一次
-    if(nmatches<20)
+    // 如果跟踪的点少，则扩大搜索半径再来一次;时间预算紧张时跳过这一步,交给后面的参考关键帧跟踪或者重定位
+    if(nmatches<20 && UnderDeadlinePressure())
+    {
+        mnDegradation |= DEGRADE_SEARCH_WIDENING;
+    }
+    else if(nmatches<20)
     {
         fill(mCurrentFrame.mvpMapPoints.begin(),mCurrentFrame.mvpMapPoints.end(),static_cast<MapPoint*>(NULL));
-        nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor==System::MONOCULAR); // 2*th
+        nmatches = matcher.SearchByProjection(mCurrentFrame,mLastFrame,2*th,mSensor); // 2*th
     }
 
     //如果就算是这样还是不能够获得足够的跟踪点,那么就认为运动跟踪失败了.
@@ -1395,7 +1447,7 @@ bool Tracking::TrackWithMotionModel()
 
     // Optimize frame pose with all matches
     // step 3：优化位姿
-    Optimizer::PoseOptimization(&mCurrentFrame);
+    Optimizer::PoseOptimization(&mCurrentFrame,mSensor,&mPoseBAPrecision);
 
     // Discard outliers
     // step 4：优化位姿后剔除outlier的mvpMapPoints,这个和前面相似
@@ -1456,7 +1508,7 @@ bool Tracking::TrackLocalMap()
     // Optimize Pose
     // 在这个函数之前，在 Relocalization、TrackReferenceKeyFrame、TrackWithMotionModel 中都有位姿优化，
     // step 3：更新局部所有MapPoints后对位姿再次优化
-    Optimizer::PoseOptimization(&mCurrentFrame);
+    Optimizer::PoseOptimization(&mCurrentFrame,mSensor,&mPoseBAPrecision);
     mnMatchesInliers = 0;
 
     // Update MapPoints Statistics
@@ -1690,45 +1742,26 @@ void Tracking::CreateNewKeyFrame()
             sort(vDepthIdx.begin(),vDepthIdx.end());
 
             // step 3.3：将距离比较近的点包装成MapPoints
+            // 先挑出需要新建地图点的特征点,然后一次性地反投影
             //处理的近点的个数
+            mvUnprojectIndices.clear();
             int nPoints = 0;
             for(size_t j=0; j<vDepthIdx.size();j++)
             {
                 int i = vDepthIdx[j].second;
 
-                bool bCreateNew = false;
-
                 MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
                 //如果当前帧中无这个地图点
                 if(!pMP)
-                    bCreateNew = true;
+                    mvUnprojectIndices.push_back(i);
                 else if(pMP->Observations()<1)
                 {
                     //或者是刚刚创立
-                    bCreateNew = true;
+                    mvUnprojectIndices.push_back(i);
                     mCurrentFrame.mvpMapPoints[i] = static_cast<MapPoint*>(NULL);
                 }
 
-                //如果需要新建地图点.这里是实打实的在全局地图中新建地图点
-                if(bCreateNew)
-                {
-                    cv::Mat x3D = mCurrentFrame.UnprojectStereo(i);
-                    MapPoint* pNewMP = new MapPoint(x3D,pKF,mpMap);
-                    // 这些添加属性的操作是每次创建MapPoint后都要做的
-                    pNewMP->AddObservation(pKF,i);
-                    pKF->AddMapPoint(pNewMP,i);
-                    pNewMP->ComputeDistinctiveDescriptors();
-                    pNewMP->UpdateNormalAndDepth();
-                    mpMap->AddMapPoint(pNewMP);
-
-                    mCurrentFrame.mvpMapPoints[i]=pNewMP;
-                    nPoints++;
-                }
-                else
-                {
-                    //? 这里?????
-                    nPoints++;
-                }
+                nPoints++;
 
                 // 这里决定了双目和rgbd摄像头时地图点云的稠密程度
                 // 但是仅仅为了让地图稠密直接改这些不太好，
@@ -1737,6 +1770,23 @@ void Tracking::CreateNewKeyFrame()
                 if(vDepthIdx[j].first>mThDepth && nPoints>100)
                     break;
             }
+
+            mCurrentFrame.UnprojectStereo(mvUnprojectIndices,mvUnprojectPoints);
+
+            //这里是实打实的在全局地图中新建地图点
+            for(size_t k=0; k<mvUnprojectIndices.size(); k++)
+            {
+                const int i = mvUnprojectIndices[k];
+                MapPoint* pNewMP = new MapPoint(mvUnprojectPoints[k],pKF,mpMap);
+                // 这些添加属性的操作是每次创建MapPoint后都要做的
+                pNewMP->AddObservation(pKF,i);
+                pKF->AddMapPoint(pNewMP,i);
+                pNewMP->ComputeDistinctiveDescriptors();
+                pNewMP->UpdateNormalAndDepth();
+                mpMap->AddMapPoint(pNewMP);
+
+                mCurrentFrame.mvpMapPoints[i]=pNewMP;
+            }
         }
     }
 
@@ -1859,6 +1909,9 @@ void Tracking::UpdateLocalPoints()
     // step 1：清空局部MapPoints
     mvpLocalMapPoints.clear();
 
+    // 时间预算紧张时限制局部地图点的数目;局部关键帧已经按照共视程度排过序,优先保留共视程度高的关键帧的地图点
+    const bool bDegrade = mnDegradation & DEGRADE_LOCAL_MAP;
+
     // step 2：遍历局部关键帧 in mvpLocalKeyFrames
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
@@ -1883,6 +1936,9 @@ void Tracking::UpdateLocalPoints()
                 pMP->mnTrackReferenceForFrame=mCurrentFrame.mnId;
             }
         }
+
+        if(bDegrade && (int)mvpLocalMapPoints.size()>=mnMaxLocalPointsDegraded)
+            break;
     }
 }
 
@@ -1955,13 +2011,35 @@ void Tracking::UpdateLocalKeyFrames()
     }
 
 
+    // 时间预算紧张时,只保留和当前帧共视程度最高的若干个关键帧,并且降低局部关键帧的总数上限
+    size_t nMaxLocalKFs = 80;
+    if(UnderDeadlinePressure())
+    {
+        mnDegradation |= DEGRADE_LOCAL_MAP;
+        nMaxLocalKFs = mnMaxLocalKFsDegraded;
+
+        // 按照共视的地图点数目从大到小排序
+        vector<pair<int,KeyFrame*> > vPairs;
+        vPairs.reserve(mvpLocalKeyFrames.size());
+        for(size_t i=0; i<mvpLocalKeyFrames.size(); i++)
+            vPairs.push_back(make_pair(keyframeCounter[mvpLocalKeyFrames[i]],mvpLocalKeyFrames[i]));
+        sort(vPairs.begin(),vPairs.end(),
+             [](const pair<int,KeyFrame*> &a, const pair<int,KeyFrame*> &b){return a.first>b.first;});
+
+        // 被截断的关键帧仍然保留mnTrackReferenceForFrame标记,这样策略2也不会再把它们加回来
+        const size_t nKeep = min(vPairs.size(),nMaxLocalKFs/2);
+        for(size_t i=0; i<nKeep; i++)
+            mvpLocalKeyFrames[i] = vPairs[i].second;
+        mvpLocalKeyFrames.resize(nKeep);
+    }
+
     // Include also some not-already-included keyframes that are neighbors to already-included keyframes
     // V-D K2: neighbors to K1 in the covisibility graph
     // 策略2：与策略1得到的局部关键帧共视程度很高的关键帧作为局部关键帧
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
         // Limit the number of keyframes
-        if(mvpLocalKeyFrames.size()>80)
+        if(mvpLocalKeyFrames.size()>nMaxLocalKFs)
             break;
 
         KeyFrame* pKF = *itKF;
@@ -2153,7 +2231,7 @@ bool Tracking::Relocalization()
 
                 // step 5：通过PoseOptimization对姿态进行优化求解
                 //只优化位姿,不优化地图点的坐标;返回的是内点的数量
-                int nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                int nGood = Optimizer::PoseOptimization(&mCurrentFrame,mSensor,&mPoseBAPrecision);
 
                 //? 如果优化之后的内点数目不多,注意这里是直接跳过了本次循环,但是却没有放弃当前的这个关键帧
                 if(nGood<10)
@@ -2179,7 +2257,7 @@ bool Tracking::Relocalization()
                     if(nadditional+nGood>=50)
                     {
                         //? 这么说在执行上面的 SearchByProjection 函数的时候, 地图点的信息已经更新了? 那么特征点呢? 有点晕 
-                        nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                        nGood = Optimizer::PoseOptimization(&mCurrentFrame,mSensor,&mPoseBAPrecision);
 
                         // If many inliers but still not enough, search by projection again in a narrower window
                         // the camera has been already optimized with many points
@@ -2202,7 +2280,7 @@ bool Tracking::Relocalization()
                             // Final optimization
                             if(nGood+nadditional>=50)
                             {
-                                nGood = Optimizer::PoseOptimization(&mCurrentFrame);
+                                nGood = Optimizer::PoseOptimization(&mCurrentFrame,mSensor,&mPoseBAPrecision);
                                 //更新地图点
                                 for(int io =0; io<mCurrentFrame.N; io++)
                                     if(mCurrentFrame.mvbOutlier[io])
@@ -2246,8 +2324,7 @@ void Tracking::Reset()
     if(mpViewer)
     {
         mpViewer->RequestStop();
-        while(!mpViewer->isStopped())
-            std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        mpViewer->WaitUntilStopped();
     }
     cout << "System Reseting" << endl;
 
@@ -2329,4 +2406,61 @@ void Tracking::InformOnlyTracking(const bool &flag)
     mbOnlyTracking = flag;
 }
 
+//降低分辨率时,特征点从图像金字塔的第1层开始提取
+void Tracking::SetReducedResolution(const bool &flag)
+{
+    mpORBextractorLeft->SetMinLevel(flag?1:0);
+    if(mSensor==System::STEREO)
+        mpORBextractorRight->SetMinLevel(flag?1:0);
+}
+
+//开始处理一帧:记录开始时刻,并根据上一帧的耗时调整特征点提取的数目
+void Tracking::BeginFrameDeadline()
+{
+    mtFrameStart = std::chrono::steady_clock::now();
+    mnDegradation = DEGRADE_NONE;
+
+    if(mfFrameDeadline<=0)
+        return;
+
+    // 上一帧超时则降低特征点数目;直到上一帧耗时回落到预算的60%以下才恢复,避免在两种数目之间来回跳变
+    int nFeatures = mpORBextractorLeft->GetNumFeatures();
+    if(mfLastFrameTime>mfFrameDeadline)
+        nFeatures = mnFeaturesDegraded;
+    else if(mfLastFrameTime<0.6f*mfFrameDeadline)
+        nFeatures = mnFeatures;
+
+    mpORBextractorLeft->SetNumFeatures(nFeatures);
+    if(mSensor==System::STEREO)
+        mpORBextractorRight->SetNumFeatures(nFeatures);
+
+    // 单目初始化阶段使用的是mpIniORBextractor,不受影响
+    const bool bIniExtractor = mSensor==System::MONOCULAR && (mState==NOT_INITIALIZED || mState==NO_IMAGES_YET);
+    if(nFeatures<mnFeatures && !bIniExtractor)
+        mnDegradation |= DEGRADE_FEATURES;
+}
+
+//一帧处理结束,记录耗时
+void Tracking::EndFrameDeadline()
+{
+    mfLastFrameTime = std::chrono::duration_cast<std::chrono::duration<float,std::milli> >(
+        std::chrono::steady_clock::now()-mtFrameStart).count();
+}
+
+//判断当前帧的时间预算是否紧张
+bool Tracking::UnderDeadlinePressure()
+{
+    if(mfFrameDeadline<=0)
+        return false;
+
+    // 上一帧已经超时
+    if(mfLastFrameTime>mfFrameDeadline)
+        return true;
+
+    // 当前帧已经用掉了一半以上的预算(通常是特征提取耗时过长)
+    const float fElapsed = std::chrono::duration_cast<std::chrono::duration<float,std::milli> >(
+        std::chrono::steady_clock::now()-mtFrameStart).count();
+    return fElapsed>0.5f*mfFrameDeadline;
+}
+
 } //namespace ORB_SLAM
@@ -216,13 +216,10 @@ void Viewer::Run()
         //如果有停止更新的请求
         if(Stop())
         {
-            //就不再绘图了,并且在这里每隔三秒检查一下是否结束
-            while(isStopped())
-            {
-				//usleep(3000);
-				std::this_thread::sleep_for(std::chrono::milliseconds(3));
-
-            }
+            //就不再绘图了,并且在这里等待Release的唤醒
+            unique_lock<mutex> lock(mMutexStop);
+            while(mbStopped)
+                mcvStopped.wait(lock);
         }
 
         //满足的时候退出这个线程循环,这里应该是查看终止请求
@@ -253,6 +250,7 @@ void Viewer::SetFinish()
 {
     unique_lock<mutex> lock(mMutexFinish);
     mbFinished = true;
+    mcvFinished.notify_all();
 }
 
 //判断当前进程是否已经结束
@@ -262,6 +260,14 @@ bool Viewer::isFinished()
     return mbFinished;
 }
 
+//阻塞直到查看器进程结束
+void Viewer::WaitUntilFinished()
+{
+    unique_lock<mutex> lock(mMutexFinish);
+    while(!mbFinished)
+        mcvFinished.wait(lock);
+}
+
 //请求当前查看器停止更新
 void Viewer::RequestStop()
 {
@@ -277,6 +283,14 @@ bool Viewer::isStopped()
     return mbStopped;
 }
 
+//阻塞直到查看器真正地停止更新
+void Viewer::WaitUntilStopped()
+{
+    unique_lock<mutex> lock(mMutexStop);
+    while(!mbStopped)
+        mcvStopped.wait(lock);
+}
+
 //当前查看器停止更新
 bool Viewer::Stop()
 {
@@ -289,6 +303,7 @@ bool Viewer::Stop()
     {
         mbStopped = true;
         mbStopRequested = false;
+        mcvStopped.notify_all();
         return true;
     }
 
@@ -301,6 +316,7 @@ void Viewer::Release()
 {
     unique_lock<mutex> lock(mMutexStop);
     mbStopped = false;
+    mcvStopped.notify_all();
 }
 
 }